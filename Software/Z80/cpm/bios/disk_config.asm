@@ -8,6 +8,7 @@
 ; List of available disk drivers
 disk_driver_nochache:	equ 	1
 disk_driver_dmcache:	equ 	2
+disk_driver_stm32:		equ 	3		; SD card served by the STM32, needs the STM32 firmware io trap
 
 ; Driver to use in bios
 cpm_disk_driver:	equ		disk_driver_nochache
@@ -40,6 +41,32 @@ if cpm_disk_driver = disk_driver_nochache
 endif
 
 
+if cpm_disk_driver = disk_driver_stm32
+
+	; Same layout as disk_nocache, relative to the boot partition. The
+	; driver adds the partition base and passes absolute block numbers
+	include 'disk_stm32.asm'
+	.dph0:	stm32_dph    0x0000 0x0000	; SD logical drive 0  A:
+	.dph1:	stm32_dph    0x0000 0x4000	; SD logical drive 1  B:
+	.dph2:	stm32_dph    0x0000 0x8000	; SD logical drive 2  C:
+	.dph3:	stm32_dph    0x0000 0xc000	; SD logical drive 3  D:
+	.dph4:	stm32_dph    0x0001 0x0000	; SD logical drive 4  E:
+	.dph5:	stm32_dph    0x0001 0x4000	; SD logical drive 5  F:
+	.dph6:	stm32_dph    0x0001 0x8000	; SD logical drive 6  G:
+	.dph7:	stm32_dph    0x0001 0xc000	; SD logical drive 7  H:
+
+	dph_vec:
+		dw	.dph0
+		dw	.dph1
+		dw	.dph2
+		dw	.dph3
+		dw	.dph4
+		dw	.dph5
+		dw	.dph6
+		dw	.dph7
+endif
+
+
 if cpm_disk_driver = disk_driver_dmcache
 
 	; NOTE: dmcache ONLY works on a single-partition starting at SD block number 0x0800
@@ -0,0 +1,552 @@
+;****************************************************************************
+;
+;   TeachZ80 BIOS disk driver, SD card access by the STM32
+;
+;   Based on disk_nocache.asm from John Winans, published under GNU LGPL:
+;   https://github.com/Z80-Retro/2063-Z80-cpm/blob/main/bios/disk_nocache.asm
+;
+;   Author:
+;   Christian Luethi
+;
+;   Same filesystem layout and single block buffer as disk_nocache, but the
+;   SD card is not bit-banged by the Z80. The STM32 serves a virtual disk on
+;   the stm32 ports (Z80IODevices.h in the STM32 firmware): the block number
+;   is written to stm32_disk_lba, the 512 bytes are moved with INIR/OTIR
+;   through stm32_disk_data. The STM32 keeps a cache of recently used blocks.
+;   An io cycle the STM32 misses fails the sector: the block number is read
+;   back, the status tells missed cycles and incomplete write buffers.
+;
+;****************************************************************************
+
+;##########################################################################
+; set .st_debug to:
+;    0 = no debug output
+;    1 = print messages from new code under development
+;    2 = print all the above plus the primairy 'normal' debug messages
+;    3 = print all the above plus verbose 'noisy' debug messages
+;##########################################################################
+.st_debug:	equ	0
+
+;##########################################################################
+;
+; CP/M 2.2 Alteration Guide p19:
+; Assuming the drive has been selected, the track has been set, the sector
+; has been set, and the DMA address has been specified, the READ subroutine
+; attempts to read one sector based upon these parameters, and returns the
+; following error codes in register A:
+;
+;    0 no errors occurred
+;    1 non-recoverable error condition occurred
+;
+; When an error is reported the BDOS will print the message "BDOS ERR ON
+; x: BAD SECTOR".  The operator then has the option of typing <cr> to ignore
+; the error, or ctl-C to abort.
+;
+;##########################################################################
+.stm32_read:
+if .st_debug >= 1
+	call	iputs
+	db		".stm32_read entered: \0"
+	call	disk_dump
+endif
+
+	; switch to a local stack (we only have a few levels when called from the BDOS!)
+	push	hl					; save HL into the caller's stack
+	ld		hl,0
+	add		hl,sp				; HL = SP
+	ld		sp,bios_stack		; SP = temporary private BIOS stack area
+	push	hl					; save the old SP value in the BIOS stack
+
+	push	bc					; save the register pairs we will otherwise clobber
+	push	de					; this is not critical but may make WBOOT cleaner later
+
+	ld		hl,(disk_track)		; HL = CP/M track number
+
+	;Check to see if the disk number has changed - Trevor Jacobs - 02-15-2023
+	ld		a,(disk_dph)
+	ld		b,a
+	ld		a,(.stm32_dph_last)
+	cp		b
+	jp		nz,.stm32_read_block		; not the same, force a new read
+
+	ld		a,(disk_dph+1)
+	ld		b,a
+	ld		a,(.stm32_dph_last+1)
+	cp		b
+	jp		nz,.stm32_read_block		; not the same, force a new read
+
+	; Check to see if the SD block in .stbuf is already the one we want
+	ld		a,(.stbuf_val)		; get the .stbuf valid flag
+	or		a					; is it a non-zero value?
+	jr		nz,.stm32_read_block		; block buffer is invalid, read the SD block
+
+	ld		a,(.stbuf_trk)		; A = CP/M track LSB
+	cp		l					; is it the one we want?
+	jr		nz,.stm32_read_block		; LSB does not match, read the SD block
+
+	ld		a,(.stbuf_trk+1)	; A = CP/M track MSB
+	cp		h					; is it the one we want?
+	jr		z,.stm32_read_ok		; The SD block in .stbuf is the one we want!
+
+.stm32_read_block:
+if .st_debug >= 2
+	call	iputs
+	db		".stm32_read cache miss: \0"
+	call	disk_dump
+endif
+	; Remember drive that is in the cache - Trevor Jacobs - 02-15-2023
+	ld		de,(disk_dph)
+	ld		(.stm32_dph_last),de
+
+	; Assume all will go well reading the SD card block.
+	; We only need to touch this if we are going to actually read the SD card.
+	ld		(.stbuf_trk),hl		; store the current CP/M track number in the .stbuf
+	xor		a					; A = 0
+	ld		(.stbuf_val),a		; mark the .stbuf as valid
+
+	call	.stm32_calc_block		; DE,HL = partition_base + HL
+
+	call	.stm32_readBlock	; read the SD block into .stbuf
+
+	or		a					; was the SD driver read OK?
+	jr		z,.stm32_read_ok
+
+	call	iputs
+	db		"BIOS_READ FAILED!\r\n\0"
+	ld		a,1					; tell CP/M the read failed
+	ld		(.stbuf_val),a		; mark the .stbuf as invalid
+	jp		.stm32_read_ret
+
+.stm32_read_ok:
+
+	; calculate the CP/M sector offset address (disk_sec*128)
+	xor		a					;clear a, clear carry
+	ld		l,a
+	ld		a,(disk_sec)		; must be less than 16
+	rra							; divide a by 2, remainder into carry
+	rr		l					; carry into l
+	ld		h,a					; HL = A*128
+
+	; calculate the address of the CP/M sector in the .stbuf
+	ld		bc,.stbuf
+	add		hl,bc				; HL = @ of cpm sector in the .stbuf
+
+	; copy the data of interest from the SD block
+	ld		de,(disk_dma)		; target address
+	ld		bc,0x0080			; number of bytes to copy
+	ldir
+
+	xor	a						; A = 0 = read OK
+
+.stm32_read_ret:
+	pop		de					; restore saved regs
+	pop		bc
+	pop		hl					; HL = original saved stack pointer
+	ld		sp,hl				; SP = original stack address
+	pop		hl					; restore the original  HL value
+
+	ret
+
+;##########################################################################
+;
+; CP/M 2.2 Alteration Guide p19:
+; Write the data from the currently selected DMA address to the currently
+; selected drive, track, and sector.  The error codes given in the READ
+; command are returned in register A:
+;
+;    0 no errors occurred
+;    1 non-recoverable error condition occurred
+;
+; p34 adds: Upon entry the value of C will be useful for blocking
+; and deblocking a drive's physical sector sizes:
+;
+;  0 = normal sector write
+;  1 = write into a directory sector
+;  2 = first sector of a newly used block
+;
+; Return the following completion status in register A:
+;
+;    0 no errors occurred
+;    1 non-recoverable error condition occurred
+;
+; When an error is reported the BDOS will print the message "BDOS ERR ON
+; x: BAD SECTOR".  The operator then has the option of typing <cr> to ignore
+; the error, or ctl-C to abort.
+;
+;##########################################################################
+.stm32_write:
+
+if .st_debug >= 1
+	push	bc
+	call	iputs
+	db		".stm32_write entered, C=\0"
+	pop		bc
+	push	bc
+	ld		a,c
+	call	hexdump_a
+	call	iputs
+	db		": \0"
+	call	disk_dump
+	pop	bc
+endif
+
+	; switch to a local stack (we only have a few levels when called from the BDOS!)
+	push	hl					; save HL into the caller's stack
+	ld		hl,0
+	add		hl,sp				; HL = SP
+	ld		sp,bios_stack		; SP = temporary private BIOS stack area
+	push	hl					; save the old SP value in the BIOS stack
+	push	de					; save the register pairs we will otherwise clobber
+	push	bc
+
+	ld	hl,(disk_track)			; HL = CP/M track number
+
+	;Check to see if the disk number has changed - Trevor Jacobs - 02-15-2023
+	ld		a,(disk_dph)
+	ld		b,a
+	ld		a,(.stm32_dph_last)
+	cp		b
+	jp		nz,.stm32_write_miss		; not the same, force a new read
+
+	ld		a,(disk_dph+1)
+	ld		b,a
+	ld		a,(.stm32_dph_last+1)
+	cp		b
+	jp		nz,.stm32_write_miss		; not the same, force a new read
+
+	; Check to see if the SD block in .stbuf is already the one we want
+	ld		a,(.stbuf_val)		; get the .stbuf valid flag
+	or		a					; is it a non-zero value?
+	jr		nz,.stm32_write_miss		; block buffer is invalid, pre-read the SD block
+
+	ld		a,(.stbuf_trk)		; A = CP/M track LSB
+	cp		l					; is it the one we want?
+	jr		nz,.stm32_write_miss		; LSB does not match, pre-read the SD block
+
+	ld		a,(.stbuf_trk+1)	; A = CP/M track MSB
+	cp		h					; is it the one we want?
+	jp		z,.write_sdbuf		; The SD block in .stbuf is the one we want!
+
+.stm32_write_miss:
+if .st_debug >= 1
+	call	iputs
+	db		".write cache miss: \0"
+	call	bios_debug_disk
+endif
+	; Remember drive that is in the cache - Trevor Jacobs - 02-15-2023
+	ld		de,(disk_dph)
+	ld		(.stm32_dph_last),de
+
+	; Assume all will go well reading the SD card block.
+	; We only need to touch this if we are going to actually read the SD card.
+	ld		(.stbuf_trk),hl		; store the current CP/M track number in the .stbuf
+	xor		a					; A = 0
+	ld		(.stbuf_val),a		; mark the .stbuf as valid
+
+	; if C==2 then we are writing into an alloc block (and therefore an SD block) that is not dirty
+	pop		bc					; restore C in case was clobbered above
+	push	bc
+	ld		a,2
+	cp		c
+	jr		nz,.stm32_write_prerd
+
+	; padd the SD buffer with all 0xe5
+	ld		hl,.stbuf			; buffer to initialize
+	ld		de,.stbuf+1			; buffer+1
+	ld		bc,0x1ff			; number of bytes to initialize
+	ld		(hl),0xe5			; set the first byte to 0xe5
+	ldir						; set the rest of the bytes to 0xe5
+	jp		.write_sdbuf		; go to write logic (skip the SD card pre-read)
+
+.stm32_write_prerd:
+	; pre-read the block so we can replace one sector and write it back
+	call	.stm32_calc_block		; DE,HL = partition_base + HL
+
+	call	.stm32_readBlock	; pre-read the SD block into .stbuf
+	or		a					; was the SD driver read OK?
+	jr		z,.write_sdbuf
+
+	call	iputs
+	db		"BIOS_WRITE SD CARD PRE-READ FAILED!\r\n\0"
+	ld		a,1					; tell CP/M the read failed
+	ld		(.stbuf_val),a		; mark the .stbuf as invalid
+	jp		.stm32_write_ret
+
+.write_sdbuf:
+	; calculate the CP/M sector offset address (disk_sec*128)
+	xor		a					;clear a, clear carry
+	ld		l,a
+	ld		a,(disk_sec)		; must be less than 16
+	rra							; divide a by 2, remainder into carry
+	rr		l					; carry into l
+	ld		h,a					; HL = A*128
+
+	; calculate the address of the CP/M sector in the .stbuf
+	ld		bc,.stbuf
+	add		hl,bc				; HL = @ of cpm sector in the .stbuf
+	ld		d,h
+	ld		e,l					; DE = @ of cpm sector in the .stbuf
+
+	; copy the data of interest /into/ the SD block
+	ld		hl,(disk_dma)		; source address
+	ld		bc,0x0080			; number of bytes to copy
+	ldir
+
+	; write the .stbuf contents to the SD card
+	ld      hl,(disk_track)
+	call	.stm32_calc_block		; DE,HL = partition_base + HL
+
+	call	.stm32_writeBlock	; write .stbuf to the SD block
+
+	or		a
+	jr		z,.stm32_write_ret
+
+	call	iputs
+	db		"BIOS_WRITE SD CARD WRITE FAILED!\r\n\0"
+	ld		a,1					; tell CP/M the read failed
+	ld		(.stbuf_val),a		; mark the .stbuf as invalid
+
+.stm32_write_ret:
+	pop		bc
+	pop		de					; restore saved regs
+	pop		hl					; HL = original saved stack pointer
+	ld		sp,hl				; SP = original stack address
+	pop		hl					; restore the original  HL value
+	ret
+
+;##########################################################################
+; Calculate the address of the SD block, given the CP/M track number
+; in HL and the fact that the currently selected drive's DPH is in 
+; disk_dph.
+; HL = CP/M track number
+; Return: the 32-bit block number in DE,HL
+; Based on proposal from Trevor Jacobs - 02-15-2023
+;##########################################################################
+.stm32_calc_block:
+	ld		ix,(disk_dph)		; IX = current DPH base address
+	ld		e,(ix+16)			; DE = low-word of the SD starting block
+	ld		d,(ix+17)			; DE = low-word of the SD starting block
+	add		hl,de
+	push 	hl
+	ld		l,(ix+18)
+	ld		h,(ix+19)
+	ld		de,0
+	adc		hl,de				; cy flag still set from add hl,de
+	ld		e,l
+	ld		d,h
+	pop		hl
+
+	; add the partition offset
+	ld		a,(disk_offset_low)
+	add		l
+	ld		l,a
+	ld		a,(disk_offset_low+1)
+	adc		a,h					; cy flag still set from prior add
+	ld		h,a
+	ld		a,(disk_offset_hi)
+	adc		a,e
+	ld		e,a
+	ld		a,(disk_offset_hi+1)
+	adc		a,d
+	ld		d,a
+	ret
+
+;##########################################################################
+; Read the SD block DE,HL into .stbuf
+; Return: A = 0 if OK, A != 0 on error
+; Clobbers: AF, BC, HL
+;##########################################################################
+.stm32_readBlock:
+	call	.stm32_setBlock		; the STM32 has the block number
+	or		a
+	ret		nz
+
+	ld		a,stm32_disk_cmd_read
+	call	.stm32_command		; the STM32 fills its data buffer
+	or		a
+	ret		nz
+
+	ld		hl,.stbuf			; HL = target buffer
+	ld		c,stm32_disk_data
+	ld		b,0					; 2 x 256 bytes
+	inir
+	inir
+
+	in		a,(stm32_disk_cmd)	; A = status, a missed byte leaves garbage in .stbuf
+	and		stm32_disk_stat_fail+stm32_disk_stat_missed
+	ret
+
+;##########################################################################
+; Write .stbuf to the SD block DE,HL
+; Return: A = 0 if OK, A != 0 on error
+; Clobbers: AF, BC
+;##########################################################################
+.stm32_writeBlock:
+	call	.stm32_setBlock		; the STM32 has the block number
+	or		a
+	ret		nz
+
+	push	hl
+	ld		a,stm32_disk_cmd_index
+	out		(stm32_disk_cmd),a	; start at the beginning of the STM32 data buffer
+	ld		hl,.stbuf			; HL = source buffer
+	ld		c,stm32_disk_data
+	ld		b,0					; 2 x 256 bytes
+	otir
+	otir
+	pop		hl
+
+	ld		a,stm32_disk_cmd_write
+	jp		.stm32_command		; the STM32 writes its data buffer, if all 512 bytes arrived
+
+;##########################################################################
+; Pass the block number DE,HL to the STM32 and read it back. An io cycle
+; missed by the STM32 leaves another block number, the transfer is not
+; started then. Writing the first byte starts the missed cycle check of
+; the STM32 (stm32_disk_stat_missed).
+; Return: A = 0 if OK, A != 0 on error
+; Clobbers: AF, C
+;##########################################################################
+.stm32_setBlock:
+	ld		c,stm32_disk_lba
+	out		(c),l				; 32-bit block number, little end first
+	inc		c
+	out		(c),h
+	inc		c
+	out		(c),e
+	inc		c
+	out		(c),d
+
+	in		a,(c)				; read back, most significant byte first
+	cp		d
+	jr		nz,.stm32_setBlock_fail
+	dec		c
+	in		a,(c)
+	cp		e
+	jr		nz,.stm32_setBlock_fail
+	dec		c
+	in		a,(c)
+	cp		h
+	jr		nz,.stm32_setBlock_fail
+	dec		c
+	in		a,(c)
+	cp		l
+	jr		nz,.stm32_setBlock_fail
+	xor		a					; A = 0 = block number OK
+	ret
+
+.stm32_setBlock_fail:
+	ld		a,1
+	ret
+
+;##########################################################################
+; Pass the command in A to the STM32, wait until the command is done. The
+; Z80 is stopped by a bus request while the STM32 accesses the SD card,
+; the current gpio_out value is passed along so the STM32 keeps the RAM
+; bank selected. A command the STM32 has missed leaves the busy bit clear,
+; the missed bit fails it.
+; Return: A = 0 if OK, A != 0 on error
+; Clobbers: AF, B
+;##########################################################################
+.stm32_command:
+	ld		b,a
+	ld		a,(gpio_out_cache)
+	out		(stm32_disk_latch),a
+	ld		a,b
+	out		(stm32_disk_cmd),a	; start the command
+
+.stm32_busy:
+	in		a,(stm32_disk_cmd)	; A = status
+	bit		0,a					; stm32_disk_stat_busy
+	jr		nz,.stm32_busy
+	and		stm32_disk_stat_fail+stm32_disk_stat_missed
+	ret
+
+;##########################################################################
+; A single SD block cache
+;##########################################################################
+.stbuf_trk:			; The CP/M track number last left in the .stbuf
+	ds	2,0xff		; initial value = garbage
+.stbuf_val:			; The CP/M track number in .stbuf_trk is valid when this is 0
+	ds	1,0xff		; initial value = INVALID
+.stbuf:				; scratch area to use for SD block reading and writing
+	ds	512,0xa5	; initial value = garbage
+.stm32_dph_last:		; the drive that has a block in the cache
+	dw	0			; an impossible DPH address
+
+;##########################################################################
+; Called once before library is used.
+;##########################################################################
+.stm32_init:
+	ld		a,1
+	ld		(.stbuf_val),a	; mark .stbuf_trk as invalid
+	ret
+
+;##########################################################################
+; Goal: Define a CP/M-compatible filesystem that can be implemented using
+; an SDHC card.  An SDHC card is comprised of a number of 512-byte blocks.
+;
+; Plan:
+; - Put 4 128-byte CP/M sectors into each 512-byte SDHC block.
+; - Treat each SDHC block as a CP/M track.
+;
+; This CP/M filesystem has:
+;  128 bytes/sector (CP/M requirement)
+;  4 sectors/track (Retro BIOS designer's choice)
+;  65536 total sectors (max CP/M limit)
+;  65536*128 = 8388608 gross bytes (max CP/M limit)
+;  65536/4 = 16384 tracks
+;  8192 allocation block size BLS (Retro BIOS designer's choice)
+;  8388608/8192 = 1024 gross allocation blocks in our filesystem
+;  32 = number of reserved tracks to hold the O/S
+;  32*512 = 16384 total reserved track bytes
+;  floor(1024-16384/8192) = 1022 total allocation blocks, absent the reserved tracks
+;  512 directory entries (Retro BIOS designer's choice)
+;  512*32 = 16384 total bytes in the directory
+;  ceiling(16384/8192) = 2 allocation blocks for the directory
+;
+;                  DSM<256   DSM>255
+;  BLS  BSH BLM    ------EXM--------
+;  1024  3    7       0         x
+;  2048  4   15       1         0
+;  4096  5   31       3         1a
+;  8192  6   63       7         3  <----------------------
+; 16384  7  127      15         7
+;
+; ** NOTE: This filesystem design is inefficient because it is unlikely
+;          that ALL of the allocation blocks will ultimately get used!
+;##########################################################################
+
+stm32_dph:	macro	sdblk_hi sdblk_lo
+	dw	0			; +0 XLT sector translation table (no xlation done)
+	dw	0			; +2 scratchpad
+	dw	0			; +4 scratchpad
+	dw	0			; +6 scratchpad
+	dw	disk_dirbuf	; +8 DIRBUF pointer
+	dw	stm32_dpb	; +10 DPB pointer
+	dw	0			; +12 CSV pointer (optional, not implemented)
+	dw	.alv		; +14 ALV pointer
+	dw	sdblk_lo	; +16 32-bit starting SD card block offset
+	dw	sdblk_hi	; +18
+
+.alv:	ds	0
+		ds	(1021/8)+1,0xaa	; scratchpad used by BDOS for disk allocation info
+		endm
+
+;##########################################################################
+; The DPB is shared by all the SD drives.
+;##########################################################################
+	dw	.stm32_init	; .sd_dpb-6	pointer to the init function
+	dw	.stm32_read	; .sd_dpb-4	pointer to the read function
+	dw	.stm32_write	; .sd_dpb-2	pointer to the write function
+stm32_dpb:
+	dw	4		; SPT
+	db	6		; BSH
+	db	63		; BLM
+	db	3		; EXM
+	dw	1021	; DSM (max allocation block number)
+	dw	511		; DRM
+	db	0xc0	; AL0
+	db	0x00	; AL1
+	dw	0		; CKS
+	dw	32		; OFF
\ No newline at end of file
@@ -65,6 +65,28 @@ gpio_in_1_user_7:   equ     0x02
 gpio_in_1_user_8:   equ     0x04
 gpio_in_1_user_9:   equ     0x08
 
+;****************************************************************************
+;  Virtual devices served by the stm32 on the stm32 ports (Z80IODevices.h)
+;****************************************************************************
+stm32_mul_a:        equ     0x60        ; multiplier operand A (2 ports, low/high)
+stm32_mul_b:        equ     0x62        ; multiplier operand B (2 ports, low/high)
+stm32_mul_result:   equ     0x60        ; read: 32 bit product (4 ports, lsb first)
+stm32_con_data:     equ     0x64        ; console fifo, write character
+stm32_con_status:   equ     0x65        ; console fifo status, bit 0 space available
+stm32_copy_param:   equ     0x66        ; block copy parameters: source, destination, length (lsb first)
+stm32_copy_cmd:     equ     0x67        ; block copy write: start, read: status, bit 0 pending
+stm32_disk_lba:     equ     0x68        ; disk block number (4 ports, lsb first), reads back
+stm32_disk_latch:   equ     0x6C        ; disk, copy of gpio_out (sram bank), kept during the SD access
+stm32_disk_cmd:     equ     0x6D        ; disk write: command, read: status
+stm32_disk_data:    equ     0x6E        ; disk data buffer, 512 bytes
+
+stm32_disk_cmd_index:   equ     0x00    ; reset the data index
+stm32_disk_cmd_read:    equ     0x01    ; read the block into the data buffer
+stm32_disk_cmd_write:   equ     0x02    ; write the data buffer to the block
+stm32_disk_stat_busy:   equ     0x01
+stm32_disk_stat_fail:   equ     0x02
+stm32_disk_stat_missed: equ     0x04    ; the stm32 has missed an io cycle since the block number was written
+
 
 ;****************************************************************************
 ;  Z80 Retro! definitions kept to maintain compatibility with Johns Software
@@ -0,0 +1,56 @@
+/* -------------------------------------------------------------------------------------------------------
+ Allocation bitmap of a CP/M disk
+
+ One bit per allocation block, block n is bit n % 32 of word n / 32 (the byte layout of the CP/M
+ allocation vector on a little endian cpu). All operations work on whole words:
+    - setBlocks / clearBlocks / anyUsed / allUsed on ranges, a mask per word instead of a loop per bit
+    - usedBlocks / freeBlocks with popcount per word
+    - firstFit / nextFit find a run of free blocks: count trailing zeros finds the next free (or used) block
+      of a word, a run is checked word by word. nextFit continues behind the last run found, and wraps
+    - highestUsed with count leading zeros, from the end of the disk
+ The cortex-m7 has CLZ (and RBIT for the trailing zeros), but no popcount instruction, gcc uses its bit
+ parallel sequence for it.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef CPM_BITMAP_H
+#define CPM_BITMAP_H
+
+    #include <Arduino.h>
+
+    #define CPMBITMAP_BLOCKS        8192        //max 0x10000 records * 128 bytes / 1024 bytes per block
+    #define CPMBITMAP_WORDS         (CPMBITMAP_BLOCKS / 32)
+    #define CPMBITMAP_NONE          0xFFFFFFFF
+
+    class CPMBitmap {
+
+        public:
+            CPMBitmap();
+            void begin(uint32_t blocks);
+            void clear(void);
+            void setBlocks(uint32_t first, uint32_t count = 1);
+            void clearBlocks(uint32_t first, uint32_t count = 1);
+            bool testBlock(uint32_t block);
+            bool anyUsed(uint32_t first, uint32_t count);
+            bool allUsed(uint32_t first, uint32_t count);
+            uint32_t usedBlocks(void);
+            uint32_t freeBlocks(void);
+            uint32_t firstFit(uint32_t count);
+            uint32_t nextFit(uint32_t count);
+            uint32_t highestUsed(void);
+            uint32_t size(void);
+
+        private:
+            uint32_t words[CPMBITMAP_WORDS];
+            uint32_t blocks;                    //blocks of the disk, the bits behind are never set
+            uint32_t nextBlock;                 //nextFit starts here
+
+            uint32_t findRun(uint32_t start, uint32_t end, uint32_t count);
+            uint32_t nextFree(uint32_t block, uint32_t end);
+            uint32_t nextUsed(uint32_t block, uint32_t end);
+            uint32_t clip(uint32_t first, uint32_t count);
+
+    };
+
+#endif
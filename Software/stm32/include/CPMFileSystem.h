@@ -13,7 +13,49 @@
     - This driver assumes all disks share the same
     - Designed for CPM 2.2 only
     - Works only for filesystems with more than 255 Blocks cpacity, so the directory allocation vector uses 2 bytes per block
- 
+
+ File records:
+    The files of a disk are kept in a fixed array of MAX_DIRECTORY_ENTRIES records, in directory order. A file
+    takes at least one directory entry, so a disk never has more files than maxdir. A refresh resets the count,
+    no heap is used. The records hold the files of the disk read last, the other disks keep their allocation
+    vector and are read again (mostly from the sd block cache) when their files are listed. 16 disks with their
+    own records would need 16 times the ram, which is not available next to the profiler and the sniffer
+    The records are indexed by a hash table on user number, name and type (open addressing), an extent finds
+    its file in constant time. Extents are added to their file in any directory order. A file written by
+    writeFileEnd or erased by eraseFile changes its record in place: the old record is deleted (the last
+    record moves into its place, its index slot becomes a tombstone), the new one is inserted, the disk is
+    not read again
+
+ Reading files:
+    readFileBegin finds the directory entries of a file, in the order of their entry number. readFileRun then
+    returns the sd blocks of the file as runs which follow each other on the card, allocation blocks numbered
+    one after the other make one run. Allocation block n starts at sd block sdoffset + boottrk + n * blocksize
+    / 512, block 0 is the directory. A hole in the file (block 0, or an entry missing) is returned as a run
+    with lba CPMFILE_HOLE, it reads as zeros
+
+ Writing files:
+    writeFileBegin reads the directory again and allocates all blocks of the file at once, as one run of
+    free blocks if there is one (firstFit), else run by run from the start of the disk. writeFileData writes
+    the sd blocks of the file through the cache, the last record is filled with 0x1A (CP/M end of file).
+    An existing file of the same name is not touched until writeFileEnd commits: the data is on the card
+    then, the directory is written last. Its new entries go to the slots of the old entries first, then to
+    free slots on the directory tracks holding the old entries, then to free slots elsewhere. Each directory
+    track is written once, with the old entries removed and the new ones added. When the old and the new
+    entries fit on one directory track (16 entries, 1MB), the replace is a single block write: the disk has
+    the old or the new file, never both or a mix. A larger change is written track by track and is not
+    atomic: a reset between two track writes leaves a part of the old entries next to the new ones. Without
+    the commit (cancelled, card error) the blocks are given back and the directory stays as it is.
+    The old file keeps its blocks until the commit, so a replace needs free blocks for the whole new file.
+    When it would only fit with the blocks of the old file, begin returns writeNoSpaceReplace: the file has
+    to be deleted first (ERA), this is the price of keeping the old file until the new one is complete.
+    The entries are built for the 16 bit allocation of the disk definitions: 8 blocks per entry, the entry
+    k covers the logical extents k*(EXM+1) .. k*(EXM+1)+EXM, EX and EG (S2) hold the last one used, RC the
+    records of it. For 8k_8m_32_512 (EXM 3) a full entry is 64k, EX 4*k+3 and RC 128
+
+ Erasing files:
+    eraseFile removes the entries of a file (ERA), each directory track holding them is written once. The
+    blocks are free again and the record is deleted from the index, a read only file is not erased
+
  Author: Christian Luethi
 --------------------------------------------------------------------------------------------------------- */
 
@@ -22,12 +64,21 @@
 
     #include <Arduino.h>
     #include <Z80SDCard.h>
+    #include <Z80SDCache.h>
+    #include <CPMBitmap.h>
 
     #define FILE_NAME_MAX_LEN            8
     #define FILE_TYPE_MAX_LEN            3
     #define TRACK_SIZE                 512
     #define MAX_DISKS                   16
-    #define ALLOCATION_VECTOR_LENGTH  ( 0x10000 * 128 / ( 1024 * 8 )) //Max disk capacity = 0x10000*128, minimum block size 1024 > max 8192 bits / 1024 bytes for alloction bitmap per disk
+    #define MAX_DIRECTORY_ENTRIES      512      //largest maxdir of the disk definitions
+    #define FILE_INDEX_SIZE           1024      //hash slots, power of 2, twice MAX_DIRECTORY_ENTRIES
+    #define FILE_INDEX_EMPTY        0xFFFF
+    #define FILE_INDEX_DELETED      0xFFFE
+    #define CPMFILE_HOLE        0xFFFFFFFF
+    #define CPMFILE_WRITE_BLOCKS      1024      //allocation blocks of a file written, 8MB with 8k blocks
+    #define MAX_DIRECTORY_TRACKS      (MAX_DIRECTORY_ENTRIES / 16)
+    #define CPMFILE_EOF               0x1A
 
     class CPMFileSystem  {
 
@@ -47,9 +98,39 @@
               
         public:        
             enum diskGeometry : uint8_t { geometry_8k_8m_32_512 = 0 };                           
-            CPMFileSystem(diskGeometry geometry, Z80SDCard z80sdcard, Z80Bus z80bus);  
+            enum readState : uint8_t { readBusy, readDone, readFailed };
+            enum writeState : uint8_t { writeDone, writeFailed, writeInvalid, writeNoSpace, writeNoSpaceReplace, writeReadOnly };
+
+            struct file_t {
+                uint32_t  records;
+                uint16_t  extends;
+                uint16_t  blocks;
+                uint8_t   name[FILE_NAME_MAX_LEN];
+                uint8_t   type[FILE_TYPE_MAX_LEN];
+                uint8_t   user;
+                bool      readonly;
+                bool      sysfile;
+            };
+
+            CPMFileSystem(diskGeometry geometry, Z80SDCard& z80sdcard, Z80SDCache& z80sdcache, Z80Bus& z80bus);  
             bool listFiles(uint8_t diskIndex, bool forceRead=false); 
+            void printFiles(uint8_t diskIndex);
             bool readDisk(uint8_t diskIndex, bool forceRead=false); 
+            readState readDiskBegin(uint8_t diskIndex, bool forceRead=false);
+            readState readDiskNext(uint16_t tracks);
+            void readDiskEnd(void);
+            uint16_t directoryTracks(void);
+            uint32_t diskTracks(void);
+            uint16_t bootTracks(void);
+            void invalidate(void);
+            uint16_t fileCount(uint8_t diskIndex);
+            const file_t* getFile(uint8_t diskIndex, uint8_t user, const char* filename);
+            readState readFileBegin(uint8_t diskIndex, uint8_t user, const char* filename, uint32_t& bytes);
+            readState readFileRun(uint32_t& lba, uint32_t& count, uint32_t maxBlocks);
+            writeState writeFileBegin(uint8_t diskIndex, uint8_t user, const char* filename, uint32_t bytes);
+            writeState writeFileData(uint32_t index, const uint8_t* data, uint16_t length);
+            writeState writeFileEnd(bool commit);
+            writeState eraseFile(uint8_t diskIndex, uint8_t user, const char* filename);
 
         private:
 
@@ -64,33 +145,22 @@
                 uint16_t allocation[8];
             } __attribute__((packed));
 
-            struct file_t {
-                uint8_t   name[FILE_NAME_MAX_LEN];
-                uint8_t   type[FILE_TYPE_MAX_LEN];
-                uint16_t  extends = 1;
-                uint32_t  records = 0;  
-                uint16_t  blocks = 0;
-                bool      readonly = false;
-                bool      sysfile = false;
-                file_t*   nextfile = nullptr;
-            };
 
             struct disk_t {
                 bool     initialized;                
                 uint32_t sdoffset;                
                 uint32_t capacity;      
                 uint32_t directoryTracks;
-                uint32_t usedblocks;
+                uint32_t usedblocks;    //data blocks allocated, from the allocation vector
+                uint16_t directoryBlocks;
                 uint16_t usedExtends;
                 uint8_t  EXM;   //extend Mask                
-                uint8_t  alv[ALLOCATION_VECTOR_LENGTH];
-                file_t*  files;
+                CPMBitmap alv;          //the directory blocks are allocated as well, as in CP/M (AL0, AL1)
             };
 
-            void deleteFileTree(file_t* next);
-
-            Z80SDCard sdcard; 
-            Z80Bus bus;
+            Z80SDCard& sdcard; 
+            Z80SDCache& sdcache;
+            Z80Bus& bus;
             
             Z80SDCard::mbrResult mbr;
             Z80SDCard::sdResult result;
@@ -98,8 +168,41 @@
             uint8_t sdPartition = 0;
             cpm_diskdef_t diskdef;
             disk_t disks[MAX_DISKS];
-
-            uint8_t trackBuffer[TRACK_SIZE];
+            file_t files[MAX_DIRECTORY_ENTRIES];
+            uint16_t fileIndex[FILE_INDEX_SIZE];    //record numbers, FILE_INDEX_EMPTY or FILE_INDEX_DELETED
+            uint16_t filesUsed = 0;             //records of filesDisk
+            uint8_t filesDisk = MAX_DISKS;      //disk the records belong to, MAX_DISKS for none
+
+            uint8_t readIndex = 0;          //disk of readDiskBegin / Next
+            uint16_t readTrack = 0;         //next directory track to read
+            uint8_t readFileDisk = 0;       //disk of readFileBegin / Run
+            uint32_t readFilePosition = 0;  //next sd block of the file
+            uint32_t readFileBlocks = 0;    //sd blocks of the file
+            uint16_t readFileEntries[MAX_DIRECTORY_ENTRIES];    //directory slot per entry number of the file
+            bool writing = false;           //writeFileBegin until writeFileEnd
+            uint8_t writeDisk = 0;
+            file_t writeFile;               //user, name and type of the file written
+            uint32_t writeRecords = 0;
+            uint16_t writeBlocks = 0;       //allocation blocks of the file
+            uint16_t writeEntries = 0;      //directory entries of the file, at least one
+            uint16_t writeAllocation[CPMFILE_WRITE_BLOCKS];
+            uint8_t writeTrackOld[MAX_DIRECTORY_TRACKS];    //entries of the old file per directory track
+            uint8_t writeTrackFree[MAX_DIRECTORY_TRACKS];   //free entries per directory track
+
+            bool parseFileName(const char* filename, uint8_t* name, uint8_t* type);
+            uint16_t fileAllocation(uint32_t index, Z80SDCard::sdResult& result);
+            bool scanDirectory(void);
+            writeState writeDirectory(void);
+            bool updateFile(void);
+            void buildEntry(directoryExtend_t& extend, uint16_t entry);
+            void clearFiles(void);
+            uint16_t findFile(uint8_t user, const uint8_t* name, const uint8_t* type);
+            uint16_t insertFile(uint8_t user, const uint8_t* name, const uint8_t* type);
+            void deleteFile(uint16_t file);
+            uint16_t fileSlot(uint16_t file);
+            uint16_t fileHash(uint8_t user, const uint8_t* name, const uint8_t* type);
+            bool fileMatch(const file_t& file, uint8_t user, const uint8_t* name, const uint8_t* type);
+            bool fileEntry(const directoryExtend_t& extend);
         
     };
 
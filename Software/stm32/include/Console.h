@@ -9,6 +9,7 @@
 
     #include <Arduino.h>    
     #include <Z80SDCard.h>  
+    #include <JobEngine.h>
 
     class Console {
             
@@ -24,7 +25,8 @@
                 welcome, main, 
                 clocks, clockz80, clocksioa, clocksiob, 
                 flash, flashdump, flashdumpmin, flashdumpmax, flashdumpresult, flasherase, flasheraseresult, flashselectprogram, flashprogramresult, flashinfo,
-                sdcard, sdcardcheck, sdcardformatconfirm, sdcardsdresult, sdcardselectprogram, sdcardprogramresult    
+                sdcard, sdcardcheck, sdcardformatconfirm, sdcardsdresult, sdcardselectprogram, sdcardprogramresult, sdcardbusy, sdcardtelemetry,
+                profile
              };
             menuState menustate, lastmenustate;
 
@@ -40,15 +42,21 @@
             Z80SDCard::sdResult sdresult;
             Z80SDCard::sdResult accessresult;
 
+            menuState jobResultMenu;        //menu shown when the job has ended
+            Job::jobState jobstate;
+            uint8_t jobProgress;
+
             void drawMenu();
             void fillScreen();
             void clearScreen();
             void drawLine(const char* text = "");
             void drawLineFormat(const char* text, ...);
+            void startJob(Job& job, menuState resultMenu);
             bool addInputChar(uint8_t c, uint8_t maxlen = 8);
             void removeInputChar();
             void print_sd_AccessError(Z80SDCard::sdResult accessresult);
             void print_sd_ReadWriteError(Z80SDCard::sdResult rwerror);
+            void dumpTelemetry();
 
     };
 
@@ -55,13 +55,13 @@
             enum loaderMode: uint8_t { active, inactive }; 
             loaderMode loadermode;
 
-            FlashLoader(Z80Flash flash);    
+            FlashLoader(Z80Flash& flash);    
             void setMode(bool modeactive);
             void process(void); 
             bool serialUpdate(uint8_t c);           
 
         private:            
-            Z80Flash z80flash;
+            Z80Flash& z80flash;
             uint32_t timer;
             uint16_t hexCounter;      
             uint8_t txBuffer[HEX_RECORD_MAX_STRING_LEN];
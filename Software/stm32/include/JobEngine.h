@@ -0,0 +1,73 @@
+/* -------------------------------------------------------------------------------------------------------
+ Job engine for long SD card and CP/M operations
+
+ Formatting the card, writing a program or reading a CP/M directory take up to seconds. Done in one call
+ they block the main loop: the serial port is not read, the LED and the flash loader timeout stop. A job
+ does the same work in steps, the engine runs it in slices from the main loop:
+    - process() runs steps of the current job until JOB_SLICE_us are used, at least one step
+    - a step is a bounded amount of bus work, at most one SD block (about 5 ms on the bit banged SPI)
+    - the serial receive buffer (SERIAL_RX_BUFFER_SIZE, platformio.ini) holds what arrives meanwhile,
+      the main loop reads all received bytes in every loop
+
+ A job implements begin, step and end (Job). begin and the steps of a job return running until the job
+ is done or failed, end is called once after begin, also when the job is cancelled. It has to close
+ open transfers (eg a multi block write), the blocks written so far stay on the card. A step returns
+ waiting if it could not do anything (serial port full, no data from the host yet), the slice ends then.
+
+ The engine holds the bus and the Z80 reset from the start to the end of the job, like a Z80BusSession
+ over all slices. One job runs at a time. progress() reports the steps done of the steps expected, both
+ counted by the job.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef JOB_ENGINE_H
+#define JOB_ENGINE_H
+
+    #include <Arduino.h>
+    #include <Z80Bus.h>
+
+    #define JOB_SLICE_us                2000        //bus work per main loop
+
+    class Job {
+
+        public:
+            enum jobState : uint8_t { running, waiting, done, failed, cancelled };
+
+            virtual ~Job() {}
+            virtual jobState begin(void) = 0;
+            virtual jobState step(void) = 0;
+            virtual void end(jobState state) = 0;
+
+            uint32_t stepsDone;
+            uint32_t stepsTotal;                //expected steps, 0 unknown
+
+    };
+
+    class JobEngine {
+
+        public:
+            JobEngine(Z80Bus& bus);
+            bool start(Job& job);
+            void process(void);
+            void cancel(void);
+            bool busy(void);
+            uint8_t progress(void);
+
+            Job::jobState state;                //current job, or the last one
+            uint32_t jobs;                      //jobs started
+            uint32_t slices;
+            uint32_t maxSlice_us;               //longest slice since start
+
+        private:
+            Z80Bus& z80bus;
+            Job* job;
+            bool begun;
+
+            JobEngine(const JobEngine&) = delete;
+            JobEngine& operator=(const JobEngine&) = delete;
+            void finish(void);
+
+    };
+
+#endif
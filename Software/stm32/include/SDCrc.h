@@ -0,0 +1,49 @@
+/* -------------------------------------------------------------------------------------------------------
+ CRC7 and CRC16 of the SD card protocol
+
+ CRC7 (polynomial x^7 + x^3 + 1) protects the commands, CRC16 (CCITT, x^16 + x^12 + x^5 + 1, initial 0)
+ the data blocks. Both are table driven, the tables are built at compile time and live in flash.
+ CRC16 is calculated slice by 4: the crc is merged with the first two bytes, each of the four bytes is then
+ looked up in its own table (the effect of the byte followed by 3, 2, 1, 0 zero bytes) and the results are
+ combined. 4 table lookups per 4 bytes instead of 32 shift steps, about 2% of a bit banged block transfer.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef SD_CRC_H
+#define SD_CRC_H
+
+    #include <Arduino.h>
+
+    #define SDCRC16_SLICES              4
+
+    struct sdCrcTables_t {
+        uint8_t crc7[256];                          //crc7 left aligned (crc << 1)
+        uint16_t crc16[SDCRC16_SLICES][256];        //[n]: byte followed by n zero bytes
+
+        constexpr sdCrcTables_t() : crc7(), crc16() {
+            for (uint32_t i=0; i<256; i++) {
+                uint8_t c7 = i;
+                for (int j=0; j<8; j++) c7 = (c7 & 0x80) ? (c7 << 1) ^ (0x09 << 1) : (c7 << 1);
+                crc7[i] = c7;
+                uint16_t c16 = i << 8;
+                for (int j=0; j<8; j++) c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : (c16 << 1);
+                crc16[0][i] = c16;
+            }
+            for (uint32_t n=1; n<SDCRC16_SLICES; n++) {
+                for (uint32_t i=0; i<256; i++) {
+                    uint16_t previous = crc16[n-1][i];
+                    crc16[n][i] = (uint16_t)(previous << 8) ^ crc16[0][previous >> 8];
+                }
+            }
+        }
+    };
+    extern const sdCrcTables_t sdCrcTables;
+
+    //last byte of a command: crc7 and the end bit
+    uint8_t sdCrc7(const uint8_t* data, uint32_t length);
+
+    //crc16 of a data block, crc continues a calculation over several buffers
+    uint16_t sdCrc16(const uint8_t* data, uint32_t length, uint16_t crc = 0);
+
+#endif
@@ -0,0 +1,106 @@
+/* -------------------------------------------------------------------------------------------------------
+ Jobs for the SD card and the CP/M filesystem, run by the JobEngine
+
+    - SDFormatJob: writes the cache back, then a new MBR (Z80SDCard::formatCard). Optionally prepares the
+      CP/M disks of the first partition: one erase over all disks (CMD32/CMD33/CMD38), polled while the
+      card erases, then the empty directory (0xE5) of each disk in one multi block write, the blocks
+      generated while they are sent. And optionally a program in the boot area of the first disk
+    - SDProgramJob: writes the cache back, then a program to a partition, one block per step
+    - CPMListJob: reads the directory of a CP/M disk, one track per step, and prints the files
+
+ The jobs which write to the card directly write the dirty blocks of the cache first, one per step. The
+ Z80 is in reset while a job runs, the virtual disk does not get new writes until the job ended.
+ setup() selects what the next run of the job does, accessResult and result hold the outcome.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef SD_JOBS_H
+#define SD_JOBS_H
+
+    #include <Arduino.h>
+    #include <JobEngine.h>
+    #include <Z80SDCard.h>
+    #include <Z80SDCache.h>
+    #include <CPMFileSystem.h>
+
+    #define SDFORMAT_NO_PROGRAM         0xFF
+    #define SDFORMAT_ERASE_TIMEOUT_ms   60000
+
+    class SDFormatJob : public Job {
+
+        public:
+            SDFormatJob(Z80SDCard& sdcard, Z80SDCache& sdcache);
+            void setup(uint8_t numPartitions, uint32_t partitionStartBlock, uint32_t partitionSize);
+            void setupDisks(uint8_t numDisks, uint32_t diskBlocks, uint16_t bootBlocks, uint16_t directoryBlocks, uint8_t programNumber = SDFORMAT_NO_PROGRAM);
+            jobState begin(void) override;
+            jobState step(void) override;
+            void end(jobState state) override;
+
+            Z80SDCard::sdResult accessResult;
+            Z80SDCard::sdResult result;
+            Z80SDCard::sdResult eraseResult;    //a card refusing the erase is formatted without
+            uint8_t disks;                      //disks prepared after setupDisks
+
+        private:
+            enum formatPhase : uint8_t { flushing, erasing, directories, booting };
+
+            Z80SDCard& sdcard;
+            Z80SDCache& sdcache;
+            uint8_t partitions;
+            uint32_t startBlock;
+            uint32_t size;
+            uint32_t diskSize;
+            uint16_t bootSize;
+            uint16_t directorySize;
+            uint8_t program;
+            formatPhase phase;
+            uint8_t disk;
+            uint32_t blocksLeft;
+            bool streaming;
+            bool eraseIssued;
+            uint32_t eraseStart;
+
+    };
+
+    class SDProgramJob : public Job {
+
+        public:
+            SDProgramJob(Z80SDCard& sdcard, Z80SDCache& sdcache);
+            void setup(uint8_t partition, uint8_t programNumber);
+            jobState begin(void) override;
+            jobState step(void) override;
+            void end(jobState state) override;
+
+            Z80SDCard::sdResult accessResult;
+            Z80SDCard::sdResult result;
+
+        private:
+            enum programPhase : uint8_t { flushing, writing, written };
+
+            Z80SDCard& sdcard;
+            Z80SDCache& sdcache;
+            uint8_t partition;
+            uint8_t program;
+            programPhase phase;
+            uint32_t blocksLeft;
+
+    };
+
+    class CPMListJob : public Job {
+
+        public:
+            CPMListJob(CPMFileSystem& filesystem);
+            void setup(uint8_t diskIndex, bool forceRead = false);
+            jobState begin(void) override;
+            jobState step(void) override;
+            void end(jobState state) override;
+
+        private:
+            CPMFileSystem& filesystem;
+            uint8_t disk;
+            bool force;
+
+    };
+
+#endif
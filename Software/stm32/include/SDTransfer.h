@@ -0,0 +1,141 @@
+/* -------------------------------------------------------------------------------------------------------
+ SD card image transfer over the serial port
+
+ Moves a range of SD blocks (a whole CP/M disk, or any LBA range) between the card and the host, to back
+ up or restore disks without removing the card. The transfer runs as a job (JobEngine.h), the main loop
+ keeps running, the Z80 is in reset until the transfer has ended. Blocks are read and written through the
+ SD block cache, so the transfer sees the blocks the Z80 virtual disk has not written back yet.
+
+ Serial control:
+ The magic sentence "helloTeachZ80SDTransfer", then 'E' (export, card to host) or 'I' (import, host to
+ card), then the first block (4 bytes) and the number of blocks (4 bytes). The board answers with an ack
+ packet for the first block, status busy if another job is running.
+
+ Packets, all values little endian:
+    'S' 'D', type (1 byte), block (4 bytes), payload length (2 bytes), payload, crc32 (4 bytes)
+    The crc32 (IEEE 802.3, as zlib) covers type, block, length and payload
+    - 'D' data: the 512 bytes of the block
+    - 'F' fill: fill byte (1 byte), number of blocks (2 bytes). Blocks filled with 0xE5 (empty CP/M
+      directory and data) or 0x00 are sent as runs of up to SDTRANSFER_FILL_MAX blocks
+    - 'E' end: status (1 byte)
+    - 'A' ack: status (1 byte), block is the next block expected
+ Export: the board sends the blocks as data or fill packets as fast as the serial port accepts them, then
+ the end packet. Any character from the host cancels the export.
+ Import: the host sends one data or fill packet, and waits for the ack. The ack holds the next block
+ expected, after an error (crc, sequence) the host continues from there. The end packet of the host
+ writes back the cache, the last ack confirms the blocks are on the card. Without a packet for
+ SDTRANSFER_TIMEOUT_ms, the import ends.
+ Both directions resume at any block: export from the first block missing in the image, import from
+ the block of the last ack. See tools/z80Disk.py.
+
+ File export: 'R' after the magic sentence, then the disk (1 byte, 0 = A), the user number (1 byte) and the
+ file name ("NAME.TYP", 12 bytes, filled with zeros). The ack holds the size of the file in bytes in its
+ block field, or status noFile. The file is sent like an export, the block of the packets is the index of
+ the 512 byte block in the file, the last data packet holds the rest of the file. A hole in the file is
+ sent as a fill packet of zeros. The blocks are read in runs of up to SDTRANSFER_RUN_BLOCKS with one
+ multi block read, as far as the allocation blocks of the file follow each other on the card.
+
+ File import: 'W' after the magic sentence, then disk, user and file name as for 'R', and the size of the
+ file in bytes (4 bytes). The board allocates the blocks of the file (status noSpace, readOnly, noFile for a
+ name which is not valid, noSpaceReplace if the file would only fit in place of the file it replaces) and
+ answers with the ack of block 0. The file is sent like an import, the block
+ of the packets is the index of the 512 byte block in the file, the last data packet holds the rest of the
+ file. The end packet writes the data back to the card, then the directory: the last ack confirms the file
+ is on the disk. An existing file is replaced when the directory is written, a file not ended stays as it
+ was (see CPMFileSystem.h).
+
+ File delete: 'D' after the magic sentence, then disk, user and file name as for 'R'. The board erases the
+ file and answers with one ack packet, status noFile if there is no such file, readOnly for a read only
+ file.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef SD_TRANSFER_H
+#define SD_TRANSFER_H
+
+    #include <Arduino.h>
+    #include <JobEngine.h>
+    #include <Z80SDCache.h>
+    #include <CPMFileSystem.h>
+
+    #define SDTRANSFER_HEADER           9           //sync (2), type, block (4), payload length (2)
+    #define SDTRANSFER_PACKET_MAX       (SDTRANSFER_HEADER + SD_BLOCK_SIZE + 4)
+    #define SDTRANSFER_FILL_MAX         128         //blocks per fill packet
+    #define SDTRANSFER_FLUSH_BLOCKS     8           //dirty blocks written back per step while importing
+    #define SDTRANSFER_TIMEOUT_ms       3000
+    #define SDTRANSFER_RUN_BLOCKS       32          //blocks of a file read in one stream, half the cache frames
+    #define SDTRANSFER_COMMAND_LENGTH   8           //first block, number of blocks
+    #define SDTRANSFER_FILE_COMMAND     14          //disk, user, file name
+    #define SDTRANSFER_WRITE_COMMAND    18          //disk, user, file name, size
+
+    class SDTransfer : public Job {
+
+        public:
+            enum transferMode : uint8_t { inactive, armed, command, exporting, importing };
+            enum packetType : uint8_t { dataPacket = 'D', fillPacket = 'F', endPacket = 'E', ackPacket = 'A' };
+            enum transferStatus : uint8_t { statusOk, statusCrcError, statusSequence, statusCardError, statusTimeout, statusBusy, statusCancelled, statusNoFile, statusNoSpace, statusReadOnly, statusNoSpaceReplace };
+
+            struct statistics_t {
+                uint32_t dataPackets;
+                uint32_t fillPackets;
+                uint32_t fillBlocks;            //blocks sent or received as fill
+                uint32_t crcErrors;             //import packets with a wrong crc
+            };
+
+            SDTransfer(Z80SDCache& sdcache, CPMFileSystem& filesystem, JobEngine& jobengine);
+            bool serialUpdate(uint8_t c);
+            jobState begin(void) override;
+            jobState step(void) override;
+            void end(jobState state) override;
+            static uint32_t crc32(const uint8_t* data, uint32_t length);
+
+            transferMode transfermode;
+            statistics_t stats;
+
+        private:
+            Z80SDCache& sdcache;
+            CPMFileSystem& filesystem;
+            JobEngine& jobengine;
+            uint8_t magicSentenceCounter;
+            uint8_t commandBytes[SDTRANSFER_WRITE_COMMAND];
+            uint8_t commandLength;
+            bool importMode;
+            bool fileMode;
+            bool deleteMode;
+            char fileName[SDTRANSFER_FILE_COMMAND - 1];     //zero terminated
+            uint32_t fileBytes;
+            uint32_t runBlock;                  //run of the file read from the card, see readFileRun
+            uint32_t runBlocks;
+            uint32_t firstBlock;
+            uint32_t endBlock;
+            uint32_t nextBlock;                 //export: next block to read, import: next block expected
+            uint8_t fillValue;                  //fill run collected (export) or written (import)
+            uint32_t fillBlocks;
+            bool finishing;                     //export: end packet sent, import: end packet received
+            bool acknowledged;
+            transferStatus status;
+            uint32_t lastPacket;
+            uint8_t txBuffer[SDTRANSFER_PACKET_MAX];
+            uint16_t txLength;
+            uint16_t txPosition;
+            uint8_t rxBuffer[SDTRANSFER_PACKET_MAX];
+            uint16_t rxLength;
+            bool rxReady;
+
+            SDTransfer(const SDTransfer&) = delete;
+            SDTransfer& operator=(const SDTransfer&) = delete;
+            jobState exportStep(void);
+            jobState fileStep(void);
+            jobState importStep(void);
+            jobState importPacket(void);
+            bool importBlock(const uint8_t* data);
+            void sendPacket(packetType type, uint32_t block, const uint8_t* payload, uint16_t length);
+            void sendFill(uint32_t block);
+            void acknowledge(transferStatus result);
+            transferStatus writeStatus(CPMFileSystem::writeState state);
+            bool sendPending(void);
+
+    };
+
+#endif
@@ -0,0 +1,101 @@
+/* -------------------------------------------------------------------------------------------------------
+ Library for Communication with the Z80 bus
+
+ This library is not general purpose, it is hard coded to be used on the teachZ80 board
+
+ There is one Z80Bus instance, all drivers (io, spi, sd card, flash, filesystem) hold a reference to it.
+ Bus ownership is reference counted:
+    - request_bus / release_bus can be nested, only the first request takes the bus (busreq, pin
+      configuration), only the last release gives it back to the Z80
+    - hold_reset / release_reset keep the Z80 in reset the same way
+ A Z80BusSession holds the bus (and by default the reset) for its lifetime, so a sequence of operations
+ on different drivers negotiates the bus only once:
+        {
+            Z80BusSession session(z80bus);
+            filesystem.listFiles(0);
+            z80flash.readChipIndentification();
+        }
+
+ IO bursts keep IOREQ asserted over a series of io reads and writes (eg the SPI clock edges), only the
+ strobes toggle. Setup times are only waited for lines which rise (open drain), falling edges are fast.
+ A burst must not address the Z80 peripheral chips (SIO, CTC), they take IOREQ without RD as a write.
+
+ onOwnerChange registers a function called when the bus changes hands: true after the Z80 has stopped
+ (busreq, before the STM32 drives the lines), false before the Z80 gets the bus back. The IO trap masks
+ its IOREQ interrupt with it, the cycles of the STM32 do not raise it.
+ 
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_H
+#define Z80_BUS_H
+
+    #include <Arduino.h>
+    #include <Z80BusTiming.h>
+
+    typedef void (*Z80BusOwnerCallback)(bool stm32Active);
+
+    class Z80Bus {                     
+              
+        public:    
+            enum Z80Bus_controlBits { reset, ioreq, mreq, rd, wr, wait };   
+
+            Z80Bus(void);    
+            void resetZ80();     
+            bool request_bus();
+            void release_bus();
+            bool bus_active();
+            void hold_reset();
+            void release_reset();
+            void release_dataBus();
+            void release_addressBus();
+            void release_controlBus();  
+            void write_controlBit(Z80Bus_controlBits bit, bool state); 
+            void write_dataBus(uint8_t data);
+            void write_addressBus(uint16_t address);
+            uint8_t read_dataBus();
+            uint16_t read_addressBus();   
+            uint8_t memRead(uint16_t address);
+            void memWrite(uint16_t address, uint8_t data);
+            uint8_t ioRead(uint8_t ioport);
+            void ioWrite(uint8_t ioport, uint8_t data);
+            void ioBurstBegin(uint8_t ioport);
+            void ioBurstWrite(uint8_t ioport, uint8_t data);
+            uint8_t ioBurstRead(uint8_t ioport);
+            void ioBurstEnd(void);
+            void onOwnerChange(Z80BusOwnerCallback callback);
+
+        private:         
+            enum Z80Bus_mode { passive, active }; 
+            Z80Bus_mode busmode;       
+            uint8_t busSessions;
+            uint8_t resetHolds;
+            uint8_t burstPort;
+            uint8_t burstData;
+            Z80BusOwnerCallback ownerCallback;
+
+            Z80Bus(const Z80Bus&) = delete;
+            Z80Bus& operator=(const Z80Bus&) = delete;
+            void controlPinsActiveDrive(bool enable);
+            void takeBus();
+            void giveBus();
+            void setBurstPort(uint8_t ioport);
+
+    };
+
+    class Z80BusSession {
+
+        public:
+            Z80BusSession(Z80Bus& bus, bool holdReset = true);
+            ~Z80BusSession();
+
+        private:
+            Z80Bus& bus;
+            bool holdReset;
+
+            Z80BusSession(const Z80BusSession&) = delete;
+            Z80BusSession& operator=(const Z80BusSession&) = delete;
+
+    };
+
+#endif
\ No newline at end of file
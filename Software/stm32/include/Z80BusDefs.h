@@ -0,0 +1,200 @@
+/* -------------------------------------------------------------------------------------------------------
+ TeachZ80 bus definitions
+
+ Pin assignment, data bus mapping and timing budgets of the Z80 bus on the teachZ80 board.
+ This header does not depend on the Arduino framework or the STM32 registers, so the same definitions
+ can be used by the bus drivers on the target and by host side tools simulating the bus.
+
+ Bus pin assignment (pin map teachZ80Board below):
+    - Port A: RESET (0), IOREQ (3), BUSREQ (6), WAIT (7), RD (15)
+    - Port B: Address bus A0-A15 (0-15)
+    - Port C: Data bus D0-D3 (0-3), D4-D7 (6-9), WR (10), MREQ (11)
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_DEFS_H
+#define Z80_BUS_DEFS_H
+
+    #include <stdint.h>
+
+    // Pin map of the bus. The bus drivers are written for the port assignment below (control lines on
+    // port A and C, address bus on port B, data bus on port C together with WR and MREQ), the pin numbers
+    // within the ports are taken from the map. All masks, register values and the data bus tables are
+    // generated from the map at compile time, a map which does not fit the drivers fails the build.
+    enum z80BusPort_t : uint8_t { z80PortA, z80PortB, z80PortC };
+
+    struct z80BusPin_t {
+        z80BusPort_t port;
+        uint8_t pin;
+    };
+
+    struct z80BusPinMap_t {
+        z80BusPin_t reset, ioreq, busreq, wait, rd, wr, mreq;
+        z80BusPin_t data[8];
+        z80BusPin_t address[16];
+    };
+
+    //teachZ80 board, a board revision with a different assignment gets its own struct and is selected below
+    struct teachZ80Board {
+        static constexpr z80BusPinMap_t pins = {
+            { z80PortA,  0 }, { z80PortA,  3 }, { z80PortA,  6 }, { z80PortA,  7 },    //reset, ioreq, busreq, wait
+            { z80PortA, 15 }, { z80PortC, 10 }, { z80PortC, 11 },                       //rd, wr, mreq
+            { { z80PortC, 0 }, { z80PortC, 1 }, { z80PortC, 2 }, { z80PortC, 3 },       //D0-D7
+              { z80PortC, 6 }, { z80PortC, 7 }, { z80PortC, 8 }, { z80PortC, 9 } },
+            { { z80PortB,  0 }, { z80PortB,  1 }, { z80PortB,  2 }, { z80PortB,  3 },   //A0-A15
+              { z80PortB,  4 }, { z80PortB,  5 }, { z80PortB,  6 }, { z80PortB,  7 },
+              { z80PortB,  8 }, { z80PortB,  9 }, { z80PortB, 10 }, { z80PortB, 11 },
+              { z80PortB, 12 }, { z80PortB, 13 }, { z80PortB, 14 }, { z80PortB, 15 } }
+        };
+    };
+
+    #ifndef Z80BUS_BOARD
+        #define Z80BUS_BOARD            teachZ80Board
+    #endif
+
+    template <class board>
+    struct Z80BusPinConfig {
+
+        static constexpr uint32_t pin(z80BusPin_t p) { return 1u << p.pin; }
+
+        static constexpr uint32_t onPort(z80BusPin_t p, z80BusPort_t port) { return (p.port == port) ? pin(p) : 0; }
+
+        static constexpr uint32_t controlLines(z80BusPort_t port) {
+            return onPort(board::pins.reset, port) | onPort(board::pins.ioreq, port) | onPort(board::pins.busreq, port) | onPort(board::pins.wait, port) |
+                   onPort(board::pins.rd, port) | onPort(board::pins.wr, port) | onPort(board::pins.mreq, port);
+        }
+
+        static constexpr uint32_t dataLines(z80BusPort_t port) {
+            uint32_t mask = 0;
+            for (uint8_t i=0; i<8; i++) mask |= onPort(board::pins.data[i], port);
+            return mask;
+        }
+
+        static constexpr uint32_t addressLines(z80BusPort_t port) {
+            uint32_t mask = 0;
+            for (uint8_t i=0; i<16; i++) mask |= onPort(board::pins.address[i], port);
+            return mask;
+        }
+
+        static constexpr uint32_t busLines(z80BusPort_t port) { return controlLines(port) | dataLines(port) | addressLines(port); }
+
+        //data byte to port pins (scatter) and back (gather)
+        static constexpr uint32_t scatter(uint8_t data) {
+            uint32_t port = 0;
+            for (uint8_t i=0; i<8; i++) if (data & (1u << i)) port |= pin(board::pins.data[i]);
+            return port;
+        }
+
+        static constexpr uint8_t gather(uint32_t port) {
+            uint8_t data = 0;
+            for (uint8_t i=0; i<8; i++) if (port & pin(board::pins.data[i])) data |= 1u << i;
+            return data;
+        }
+
+        //value for the registers with 2 bits per pin (MODER, OSPEEDR, PUPDR): the field of each pin in the mask
+        static constexpr uint32_t field2(uint32_t pins, uint32_t value) {
+            uint32_t result = 0;
+            for (uint8_t i=0; i<16; i++) if (pins & (1u << i)) result |= value << (2 * i);
+            return result;
+        }
+
+        //checks of the map against the port assignment of the drivers, and for pins used twice
+        static constexpr bool valid(void) {
+            const z80BusPin_t portA[] = { board::pins.reset, board::pins.ioreq, board::pins.busreq, board::pins.wait, board::pins.rd };
+            for (const z80BusPin_t& p : portA) if (p.port != z80PortA) return false;
+            if ((board::pins.wr.port != z80PortC) || (board::pins.mreq.port != z80PortC)) return false;
+            for (uint8_t i=0; i<8; i++) if (board::pins.data[i].port != z80PortC) return false;
+            for (uint8_t i=0; i<16; i++) if ((board::pins.address[i].port != z80PortB) || (board::pins.address[i].pin != i)) return false;
+            uint32_t used[3] = { 0, 0, 0 };
+            const z80BusPin_t control[] = { board::pins.reset, board::pins.ioreq, board::pins.busreq, board::pins.wait, board::pins.rd, board::pins.wr, board::pins.mreq };
+            for (const z80BusPin_t& p : control) {
+                if ((p.pin > 15) || (used[p.port] & pin(p))) return false;
+                used[p.port] |= pin(p);
+            }
+            for (uint8_t i=0; i<8; i++) {
+                if ((board::pins.data[i].pin > 15) || (used[z80PortC] & pin(board::pins.data[i]))) return false;
+                used[z80PortC] |= pin(board::pins.data[i]);
+            }
+            return true;
+        }
+
+        //highest data pin, sizes the gather lookup table
+        static constexpr uint8_t dataPinsWidth(void) {
+            uint8_t width = 0;
+            for (uint8_t i=0; i<8; i++) if (board::pins.data[i].pin + 1 > width) width = board::pins.data[i].pin + 1;
+            return width;
+        }
+
+    };
+
+    typedef Z80BusPinConfig<Z80BUS_BOARD> Z80BusPins;
+    static_assert(Z80BusPins::valid(), "Z80 bus pin map does not fit the bus drivers");
+
+    // These masks help for easy setup, write and release of pins later, generated from the pin map
+    #define PORTA_BUS_LINES_IN_USE      Z80BusPins::busLines(z80PortA)
+    #define PORTA_CONTROL_LINES_IN_USE  Z80BusPins::controlLines(z80PortA)
+    #define PORTA_CONTROL_LINES_EX_RES  (PORTA_CONTROL_LINES_IN_USE & ~PORTA_PIN_RESET)
+
+    #define PORTB_BUS_LINES_IN_USE      Z80BusPins::busLines(z80PortB)
+    #define PORTB_ADDRESS_LINES_IN_USE  Z80BusPins::addressLines(z80PortB)
+
+    #define PORTC_BUS_LINES_IN_USE      Z80BusPins::busLines(z80PortC)
+    #define PORTC_DATA_LINES_IN_USE     Z80BusPins::dataLines(z80PortC)
+    #define PORTC_CONTROL_LINES_IN_USE  Z80BusPins::controlLines(z80PortC)
+
+    // Single control lines
+    #define PORTA_PIN_RESET             Z80BusPins::pin(Z80BUS_BOARD::pins.reset)
+    #define PORTA_PIN_IOREQ             Z80BusPins::pin(Z80BUS_BOARD::pins.ioreq)
+    #define PORTA_PIN_BUSREQ            Z80BusPins::pin(Z80BUS_BOARD::pins.busreq)
+    #define PORTA_PIN_WAIT              Z80BusPins::pin(Z80BUS_BOARD::pins.wait)
+    #define PORTA_PIN_RD                Z80BusPins::pin(Z80BUS_BOARD::pins.rd)
+    #define PORTC_PIN_WR                Z80BusPins::pin(Z80BUS_BOARD::pins.wr)
+    #define PORTC_PIN_MREQ              Z80BusPins::pin(Z80BUS_BOARD::pins.mreq)
+
+    #define PORTC_WR_MREQ               (PORTC_PIN_WR | PORTC_PIN_MREQ)     //wr and mreq share port C with the data bus
+    #define PORTA_RD_IOREQ              (PORTA_PIN_RD | PORTA_PIN_IOREQ)    //rd and ioreq are both on port A
+
+    // Bus timing budgets in nanoseconds
+    // The budgets are derived from the SST39SF0x0-70 datasheet and the 74HC latches used for the Z80 IO ports:
+    //    - tAS 0ns / tAH 30ns address setup and hold, tAA 70ns address access time
+    //    - tOE 35ns output enable to output valid
+    //    - tWP 40ns write pulse width, tWPH 30ns write pulse high, tDS 40ns data setup, tDH 0ns data hold
+    // All bus lines are open drain with external pull ups to 5V. Falling edges are fast, but rising edges
+    // are limited by the RC constant of the pull ups and the bus capacitance. Address and data setup budgets
+    // therefore are significantly longer than the datasheet values.
+    #define Z80BUS_ADDRESS_SETUP_ns     250     //address lines stable (open drain rising edge) before a strobe is asserted
+    #define Z80BUS_DATA_SETUP_ns        250     //data lines stable (open drain rising edge) before the write strobe is released
+    #define Z80BUS_READ_STROBE_ns       150     //rd asserted until data is valid on the bus (tAA, tOE, buffer delay and input sync)
+    #define Z80BUS_WRITE_STROBE_ns       60     //wr pulse width (tWP)
+    #define Z80BUS_CONTROL_SETTLE_ns     40     //any other control line edge (push-pull in active mode, tWPH, tAH)
+
+    //scatters a data byte to the port C data pins
+    constexpr uint32_t dataToPortC(uint32_t data) { return Z80BusPins::scatter(data); }
+
+    //BSRR values to put any data byte onto the data bus with one single store
+    //one bits are released (set), zero bits are pulled low (reset)
+    struct dataBusTable_t {
+        uint32_t bsrr[256];
+        constexpr dataBusTable_t() : bsrr() {
+            for (uint32_t i=0; i<256; i++) bsrr[i] = dataToPortC(i) | ((PORTC_DATA_LINES_IN_USE & ~dataToPortC(i)) << 16);
+        }
+    };
+    extern const dataBusTable_t dataBusTable;
+
+    //data byte for each value of the port C data pins, the gather is one single load (like pext)
+    #define Z80BUS_GATHER_SIZE          (1u << Z80BusPins::dataPinsWidth())
+    static_assert(Z80BUS_GATHER_SIZE <= 1024, "Z80 data bus pins too far apart for the gather table");
+
+    struct dataGatherTable_t {
+        uint8_t data[Z80BUS_GATHER_SIZE];
+        constexpr dataGatherTable_t() : data() {
+            for (uint32_t i=0; i<Z80BUS_GATHER_SIZE; i++) data[i] = Z80BusPins::gather(i);
+        }
+    };
+    extern const dataGatherTable_t dataGatherTable;
+
+    //gathers the data byte from a port C value
+    inline uint8_t portCToData(uint32_t port) { return dataGatherTable.data[port & (Z80BUS_GATHER_SIZE - 1)]; }
+
+#endif
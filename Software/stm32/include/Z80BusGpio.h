@@ -0,0 +1,33 @@
+/* -------------------------------------------------------------------------------------------------------
+ GPIO backend for the Z80 bus libraries
+
+ The bus drivers access the GPIO ports only through the definitions below. The backend is selected at
+ compile time:
+    - target (default): the ports resolve directly to the STM32 GPIO registers, there is no overhead
+    - TEACHZ80_NATIVE: the ports resolve to the simulated teachZ80 board (src/native/SimBoard.h), which
+      provides the same register names. Used by the PlatformIO native environment, to run and benchmark
+      the driver stack on the development host
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_GPIO_H
+#define Z80_BUS_GPIO_H
+
+    #include <Arduino.h>
+
+    #ifdef TEACHZ80_NATIVE
+        #include <SimBoard.h>
+
+        #define Z80BUS_GPIOA                (&simBoard.portA)
+        #define Z80BUS_GPIOB                (&simBoard.portB)
+        #define Z80BUS_GPIOC                (&simBoard.portC)
+        #define Z80BUS_GPIO_CLK_ENABLE()
+    #else
+        #define Z80BUS_GPIOA                GPIOA
+        #define Z80BUS_GPIOB                GPIOB
+        #define Z80BUS_GPIOC                GPIOC
+        #define Z80BUS_GPIO_CLK_ENABLE()    do { __HAL_RCC_GPIOA_CLK_ENABLE(); __HAL_RCC_GPIOB_CLK_ENABLE(); __HAL_RCC_GPIOC_CLK_ENABLE(); } while (0)
+    #endif
+
+#endif
@@ -0,0 +1,79 @@
+/* -------------------------------------------------------------------------------------------------------
+ Library for precomputed Z80 bus sequences
+
+ A sequence is a whole transfer (eg a flash program command or a run of SPI clock toggles through IO port
+ 0x10), translated into a list of GPIO port words. The list is organized in slots of equal length. In
+ every slot, one BSRR word is written to each of the three bus ports, in the order:
+    1. Port B (address bus)
+    2. Port A (RD, IOREQ)
+    3. Port C (data bus, WR, MREQ)
+ At the end of each slot, the port C input register is sampled, which is how read cycles get their data.
+ A word of zero does not change the port.
+
+ The sequences are a host side model of the bus timing: they are played by the Z80BusWaveform simulator,
+ which checks the timing budgets of the bus library against the Z80 bus cycles. There is no DMA player
+ on the target, the firmware drives the bus by the CPU, Z80BusSequence.cpp is left out of the target
+ build like the simulator. This library does not access any hardware.
+
+ Every bus cycle is split into slots according the timing budgets in Z80BusDefs.h:
+        slot:    0         n1        n1+n2     n1+n2+1
+ ADDRESS    ____X==================================X____
+ IOREQ      _________\___________________________/_____     (mreq for memory cycles)
+ WR/RD      _________\_________________/_______________
+ DATA       ____X==================================X____     (write cycles only)
+                |-------| address setup
+                        |----------| data setup / read strobe
+                                   |------| control settle
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_SEQUENCE_H
+#define Z80_BUS_SEQUENCE_H
+
+    #include <Z80BusDefs.h>
+
+    #define Z80BUS_SEQUENCE_MAX_SLOTS   1024    //max amount of slots in one sequence
+    #define Z80BUS_SEQUENCE_MAX_READS    256    //max amount of read cycles in one sequence
+    #define Z80BUS_SEQUENCE_SLOT_ns      250    //default slot length
+
+    class Z80BusSequence {
+
+        public:
+            Z80BusSequence(uint32_t slotLength_ns = Z80BUS_SEQUENCE_SLOT_ns);
+            void clear(void);
+            bool memWrite(uint16_t address, uint8_t data);
+            bool memRead(uint16_t address);
+            bool ioWrite(uint8_t ioport, uint8_t data);
+            bool ioRead(uint8_t ioport);
+            bool idle(uint32_t ns);
+            uint8_t readData(uint16_t readIndex);
+            uint16_t length(void) { return slots; }
+            uint16_t reads(void) { return numReads; }
+            uint16_t readSlot(uint16_t readIndex) { return readSlots[readIndex]; }
+            uint32_t slotLength(void) { return slotLength_ns; }
+
+            //port words, aligned to cache lines for dma
+            uint32_t portA[Z80BUS_SEQUENCE_MAX_SLOTS] __attribute__((aligned(32)));
+            uint32_t portB[Z80BUS_SEQUENCE_MAX_SLOTS] __attribute__((aligned(32)));
+            uint32_t portC[Z80BUS_SEQUENCE_MAX_SLOTS] __attribute__((aligned(32)));
+            uint16_t capture[Z80BUS_SEQUENCE_MAX_SLOTS] __attribute__((aligned(32)));
+
+        private:
+            enum budget : uint8_t { addressSetup, dataSetup, readStrobe, controlSettle, numBudgets };
+
+            uint32_t slotLength_ns;
+            uint16_t slots;
+            uint16_t numReads;
+            uint8_t  budgetSlots[numBudgets];
+            uint16_t readSlots[Z80BUS_SEQUENCE_MAX_READS];
+
+            uint16_t nsToSlots(uint32_t ns);
+            bool reserve(uint16_t numSlots);
+            bool writeCycle(uint16_t address, uint8_t data, uint32_t portAStrobe, uint32_t portCStrobe);
+            bool readCycle(uint16_t address, uint32_t portAStrobe, uint32_t portCStrobe);
+            static uint32_t addressWord(uint16_t address) { return address | ((uint32_t)(uint16_t)~address << 16); }
+
+    };
+
+#endif
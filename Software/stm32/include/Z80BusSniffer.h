@@ -0,0 +1,86 @@
+/* -------------------------------------------------------------------------------------------------------
+ Passive Z80 bus sniffer
+
+ This library is not general purpose, it is hard coded to be used on the teachZ80 board.
+ While the Z80 runs, the sniffer only listens on the bus, it never drives a line and never stalls the Z80:
+    - the falling edges of MREQ (PC11) and IOREQ (PA3) raise an EXTI interrupt
+    - the interrupt samples the address bus, then follows the cycle until the request line is released.
+      The data bus is taken from the last sample with RD or WR active, so read data is as late as possible
+    - cycles without RD and WR (memory refresh, interrupt acknowledge) are skipped
+    - bus cycles of the STM32 itself (bus requested) are not captured
+    - the record (DWT time, address, data, type) is put into a lock free ring buffer, interrupt is the
+      only producer, the main loop the only consumer. If the ring is full, the record is counted as lost,
+      the count is put into the ring in front of the next record
+    - the ring lives in the capture arena shared with the profiler (Z80CaptureArena.h). No capture is
+      started while the profiler samples or dumps, a capture clears the profiler counters
+ The main loop drains the ring, encodes the records in the compact trace format (Z80Trace.h) and streams
+ them to the host as fast as the serial port accepts them. Lost records are reported as overflow markers.
+
+ While the IO trap (Z80IOTrap.h) is active, it owns the IOREQ interrupt: the sniffer observes the io
+ cycles through the trap, the cycles of the trapped ports are recorded as the trap has served them.
+
+ Every cycle costs the interrupt entry and the EXTI dispatch of the Arduino core. At high Z80 clocks,
+ back to back cycles can be faster than that, those are merged by the EXTI pending bit and not captured.
+ For complete traces, capture io cycles only, or lower the Z80 clock in the configuration.
+
+ Serial control:
+ The magic sentence "helloTeachZ80BusSniffer" arms the sniffer, the next character selects the cycles
+ to capture: 'A' all, 'M' memory only, 'I' io only. The stream starts with the trace header. Any
+ character received while capturing stops the capture, the stream ends with the end marker. If the capture
+ cannot start, the header is followed by the refused marker only.
+ See tools/z80Trace.py for capturing and decoding on the host.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_SNIFFER_H
+#define Z80_BUS_SNIFFER_H
+
+    #include <Arduino.h>
+    #include <Z80Bus.h>
+    #include <Z80Trace.h>
+    #include <Z80IOTrap.h>
+    #include <Z80CaptureArena.h>
+
+    #define Z80SNIFFER_RING_SIZE        (Z80CAPTURE_ARENA_SIZE / sizeof(z80TraceRecord_t))    //records, power of 2
+
+    class Z80BusSniffer {
+
+        public:
+            enum snifferMode : uint8_t { inactive, armed, active };
+            enum captureFilter : uint8_t { all, memoryOnly, ioOnly };
+            snifferMode sniffermode;
+
+            Z80BusSniffer(Z80Bus& bus, Z80IOTrap& iotrap, Z80CaptureArena& arena);
+            bool start(captureFilter filter);
+            void stop(void);
+            void process(void);
+            bool serialUpdate(uint8_t c);
+
+        private:
+            Z80Bus& bus;
+            Z80IOTrap& iotrap;
+            Z80CaptureArena& arena;
+            Z80TraceEncoder encoder;
+            z80TraceRecord_t* ring;
+            volatile uint32_t head;
+            volatile uint32_t tail;
+            uint32_t dropped;
+            uint32_t lostTotal;
+            uint8_t magicSentenceCounter;
+            bool observing;
+            static Z80BusSniffer* instance;
+
+            Z80BusSniffer(const Z80BusSniffer&) = delete;
+            Z80BusSniffer& operator=(const Z80BusSniffer&) = delete;
+            void refuse(Z80TraceEncoder::refusalReason reason);
+            void capture(bool io);
+            void put(const z80TraceRecord_t& record);
+            uint8_t encodeNext(uint8_t* buffer);
+            static void mreqHandler(void);
+            static void ioreqHandler(void);
+            static void ioObserved(const z80TraceRecord_t* served);
+
+    };
+
+#endif
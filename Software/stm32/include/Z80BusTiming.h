@@ -0,0 +1,48 @@
+/* -------------------------------------------------------------------------------------------------------
+ Library for cycle accurate Z80 bus timing
+
+ This library is not general purpose, it is hard coded to be used on the teachZ80 board.
+ It replaces fixed microsecond delays on the bus with waits based on the DWT cycle counter of the
+ Cortex-M7 core. Every bus operation has a named setup/hold budget in nanoseconds, which is converted
+ once into core clock cycles when the timing is started.
+
+ The budgets itself are defined in Z80BusDefs.h
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_TIMING_H
+#define Z80_BUS_TIMING_H
+
+    #include <Arduino.h>
+    #include <Z80BusDefs.h>
+
+    class Z80BusTiming {
+
+        public:
+            enum busOperation : uint8_t { addressSetup, dataSetup, readStrobe, writeStrobe, controlSettle, numOperations };
+
+            static void begin(void);
+            static uint32_t nsToCycles(uint32_t ns);
+
+            //current value of the cycle counter
+            static inline uint32_t now(void) {
+                return DWT->CYCCNT;
+            }
+
+            //wait until the budget of the operation has passed since the given cycle counter value
+            static inline void waitSince(uint32_t start, busOperation operation) {
+                uint32_t budget = cycles[operation];
+                while ((DWT->CYCCNT - start) < budget);
+            }
+
+            //wait the budget of the operation, starting now
+            static inline void wait(busOperation operation) {
+                waitSince(DWT->CYCCNT, operation);
+            }
+
+            static uint32_t cycles[numOperations];
+
+    };
+
+#endif
@@ -0,0 +1,66 @@
+/* -------------------------------------------------------------------------------------------------------
+ Z80 bus waveform simulator
+
+ Host side tool, to verify Z80BusSequence lists without hardware. Not part of the target firmware.
+ The simulator plays a sequence slot by slot, in the port order and at the sample point of the slots
+ (Z80BusSequence.h):
+    - port B word at the start of the slot, port A word after 1/4, port C word after 1/2 of the slot
+    - the data bus is sampled at the end of the slot, the samples are stored in the sequence capture array
+ From the resulting pin levels, the simulator
+    - decodes the bus cycles (memory/io read/write) with address and data
+    - checks every cycle against the timing budgets in Z80BusDefs.h and counts violations
+    - optionally writes a VCD file, which can be viewed with any waveform viewer (eg GTKWave)
+
+ During read cycles, data is provided by a read handler (a simple model of the memory or io device).
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_BUS_WAVEFORM_H
+#define Z80_BUS_WAVEFORM_H
+
+    #include <stdio.h>
+    #include <Z80BusDefs.h>
+    #include <Z80BusSequence.h>
+
+    #define Z80BUS_WAVEFORM_MAX_CYCLES  Z80BUS_SEQUENCE_MAX_SLOTS
+
+    class Z80BusWaveform {
+
+        public:
+            enum cycleType : uint8_t { memoryRead, memoryWrite, ioRead, ioWrite };
+
+            struct busCycle_t {
+                cycleType type;
+                uint16_t address;
+                uint8_t data;
+                uint32_t time_ns;
+            };
+
+            typedef uint8_t (*readHandler_t)(cycleType type, uint16_t address);
+
+            Z80BusWaveform(readHandler_t handler = nullptr);
+            uint32_t play(Z80BusSequence* sequence, FILE* vcd = nullptr);
+            void printCycle(uint32_t index);
+
+            uint32_t cycles;
+            uint32_t violations;
+            busCycle_t cycle[Z80BUS_WAVEFORM_MAX_CYCLES];
+
+        private:
+            readHandler_t readHandler;
+            uint32_t portA, portB, portC;
+            uint8_t  dataBus, lastSample;
+            uint32_t addressChange_ns, dataChange_ns, strobeStart_ns, lastSample_ns;
+            uint32_t slotLength_ns;
+
+            void writePort(uint32_t* port, uint32_t bsrr);
+            void update(uint32_t time_ns, uint32_t lastA, uint32_t lastB, uint32_t lastC, FILE* vcd);
+            void addCycle(cycleType type, uint8_t data, uint32_t time_ns);
+            void check(bool condition, const char* text, uint32_t time_ns);
+            void vcdHeader(FILE* vcd);
+            void vcdDump(FILE* vcd, uint32_t time_ns);
+
+    };
+
+#endif
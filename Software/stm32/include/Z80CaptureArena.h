@@ -0,0 +1,44 @@
+/* -------------------------------------------------------------------------------------------------------
+ Shared memory of the capture tools
+
+ The profiler (Z80Profiler.h) and the bus sniffer (Z80BusSniffer.h) both need a large buffer, but they
+ are never used at the same time. Both work in this one static arena instead of a buffer each.
+    - a tool claims the arena before it starts, and releases it when it stops. The claim fails while
+      the other tool holds the arena
+    - the content stays with the last tool after the release: the profiler counters can be shown and
+      dumped after sampling stopped, until the sniffer claims the arena for a capture
+ The arena is claimed and released from the main loop only, the interrupts of the tools just use it.
+
+ This header does not depend on the Arduino framework or the STM32 registers.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_CAPTURE_ARENA_H
+#define Z80_CAPTURE_ARENA_H
+
+    #include <stdint.h>
+
+    #define Z80CAPTURE_ARENA_SIZE       0x20000     //bytes, the 64k 16 bit profiler counters
+
+    class Z80CaptureArena {
+
+        public:
+            enum arenaUser : uint8_t { nobody, profiler, sniffer };
+
+            Z80CaptureArena(void);
+            void* claim(arenaUser user);
+            void release(arenaUser user);
+            bool holds(arenaUser user);
+
+        private:
+            uint32_t memory[Z80CAPTURE_ARENA_SIZE / sizeof(uint32_t)];
+            arenaUser owner;
+            bool claimed;
+
+            Z80CaptureArena(const Z80CaptureArena&) = delete;
+            Z80CaptureArena& operator=(const Z80CaptureArena&) = delete;
+
+    };
+
+#endif
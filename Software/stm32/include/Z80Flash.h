@@ -14,6 +14,9 @@
     4. Byte-by-Byte programming
     5. Byte-by-Byte verification
     6. Release Z80 reset line
+
+ writeBytes programs a range of bytes, one writeByte at a time. The 25us program time of every byte
+ dominates the bus cycles of the program command.
  
  Author: Christian Luethi
 --------------------------------------------------------------------------------------------------------- */
@@ -22,7 +25,7 @@
 #define Z80_FLASH
 
     #include <Arduino.h>
-    #include <Z80bus.h> 
+    #include <Z80Bus.h> 
     #include <HexRecord.h>       
 
     class Z80Flash {
@@ -33,10 +36,11 @@
             uint8_t chipVendorId;
             uint8_t chipDeviceId;
 
-            Z80Flash(Z80Bus bus);    
+            Z80Flash(Z80Bus& bus);    
             void setMode(bool modeactive = true);
             uint8_t readByte(uint16_t address); 
             void writeByte(uint16_t address, uint8_t data);
+            void writeBytes(uint16_t address, const uint8_t* data, uint32_t length);
             void eraseFlash();   
             void eraseBank();   
             uint32_t bytesProgrammed(void);
@@ -44,8 +48,7 @@
             void readChipIndentification();            
 
         private:            
-            Z80Bus z80bus;      
-            void singleByteWrite(uint16_t address, uint8_t data);         
+            Z80Bus& z80bus;      
 
     };
 
@@ -6,6 +6,8 @@
 
  CAUTION: This code may change the output latches on the Z80. It cannot know the current status of the outputs.
  When the IO write requests are not used anymore (eg after SD access is completed), the Z80 should be reset
+
+ stats counts the io cycles issued, single and within bursts, for the SD telemetry (Console, SD-Card)
  
  Author: Christian Luethi
 --------------------------------------------------------------------------------------------------------- */
@@ -19,13 +21,24 @@
     class Z80IO  {
               
         public:            
-            Z80IO(Z80Bus bus);    
+            Z80IO(Z80Bus& bus);    
             void requestBus(bool request);
             void write(uint8_t ioport, uint8_t data);
             uint8_t read(uint8_t ioport);          
+            void burstBegin(uint8_t ioport);
+            void burstWrite(uint8_t ioport, uint8_t data);
+            uint8_t burstRead(uint8_t ioport);
+            void burstEnd(void);
+
+            struct statistics_t {
+                uint32_t reads;
+                uint32_t writes;
+                uint32_t bursts;
+            };
+            statistics_t stats;
 
         private:
-            Z80Bus z80bus; 
+            Z80Bus& z80bus; 
     
     };
 
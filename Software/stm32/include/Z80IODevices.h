@@ -0,0 +1,132 @@
+/* -------------------------------------------------------------------------------------------------------
+ Virtual Z80 peripherals, served by the IO trap (Z80IOTrap.h)
+
+ Port numbers are relative to the first port the device is attached to. Default assignment in main.cpp:
+    0x60-0x63 Z80IOMultiplier
+        write 0/1: operand A low/high, write 2/3: operand B low/high
+        read 0-3: unsigned 32 bit product A * B, least significant byte first
+    0x64-0x65 Z80IOConsoleFifo
+        write 0: character to the serial console, read 1: status, bit 0 set if there is space in the fifo
+    0x66-0x67 Z80IOBlockCopy, memory copy by the STM32 (like LDIR: forward, byte by byte)
+        write 0: parameters, in order source low/high, destination low/high, length low/high
+        read 0:  resets the parameter order
+        write 1: starts the copy, the Z80 is stopped by a bus request until the copy has been done
+        read 1:  status, bit 0 set while the copy is pending
+    0x68-0x6E Z80IODisk, 512 byte block device on the SD card, through the SD block cache (Z80SDCache.h)
+        write 0-3: block number (LBA), least significant byte first. Write 0 starts a transfer (see bit 2)
+        read 0-3:  block number, read back by the Z80 to see that all four bytes have arrived
+        write 4:   output latch 0 of the Z80 (sram bank bits), kept while the STM32 clocks the SD card
+        write 5:   command, 0 resets the data index, 1 reads the block into the buffer, 2 writes the buffer
+        read 5:    status, bit 0 set while the command is busy, bit 1 set if it has failed, bit 2 set if the
+                   IO trap has missed a cycle since the transfer started (Z80IOTrap::stats.missed)
+        read/write 6: data buffer, 512 bytes, the index increments with every access
+       A read or write command sets the index to 0. A write command fails unless all 512 bytes of the
+       buffer have been written since the index was reset. The Z80 fails the sector when bit 1 or 2 is set,
+       after the command and after moving the data (a missed cycle leaves stale or floating data). The SD card is accessed by a bus request, the Z80 stops
+       until the block has been transferred. Written blocks stay in the cache, they are written to the card
+       when the disk has not been used for Z80IODISK_FLUSH_ms, or when their frame is needed
+       While a multi block stream is open on the card, a command stays busy and the written blocks stay in
+       the cache, both are done in the first main loop after it. A job (JobEngine.h) resets the Z80 and may
+       change the card: a command latched before the job has started fails (status bit 1), it is not done
+       after the job. The written blocks stay in the cache until the job has ended
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_IO_DEVICES_H
+#define Z80_IO_DEVICES_H
+
+    #include <Arduino.h>
+    #include <Z80Bus.h>
+    #include <Z80IOTrap.h>
+    #include <Z80SPI.h>
+    #include <Z80SDCard.h>
+    #include <Z80SDCache.h>
+    #include <JobEngine.h>
+
+    #define Z80IOFIFO_SIZE              256         //power of 2
+    #define Z80IODISK_FLUSH_ms          500         //idle time until written blocks go to the card
+
+    class Z80IOMultiplier : public Z80IODevice {
+
+        public:
+            Z80IOMultiplier(void);
+            uint8_t ioRead(uint8_t port) override;
+            void ioWrite(uint8_t port, uint8_t data) override;
+
+        private:
+            uint8_t operands[4];
+
+    };
+
+    class Z80IOConsoleFifo : public Z80IODevice {
+
+        public:
+            Z80IOConsoleFifo(void);
+            uint8_t ioRead(uint8_t port) override;
+            void ioWrite(uint8_t port, uint8_t data) override;
+            void process(void) override;
+
+        private:
+            uint8_t fifo[Z80IOFIFO_SIZE];
+            volatile uint32_t head;
+            volatile uint32_t tail;
+
+    };
+
+    class Z80IOBlockCopy : public Z80IODevice {
+
+        public:
+            Z80IOBlockCopy(Z80Bus& bus);
+            uint8_t ioRead(uint8_t port) override;
+            void ioWrite(uint8_t port, uint8_t data) override;
+            void process(void) override;
+
+        private:
+            Z80Bus& bus;
+            uint8_t parameters[6];
+            uint8_t parameterIndex;
+            volatile bool pending;
+
+    };
+
+    class Z80IODisk : public Z80IODevice {
+
+        public:
+            enum diskCommand : uint8_t { resetIndex, readBlock, writeBlock };
+
+            struct statistics_t {
+                uint32_t reads;
+                uint32_t writes;
+                uint32_t hits;                  //reads served from the cache
+                uint32_t errors;
+                uint32_t rejected;              //write commands without a full data buffer
+            };
+
+            Z80IODisk(Z80SDCache& cache, Z80SPI& spi, JobEngine& jobengine, const uint32_t& missedCycles);
+            uint8_t ioRead(uint8_t port) override;
+            void ioWrite(uint8_t port, uint8_t data) override;
+            void process(void) override;
+            bool flush(void);
+
+            statistics_t stats;
+
+        private:
+            Z80SDCache& cache;
+            Z80SPI& spi;
+            JobEngine& jobengine;
+            const uint32_t& missedCycles;       //missed cycles of the IO trap
+            uint32_t missedAtStart;             //missed cycles when the transfer started
+            uint8_t buffer[SD_BLOCK_SIZE];
+            uint8_t lba[4];
+            uint8_t outputLatch;
+            uint32_t lastCommand;
+            volatile uint32_t commandJobs;      //jobs started when the command was latched
+            volatile uint16_t dataIndex;
+            volatile uint8_t command;
+            volatile bool busy;
+            volatile bool failed;
+
+    };
+
+#endif
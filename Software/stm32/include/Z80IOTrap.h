@@ -0,0 +1,107 @@
+/* -------------------------------------------------------------------------------------------------------
+ IO trap for virtual Z80 peripherals
+
+ This library is not general purpose, it is hard coded to be used on the teachZ80 board.
+ The STM32 serves the Z80 io cycles on the stm32 ports 0x60-0x6F, no other device on the board drives
+ the data bus on these ports. Virtual devices (Z80IODevice) are attached to a range of these ports.
+ For each io cycle on a trapped port:
+    - the falling edge of IOREQ (PA3) raises the EXTI3 interrupt. The interrupt is served directly from a
+      copy of the vector table in ram, without the dispatch of the Arduino core, to be in time for WAIT
+    - WAIT is asserted, so the Z80 stretches the cycle while the device is called
+    - io write: the data is latched and passed to the device
+      io read: the device provides the data, it is driven on the bus
+    - WAIT is released, the data bus is released when the Z80 ends the cycle (IOREQ high)
+ The Z80 samples WAIT in the automatic wait state of the io cycle, about 1.5 clocks after IOREQ. start()
+ turns this into a budget of core clock cycles for the given Z80 clock, less the interrupt entry. When
+ the Z80 clock is changed, setClock() sets the budget for the new clock. WAIT is
+ timestamped against the entry of the handler: if it would be asserted after the budget (late entry on a
+ cold cache, flash wait states, higher priority interrupts), the Z80 has already passed the sample point.
+ The cycle is counted as missed, WAIT is not asserted and the bus is not driven, the device is not
+ called. The same applies to cycles which have ended before the handler has seen them.
+
+ Device functions are called in interrupt context and have to be short. Work which needs longer, or the
+ bus, is done in process() of the device, called from the main loop (see Z80IODevices.h).
+
+ The trap owns the EXTI3 line at priority 0. An observer (the bus sniffer) registers with observe()
+ instead of attachInterrupt on the same line: IOREQ edges on other ports are passed to it to follow the
+ cycle itself, the served cycles of the trapped ports are passed as a record once they have ended.
+ Without an observer, the edges on other ports go to the Arduino interrupt dispatch. While the trap is
+ active, it re-enables its interrupt and restores its priority if another user has changed them.
+ While the STM32 holds the bus (request_bus), the EXTI3 line is masked (Z80Bus::onOwnerChange): the io
+ cycles of the STM32 itself (the SPI bytes of the SD card) do not enter the handler. The edges seen
+ meanwhile are cleared before the Z80 gets the bus back.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_IO_TRAP_H
+#define Z80_IO_TRAP_H
+
+    #include <Arduino.h>
+    #include <Z80Bus.h>
+    #include <Z80Trace.h>
+
+    #define Z80IOTRAP_PORT_BASE         0x60        //stm32_port in Software/Z80/lib/io.asm
+    #define Z80IOTRAP_PORTS             16
+    #define Z80IOTRAP_TIMEOUT_ns        5000        //longest wait for a strobe, and for the end of the cycle after WAIT
+    #define Z80IOTRAP_ENTRY_CYCLES      12          //core clock cycles from the IOREQ edge to the handler (exception entry)
+
+    class Z80IODevice {
+
+        public:
+            virtual ~Z80IODevice() {}
+
+            //interrupt context, port relative to the first port of the device
+            virtual uint8_t ioRead(uint8_t port) = 0;
+            virtual void ioWrite(uint8_t port, uint8_t data) = 0;
+
+            //main loop context, deferred work
+            virtual void process(void) {}
+
+    };
+
+    class Z80IOTrap {
+
+        public:
+            //interrupt context: nullptr for an io cycle on another port, still running, else a served cycle
+            typedef void (*ioObserver)(const z80TraceRecord_t* served);
+
+            struct statistics_t {
+                uint32_t reads;
+                uint32_t writes;
+                uint32_t unclaimed;             //trapped port without device, reads 0xFF
+                uint32_t missed;                //WAIT was late for the sample point of the Z80, the cycle was not served
+                uint32_t maxServiceCycles;      //longest cycle, core clock cycles from interrupt entry to release of WAIT
+            };
+
+            Z80IOTrap(Z80Bus& bus);
+            bool attach(Z80IODevice& device, uint8_t firstPort, uint8_t numPorts);
+            bool start(uint32_t z80Clock);
+            bool setClock(uint32_t z80Clock);
+            void stop(void);
+            bool active(void);
+            void process(void);
+            void observe(ioObserver observer);
+
+            statistics_t stats;
+
+        private:
+            Z80Bus& bus;
+            Z80IODevice* devices[Z80IOTRAP_PORTS];
+            uint8_t firstPorts[Z80IOTRAP_PORTS];
+            bool trapActive;
+            uint32_t timeoutCycles;
+            uint32_t waitBudgetCycles;          //latest assertion of WAIT after the handler entry
+            volatile ioObserver observer;
+            static Z80IOTrap* instance;
+
+            Z80IOTrap(const Z80IOTrap&) = delete;
+            Z80IOTrap& operator=(const Z80IOTrap&) = delete;
+            void enableInterrupt(void);
+            void serve(void);
+            static void irqHandler(void);
+            static void ownerChanged(bool stm32Active);
+
+    };
+
+#endif
@@ -0,0 +1,83 @@
+/* -------------------------------------------------------------------------------------------------------
+ Statistical profiler for the running Z80
+
+ This library is not general purpose, it is hard coded to be used on the teachZ80 board.
+ A timer interrupt samples the address bus while the Z80 runs, the bus stays passive. Every sample
+ increments one of 64k hit counters, one per address. Hot loops show up as the addresses with the most
+ hits, without any instrumentation of the Z80 code.
+    - samples during memory refresh (MREQ without RD/WR) and io cycles are skipped, as the address bus
+      then does not carry a program or data address
+    - samples while the STM32 holds the bus or the Z80 is in reset are skipped
+    - the sample period is dithered, to not alias with loops running at a multiple of the sample rate
+    - the counters are 16 bit. If one saturates, all counters are halved and the halving is counted,
+      the proportions stay intact
+    - the counters live in the capture arena shared with the bus sniffer (Z80CaptureArena.h). Sampling
+      does not start while a capture runs, a capture started after sampling stopped clears the counters
+
+ Serial control:
+ The magic sentence "helloTeachZ80Profiler" followed by a command character:
+    'S' clear the counters and start, 'X' stop, 'D' dump the counters
+ Dump format, all values little endian:
+    "Z80P", version (1 byte), sample rate in Hz (4 bytes), samples (4 bytes), skipped samples (4 bytes),
+    number of halvings (1 byte), then address (2 bytes) and hits (2 bytes) for every address with hits,
+    terminated by address 0 with 0 hits. Sampling is paused during the dump. If a capture took the
+    counters, the dump has no entries.
+ See tools/z80Profile.py for capturing and mapping the hits to the symbols of the assembler listings.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_PROFILER_H
+#define Z80_PROFILER_H
+
+    #include <Arduino.h>
+    #include <Z80Bus.h>
+    #include <Z80CaptureArena.h>
+
+    #define Z80PROFILER_RATE_Hz         10000
+    #define Z80PROFILER_BUCKETS         0x10000
+
+    class Z80Profiler {
+
+        public:
+            enum profilerMode : uint8_t { inactive, armed };
+            profilerMode profilermode;
+
+            Z80Profiler(Z80Bus& bus, Z80CaptureArena& arena);
+            bool start(uint32_t rateHz = Z80PROFILER_RATE_Hz);
+            void stop(void);
+            void clear(void);
+            bool running(void);
+            bool valid(void);
+            void process(void);
+            bool serialUpdate(uint8_t c);
+            uint16_t hits(uint16_t address);
+            uint8_t topAddresses(uint16_t* addresses, uint8_t count);
+
+            volatile uint32_t samples;
+            volatile uint32_t skipped;
+            volatile uint8_t halvings;
+            uint32_t rate;
+
+        private:
+            Z80Bus& bus;
+            Z80CaptureArena& arena;
+            HardwareTimer* timer;
+            uint16_t* histogram;
+            volatile bool paused;
+            bool dumping;
+            uint32_t dumpAddress;
+            uint32_t period;
+            uint32_t dither;
+            uint8_t magicSentenceCounter;
+            static Z80Profiler* instance;
+
+            Z80Profiler(const Z80Profiler&) = delete;
+            Z80Profiler& operator=(const Z80Profiler&) = delete;
+            void sample(void);
+            void halve(void);
+            static void timerHandler(void);
+
+    };
+
+#endif
@@ -0,0 +1,123 @@
+/* -------------------------------------------------------------------------------------------------------
+ SD card block cache
+
+ Cache of 512 byte SD blocks in the STM32 ram, shared by all users of the SD card (CP/M filesystem, the
+ virtual disk of the Z80). It sits on top of Z80SDCard:
+    - frames are found by a hash of the block number (LBA), chained per hash bucket
+    - frames are replaced least recently used first
+    - writes are kept in the frame (dirty) until the frame is replaced or flush() is called
+    - prefetch() loads a range of blocks with one multi block read
+    - sequential reads are detected and read ahead, see below
+
+ The card is accessed when a block is not cached or a dirty frame has to be written. If the user has not
+ accessed the card, the cache does it and keeps the access until release() is called. Hits do not touch
+ the card or the bus.
+
+ Read ahead: up to Z80SDCACHE_STREAMS sequential readers are recognized by the block they read next, no
+ matter who reads. A stream reads ahead when it comes within half a window of the blocks read ahead, the
+ next window is loaded with one multi block read. The window doubles while the blocks read ahead are used,
+ up to Z80SDCACHE_READAHEAD_MAX. It halves when blocks read ahead have been replaced before they were used.
+
+ Writes to the card which do not pass the cache (format, programs) and a new initialization of the card
+ are detected by the counters of Z80SDCard, the clean frames are dropped then. Dirty frames are kept,
+ flush the cache before writing to the card directly.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_SD_CACHE_H
+#define Z80_SD_CACHE_H
+
+    #include <Arduino.h>
+    #include <Z80SDCard.h>
+
+    #define Z80SDCACHE_FRAMES           64          //512 bytes each
+    #define Z80SDCACHE_BUCKETS          64          //power of 2
+    #define Z80SDCACHE_NONE             0xFFFF
+    #define Z80SDCACHE_STREAMS          4           //sequential readers recognized at the same time
+    #define Z80SDCACHE_READAHEAD_MIN    2           //blocks
+    #define Z80SDCACHE_READAHEAD_MAX    8           //blocks, at most half of the frames
+    #define Z80SDCACHE_NO_BLOCK         0xFFFFFFFF
+
+    class Z80SDCache {
+
+        public:
+            struct statistics_t {
+                uint32_t reads;
+                uint32_t writes;
+                uint32_t hits;                  //reads and writes served by a cached frame
+                uint32_t misses;                //blocks read from the card
+                uint32_t writeBacks;            //dirty blocks written to the card
+                uint32_t readAheads;            //blocks read ahead
+                uint32_t readAheadHits;         //blocks read ahead which have been used
+                uint32_t errors;
+            };
+
+            Z80SDCache(Z80SDCard& sdcard);
+            Z80SDCard::sdResult readBlock(uint32_t blockNumber, uint8_t* dst);
+            const uint8_t* getBlock(uint32_t blockNumber, Z80SDCard::sdResult& result);
+            Z80SDCard::sdResult writeBlock(uint32_t blockNumber, const uint8_t* src);
+            Z80SDCard::sdResult prefetch(uint32_t blockNumber, uint32_t count);
+            Z80SDCard::mbrResult readMBR(void);
+            Z80SDCard::sdResult flush(uint32_t maxBlocks = Z80SDCACHE_FRAMES);
+            void invalidate(void);
+            void release(void);
+            void setReadAhead(bool enable);
+            bool contains(uint32_t blockNumber);
+            bool dirty(void);
+            bool streaming(void);
+            uint16_t dirtyBlocks(void);
+
+            statistics_t stats;
+
+        private:
+            struct frame_t {
+                uint32_t block;
+                uint16_t hashNext;              //next frame of the same bucket
+                uint16_t lruPrev;               //towards the most recently used
+                uint16_t lruNext;               //towards the least recently used
+                bool valid;
+                bool dirty;
+                bool readAhead;                 //read ahead and not used yet
+                uint8_t data[SD_BLOCK_SIZE];
+            };
+
+            struct stream_t {
+                uint32_t nextBlock;             //block the stream reads next
+                uint32_t aheadBlock;            //first block not read ahead yet
+                uint32_t lastUse;
+                uint16_t window;                //blocks read ahead at once
+                uint16_t used;                  //blocks read ahead and used since the last read ahead
+            };
+
+            Z80SDCard& sdcard;
+            frame_t frames[Z80SDCACHE_FRAMES];
+            uint16_t buckets[Z80SDCACHE_BUCKETS];
+            uint16_t lruHead, lruTail;
+            uint16_t dirtyFrames;
+            uint32_t sdWriteCount;
+            uint32_t sdInitCount;
+            bool cardOpened;
+            stream_t streams[Z80SDCACHE_STREAMS];
+            uint32_t streamClock;
+            bool readAheadEnabled;
+
+            Z80SDCache(const Z80SDCache&) = delete;
+            Z80SDCache& operator=(const Z80SDCache&) = delete;
+            void synchronize(void);
+            Z80SDCard::sdResult openCard(void);
+            uint16_t find(uint32_t blockNumber);
+            uint16_t load(uint32_t blockNumber, Z80SDCard::sdResult& result);
+            Z80SDCard::sdResult fetch(uint32_t blockNumber, uint32_t count, bool ahead);
+            void resetStreams(void);
+            void readAhead(uint32_t blockNumber);
+            uint16_t replace(Z80SDCard::sdResult& result);
+            void insert(uint16_t index, uint32_t blockNumber);
+            void remove(uint16_t index);
+            void touch(uint16_t index);
+            void setDirty(uint16_t index, bool state);
+            uint16_t bucket(uint32_t blockNumber);
+
+    };
+
+#endif
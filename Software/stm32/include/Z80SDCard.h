@@ -5,7 +5,33 @@
 
  Thi is not a complete SD library, it is very much simplified based on what is required for TeachZ80
  This library is implemented based on John Winans original SD library in the Z80, written in asm
- 
+
+ Multi block transfers stream with CMD18 (read, ended by CMD12) and CMD25 (write, pre-erased with ACMD23,
+ ended by the stop token). Either use readBlocks/writeBlocks on a buffer, or Begin / Next per block / End
+ when the blocks are produced or consumed one by one. End has to be called after an error as well.
+ writeBlocksFill writes a block of one repeated byte into a write stream, generated while it is sent.
+
+ eraseBlocks erases a range with CMD32/CMD33/CMD38. The card erases while it is deselected, busy() tells
+ when it is done. Erased blocks read as 0x00 or 0xFF, depending on the card.
+
+ The card stays initialized between accesses. accessCard(true) only checks the SD detect bit and the card
+ status (CMD13), the full initialization is done for a new or removed card, or if the status fails. This
+ makes an access cost a few hundred microseconds instead of tens of milliseconds.
+
+ In crc mode (setCrcMode) the card checks the crc7 of the commands and the crc16 of the blocks written,
+ the library checks the crc16 of the blocks read (SDCrc.h). A block with a crc error is transferred again.
+ A read stream is restarted behind such a block only while blocks of the count given to readBlocksBegin
+ remain (count 0: no end announced), the last block is read again on its own and ends the stream.
+
+ commandStats holds the telemetry per command number (ACMDs under their own number), latency in DWT cycles:
+    - commands sent on their own: command to response
+    - CMD17 / CMD24: the whole block transfer, including the busy time of the card, the retries included
+    - CMD18 / CMD25: the whole stream from Begin to End, the time between the blocks included. bytes counts
+      the data moved, bytes per second are bytes * SystemCoreClock / totalCycles
+    - CMD12: command to the end of the busy time
+ busyPolls counts the bytes read while waiting for a token, a data response or the end of the busy time,
+ for the last command sent. retries counts the transfers repeated after a crc error.
+
  Author: Christian Luethi
 --------------------------------------------------------------------------------------------------------- */
 
@@ -14,6 +40,7 @@
 
     #define SD_COMMAND_BUFFER_LENGTH          6
     #define SD_BLOCK_SIZE                   512
+    #define SD_COMMANDS                      64
 
     #include <Arduino.h>
     #include <Z80SPI.h>
@@ -22,7 +49,7 @@
     class Z80SDCard  {
 
         public:        
-            enum sdResult: uint8_t { ok, nocard, not_initialized, not_idle, invalid_status, not_ready, invalid_capacity, read_timeout, write_error, write_timeout_1, write_timeout_2, invalid_partition }; 
+            enum sdResult: uint8_t { ok, nocard, not_initialized, not_idle, invalid_status, not_ready, invalid_capacity, read_timeout, write_error, write_timeout_1, write_timeout_2, invalid_partition, read_error, crc_error, erase_error }; 
             
             struct partition_t { 
                 uint32_t block; 
@@ -37,21 +64,76 @@
                 partition_t partitiontable[4]; 
             };
 
-            Z80SDCard(Z80SPI spi);   
+            struct commandStats_t {
+                uint32_t count;
+                uint32_t minCycles;
+                uint32_t maxCycles;
+                uint64_t totalCycles;
+                uint32_t busyPolls;
+                uint32_t retries;
+                uint32_t bytes;
+            };
+
+            Z80SDCard(Z80SPI& spi);   
             sdResult accessCard(bool state);      
+            bool accessed(void);
             sdResult readBlock(uint32_t blockNumber, uint8_t* dst);
-            sdResult writeBlock(uint32_t blockNumber, uint8_t* src);
+            sdResult writeBlock(uint32_t blockNumber, const uint8_t* src);
+            sdResult readBlocks(uint32_t blockNumber, uint32_t count, uint8_t* dst);
+            sdResult writeBlocks(uint32_t blockNumber, uint32_t count, const uint8_t* src);
+            sdResult readBlocksBegin(uint32_t blockNumber, uint32_t count);
+            sdResult readBlocksNext(uint8_t* dst);
+            sdResult readBlocksEnd(void);
+            sdResult writeBlocksBegin(uint32_t blockNumber, uint32_t count);
+            sdResult writeBlocksNext(const uint8_t* src);
+            sdResult writeBlocksFill(uint8_t value);
+            sdResult writeBlocksEnd(void);
+            sdResult eraseBlocks(uint32_t firstBlock, uint32_t lastBlock);
+            bool busy(void);
+            bool streaming(void);
             mbrResult readMBR();
             sdResult formatCard(uint8_t numPartitions, uint32_t partitionStartBlock, uint32_t partitionSize);
             sdResult writeProgram(uint8_t partition, uint8_t programNumber);
+            sdResult writeProgramBegin(uint8_t partition, uint8_t programNumber);
+            sdResult writeProgramNext(void);
+            sdResult writeProgramEnd(void);
+            uint32_t programBlocks(uint8_t programNumber);
+            void parseMBR(mbrResult* mbr, const uint8_t* src);
+            sdResult setCrcMode(bool enable);
+            bool getCrcMode(void);
             uint8_t sdDataBuffer[SD_BLOCK_SIZE];
+            uint32_t writeCount;                //blocks written successfully, lets caches detect foreign writes
+            uint32_t crcErrors;                 //crc errors seen in crc mode, by the card or the library
+            uint32_t initCount;                 //full initializations, lets caches detect a new card
+            commandStats_t commandStats[SD_COMMANDS];
+            void clearStats(void);
 
         private:
             void selectCard(bool select);
             void sdCommand(uint8_t* cmd, uint8_t txlen, uint8_t rxlen, uint8_t maxtries = 15, bool controlssel = true);
-            void parseMBR(mbrResult* mbr, uint8_t* src);
+            void buildCommand(uint8_t* cmd, uint8_t index, uint32_t argument);
+            sdResult readDataBlock(uint8_t* dst);
+            sdResult writeDataBlock(uint8_t token, const uint8_t* src, uint8_t fill = 0);
+            sdResult writeStreamBlock(const uint8_t* src, uint8_t fill);
+            bool waitNotBusy(void);
+            void record(uint8_t index, uint32_t start, uint32_t bytes);
+            bool probeCard(void);
+            sdResult sendCrcOnOff(void);
+            enum streamState : uint8_t { noStream, readStream, writeStream };
+            streamState stream;
+            uint32_t streamBlock;               //next block of the stream
+            uint32_t streamRemaining;           //announced blocks left of the stream, 0 if no end was announced
+            uint32_t streamStart;               //cycles at the begin of the stream, and its bytes, for commandStats
+            uint32_t streamBytes;
+            uint8_t pollCommand;                //last command sent, busy polls are counted for it
+            uint8_t program;                    //program written by writeProgramNext
+            uint32_t programIndex;
+            uint32_t programRemaining;          //bytes of the program not written yet
+            bool crcMode;
             bool sdReady;
-            Z80SPI z80spi;             
+            bool busRequested;
+            bool cardInitialized;
+            Z80SPI& z80spi;             
             uint8_t sdCmdRxBuffer[SD_COMMAND_BUFFER_LENGTH];
     
     };
@@ -15,6 +15,11 @@
  MOSI        \_____X_____X_____X_ ... _X_____X_____/         Host --> Device
         _____ _____ _____ _____ _     _ _____ _____ ______
  MISO        \_____X_____X_____X_ ... _X_____X_____/         Host <-- Device
+
+ All transfers run as one io burst (Z80IO, Z80Bus): IOREQ is held, each clock edge is one write strobe
+ with a precomputed latch value, MISO is read after the rising edge. Bulk transfers (blocks) should use
+ writeBytes, readBytes or transfer, so the burst spans the whole block. stats counts the bytes and the
+ bursts, for the SD telemetry.
  
  Author: Christian Luethi
 --------------------------------------------------------------------------------------------------------- */
@@ -28,15 +33,26 @@
     class Z80SPI  {
               
         public:            
-            Z80SPI(Z80IO io);   
+            Z80SPI(Z80IO& io);   
             void requestBus(bool request);
             void slaveSelect(bool state);
             void writeByte(uint8_t data); 
             uint8_t readByte(void); 
+            void writeBytes(const uint8_t* data, uint32_t length);
+            void readBytes(uint8_t* data, uint32_t length);
+            void fillBytes(uint8_t data, uint32_t length);
+            void transfer(const uint8_t* tx, uint8_t* rx, uint32_t length);
             bool checkSDDetect(void);
+            void setOutputLatch(uint8_t latch);
+
+            struct statistics_t {
+                uint32_t bytes;
+                uint32_t transfers;             //bursts
+            };
+            statistics_t stats;
 
         private:
-            Z80IO z80io;             
+            Z80IO& z80io;             
             uint8_t outputBuffer;    
     };
 
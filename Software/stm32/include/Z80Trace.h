@@ -0,0 +1,69 @@
+/* -------------------------------------------------------------------------------------------------------
+ Compact trace format for captured Z80 bus cycles
+
+ This header does not depend on the Arduino framework or the STM32 registers. The encoder is used by the
+ bus sniffer on the target and by the host tools (native build), the decoder is tools/z80Trace.py.
+
+ Stream format, all multi byte values little endian:
+    Header:  "Z80T", version (1 byte), core clock in Hz (4 bytes), time unit shift (1 byte)
+             timestamps are counted in units of (1 << shift) core clock cycles
+    Record:  byte 0 bits 7-6  cycle type: 0 memory read, 1 memory write, 2 io read, 3 io write
+                    bits 5-4  address mode, see below
+                    bits 3-0  time since the previous record in time units, 15: a varint follows
+             [varint]         time delta - 15, only if bits 3-0 are 15
+             [address]        0, 1 or 2 bytes, depending on the address mode
+             data             the data byte of the cycle
+    Address modes, memory and io addresses are tracked separately:
+             0   memory: previous memory address + 1      io: same address as the previous io cycle
+             1   memory: previous + int8 delta (1 byte)   io: new low byte (1 byte), high byte unchanged
+             2   absolute address (2 bytes)
+             3   marker, the cycle type bits select the marker, followed by a varint value:
+                 0 overflow (value: cycles lost since the previous marker), 1 end of trace (value: total lost)
+                 2 capture refused, ends the trace (value: reason, 1 bus in use, 2 capture memory in use)
+    Varint:  7 bits per byte, least significant group first, bit 7 set if more bytes follow
+
+ A sequential opcode fetch is 2 bytes, a typical io cycle 2-3 bytes.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef Z80_TRACE_H
+#define Z80_TRACE_H
+
+    #include <stdint.h>
+
+    #define Z80TRACE_VERSION            1
+    #define Z80TRACE_TIME_SHIFT         4           //16 core clock cycles per time unit, 74ns at 216MHz
+    #define Z80TRACE_HEADER_LEN         10
+    #define Z80TRACE_MAX_RECORD_LEN     9           //type, 5 bytes varint, 2 bytes address, data
+
+    //one captured bus cycle, type is one of Z80TraceEncoder::cycleType
+    struct z80TraceRecord_t {
+        uint32_t time;                              //core clock cycles
+        uint16_t address;
+        uint8_t  data;
+        uint8_t  type;
+    };
+
+    class Z80TraceEncoder {
+
+        public:
+            enum cycleType : uint8_t { memoryRead, memoryWrite, ioRead, ioWrite };
+            enum markerType : uint8_t { overflow, end, refused };
+            enum refusalReason : uint8_t { busInUse = 1, memoryInUse };
+
+            Z80TraceEncoder(void);
+            uint8_t header(uint8_t* buffer, uint32_t clockHz, uint32_t startTime);
+            uint8_t encode(const z80TraceRecord_t& record, uint8_t* buffer);
+            uint8_t marker(markerType marker, uint32_t value, uint8_t* buffer);
+
+        private:
+            uint32_t lastTime;
+            uint16_t lastMemory;
+            uint16_t lastIo;
+
+            uint8_t varint(uint32_t value, uint8_t* buffer);
+
+    };
+
+#endif
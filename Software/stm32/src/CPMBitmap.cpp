@@ -0,0 +1,152 @@
+#include <CPMBitmap.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ mask of count bits from bit on, within one word
+---------------------------------------------------------------------------------------------------------*/
+static inline uint32_t rangeMask(uint32_t bit, uint32_t count) {
+    return ((count == 32) ? 0xFFFFFFFF : ((1u << count) - 1)) << bit;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor, begin sets the number of blocks of the disk and clears the bitmap
+---------------------------------------------------------------------------------------------------------*/
+CPMBitmap::CPMBitmap() {
+    begin(CPMBITMAP_BLOCKS);
+}
+
+void CPMBitmap::begin(uint32_t numBlocks) {
+    blocks = (numBlocks > CPMBITMAP_BLOCKS) ? CPMBITMAP_BLOCKS : numBlocks;
+    clear();
+}
+
+void CPMBitmap::clear(void) {
+    memset(words, 0, sizeof(words));
+    nextBlock = 0;
+}
+
+uint32_t CPMBitmap::size(void) {
+    return blocks;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Ranges, blocks behind the end of the disk are ignored
+---------------------------------------------------------------------------------------------------------*/
+uint32_t CPMBitmap::clip(uint32_t first, uint32_t count) {
+    if (first >= blocks) return 0;
+    return (count > blocks - first) ? blocks - first : count;
+}
+
+void CPMBitmap::setBlocks(uint32_t first, uint32_t count) {
+    count = clip(first, count);
+    while (count > 0) {
+        uint32_t bit = first & 31;
+        uint32_t bits = (32 - bit < count) ? 32 - bit : count;
+        words[first >> 5] |= rangeMask(bit, bits);
+        first += bits;
+        count -= bits;
+    }
+}
+
+void CPMBitmap::clearBlocks(uint32_t first, uint32_t count) {
+    count = clip(first, count);
+    while (count > 0) {
+        uint32_t bit = first & 31;
+        uint32_t bits = (32 - bit < count) ? 32 - bit : count;
+        words[first >> 5] &= ~rangeMask(bit, bits);
+        first += bits;
+        count -= bits;
+    }
+}
+
+bool CPMBitmap::testBlock(uint32_t block) {
+    if (block >= blocks) return false;
+    return (words[block >> 5] >> (block & 31)) & 1;
+}
+
+bool CPMBitmap::anyUsed(uint32_t first, uint32_t count) {
+    count = clip(first, count);
+    return (count > 0) && (nextUsed(first, first + count) != CPMBITMAP_NONE);
+}
+
+bool CPMBitmap::allUsed(uint32_t first, uint32_t count) {
+    if (clip(first, count) != count) return false;
+    return (count == 0) || (nextFree(first, first + count) == CPMBITMAP_NONE);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Counts, the bits behind the end of the disk are zero
+---------------------------------------------------------------------------------------------------------*/
+uint32_t CPMBitmap::usedBlocks(void) {
+    uint32_t used = 0;
+    for (uint32_t i=0; i<(blocks + 31) / 32; i++) used += __builtin_popcount(words[i]);
+    return used;
+}
+
+uint32_t CPMBitmap::freeBlocks(void) {
+    return blocks - usedBlocks();
+}
+
+uint32_t CPMBitmap::highestUsed(void) {
+    for (uint32_t i=(blocks + 31) / 32; i>0; i--) {
+        if (words[i - 1] != 0) return (i - 1) * 32 + 31 - __builtin_clz(words[i - 1]);
+    }
+    return CPMBITMAP_NONE;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Free runs: firstFit from the start of the disk, nextFit behind the run found last, wrapping to the start.
+ The blocks are not allocated, the caller sets them
+---------------------------------------------------------------------------------------------------------*/
+uint32_t CPMBitmap::firstFit(uint32_t count) {
+    return findRun(0, blocks, count);
+}
+
+uint32_t CPMBitmap::nextFit(uint32_t count) {
+    uint32_t block = findRun(nextBlock, blocks, count);
+    //a run across the wrap point is not used, the disk does not wrap
+    if (block == CPMBITMAP_NONE) block = findRun(0, (nextBlock + count < blocks) ? nextBlock + count : blocks, count);
+    if (block != CPMBITMAP_NONE) nextBlock = (block + count < blocks) ? block + count : 0;
+    return block;
+}
+
+//first run of count free blocks in start..end
+uint32_t CPMBitmap::findRun(uint32_t start, uint32_t end, uint32_t count) {
+    if (count == 0) return CPMBITMAP_NONE;
+    uint32_t block = start;
+    while ((block < end) && (count <= end - block)) {
+        block = nextFree(block, end);
+        if ((block == CPMBITMAP_NONE) || (count > end - block)) return CPMBITMAP_NONE;
+        uint32_t used = nextUsed(block, block + count);
+        if (used == CPMBITMAP_NONE) return block;
+        block = used + 1;
+    }
+    return CPMBITMAP_NONE;
+}
+
+//first free (zero) bit at block or behind, before end
+uint32_t CPMBitmap::nextFree(uint32_t block, uint32_t end) {
+    uint32_t word = block >> 5;
+    uint32_t bits = ~words[word] & (0xFFFFFFFF << (block & 31));
+    while (true) {
+        if (bits != 0) {
+            uint32_t found = (word << 5) + __builtin_ctz(bits);
+            return (found < end) ? found : CPMBITMAP_NONE;
+        }
+        if ((++word << 5) >= end) return CPMBITMAP_NONE;
+        bits = ~words[word];
+    }
+}
+
+//first used (one) bit at block or behind, before end
+uint32_t CPMBitmap::nextUsed(uint32_t block, uint32_t end) {
+    uint32_t word = block >> 5;
+    uint32_t bits = words[word] & (0xFFFFFFFF << (block & 31));
+    while (true) {
+        if (bits != 0) {
+            uint32_t found = (word << 5) + __builtin_ctz(bits);
+            return (found < end) ? found : CPMBITMAP_NONE;
+        }
+        if ((++word << 5) >= end) return CPMBITMAP_NONE;
+        bits = words[word];
+    }
+}
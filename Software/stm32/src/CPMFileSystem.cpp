@@ -3,10 +3,11 @@
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
-CPMFileSystem::CPMFileSystem(diskGeometry geometry, Z80SDCard z80sdcard, Z80Bus z80bus) : sdcard(z80sdcard), bus(z80bus) {
+CPMFileSystem::CPMFileSystem(diskGeometry geometry, Z80SDCard& z80sdcard, Z80SDCache& z80sdcache, Z80Bus& z80bus) : sdcard(z80sdcard), sdcache(z80sdcache), bus(z80bus) {
 	
 	//for now assume all disks have the same geometry
 	diskdef = diskDefs[geometry];
+	clearFiles();
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -16,28 +17,7 @@ bool CPMFileSystem::listFiles(uint8_t diskIndex, bool forceRead) {
 
 	//intialize the the disk
 	if (readDisk(diskIndex, forceRead)) { 
-		Serial.println("");
-		file_t* next = disks[diskIndex].files;
-		if (next == nullptr) Serial.println("No File Fount");
-		else {
-			//print header				
-			Serial.println(" Recs  Bytes  Ext  Acc");
-			while (next != nullptr) {
-				Serial.printf(" %4u  %4uk  %3u  ", next->records, next->blocks*diskdef.blocksize >> 10, next->extends);
-				Serial.print("R/W  ");
-				Serial.write(diskIndex + 'A');
-				Serial.print(": ");
-				for (int j=0; j<FILE_NAME_MAX_LEN; j++) if (next->name[j] != ' ') Serial.write(next->name[j]);
-				Serial.write('.');
-				for (int j=0; j<FILE_TYPE_MAX_LEN; j++) if (next->type[j] != ' ') Serial.write(next->type[j]);
-				Serial.println("");
-				next = next->nextfile;
-			}
-			//print capacity
-			Serial.print(" Bytes Remaining On ");
-			Serial.write(diskIndex + 'A');
-			Serial.printf(": %uk\r\n", (disks[diskIndex].capacity - disks[diskIndex].usedblocks*diskdef.blocksize) >> 10);
-		}
+		printFiles(diskIndex);
 		return true;
 	}
 	Serial.println("ERROR: Cannot read the Disk");
@@ -45,12 +25,347 @@ bool CPMFileSystem::listFiles(uint8_t diskIndex, bool forceRead) {
 }
 
 /*--------------------------------------------------------------------------------------------------------
- Helper function to recursively delete the linked list of files
+ Print the file list of a disk which has been read
+---------------------------------------------------------------------------------------------------------*/
+void CPMFileSystem::printFiles(uint8_t diskIndex) {
+	Serial.println("");
+	uint16_t count = fileCount(diskIndex);
+	if (count == 0) Serial.println("No File Fount");
+	else {
+		//print header				
+		Serial.println(" Recs  Bytes  Ext  Acc");
+		for (uint16_t i=0; i<count; i++) {
+			const file_t* next = &files[i];
+			Serial.printf(" %4u  %4uk  %3u  ", next->records, next->blocks*diskdef.blocksize >> 10, next->extends);
+			Serial.print("R/W  ");
+			Serial.write(diskIndex + 'A');
+			Serial.print(": ");
+			for (int j=0; j<FILE_NAME_MAX_LEN; j++) if (next->name[j] != ' ') Serial.write(next->name[j]);
+			Serial.write('.');
+			for (int j=0; j<FILE_TYPE_MAX_LEN; j++) if (next->type[j] != ' ') Serial.write(next->type[j]);
+			Serial.println("");
+		}
+		//print capacity
+		Serial.print(" Bytes Remaining On ");
+		Serial.write(diskIndex + 'A');
+		Serial.printf(": %uk\r\n", (disks[diskIndex].capacity - disks[diskIndex].usedblocks*diskdef.blocksize) >> 10);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Number of files of a disk, 0 if the file records hold another disk
+---------------------------------------------------------------------------------------------------------*/
+uint16_t CPMFileSystem::fileCount(uint8_t diskIndex) {
+	return (filesDisk == diskIndex) ? filesUsed : 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ File of a disk which has been read, by its name ("NAME.TYP", not case sensitive). nullptr if not fount
+---------------------------------------------------------------------------------------------------------*/
+const CPMFileSystem::file_t* CPMFileSystem::getFile(uint8_t diskIndex, uint8_t user, const char* filename) {
+	uint8_t name[FILE_NAME_MAX_LEN];
+	uint8_t type[FILE_TYPE_MAX_LEN];
+	if ((filesDisk != diskIndex) || !parseFileName(filename, name, type)) return nullptr;
+	uint16_t file = findFile(user, name, type);
+	return (file == FILE_INDEX_EMPTY) ? nullptr : &files[file];
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Read a file in runs of consecutive sd blocks. Begin returns the size of the file in bytes (records * 128),
+ the last sd block holds the rest. Run returns readDone after the last block. The caller holds a bus
+ session and releases the cache at the end
 ---------------------------------------------------------------------------------------------------------*/
-void CPMFileSystem::deleteFileTree(file_t* next) {
-	if (next == nullptr) return;
-	if (next->nextfile != nullptr) deleteFileTree(next->nextfile);	
-	delete next;
+CPMFileSystem::readState CPMFileSystem::readFileBegin(uint8_t diskIndex, uint8_t user, const char* filename, uint32_t& bytes) {
+	bytes = 0;
+	//the Z80 or an image import may have changed the directory since the last read
+	if (!readDisk(diskIndex, true)) return readFailed;
+	const file_t* file = getFile(diskIndex, user, filename);
+	if (file == nullptr) return readFailed;
+
+	readFileDisk = diskIndex;
+	readFilePosition = 0;
+	readFileBlocks = (file->records*diskdef.seclen + TRACK_SIZE - 1) / TRACK_SIZE;
+	bytes = file->records*diskdef.seclen;
+
+	//the directory entries of the file by their entry number, mostly from the cache after readDisk
+	for (uint16_t i=0; i<MAX_DIRECTORY_ENTRIES; i++) readFileEntries[i] = FILE_INDEX_EMPTY;
+	uint32_t directoryBlock = disks[diskIndex].sdoffset + diskdef.boottrk;
+	Z80SDCard::sdResult result = sdcache.prefetch(directoryBlock, disks[diskIndex].directoryTracks);
+	for (uint16_t track = 0; track < disks[diskIndex].directoryTracks; track++) {
+		const directoryExtend_t* extend = nullptr;
+		if (result == sdcard.ok) extend = (const directoryExtend_t*) sdcache.getBlock(directoryBlock + track, result);
+		if (result != sdcard.ok) return readFailed;
+		for (int i=0; i<16; i++) {
+			if ((extend[i].status == 0xE5) || !fileMatch(*file, extend[i].status, extend[i].name, extend[i].type)) continue;
+			uint16_t entrynumber = (32*extend[i].EG + extend[i].EX) / (disks[diskIndex].EXM + 1);
+			if (entrynumber < MAX_DIRECTORY_ENTRIES) readFileEntries[entrynumber] = track*16 + i;
+		}
+	}
+	return (readFileBlocks > 0) ? readBusy : readDone;
+}
+
+CPMFileSystem::readState CPMFileSystem::readFileRun(uint32_t& lba, uint32_t& count, uint32_t maxBlocks) {
+	count = 0;
+	lba = CPMFILE_HOLE;
+	if (readFilePosition >= readFileBlocks) return readDone;
+	uint32_t tracksPerBlock = diskdef.blocksize / TRACK_SIZE;
+	Z80SDCard::sdResult result;
+	uint16_t block = fileAllocation(readFilePosition / tracksPerBlock, result);
+	if (result != sdcard.ok) return readFailed;
+	if (block != 0) lba = disks[readFileDisk].sdoffset + diskdef.boottrk + block*tracksPerBlock + readFilePosition % tracksPerBlock;
+
+	//the run goes on while the next allocation block follows on the card, or the hole goes on
+	while ((count < maxBlocks) && (readFilePosition < readFileBlocks)) {
+		if ((count > 0) && (readFilePosition % tracksPerBlock == 0)) {
+			uint16_t next = fileAllocation(readFilePosition / tracksPerBlock, result);
+			if (result != sdcard.ok) return readFailed;
+			if ((block == 0) ? (next != 0) : (next != block + 1)) break;
+			block = next;
+		}
+		count++;
+		readFilePosition++;
+	}
+	return readBusy;
+}
+
+//allocation block number index of the file, 8 per directory entry. 0 for a hole
+uint16_t CPMFileSystem::fileAllocation(uint32_t index, Z80SDCard::sdResult& result) {
+	result = sdcard.ok;
+	uint16_t slot = (index / 8 < MAX_DIRECTORY_ENTRIES) ? readFileEntries[index / 8] : FILE_INDEX_EMPTY;
+	if (slot == FILE_INDEX_EMPTY) return 0;
+	const directoryExtend_t* extend = (const directoryExtend_t*) sdcache.getBlock(disks[readFileDisk].sdoffset + diskdef.boottrk + slot / 16, result);
+	if (result != sdcard.ok) return 0;
+	uint16_t block = extend[slot % 16].allocation[index % 8];
+	return (block < disks[readFileDisk].alv.size()) ? block : 0;
+}
+
+//name and type in directory format: upper case, filled with spaces
+bool CPMFileSystem::parseFileName(const char* filename, uint8_t* name, uint8_t* type) {
+	memset(name, ' ', FILE_NAME_MAX_LEN);
+	memset(type, ' ', FILE_TYPE_MAX_LEN);
+	uint8_t length = 0;
+	while ((*filename != 0) && (*filename != '.')) {
+		if (length == FILE_NAME_MAX_LEN) return false;
+		name[length++] = toupper(*filename++);
+	}
+	if (length == 0) return false;
+	if (*filename == '.') filename++;
+	length = 0;
+	while (*filename != 0) {
+		if (length == FILE_TYPE_MAX_LEN) return false;
+		type[length++] = toupper(*filename++);
+	}
+	return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Write a file: Begin checks the name and the space and allocates the blocks, Data writes the sd block index
+ of the file (length bytes, the last one holds the rest), End commits the directory or gives the blocks
+ back. An existing file is replaced, unless it is read only. The caller holds a bus session and releases
+ the cache at the end
+---------------------------------------------------------------------------------------------------------*/
+CPMFileSystem::writeState CPMFileSystem::writeFileBegin(uint8_t diskIndex, uint8_t user, const char* filename, uint32_t bytes) {
+	writeFileEnd(false);
+	if ((diskIndex >= MAX_DISKS) || (user > 15)) return writeInvalid;
+	memset(&writeFile, 0, sizeof(writeFile));
+	writeFile.user = user;
+	if (!parseFileName(filename, writeFile.name, writeFile.type)) return writeInvalid;
+	for (int i=0; i<FILE_NAME_MAX_LEN + FILE_TYPE_MAX_LEN; i++) {
+		uint8_t c = (i < FILE_NAME_MAX_LEN) ? writeFile.name[i] : writeFile.type[i - FILE_NAME_MAX_LEN];
+		if ((c < ' ') || (c > '~') || (c == '*') || (c == '?') || (c == '.')) return writeInvalid;
+	}
+
+	//the directory as it is now, the z80 may have changed it since it was read last
+	if (!readDisk(diskIndex, true)) return writeFailed;
+	const file_t* file = getFile(diskIndex, user, filename);
+	if ((file != nullptr) && file->readonly) return writeReadOnly;
+
+	//blocks and entries of the file, an empty file has one entry without blocks
+	writeDisk = diskIndex;
+	writeRecords = (bytes + diskdef.seclen - 1) / diskdef.seclen;
+	uint32_t blocks = (writeRecords*diskdef.seclen + diskdef.blocksize - 1) / diskdef.blocksize;
+	if (blocks > CPMFILE_WRITE_BLOCKS) return writeNoSpace;
+	if (blocks > disks[diskIndex].alv.freeBlocks()) {
+		//the old file is not freed before the commit, it would fit in its place
+		if ((file != nullptr) && (blocks <= disks[diskIndex].alv.freeBlocks() + file->blocks)) return writeNoSpaceReplace;
+		return writeNoSpace;
+	}
+	writeBlocks = blocks;
+	writeEntries = (writeBlocks > 0) ? (writeBlocks + 7) / 8 : 1;
+	if (!scanDirectory()) return writeNoSpace;
+
+	//one run if there is one, else the first free runs of the disk. The old file keeps its blocks
+	CPMBitmap& alv = disks[diskIndex].alv;
+	uint16_t count = 0;
+	while (count < writeBlocks) {
+		uint32_t rest = writeBlocks - count;
+		uint32_t run = rest;
+		uint32_t block = alv.firstFit(rest);
+		if (block == CPMBITMAP_NONE) {
+			block = alv.firstFit(1);
+			run = 1;
+			while ((run < rest) && (block + run < alv.size()) && !alv.testBlock(block + run)) run++;
+		}
+		alv.setBlocks(block, run);
+		for (uint32_t i=0; i<run; i++) writeAllocation[count++] = block + i;
+	}
+	writing = true;
+	return writeDone;
+}
+
+CPMFileSystem::writeState CPMFileSystem::writeFileData(uint32_t index, const uint8_t* data, uint16_t length) {
+	uint32_t tracksPerBlock = diskdef.blocksize / TRACK_SIZE;
+	if (!writing || (index / tracksPerBlock >= writeBlocks) || (length > TRACK_SIZE)) return writeFailed;
+	uint32_t lba = disks[writeDisk].sdoffset + diskdef.boottrk + writeAllocation[index / tracksPerBlock]*tracksPerBlock + index % tracksPerBlock;
+	if (length < TRACK_SIZE) {
+		uint8_t block[TRACK_SIZE];
+		memcpy(block, data, length);
+		memset(block + length, CPMFILE_EOF, TRACK_SIZE - length);
+		return (sdcache.writeBlock(lba, block) == sdcard.ok) ? writeDone : writeFailed;
+	}
+	return (sdcache.writeBlock(lba, data) == sdcard.ok) ? writeDone : writeFailed;
+}
+
+CPMFileSystem::writeState CPMFileSystem::writeFileEnd(bool commit) {
+	if (!writing) return writeFailed;
+	writing = false;
+	writeState state = writeFailed;
+	//the data first, then the directory
+	if (commit && (sdcache.flush() == sdcard.ok) && scanDirectory()) state = writeDirectory();
+	if (state == writeDone) state = (sdcache.flush() == sdcard.ok) ? writeDone : writeFailed;
+	if (state != writeDone) {
+		//the allocation vector is built again with the next read
+		for (uint16_t i=0; i<writeBlocks; i++) disks[writeDisk].alv.clearBlocks(writeAllocation[i]);
+		disks[writeDisk].initialized = false;
+	}
+	else if (!updateFile()) disks[writeDisk].initialized = false;
+	return state;
+}
+
+//the record of the old file is replaced by the one of the new file, the disk needs no new read. The
+//blocks of the old entries have been freed while the directory was written
+bool CPMFileSystem::updateFile(void) {
+	if (!disks[writeDisk].initialized || (filesDisk != writeDisk)) return false;
+	uint16_t file = findFile(writeFile.user, writeFile.name, writeFile.type);
+	if (file != FILE_INDEX_EMPTY) {
+		disks[writeDisk].usedExtends -= files[file].extends;
+		deleteFile(file);
+	}
+	disks[writeDisk].usedblocks = disks[writeDisk].alv.usedBlocks() - disks[writeDisk].directoryBlocks;
+	if (writeEntries == 0) return true;
+	file = insertFile(writeFile.user, writeFile.name, writeFile.type);
+	if (file == FILE_INDEX_EMPTY) return false;
+	files[file].records = writeRecords;
+	files[file].extends = writeEntries;
+	files[file].blocks = writeBlocks;
+	disks[writeDisk].usedExtends += writeEntries;
+	return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Erase a file (ERA): its entries are removed with one write per directory track holding them, its blocks
+ are free again and its record is deleted. writeInvalid if there is no such file
+---------------------------------------------------------------------------------------------------------*/
+CPMFileSystem::writeState CPMFileSystem::eraseFile(uint8_t diskIndex, uint8_t user, const char* filename) {
+	writeFileEnd(false);
+	if ((diskIndex >= MAX_DISKS) || (user > 15)) return writeInvalid;
+	memset(&writeFile, 0, sizeof(writeFile));
+	writeFile.user = user;
+	if (!parseFileName(filename, writeFile.name, writeFile.type)) return writeInvalid;
+	if (!readDisk(diskIndex, true)) return writeFailed;
+	const file_t* file = getFile(diskIndex, user, filename);
+	if (file == nullptr) return writeInvalid;
+	if (file->readonly) return writeReadOnly;
+
+	//a file without entries: the entries of the old file are removed, no new ones written
+	writeDisk = diskIndex;
+	writeRecords = 0;
+	writeBlocks = 0;
+	writeEntries = 0;
+	writeState state = scanDirectory() ? writeDirectory() : writeFailed;
+	if (state == writeDone) state = (sdcache.flush() == sdcard.ok) ? writeDone : writeFailed;
+	if ((state != writeDone) || !updateFile()) disks[diskIndex].initialized = false;
+	return state;
+}
+
+//entries of the old file and free entries per directory track, true if the new entries fit
+bool CPMFileSystem::scanDirectory(void) {
+	uint32_t directoryBlock = disks[writeDisk].sdoffset + diskdef.boottrk;
+	uint16_t available = 0;
+	Z80SDCard::sdResult result = sdcache.prefetch(directoryBlock, disks[writeDisk].directoryTracks);
+	for (uint16_t track = 0; track < disks[writeDisk].directoryTracks; track++) {
+		const directoryExtend_t* extend = nullptr;
+		if (result == sdcard.ok) extend = (const directoryExtend_t*) sdcache.getBlock(directoryBlock + track, result);
+		if (result != sdcard.ok) return false;
+		writeTrackOld[track] = 0;
+		writeTrackFree[track] = 0;
+		for (int i=0; i<16; i++) {
+			if (extend[i].status == 0xE5) writeTrackFree[track]++;
+			else if (fileMatch(writeFile, extend[i].status, extend[i].name, extend[i].type)) writeTrackOld[track]++;
+		}
+		available += writeTrackOld[track] + writeTrackFree[track];
+	}
+	return available >= writeEntries;
+}
+
+//each directory track changed is written once, the tracks of the old file take the new entries first
+CPMFileSystem::writeState CPMFileSystem::writeDirectory(void) {
+	uint8_t trackNew[MAX_DIRECTORY_TRACKS];
+	uint16_t tracks = disks[writeDisk].directoryTracks;
+	uint16_t rest = writeEntries;
+	for (uint16_t track = 0; track < tracks; track++) {
+		trackNew[track] = 0;
+		if (writeTrackOld[track] == 0) continue;
+		trackNew[track] = (writeTrackOld[track] + writeTrackFree[track] < rest) ? writeTrackOld[track] + writeTrackFree[track] : rest;
+		rest -= trackNew[track];
+	}
+	for (uint16_t track = 0; (track < tracks) && (rest > 0); track++) {
+		if (writeTrackOld[track] != 0) continue;
+		trackNew[track] = (writeTrackFree[track] < rest) ? writeTrackFree[track] : rest;
+		rest -= trackNew[track];
+	}
+
+	uint32_t directoryBlock = disks[writeDisk].sdoffset + diskdef.boottrk;
+	uint16_t entry = 0;
+	for (uint16_t track = 0; track < tracks; track++) {
+		if ((writeTrackOld[track] == 0) && (trackNew[track] == 0)) continue;
+		Z80SDCard::sdResult result;
+		const uint8_t* data = sdcache.getBlock(directoryBlock + track, result);
+		if (result != sdcard.ok) return writeFailed;
+		directoryExtend_t extend[16];
+		memcpy(extend, data, sizeof(extend));
+		for (int i=0; i<16; i++) {
+			if ((extend[i].status != 0xE5) && fileMatch(writeFile, extend[i].status, extend[i].name, extend[i].type)) {
+				for (int j=0; j<8; j++) if (extend[i].allocation[j] > 0) disks[writeDisk].alv.clearBlocks(extend[i].allocation[j]);
+				memset(&extend[i], 0xE5, sizeof(directoryExtend_t));
+			}
+			if ((extend[i].status == 0xE5) && (trackNew[track] > 0)) {
+				buildEntry(extend[i], entry++);
+				trackNew[track]--;
+			}
+		}
+		if (sdcache.writeBlock(directoryBlock + track, (const uint8_t*)extend) != sdcard.ok) return writeFailed;
+	}
+	return writeDone;
+}
+
+//entry number entry of the file: the last logical extent used in EX and EG, its records in RC
+void CPMFileSystem::buildEntry(directoryExtend_t& extend, uint16_t entry) {
+	uint8_t EXM = disks[writeDisk].EXM;
+	uint32_t recordsPerEntry = (EXM + 1)*128;
+	uint32_t records = writeRecords - entry*recordsPerEntry;
+	if (records > recordsPerEntry) records = recordsPerEntry;
+	memset(&extend, 0, sizeof(directoryExtend_t));
+	extend.status = writeFile.user;
+	memcpy(extend.name, writeFile.name, FILE_NAME_MAX_LEN);
+	memcpy(extend.type, writeFile.type, FILE_TYPE_MAX_LEN);
+	if (records > 0) {
+		uint32_t extent = entry*(EXM + 1) + (records - 1) / 128;
+		extend.EX = extent & 0x1F;
+		extend.EG = extent >> 5;
+		extend.RC = records - ((records - 1) / 128)*128;
+	}
+	for (int j=0; j<8; j++) if (entry*8 + j < writeBlocks) extend.allocation[j] = writeAllocation[entry*8 + j];
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -61,138 +376,236 @@ void CPMFileSystem::deleteFileTree(file_t* next) {
 ---------------------------------------------------------------------------------------------------------*/
 bool CPMFileSystem::readDisk(uint8_t diskIndex, bool forceRead) {
 
-	if (disks[diskIndex].initialized && !forceRead) return true; //no refresh required
-
-	//initialize the sd card
-	bus.write_controlBit(bus.reset, true);
-	result = sdcard.accessCard(true);
-	if (result == sdcard.ok) {
-		//intiailize some variables
-		disks[diskIndex].initialized = false;
-		disks[diskIndex].files = nullptr;
-		disks[diskIndex].usedblocks = 0;
-		disks[diskIndex].usedExtends = 0;
-		for (int i=0; i<ALLOCATION_VECTOR_LENGTH; i++) disks[diskIndex].alv[i] = 0;
-		deleteFileTree(disks[diskIndex].files);
-		disks[diskIndex].files = nullptr;
-
-		//if mbr is not valid yet, read mbr
-		//if the amount of partitions fount is smaller than the requested partition return with error (sdPartition 0 == pysical sd partition 1)
-		if (mbr.partitions == 0) mbr = sdcard.readMBR();
-		if (mbr.partitions < sdPartition + 1) return false;
-
-		//calculate basic disk / filesystem information
-		//size of directory in tracks (equal sd blocks). CEILING!
-		uint32_t directorySize = diskdef.maxdir*32;
-		uint32_t trackSize = diskdef.seclen*diskdef.sectrk; //must be 512!
-		disks[diskIndex].directoryTracks = (directorySize + trackSize - 1) / trackSize;
-		//available data tracks on the disk
-		disks[diskIndex].capacity = (diskdef.tracks - diskdef.boottrk - disks[diskIndex].directoryTracks)*trackSize;		
-		//disk start sector on sd card, assumes track size == sd block size
-		disks[diskIndex].sdoffset = diskIndex * diskdef.tracks + mbr.partitiontable[sdPartition].block;
-		//disk extend mask and shift calculation
-		//assumes 16bit block addresses / amount of blocks on disk (DSM) > 255
-		//RC can be max 128, and therefore addresses max 16k (128*128) (as designed in cpm 1.4). 
-		//One extend can hold blocksize*8 bytes, divide by max RC (128*128), then - 1 -> The max EX value than can appear in one extend
-		disks[diskIndex].EXM = (( diskdef.blocksize * 8 ) / ( diskdef.seclen * 128 )) - 1;  
-		//trackbuffer casted to array of extends
-		directoryExtend_t* extend = (directoryExtend_t*) trackBuffer;
-		//the current file entry worked on
-		file_t* currentfile = nullptr;
-
-		//read the whole directory space, build the allocation vector and the list of files
-		for (uint16_t directorytrack = 0; directorytrack < disks[diskIndex].directoryTracks; directorytrack++) {
-			//read the next directory track from the sd card
-			uint32_t blockNumber = disks[diskIndex].sdoffset + diskdef.boottrk + directorytrack;
-			result = sdcard.readBlock(blockNumber, trackBuffer);
-			if (result == sdcard.ok) {	
-				//1 track = 1 sd block always holds 16 extends (512 / 32 bytes)
-				for (int i=0; i<16; i++) {			
-					if (extend[i].status != 0xE5) {			
-						disks[diskIndex].usedExtends++;
-
-						//Extend calculation
-						uint16_t entrynumber = (32*extend[i].EG + extend[i].EX) / (disks[diskIndex].EXM + 1);
-						uint16_t recs = (extend[i].EX & disks[diskIndex].EXM) * 128 + extend[i].RC;
-						uint16_t blocks = (recs*diskdef.seclen + diskdef.blocksize - 1) / diskdef.blocksize; 
-						disks[diskIndex].usedblocks += blocks;
-						
-
-						//DEBUG
-						/*
-						Serial.printf("Extend %2u, Entry %u, Recs %3u, Blocks %u - ", disks[diskIndex].usedExtends, entrynumber, recs, blocks);
-						for (int j=0; j<FILE_NAME_MAX_LEN;j++) Serial.write(extend[i].name[j]);
-						Serial.write('.');
-						for (int j=0; j<FILE_TYPE_MAX_LEN;j++) Serial.write(extend[i].type[j]);
-						Serial.print(" -");
-						for (int j=0; j<8; j++) Serial.printf(" %2u", extend[i].allocation[j]);
-						Serial.println("");
-						*/
-
-						//if entry number is zero, create a new file
-						if (entrynumber == 0) {
-
-							file_t* next = new file_t;
-							if (currentfile == nullptr) disks[diskIndex].files = next;
-							else currentfile->nextfile = next;
-							currentfile = next;
-
-							//fill file information
-							currentfile->blocks = blocks;
-							currentfile->records = recs;
-							//copy name and type as is
-							memcpy(currentfile->name, extend[i].name, FILE_NAME_MAX_LEN);
-							memcpy(currentfile->type, extend[i].type, FILE_TYPE_MAX_LEN);
-							//check file flags
-							if (extend[i].type[0] & 0x80) currentfile->readonly = true;
-							if (extend[i].type[1] & 0x80) currentfile->sysfile = true;
-						}
-						//if not, there must be an already created file with the same name, add to this file
-						else {
-							file_t* root = disks[diskIndex].files;
-							while (root != nullptr) {
-								//compare name
-								bool match = true;
-								if (memcmp(root->name, extend[i].name, FILE_NAME_MAX_LEN) != 0) match = false;
-								if (memcmp(root->type, extend[i].type, FILE_TYPE_MAX_LEN) != 0) match = false;
-								if (match) {
-									root->extends++;
-									root->records += recs;
-									root->blocks += blocks;
-									break;
-								}												
-								root = root->nextfile;
-							}
-						}
-
-						//Build allocation vector
-						//max 8 blocks allocated per extend (assumes >255 blocks on disk)								
-						for (int j=0; j<8; j++) {
-							//Serial.printf("%2u - ", extend[i].allocation[j]);
-							if (extend[i].allocation[j] > 0) {
-								uint16_t byte = extend[i].allocation[j] / 8;
-								uint8_t  bit  = extend[i].allocation[j] % 8;
-								disks[diskIndex].alv[byte] |= 1 << bit;				
-							}
-						}
+	if (disks[diskIndex].initialized && (filesDisk == diskIndex) && !forceRead) return true; //no refresh required
+
+	//the sd card is accessed by the cache when a block is not cached, the z80 is kept in reset while the bus is used
+	Z80BusSession session(bus);
+	readState state = readDiskBegin(diskIndex, forceRead);
+	//the directory tracks are consecutive sd blocks, the ones not cached are read in one stream
+	if (state == readBusy) state = readDiskNext(disks[diskIndex].directoryTracks);
+	readDiskEnd();
+	return state == readDone;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ readDisk in steps, for jobs running in slices of the main loop (JobEngine.h)
+ Begin does the disk calculations, Next reads the given number of directory tracks, End ends the access
+ of the cache. The caller holds a bus session from Begin to End, End is called after an error as well
+---------------------------------------------------------------------------------------------------------*/
+CPMFileSystem::readState CPMFileSystem::readDiskBegin(uint8_t diskIndex, bool forceRead) {
+
+	if (disks[diskIndex].initialized && (filesDisk == diskIndex) && !forceRead) return readDone; //no refresh required
+
+	//intiailize some variables, the file records are taken over by this disk
+	readIndex = diskIndex;
+	readTrack = 0;
+	filesDisk = diskIndex;
+	clearFiles();
+	disks[diskIndex].initialized = false;
+	disks[diskIndex].usedblocks = 0;
+	disks[diskIndex].usedExtends = 0;
+
+	//if mbr is not valid yet, read mbr
+	//if the amount of partitions fount is smaller than the requested partition return with error (sdPartition 0 == pysical sd partition 1)
+	if (mbr.partitions == 0) mbr = sdcache.readMBR();
+	if (mbr.partitions < sdPartition + 1) {
+		if (mbr.readresult != sdcard.ok) Serial.print("ERROR: Cannot Access SD Card");
+		return readFailed;
+	}
+
+	//calculate basic disk / filesystem information
+	//size of directory in tracks (equal sd blocks). CEILING!
+	uint32_t directorySize = diskdef.maxdir*32;
+	uint32_t trackSize = diskdef.seclen*diskdef.sectrk; //must be 512!
+	disks[diskIndex].directoryTracks = (directorySize + trackSize - 1) / trackSize;
+	//available data tracks on the disk
+	disks[diskIndex].capacity = (diskdef.tracks - diskdef.boottrk - disks[diskIndex].directoryTracks)*trackSize;		
+	//disk start sector on sd card, assumes track size == sd block size
+	disks[diskIndex].sdoffset = diskIndex * diskdef.tracks + mbr.partitiontable[sdPartition].block;
+	//allocation blocks start behind the boot tracks, the first ones hold the directory
+	disks[diskIndex].directoryBlocks = (disks[diskIndex].directoryTracks*trackSize + diskdef.blocksize - 1) / diskdef.blocksize;
+	disks[diskIndex].alv.begin((diskdef.tracks - diskdef.boottrk)*trackSize / diskdef.blocksize);
+	disks[diskIndex].alv.setBlocks(0, disks[diskIndex].directoryBlocks);
+	//disk extend mask and shift calculation
+	//assumes 16bit block addresses / amount of blocks on disk (DSM) > 255
+	//RC can be max 128, and therefore addresses max 16k (128*128) (as designed in cpm 1.4). 
+	//One extend can hold blocksize*8 bytes, divide by max RC (128*128), then - 1 -> The max EX value than can appear in one extend
+	disks[diskIndex].EXM = (( diskdef.blocksize * 8 ) / ( diskdef.seclen * 128 )) - 1;  
+	return readBusy;
+}
+
+CPMFileSystem::readState CPMFileSystem::readDiskNext(uint16_t tracks) {
+	uint8_t diskIndex = readIndex;
+
+	//read the directory tracks, build the allocation vector and the list of files
+	//the tracks not cached are read in one stream, no read ahead beyond them
+	uint32_t directoryBlock = disks[diskIndex].sdoffset + diskdef.boottrk;
+	if (tracks > disks[diskIndex].directoryTracks - readTrack) tracks = disks[diskIndex].directoryTracks - readTrack;
+	result = sdcache.prefetch(directoryBlock + readTrack, tracks);
+	for (uint16_t directorytrack = readTrack; directorytrack < readTrack + tracks; directorytrack++) {
+		//the next directory track, casted to array of extends
+		const directoryExtend_t* extend = nullptr;
+		if (result == sdcard.ok) extend = (const directoryExtend_t*) sdcache.getBlock(directoryBlock + directorytrack, result);
+		if (result != sdcard.ok) {
+			Serial.print("ERROR: Error while reading directory track from SD card");
+			return readFailed;
+		}
+		//1 track = 1 sd block always holds 16 extends (512 / 32 bytes)
+		for (int i=0; i<16; i++) {			
+			if (fileEntry(extend[i])) {			
+				disks[diskIndex].usedExtends++;
+
+				//Extend calculation
+				uint16_t entrynumber = (32*extend[i].EG + extend[i].EX) / (disks[diskIndex].EXM + 1);
+				uint16_t recs = (extend[i].EX & disks[diskIndex].EXM) * 128 + extend[i].RC;
+				uint16_t blocks = (recs*diskdef.seclen + diskdef.blocksize - 1) / diskdef.blocksize; 
+				
+
+				//DEBUG
+				/*
+				Serial.printf("Extend %2u, Entry %u, Recs %3u, Blocks %u - ", disks[diskIndex].usedExtends, entrynumber, recs, blocks);
+				for (int j=0; j<FILE_NAME_MAX_LEN;j++) Serial.write(extend[i].name[j]);
+				Serial.write('.');
+				for (int j=0; j<FILE_TYPE_MAX_LEN;j++) Serial.write(extend[i].type[j]);
+				Serial.print(" -");
+				for (int j=0; j<8; j++) Serial.printf(" %2u", extend[i].allocation[j]);
+				Serial.println("");
+				*/
+
+				//the file of the extent, a new record for the first extent seen. The first extent (entry number zero)
+				//brings the name with the attributes, the other extents of the file can come before it
+				uint8_t user = extend[i].status;
+				uint16_t file = findFile(user, extend[i].name, extend[i].type);
+				if (file == FILE_INDEX_EMPTY) file = insertFile(user, extend[i].name, extend[i].type);
+				if (file != FILE_INDEX_EMPTY) {
+					file_t* next = &files[file];
+					next->extends++;
+					next->records += recs;
+					next->blocks += blocks;
+					if (entrynumber == 0) {
+						//copy name and type as is, check file flags
+						memcpy(next->name, extend[i].name, FILE_NAME_MAX_LEN);
+						memcpy(next->type, extend[i].type, FILE_TYPE_MAX_LEN);
+						next->readonly = (extend[i].type[0] & 0x80) != 0;
+						next->sysfile = (extend[i].type[1] & 0x80) != 0;
 					}
 				}
-			}
-			else {
-				Serial.print("ERROR: Error while reading directory track from SD card");
-				sdcard.accessCard(false);
-				bus.write_controlBit(bus.reset, false);
-				return false;
+
+				//Build allocation vector
+				//max 8 blocks allocated per extend (assumes >255 blocks on disk)								
+				for (int j=0; j<8; j++) if (extend[i].allocation[j] > 0) disks[diskIndex].alv.setBlocks(extend[i].allocation[j]);
 			}
 		}
-		//done
-		disks[diskIndex].initialized = true;
-		sdcard.accessCard(false);
-		bus.write_controlBit(bus.reset, false);
-		return true;
 	}
-	Serial.print("ERROR: Cannot Access SD Card");
-	sdcard.accessCard(false);
-	bus.write_controlBit(bus.reset, false);
-	return false;
-} 
+	readTrack += tracks;
+	if (readTrack < disks[diskIndex].directoryTracks) return readBusy;
+
+	//done, the blocks used are counted in the allocation vector
+	disks[diskIndex].usedblocks = disks[diskIndex].alv.usedBlocks() - disks[diskIndex].directoryBlocks;
+	disks[diskIndex].initialized = true;
+	return readDone;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Index of the file records: open addressing with linear probing, keyed on user number, name and type
+ without the attribute bits. A deleted slot keeps the probing going behind it. At most half of the slots
+ are used, a probe always ends on an empty slot
+---------------------------------------------------------------------------------------------------------*/
+void CPMFileSystem::clearFiles(void) {
+	filesUsed = 0;
+	memset(fileIndex, 0xFF, sizeof(fileIndex));
+}
+
+//record number of the file, FILE_INDEX_EMPTY if there is none
+uint16_t CPMFileSystem::findFile(uint8_t user, const uint8_t* name, const uint8_t* type) {
+	uint16_t slot = fileHash(user, name, type);
+	while (fileIndex[slot] != FILE_INDEX_EMPTY) {
+		uint16_t file = fileIndex[slot];
+		if ((file != FILE_INDEX_DELETED) && fileMatch(files[file], user, name, type)) return file;
+		slot = (slot + 1) & (FILE_INDEX_SIZE - 1);
+	}
+	return FILE_INDEX_EMPTY;
+}
+
+//new empty record for a file not in the index yet, FILE_INDEX_EMPTY if all records are used
+uint16_t CPMFileSystem::insertFile(uint8_t user, const uint8_t* name, const uint8_t* type) {
+	if (filesUsed >= MAX_DIRECTORY_ENTRIES) return FILE_INDEX_EMPTY;
+	uint16_t slot = fileHash(user, name, type);
+	while ((fileIndex[slot] != FILE_INDEX_EMPTY) && (fileIndex[slot] != FILE_INDEX_DELETED)) slot = (slot + 1) & (FILE_INDEX_SIZE - 1);
+	file_t* file = &files[filesUsed];
+	memset(file, 0, sizeof(file_t));
+	memcpy(file->name, name, FILE_NAME_MAX_LEN);
+	memcpy(file->type, type, FILE_TYPE_MAX_LEN);
+	file->user = user;
+	fileIndex[slot] = filesUsed;
+	return filesUsed++;
+}
+
+//the last record moves into the gap, the records stay contiguous
+void CPMFileSystem::deleteFile(uint16_t file) {
+	if (file >= filesUsed) return;
+	fileIndex[fileSlot(file)] = FILE_INDEX_DELETED;
+	uint16_t last = --filesUsed;
+	if (file == last) return;
+	fileIndex[fileSlot(last)] = file;
+	files[file] = files[last];
+}
+
+uint16_t CPMFileSystem::fileSlot(uint16_t file) {
+	uint16_t slot = fileHash(files[file].user, files[file].name, files[file].type);
+	while (fileIndex[slot] != file) slot = (slot + 1) & (FILE_INDEX_SIZE - 1);
+	return slot;
+}
+
+//fnv-1a
+uint16_t CPMFileSystem::fileHash(uint8_t user, const uint8_t* name, const uint8_t* type) {
+	uint32_t hash = (2166136261u ^ user) * 16777619u;
+	for (int i=0; i<FILE_NAME_MAX_LEN; i++) hash = (hash ^ (name[i] & 0x7F)) * 16777619u;
+	for (int i=0; i<FILE_TYPE_MAX_LEN; i++) hash = (hash ^ (type[i] & 0x7F)) * 16777619u;
+	return (hash ^ (hash >> 16)) & (FILE_INDEX_SIZE - 1);
+}
+
+bool CPMFileSystem::fileMatch(const file_t& file, uint8_t user, const uint8_t* name, const uint8_t* type) {
+	if (file.user != user) return false;
+	for (int i=0; i<FILE_NAME_MAX_LEN; i++) if ((file.name[i] ^ name[i]) & 0x7F) return false;
+	for (int i=0; i<FILE_TYPE_MAX_LEN; i++) if ((file.type[i] ^ type[i]) & 0x7F) return false;
+	return true;
+}
+
+//entry of a file: user 0..15 and a name of printable characters. Empty entries (0xE5), and the zeros or
+//garbage of a disk which has never been formatted, are no files and allocate no blocks
+bool CPMFileSystem::fileEntry(const directoryExtend_t& extend) {
+	if ((extend.status > 15) || ((extend.name[0] & 0x7F) == ' ')) return false;
+	for (int i=0; i<FILE_NAME_MAX_LEN; i++) if (((extend.name[i] & 0x7F) < ' ') || ((extend.name[i] & 0x7F) > '~')) return false;
+	for (int i=0; i<FILE_TYPE_MAX_LEN; i++) if (((extend.type[i] & 0x7F) < ' ') || ((extend.type[i] & 0x7F) > '~')) return false;
+	return true;
+}
+
+void CPMFileSystem::readDiskEnd(void) {
+	sdcache.release();
+}
+
+uint16_t CPMFileSystem::directoryTracks(void) {
+	return (diskdef.maxdir*32 + diskdef.seclen*diskdef.sectrk - 1) / (diskdef.seclen*diskdef.sectrk);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ disk layout in tracks (sd blocks), for the format of the disks
+---------------------------------------------------------------------------------------------------------*/
+uint32_t CPMFileSystem::diskTracks(void) {
+	return diskdef.tracks;
+}
+
+uint16_t CPMFileSystem::bootTracks(void) {
+	return diskdef.boottrk;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ the card has been formatted: the mbr and the directories are read again with the next access
+---------------------------------------------------------------------------------------------------------*/
+void CPMFileSystem::invalidate(void) {
+	mbr.partitions = 0;
+	for (uint8_t i=0; i<MAX_DISKS; i++) disks[i].initialized = false;
+	filesDisk = MAX_DISKS;
+	clearFiles();
+}
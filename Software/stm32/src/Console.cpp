@@ -6,7 +6,11 @@
 #include <Z80Bus.h>
 #include <Z80Flash.h>
 #include <Z80Programs.h>
+#include <Z80SDCache.h>
 #include <CPMFileSystem.h>
+#include <Z80Profiler.h>
+#include <Z80IOTrap.h>
+#include <SDJobs.h>
 
 /* Types and definitions ------------------------------------------------------------------------------- */  
 #define SCREEN_HEIGHT      21
@@ -15,6 +19,8 @@
 #define KEY_CARRIAGE_FEED  13
 #define KEY_BACKSPACE       8
 #define KEY_DEL           127
+#define PROFILER_TOP_LINES   8
+#define TELEMETRY_VERSION    1
 
 /* String Constants ------------------------------------------------------------------------------------ */  
 const char headerDivider[]    =   "**************************************************************";
@@ -42,6 +48,9 @@ const char* menuTitles[]    = { " Welcome ",
                                 " TeachZ80 - Main Menu - SD-Card - Format",
                                 " TeachZ80 - Main Menu - SD-Card - Program",
                                 " TeachZ80 - Main Menu - SD-Card - Program",
+                                " TeachZ80 - Main Menu - SD-Card - Working",
+                                " TeachZ80 - Main Menu - SD-Card - Telemetry",
+                                " TeachZ80 - Main Menu - Profiler",
                               };
 
 /* extern references ----------------------------------------------------------------------------------- */  
@@ -49,15 +58,27 @@ extern Si5153 clock;
 extern FlashLoader flashloader;   
 extern Config config;         
 extern Z80Bus z80bus;  
+extern Z80IO z80io;
+extern Z80SPI z80spi;
 extern Z80Flash z80flash;
 extern Z80SDCard z80sdcard;
+extern Z80SDCache z80sdcache;
 extern CPMFileSystem filesystem;
+extern Z80Profiler profiler;
+extern Z80IOTrap iotrap;
+extern JobEngine jobengine;
+extern SDFormatJob formatjob;
+extern SDProgramJob programjob;
+extern CPMListJob listjob;
 
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
 Console::Console() {
     menustate = welcome;
+    jobResultMenu = main;
+    jobstate = Job::done;
+    jobProgress = 0;
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -97,6 +118,7 @@ void Console::drawMenu() {
             drawLine(" 1: Clock Menu");
             drawLine(" 2: Flash Menu");
             drawLine(" 3: SD-Card Menu");
+            drawLine(" 6: Profiler Menu");
             break;
         }
         case clocks: {
@@ -321,6 +343,9 @@ void Console::drawMenu() {
             drawLine(" 1: Card Information");
             drawLine(" 2: Format Card");
             drawLine(" 3: Save Program");
+            Serial.printf(" 4: CRC Check: %s (%u errors)", z80sdcard.getCrcMode() ? "On" : "Off", z80sdcard.crcErrors);
+            drawLine("");
+            drawLine(" 5: Telemetry");
             drawLine(menuDivider);
             drawLine(" 9: Main Menu");
             break;
@@ -365,19 +390,33 @@ void Console::drawMenu() {
             drawLine("");
             drawLine(" PLEASE CONFIRM SD-CARD FORMATTING!");
             drawLine(" THIS WILL ERASE DATA YOU CURRENTLY HAVE STORED ON YOUR CARD");
+            drawLine(" Partition 1 is erased and gets 16 empty CP/M disks");
             drawLine("");
             drawLine(" Commands");
             drawLine(menuDivider);
             drawLine(" Enter: Confirm");
+            for (int i=0; i<sizeof(z80SDPrograms) / sizeof(z80Program_t); i++) {
+                Serial.printf(" %u    : Confirm, with ", i+1);
+                Serial.print(z80SDPrograms[i].name);
+                drawLine(" in the boot area of disk A");
+            }
             drawLine(" ESC  : Cancel");
             break;
         }
 
         case sdcardsdresult: {
             drawLine("");
-            if (accessresult != z80sdcard.ok) print_sd_AccessError(accessresult);  
+            if (jobstate == Job::cancelled) drawLine(" Formatting cancelled");
+            else if (accessresult != z80sdcard.ok) print_sd_AccessError(accessresult);  
             else if (sdresult != z80sdcard.ok) print_sd_ReadWriteError(sdresult);
-            else drawLine(" SD-Card formatted successfully");
+            else {
+                drawLine(" SD-Card formatted successfully");
+                if (formatjob.disks > 0) {
+                    Serial.printf(" %u empty CP/M disks in partition 1", formatjob.disks);
+                    drawLine("");
+                }
+                if (formatjob.eraseResult != z80sdcard.ok) drawLine(" The card refused the erase, the data tracks still hold the old data");
+            }
             drawLine("");
             drawLine(" Commands");
             drawLine(menuDivider);
@@ -405,7 +444,8 @@ void Console::drawMenu() {
 
         case sdcardprogramresult: {
             drawLine("");
-            if (accessresult != z80sdcard.ok) print_sd_AccessError(accessresult);  
+            if (jobstate == Job::cancelled) drawLine(" Program write cancelled, partition 1 is incomplete");
+            else if (accessresult != z80sdcard.ok) print_sd_AccessError(accessresult);  
             else if (sdresult != z80sdcard.ok) print_sd_ReadWriteError(sdresult);
             else drawLine(" Programm written SUCCESSFUL");
             drawLine("");
@@ -415,6 +455,77 @@ void Console::drawMenu() {
             break;
         }
 
+        case sdcardbusy: {
+            drawLine("");
+            drawLine(" Working, please wait");
+            drawLine("");
+            drawLine(" Commands");
+            drawLine(menuDivider);
+            drawLine(" ESC  : Cancel");
+            break;
+        }
+
+        case sdcardtelemetry: {
+            drawLine("");
+            drawLine(" Cmd     Count  Min cycles Mean cycles  Max cycles    Polls Retries    kB/s");
+            drawLine(menuDividerLong);
+            bool found = false;
+            for (uint8_t i=0; i<SD_COMMANDS; i++) {
+                const Z80SDCard::commandStats_t& command = z80sdcard.commandStats[i];
+                if (command.count == 0) continue;
+                found = true;
+                Serial.printf(" %3u %9u %11u %11u %11u %8u %7u", i, command.count, command.minCycles, (uint32_t)(command.totalCycles / command.count), command.maxCycles, command.busyPolls, command.retries);
+                //throughput of the data transfers
+                if ((command.bytes > 0) && (command.totalCycles > 0)) Serial.printf(" %7u", (uint32_t)((float)command.bytes * SystemCoreClock / command.totalCycles / 1024));
+                drawLine("");
+            }
+            if (!found) drawLine(" No commands");
+            drawLine("");
+            Serial.printf(" Bus: %u io reads, %u io writes, %u bursts, %u spi bytes in %u transfers", z80io.stats.reads, z80io.stats.writes, z80io.stats.bursts, z80spi.stats.bytes, z80spi.stats.transfers);
+            drawLine("");
+            drawLine("");
+            drawLine(" Commands");
+            drawLine(menuDivider);
+            drawLine(" 1: Refresh");
+            drawLine(" 2: Clear");
+            drawLine(" 3: Dump (CSV)");
+            drawLine(menuDivider);
+            drawLine(" 9: Back");
+            break;
+        }
+
+        case profile: {
+            drawLine("");
+            if (profiler.running()) Serial.printf(" Sampling : running, %u Hz", profiler.rate);
+            else Serial.print(" Sampling : stopped");
+            drawLine("");
+            if (profiler.valid()) Serial.printf(" Samples  : %u (%u skipped, %u halvings)", profiler.samples, profiler.skipped, profiler.halvings);
+            else Serial.print(" Samples  : none");
+            drawLine("");
+            drawLine("");
+            drawLine(" Hot Addresses");
+            drawLine(menuDivider);
+            uint16_t addresses[PROFILER_TOP_LINES];
+            uint8_t found = profiler.topAddresses(addresses, PROFILER_TOP_LINES);
+            uint32_t total = 0;
+            for (uint32_t i=0; i<Z80PROFILER_BUCKETS; i++) total += profiler.hits(i);
+            for (uint8_t i=0; i<found; i++) {
+                uint16_t hits = profiler.hits(addresses[i]);
+                Serial.printf(" %04X: %5u hits %3u%%", addresses[i], hits, (uint32_t)hits * 100 / total);
+                drawLine("");
+            }
+            if (found == 0) drawLine(" No samples");
+            drawLine("");
+            drawLine(" Commands");
+            drawLine(menuDivider);
+            drawLine(" 1: Clear and Start");
+            drawLine(" 2: Stop");
+            drawLine(" 3: Refresh");
+            drawLine(menuDivider);
+            drawLine(" 9: Main Menu");
+            break;
+        }
+
         default: {
             break;
         }
@@ -428,6 +539,12 @@ void Console::drawMenu() {
 void Console::serialUpdate(uint8_t c) {
     
     bool refreshScreen = true;
+
+    //while a job runs, only cancel is accepted
+    if (jobengine.busy()) {
+        if (c == KEY_ESC) jobengine.cancel();
+        return;
+    }
     
     switch (menustate) {
         case welcome: {
@@ -439,8 +556,9 @@ void Console::serialUpdate(uint8_t c) {
             if (c == '1') menustate = clocks;
             else if (c == '2') menustate = flash;
             else if (c == '3') menustate = sdcard;
-            else if (c == '4') { filesystem.listFiles(0); refreshScreen = false; }
-            else if (c == '5') { filesystem.listFiles(1); refreshScreen = false; }
+            else if (c == '4') { listjob.setup(0); jobengine.start(listjob); refreshScreen = false; }
+            else if (c == '5') { listjob.setup(1); jobengine.start(listjob); refreshScreen = false; }
+            else if (c == '6') menustate = profile;
             else refreshScreen = false;
             break;
         }
@@ -468,6 +586,7 @@ void Console::serialUpdate(uint8_t c) {
 
                 if (clockChannel == 0) {                    
                     clock.configureChannel(0, currentInput*100, clock.DIV1, clock.PLLA, clock.ENABLE);
+                    iotrap.setClock(currentInput*100);
                     if (c == '+') {
                         config.configdata.clock.z80Clock = currentInput*100;
                         config.write();
@@ -595,15 +714,16 @@ void Console::serialUpdate(uint8_t c) {
 
         case sdcard: {
             if (c == '1') { 
-                z80bus.write_controlBit(z80bus.reset, true);
+                Z80BusSession session(z80bus);
                 accessresult = z80sdcard.accessCard(true);
-                mbrResult = z80sdcard.readMBR(); 
+                mbrResult = z80sdcache.readMBR(); 
                 z80sdcard.accessCard(false);
-                z80bus.write_controlBit(z80bus.reset, false);
                 menustate = sdcardcheck;
             }
             else if (c == '2') menustate = sdcardformatconfirm;
             else if (c == '3') menustate = sdcardselectprogram;
+            else if (c == '4') z80sdcard.setCrcMode(!z80sdcard.getCrcMode());
+            else if (c == '5') menustate = sdcardtelemetry;
             else if (c == '9') menustate = main;
             else refreshScreen = false;
             break;
@@ -617,13 +737,11 @@ void Console::serialUpdate(uint8_t c) {
 
         case sdcardformatconfirm: {
             if (c == KEY_ESC) menustate = sdcard;
-            else if ((c == KEY_LINE_FEED) || (c == KEY_CARRIAGE_FEED)) {
-                z80bus.write_controlBit(z80bus.reset, true);
-                accessresult = z80sdcard.accessCard(true);
-                sdresult = z80sdcard.formatCard(4, 0x800, 0x40000); //4 128MB partitions 
-                z80sdcard.accessCard(false);
-                z80bus.write_controlBit(z80bus.reset, false);
-                menustate = sdcardsdresult;
+            else if ((c == KEY_LINE_FEED) || (c == KEY_CARRIAGE_FEED) || ((c >= '1') && (c < '1' + sizeof(z80SDPrograms) / sizeof(z80Program_t)))) {
+                uint8_t programNumber = ((c >= '1') && (c <= '9')) ? c - '1' : SDFORMAT_NO_PROGRAM;
+                formatjob.setup(4, 0x800, 0x40000); //4 128MB partitions 
+                formatjob.setupDisks(MAX_DISKS, filesystem.diskTracks(), filesystem.bootTracks(), filesystem.directoryTracks(), programNumber);
+                startJob(formatjob, sdcardsdresult);
             }
             else refreshScreen = false;
             break;
@@ -641,12 +759,8 @@ void Console::serialUpdate(uint8_t c) {
                 if ((c >= '1') && (c <= '8')) {
                     uint8_t programNumber = c - '1';
                     if (programNumber <= (sizeof(z80SDPrograms) / sizeof(z80Program_t)) - 1) { 
-                        z80bus.write_controlBit(z80bus.reset, true);
-                        accessresult = z80sdcard.accessCard(true);
-                        sdresult = z80sdcard.writeProgram(0, programNumber);
-                        z80sdcard.accessCard(false);
-                        z80bus.write_controlBit(z80bus.reset, false);
-                        menustate = sdcardprogramresult;
+                        programjob.setup(0, programNumber);
+                        startJob(programjob, sdcardprogramresult);
                     }
                     else refreshScreen = false;
                 }
@@ -661,6 +775,31 @@ void Console::serialUpdate(uint8_t c) {
             break;
         }
 
+        case sdcardbusy: {
+            refreshScreen = false;
+            break;
+        }
+
+        case sdcardtelemetry: {
+            if (c == '2') {
+                z80sdcard.clearStats();
+                memset(&z80io.stats, 0, sizeof(z80io.stats));
+                memset(&z80spi.stats, 0, sizeof(z80spi.stats));
+            }
+            else if (c == '3') { dumpTelemetry(); refreshScreen = false; }
+            else if (c == '9') menustate = sdcard;
+            else if (c != '1') refreshScreen = false;
+            break;
+        }
+
+        case profile: {
+            if (c == '1') { profiler.clear(); profiler.start(); }
+            else if (c == '2') profiler.stop();
+            else if (c == '9') menustate = main;
+            else if (c != '3') refreshScreen = false;
+            break;
+        }
+
     }
 
     if (refreshScreen) {
@@ -692,13 +831,33 @@ void Console::print_sd_ReadWriteError(Z80SDCard::sdResult rwerror) {
         case z80sdcard.not_initialized: drawLine(" ERROR: SD card not initalized"); break;                                      
         case z80sdcard.not_ready: drawLine(" ERROR: Card not ready to read/write data."); break; 
         case z80sdcard.read_timeout: drawLine(" ERROR: Read timeout occured"); break; 
+        case z80sdcard.read_error: drawLine(" ERROR: Read error signalled by card"); break;
+        case z80sdcard.crc_error: drawLine(" ERROR: CRC error, repeated transfers failed"); break;
         case z80sdcard.write_timeout_1: drawLine(" ERROR: Write timeout occured"); break; 
         case z80sdcard.write_timeout_2: drawLine(" ERROR: Timeout while waiting complete message occured"); break; 
         case z80sdcard.write_error: drawLine(" ERROR: Write error signalled by card "); break; 
+        case z80sdcard.erase_error: drawLine(" ERROR: Erase timeout occured"); break; 
         default: drawLineFormat(" ERROR: Unknown Error while reading/writing the card: Code 0x%02X", accessresult); break;
     }
 }
 
+/*--------------------------------------------------------------------------------------------------------
+ SD telemetry for scripts: a header with the version and the core clock, one csv line per command used,
+ then the bus counters. Latency in DWT cycles, throughput is bytes * clock / (mean * count)
+---------------------------------------------------------------------------------------------------------*/
+void Console::dumpTelemetry() {
+    Serial.printf("#sdstats %u %u\r\n", TELEMETRY_VERSION, SystemCoreClock);
+    Serial.print("cmd,count,min,mean,max,polls,retries,bytes\r\n");
+    for (uint8_t i=0; i<SD_COMMANDS; i++) {
+        const Z80SDCard::commandStats_t& command = z80sdcard.commandStats[i];
+        if (command.count == 0) continue;
+        Serial.printf("%u,%u,%u,%u,%u,%u,%u,%u\r\n", i, command.count, command.minCycles, (uint32_t)(command.totalCycles / command.count), command.maxCycles, command.busyPolls, command.retries, command.bytes);
+    }
+    Serial.printf("io,%u,%u,%u\r\n", z80io.stats.reads, z80io.stats.writes, z80io.stats.bursts);
+    Serial.printf("spi,%u,%u\r\n", z80spi.stats.bytes, z80spi.stats.transfers);
+    Serial.print("#end\r\n");
+}
+
 /*--------------------------------------------------------------------------------------------------------
  string helper functions
 ---------------------------------------------------------------------------------------------------------*/
@@ -751,7 +910,39 @@ void Console::clearScreen(void) {
 
 /*--------------------------------------------------------------------------------------------------------
  process, run in main loop 
+ shows the progress of a job started by the console, and its result when it has ended
 ---------------------------------------------------------------------------------------------------------*/
 void Console::process(void) {
-        
+    if (menustate != sdcardbusy) return;
+    if (jobengine.busy()) {
+        uint8_t progress = jobengine.progress();
+        if (progress != jobProgress) Serial.printf("\r Progress: %3u%%", progress);
+        jobProgress = progress;
+        return;
+    }
+
+    jobstate = jobengine.state;
+    if (jobResultMenu == sdcardsdresult) {
+        accessresult = formatjob.accessResult;
+        sdresult = formatjob.result;
+        filesystem.invalidate();
+    }
+    else {
+        accessresult = programjob.accessResult;
+        sdresult = programjob.result;
+    }
+    menustate = jobResultMenu;
+    clearScreen();        
+    drawMenu();
+    fillScreen();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ starts a job, the busy page is shown until it has ended
+---------------------------------------------------------------------------------------------------------*/
+void Console::startJob(Job& job, menuState resultMenu) {
+    if (!jobengine.start(job)) return;
+    jobResultMenu = resultMenu;
+    jobProgress = 0xFF;
+    menustate = sdcardbusy;
 }
\ No newline at end of file
@@ -1,5 +1,5 @@
 #include <FlashLoader.h>
-#include <z80Programs.h>
+#include <Z80Programs.h>
 
 /* Types and definitions -------------------------------------------------------------------------------- */  
 // Timeout for automatic aborting flash mode
@@ -21,7 +21,7 @@ const uint8_t flashloader_magicSentence[] = "helloTeachZ80FlashLoader";
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
-FlashLoader::FlashLoader(Z80Flash flash) : z80flash(flash) {
+FlashLoader::FlashLoader(Z80Flash& flash) : z80flash(flash) {
     loadermode = inactive;
     magicSentenceCounter = 0;
 }
@@ -91,7 +91,7 @@ bool FlashLoader::serialUpdate(uint8_t c) {
 
                 bool writeOK = true;                         
                 //write data to flash
-                for (int i=0; i<rxHex.payloadLength; i++) z80flash.writeByte(rxHex.address + i, rxHex.payload[i]);                    
+                z80flash.writeBytes(rxHex.address, rxHex.payload, rxHex.payloadLength);
                 //verify data
                 for (int i=0; i<rxHex.payloadLength; i++) if(z80flash.readByte(rxHex.address + i) != rxHex.payload[i]) writeOK = false;
 
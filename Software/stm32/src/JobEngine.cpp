@@ -0,0 +1,88 @@
+#include <JobEngine.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+JobEngine::JobEngine(Z80Bus& bus) : z80bus(bus) {
+    state = Job::done;
+    jobs = 0;
+    slices = 0;
+    maxSlice_us = 0;
+    job = nullptr;
+    begun = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Starts a job, it begins with the next call of process(). False if a job is running already
+---------------------------------------------------------------------------------------------------------*/
+bool JobEngine::start(Job& newJob) {
+    if (job != nullptr) return false;
+    job = &newJob;
+    job->stepsDone = 0;
+    job->stepsTotal = 0;
+    begun = false;
+    state = Job::running;
+    jobs++;
+    slices = 0;
+    maxSlice_us = 0;
+
+    //bus and reset are held until the job ends, the z80 does not run between the slices
+    z80bus.hold_reset();
+    z80bus.request_bus();
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ process, run in main loop. One slice of the current job
+---------------------------------------------------------------------------------------------------------*/
+void JobEngine::process(void) {
+    if (job == nullptr) return;
+    uint32_t start = micros();
+    if (!begun) {
+        begun = true;
+        state = job->begin();
+    }
+    else {
+        do {
+            state = job->step();
+        } while ((state == Job::running) && (micros() - start < JOB_SLICE_us));
+    }
+    uint32_t slice = micros() - start;
+    if (slice > maxSlice_us) maxSlice_us = slice;
+    slices++;
+    if (state == Job::waiting) state = Job::running;
+    if (state != Job::running) finish();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Cancels the current job, it ends immediately
+---------------------------------------------------------------------------------------------------------*/
+void JobEngine::cancel(void) {
+    if (job == nullptr) return;
+    state = Job::cancelled;
+    finish();
+}
+
+bool JobEngine::busy(void) {
+    return job != nullptr;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Progress of the current job in percent, 0 as long as the steps are not known
+---------------------------------------------------------------------------------------------------------*/
+uint8_t JobEngine::progress(void) {
+    if (job == nullptr) return (state == Job::done) ? 100 : 0;
+    if (job->stepsTotal == 0) return 0;
+    if (job->stepsDone >= job->stepsTotal) return 100;
+    return job->stepsDone * 100 / job->stepsTotal;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ ends the job and gives the bus back
+---------------------------------------------------------------------------------------------------------*/
+void JobEngine::finish(void) {
+    if (begun) job->end(state);
+    job = nullptr;
+    z80bus.release_bus();
+    z80bus.release_reset();
+}
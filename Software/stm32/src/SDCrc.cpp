@@ -0,0 +1,27 @@
+#include <SDCrc.h>
+
+constexpr sdCrcTables_t sdCrcTables;
+
+/*--------------------------------------------------------------------------------------------------------
+ crc7 of a command (usually 5 bytes), returned with the end bit set, ready to be sent
+---------------------------------------------------------------------------------------------------------*/
+uint8_t sdCrc7(const uint8_t* data, uint32_t length) {
+    uint8_t crc = 0;
+    for (uint32_t i=0; i<length; i++) crc = sdCrcTables.crc7[crc ^ data[i]];
+    return crc | 0x01;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ crc16, slice by 4, the remaining bytes one by one
+---------------------------------------------------------------------------------------------------------*/
+uint16_t sdCrc16(const uint8_t* data, uint32_t length, uint16_t crc) {
+    const uint16_t (*t)[256] = sdCrcTables.crc16;
+    while (length >= 4) {
+        crc ^= (data[0] << 8) | data[1];
+        crc = t[3][crc >> 8] ^ t[2][crc & 0xFF] ^ t[1][data[2]] ^ t[0][data[3]];
+        data += 4;
+        length -= 4;
+    }
+    while (length--) crc = (crc << 8) ^ t[0][(crc >> 8) ^ *data++];
+    return crc;
+}
@@ -0,0 +1,223 @@
+#include <SDJobs.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ Format the card: write back the cache, then the new MBR. Then the disks, if set up
+---------------------------------------------------------------------------------------------------------*/
+SDFormatJob::SDFormatJob(Z80SDCard& sdcard, Z80SDCache& sdcache) : sdcard(sdcard), sdcache(sdcache) {
+    accessResult = Z80SDCard::ok;
+    result = Z80SDCard::ok;
+    eraseResult = Z80SDCard::ok;
+    disks = 0;
+    partitions = 0;
+    startBlock = 0;
+    size = 0;
+    diskSize = 0;
+    bootSize = 0;
+    directorySize = 0;
+    program = SDFORMAT_NO_PROGRAM;
+    phase = flushing;
+    disk = 0;
+    blocksLeft = 0;
+    streaming = false;
+    eraseIssued = false;
+    eraseStart = 0;
+}
+
+//the mbr only, setupDisks adds the disks
+void SDFormatJob::setup(uint8_t numPartitions, uint32_t partitionStartBlock, uint32_t partitionSize) {
+    partitions = numPartitions;
+    startBlock = partitionStartBlock;
+    size = partitionSize;
+    disks = 0;
+    program = SDFORMAT_NO_PROGRAM;
+}
+
+//disks of the first partition, as many as fit. The program is written to the boot area of the first disk
+void SDFormatJob::setupDisks(uint8_t numDisks, uint32_t diskBlocks, uint16_t bootBlocks, uint16_t directoryBlocks, uint8_t programNumber) {
+    disks = numDisks;
+    if ((diskBlocks == 0) || (size / diskBlocks < disks)) disks = (diskBlocks > 0) ? size / diskBlocks : 0;
+    diskSize = diskBlocks;
+    bootSize = bootBlocks;
+    directorySize = directoryBlocks;
+    program = programNumber;
+}
+
+Job::jobState SDFormatJob::begin(void) {
+    result = Z80SDCard::ok;
+    eraseResult = Z80SDCard::ok;
+    phase = flushing;
+    disk = 0;
+    blocksLeft = 0;
+    streaming = false;
+    eraseIssued = false;
+    accessResult = sdcard.accessCard(true);
+    if (accessResult != Z80SDCard::ok) return failed;
+    stepsTotal = sdcache.dirtyBlocks() + 1;
+    if (disks > 0) stepsTotal += 1 + disks * directorySize;
+    if (program != SDFORMAT_NO_PROGRAM) stepsTotal += sdcard.programBlocks(program);
+    return running;
+}
+
+Job::jobState SDFormatJob::step(void) {
+    //written blocks of the cache first, the format is written directly to the card
+    if (phase == flushing) {
+        stepsDone++;
+        if (sdcache.dirty()) result = sdcache.flush(1);
+        else {
+            result = sdcard.formatCard(partitions, startBlock, size);
+            phase = (disks > 0) ? erasing : booting;
+        }
+        return (result == Z80SDCard::ok) ? running : failed;
+    }
+
+    //all disks in one erase, the card is polled until it is done
+    if (phase == erasing) {
+        if (!eraseIssued) {
+            eraseIssued = true;
+            eraseStart = millis();
+            eraseResult = sdcard.eraseBlocks(startBlock, startBlock + disks * diskSize - 1);
+            if (eraseResult == Z80SDCard::ok) return waiting;
+        }
+        else if (sdcard.busy()) {
+            if (millis() - eraseStart < SDFORMAT_ERASE_TIMEOUT_ms) return waiting;
+            result = Z80SDCard::erase_error;
+            return failed;
+        }
+        eraseIssued = false;
+        stepsDone++;
+        phase = directories;
+        return running;
+    }
+
+    //empty directory of each disk, one stream per disk
+    if (phase == directories) {
+        if (!streaming) {
+            result = sdcard.writeBlocksBegin(startBlock + disk * diskSize + bootSize, directorySize);
+            if (result != Z80SDCard::ok) return failed;
+            streaming = true;
+            blocksLeft = directorySize;
+        }
+        stepsDone++;
+        result = sdcard.writeBlocksFill(0xE5);
+        if (result != Z80SDCard::ok) return failed;
+        if (--blocksLeft > 0) return running;
+        streaming = false;
+        result = sdcard.writeBlocksEnd();
+        if (result != Z80SDCard::ok) return failed;
+        if (++disk == disks) phase = booting;
+        return running;
+    }
+
+    //program in the boot area of the first disk, the start of the first partition
+    if (program == SDFORMAT_NO_PROGRAM) return done;
+    if (!streaming) {
+        result = sdcard.writeProgramBegin(0, program);
+        if (result != Z80SDCard::ok) return failed;
+        streaming = true;
+        blocksLeft = sdcard.programBlocks(program);
+    }
+    stepsDone++;
+    result = sdcard.writeProgramNext();
+    if (result != Z80SDCard::ok) return failed;
+    if (--blocksLeft > 0) return running;
+    streaming = false;
+    result = sdcard.writeProgramEnd();
+    return (result == Z80SDCard::ok) ? done : failed;
+}
+
+void SDFormatJob::end(jobState state) {
+    (void)state;
+    //failed or cancelled while writing, the stream is stopped
+    if (streaming && (phase == booting)) sdcard.writeProgramEnd();
+    else if (streaming) sdcard.writeBlocksEnd();
+    streaming = false;
+    sdcard.accessCard(false);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Write a program to a partition: write back the cache, then the program in one multi block write
+---------------------------------------------------------------------------------------------------------*/
+SDProgramJob::SDProgramJob(Z80SDCard& sdcard, Z80SDCache& sdcache) : sdcard(sdcard), sdcache(sdcache) {
+    accessResult = Z80SDCard::ok;
+    result = Z80SDCard::ok;
+    partition = 0;
+    program = 0;
+    phase = flushing;
+    blocksLeft = 0;
+}
+
+void SDProgramJob::setup(uint8_t partitionNumber, uint8_t programNumber) {
+    partition = partitionNumber;
+    program = programNumber;
+}
+
+Job::jobState SDProgramJob::begin(void) {
+    result = Z80SDCard::ok;
+    phase = flushing;
+    accessResult = sdcard.accessCard(true);
+    if (accessResult != Z80SDCard::ok) return failed;
+    blocksLeft = sdcard.programBlocks(program);
+    stepsTotal = sdcache.dirtyBlocks() + 1 + blocksLeft;
+    return running;
+}
+
+Job::jobState SDProgramJob::step(void) {
+    stepsDone++;
+    //written blocks of the cache first, the program is written directly to the card
+    if (phase == flushing) {
+        if (sdcache.dirty()) result = sdcache.flush(1);
+        else {
+            //reads the mbr and opens the write stream
+            phase = writing;
+            result = sdcard.writeProgramBegin(partition, program);
+        }
+        return (result == Z80SDCard::ok) ? running : failed;
+    }
+    result = sdcard.writeProgramNext();
+    if (result != Z80SDCard::ok) return failed;
+    if (--blocksLeft > 0) return running;
+    phase = written;
+    result = sdcard.writeProgramEnd();
+    return (result == Z80SDCard::ok) ? done : failed;
+}
+
+void SDProgramJob::end(jobState state) {
+    (void)state;
+    //failed or cancelled while writing, the stream is stopped
+    if (phase == writing) sdcard.writeProgramEnd();
+    sdcard.accessCard(false);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Read the directory of a CP/M disk and print the files
+---------------------------------------------------------------------------------------------------------*/
+CPMListJob::CPMListJob(CPMFileSystem& filesystem) : filesystem(filesystem) {
+    disk = 0;
+    force = false;
+}
+
+void CPMListJob::setup(uint8_t diskIndex, bool forceRead) {
+    disk = diskIndex;
+    force = forceRead;
+}
+
+Job::jobState CPMListJob::begin(void) {
+    stepsTotal = filesystem.directoryTracks();
+    CPMFileSystem::readState state = filesystem.readDiskBegin(disk, force);
+    if (state == CPMFileSystem::readDone) return done;
+    return (state == CPMFileSystem::readBusy) ? running : failed;
+}
+
+Job::jobState CPMListJob::step(void) {
+    stepsDone++;
+    CPMFileSystem::readState state = filesystem.readDiskNext(1);
+    if (state == CPMFileSystem::readDone) return done;
+    return (state == CPMFileSystem::readBusy) ? running : failed;
+}
+
+void CPMListJob::end(jobState state) {
+    filesystem.readDiskEnd();
+    if (state == done) filesystem.printFiles(disk);
+    else if (state == cancelled) Serial.println("Cancelled");
+    else Serial.println("ERROR: Cannot read the Disk");
+}
@@ -0,0 +1,448 @@
+#include <SDTransfer.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+const uint8_t sdtransfer_magicSentence[] = "helloTeachZ80SDTransfer";
+
+struct crc32Table_t {
+    uint32_t table[256];
+
+    constexpr crc32Table_t() : table() {
+        for (uint32_t i=0; i<256; i++) {
+            uint32_t c = i;
+            for (int j=0; j<8; j++) c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+            table[i] = c;
+        }
+    }
+};
+
+constexpr crc32Table_t crc32Table;
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+SDTransfer::SDTransfer(Z80SDCache& sdcache, CPMFileSystem& filesystem, JobEngine& jobengine) : sdcache(sdcache), filesystem(filesystem), jobengine(jobengine) {
+    transfermode = inactive;
+    memset(&stats, 0, sizeof(stats));
+    magicSentenceCounter = 0;
+    commandLength = 0;
+    importMode = false;
+    fileMode = false;
+    deleteMode = false;
+    memset(fileName, 0, sizeof(fileName));
+    fileBytes = 0;
+    runBlock = 0;
+    runBlocks = 0;
+    firstBlock = 0;
+    endBlock = 0;
+    nextBlock = 0;
+    fillValue = 0;
+    fillBlocks = 0;
+    finishing = false;
+    acknowledged = false;
+    status = statusOk;
+    lastPacket = 0;
+    txLength = 0;
+    txPosition = 0;
+    rxLength = 0;
+    rxReady = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ crc32 as zlib (reflected, polynom 0xEDB88320)
+---------------------------------------------------------------------------------------------------------*/
+uint32_t SDTransfer::crc32(const uint8_t* data, uint32_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) crc = (crc >> 8) ^ crc32Table.table[(crc ^ *data++) & 0xFF];
+    return ~crc;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ reception of new serial characters, returns true if the character was used by the transfer
+---------------------------------------------------------------------------------------------------------*/
+bool SDTransfer::serialUpdate(uint8_t c) {
+
+    //process the magic sentence, the character is still processed by others
+    if (transfermode == inactive) {
+        if (c == sdtransfer_magicSentence[magicSentenceCounter]) {
+            magicSentenceCounter++;
+            if (magicSentenceCounter == sizeof(sdtransfer_magicSentence) - 1) { transfermode = armed; magicSentenceCounter = 0; }
+        }
+        else magicSentenceCounter = 0;
+        return false;
+    }
+
+    //direction after the magic sentence
+    if (transfermode == armed) {
+        if ((c != 'E') && (c != 'I') && (c != 'R') && (c != 'W') && (c != 'D')) { transfermode = inactive; return false; }
+        importMode = (c == 'I') || (c == 'W');
+        fileMode = (c == 'R') || (c == 'W') || (c == 'D');
+        deleteMode = (c == 'D');
+        commandLength = 0;
+        transfermode = command;
+        return true;
+    }
+
+    //first block and number of blocks, or disk, user and name (and size) of the file. Then the job starts
+    if (transfermode == command) {
+        commandBytes[commandLength++] = c;
+        uint8_t length = fileMode ? (importMode ? SDTRANSFER_WRITE_COMMAND : SDTRANSFER_FILE_COMMAND) : SDTRANSFER_COMMAND_LENGTH;
+        if (commandLength < length) return true;
+        if (fileMode) {
+            firstBlock = 0;
+            memcpy(fileName, &commandBytes[2], sizeof(fileName) - 1);
+            fileName[sizeof(fileName) - 1] = 0;
+            fileBytes = 0;
+            if (importMode) for (uint8_t i=0; i<4; i++) fileBytes |= (uint32_t)commandBytes[SDTRANSFER_FILE_COMMAND + i] << (8*i);
+        }
+        else {
+            uint32_t values[2] = { 0, 0 };
+            for (uint8_t i=0; i<8; i++) values[i/4] |= (uint32_t)commandBytes[i] << (8*(i%4));
+            firstBlock = values[0];
+            endBlock = values[0] + values[1];
+        }
+        transfermode = importMode ? importing : exporting;
+        if (!jobengine.start(*this)) {
+            transfermode = inactive;
+            uint8_t result = statusBusy;
+            sendPacket(ackPacket, firstBlock, &result, 1);
+            Serial.write(txBuffer, txLength);
+            txLength = 0;
+        }
+        return true;
+    }
+
+    //any character cancels an export
+    if (transfermode == exporting) {
+        status = statusCancelled;
+        jobengine.cancel();
+        transfermode = inactive;
+        return true;
+    }
+
+    //import: collects one packet, the host waits for the ack before it sends the next
+    if (rxReady) return true;
+    if ((rxLength == 0) && (c != 'S')) return true;
+    if ((rxLength == 1) && (c != 'D')) { rxLength = (c == 'S') ? 1 : 0; return true; }
+    rxBuffer[rxLength++] = c;
+    if (rxLength >= SDTRANSFER_HEADER) {
+        uint16_t length = rxBuffer[7] | (rxBuffer[8] << 8);
+        if (length > SD_BLOCK_SIZE) rxLength = 0;
+        else if (rxLength == SDTRANSFER_HEADER + length + 4) rxReady = true;
+    }
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Job: the ack of the first block tells the host the transfer has started
+---------------------------------------------------------------------------------------------------------*/
+Job::jobState SDTransfer::begin(void) {
+    nextBlock = firstBlock;
+    stepsTotal = endBlock - firstBlock;
+    fillBlocks = 0;
+    finishing = false;
+    acknowledged = false;
+    status = statusOk;
+    txLength = 0;
+    txPosition = 0;
+    rxLength = 0;
+    rxReady = false;
+    lastPacket = millis();
+    if (fileMode && importMode) {
+        //the blocks are allocated, the file is written to them
+        CPMFileSystem::writeState state = CPMFileSystem::writeInvalid;
+        if (commandBytes[0] < MAX_DISKS) state = filesystem.writeFileBegin(commandBytes[0], commandBytes[1], fileName, fileBytes);
+        status = writeStatus(state);
+        if (status != statusOk) return failed;
+        endBlock = (fileBytes + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+        stepsTotal = endBlock;
+        acknowledge(statusOk);
+        return running;
+    }
+    if (deleteMode) {
+        //the file is erased in this step, the ack tells the result
+        CPMFileSystem::writeState state = CPMFileSystem::writeInvalid;
+        if (commandBytes[0] < MAX_DISKS) state = filesystem.eraseFile(commandBytes[0], commandBytes[1], fileName);
+        uint8_t result = writeStatus(state);
+        sendPacket(ackPacket, 0, &result, 1);
+        if (result != statusOk) { status = (transferStatus)result; return failed; }
+        stepsTotal = 0;
+        return running;
+    }
+    if (fileMode) {
+        //the ack holds the size of the file
+        runBlocks = 0;
+        uint8_t result = statusOk;
+        if (commandBytes[0] >= MAX_DISKS) result = statusNoFile;
+        else if (filesystem.readFileBegin(commandBytes[0], commandBytes[1], fileName, fileBytes) == CPMFileSystem::readFailed) result = statusNoFile;
+        sendPacket(ackPacket, (result == statusOk) ? fileBytes : 0, &result, 1);
+        if (result != statusOk) { status = (transferStatus)result; return failed; }
+        endBlock = (fileBytes + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+        stepsTotal = endBlock;
+        return running;
+    }
+    acknowledge(statusOk);
+    return running;
+}
+
+Job::jobState SDTransfer::step(void) {
+    if (!sendPending()) return waiting;
+    if (deleteMode) return done;
+    if (importMode) return importStep();
+    return fileMode ? fileStep() : exportStep();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Job end: the cache gives the card free. A failed or cancelled transfer ends with a last packet, a
+ partly sent packet is completed first to keep the host in sync
+---------------------------------------------------------------------------------------------------------*/
+void SDTransfer::end(jobState state) {
+    //a file not committed gives its blocks back, the directory is not changed
+    if (fileMode && importMode) filesystem.writeFileEnd(false);
+    //an image import may have replaced directories and the partition table, also in part
+    if (!fileMode && importMode) filesystem.invalidate();
+    sdcache.release();
+    if (state != done) {
+        if (status == statusOk) status = statusCancelled;
+        if (txPosition < txLength) Serial.write(txBuffer + txPosition, txLength - txPosition);
+        uint8_t result = status;
+        if (importMode) sendPacket(ackPacket, nextBlock, &result, 1);
+        else sendPacket(endPacket, nextBlock, &result, 1);
+        Serial.write(txBuffer, txLength);
+    }
+    txLength = 0;
+    txPosition = 0;
+    transfermode = inactive;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Status sent to the host for the result of a file write or erase
+---------------------------------------------------------------------------------------------------------*/
+SDTransfer::transferStatus SDTransfer::writeStatus(CPMFileSystem::writeState state) {
+    if (state == CPMFileSystem::writeDone) return statusOk;
+    if (state == CPMFileSystem::writeInvalid) return statusNoFile;
+    if (state == CPMFileSystem::writeNoSpace) return statusNoSpace;
+    if (state == CPMFileSystem::writeNoSpaceReplace) return statusNoSpaceReplace;
+    if (state == CPMFileSystem::writeReadOnly) return statusReadOnly;
+    return statusCardError;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Export, one block per step. Runs of fill blocks are collected, a block which ends a run is read again
+ in the next step, from the cache
+---------------------------------------------------------------------------------------------------------*/
+Job::jobState SDTransfer::exportStep(void) {
+    if (finishing) return done;
+    if (nextBlock == endBlock) {
+        if (fillBlocks > 0) sendFill(nextBlock - fillBlocks);
+        else {
+            uint8_t result = statusOk;
+            sendPacket(endPacket, nextBlock, &result, 1);
+            finishing = true;
+        }
+        return running;
+    }
+
+    Z80SDCard::sdResult result;
+    const uint8_t* data = sdcache.getBlock(nextBlock, result);
+    if (data == nullptr) { status = statusCardError; return failed; }
+
+    bool fill = (data[0] == 0x00) || (data[0] == 0xE5);
+    for (uint16_t i=1; (i<SD_BLOCK_SIZE) && fill; i++) fill = data[i] == data[0];
+    if (fill && (fillBlocks > 0) && (data[0] == fillValue) && (fillBlocks < SDTRANSFER_FILL_MAX)) fillBlocks++;
+    else if (fillBlocks > 0) { sendFill(nextBlock - fillBlocks); return running; }
+    else if (fill) { fillValue = data[0]; fillBlocks = 1; }
+    else {
+        sendPacket(dataPacket, nextBlock, data, SD_BLOCK_SIZE);
+        stats.dataPackets++;
+    }
+    nextBlock++;
+    stepsDone = nextBlock - firstBlock;
+    return running;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ File export, one block per step. A run of the file is read from the card with one multi block read
+---------------------------------------------------------------------------------------------------------*/
+Job::jobState SDTransfer::fileStep(void) {
+    if (finishing) return done;
+    Z80SDCard::sdResult result = Z80SDCard::ok;
+    if (runBlocks == 0) {
+        CPMFileSystem::readState state = filesystem.readFileRun(runBlock, runBlocks, SDTRANSFER_RUN_BLOCKS);
+        if (state == CPMFileSystem::readFailed) { status = statusCardError; return failed; }
+        if (state == CPMFileSystem::readDone) {
+            uint8_t payload = statusOk;
+            sendPacket(endPacket, nextBlock, &payload, 1);
+            finishing = true;
+            return running;
+        }
+        if (runBlock == CPMFILE_HOLE) {
+            fillValue = 0x00;
+            fillBlocks = runBlocks;
+            sendFill(nextBlock);
+            nextBlock += runBlocks;
+            runBlocks = 0;
+            stepsDone = nextBlock;
+            return running;
+        }
+        result = sdcache.prefetch(runBlock, runBlocks);
+        if (result != Z80SDCard::ok) { status = statusCardError; return failed; }
+    }
+
+    const uint8_t* data = sdcache.getBlock(runBlock, result);
+    if (data == nullptr) { status = statusCardError; return failed; }
+    uint32_t rest = fileBytes - nextBlock * SD_BLOCK_SIZE;
+    sendPacket(dataPacket, nextBlock, data, (rest < SD_BLOCK_SIZE) ? rest : SD_BLOCK_SIZE);
+    stats.dataPackets++;
+    nextBlock++;
+    runBlock++;
+    runBlocks--;
+    stepsDone = nextBlock;
+    return running;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Import, one block per step. Fill packets are written one block per step, written blocks are written
+ back in groups while the host waits for the ack
+---------------------------------------------------------------------------------------------------------*/
+Job::jobState SDTransfer::importStep(void) {
+    Z80SDCard::sdResult result = Z80SDCard::ok;
+
+    if (fillBlocks > 0) {
+        uint8_t block[SD_BLOCK_SIZE];
+        memset(block, fillValue, sizeof(block));
+        if (!importBlock(block)) { status = statusCardError; return failed; }
+        nextBlock++;
+        stepsDone = nextBlock - firstBlock;
+        if (--fillBlocks == 0) acknowledge(statusOk);
+        return running;
+    }
+
+    //end packet received: all blocks to the card, the directory of a file, then the last ack
+    if (finishing) {
+        if (sdcache.dirty()) result = sdcache.flush(SDTRANSFER_FLUSH_BLOCKS);
+        else if (!acknowledged) {
+            if (fileMode && (filesystem.writeFileEnd(true) != CPMFileSystem::writeDone)) { status = statusCardError; return failed; }
+            acknowledge(statusOk);
+            acknowledged = true;
+            return running;
+        }
+        else return done;
+        if (result != Z80SDCard::ok) { status = statusCardError; return failed; }
+        return running;
+    }
+
+    if (sdcache.dirtyBlocks() >= SDTRANSFER_FLUSH_BLOCKS) {
+        result = sdcache.flush(SDTRANSFER_FLUSH_BLOCKS);
+        if (result != Z80SDCard::ok) { status = statusCardError; return failed; }
+        return running;
+    }
+
+    if (rxReady) return importPacket();
+    if (millis() - lastPacket > SDTRANSFER_TIMEOUT_ms) { status = statusTimeout; return failed; }
+    return waiting;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Import, a packet received: checks crc and block, an error is answered with the block expected
+---------------------------------------------------------------------------------------------------------*/
+Job::jobState SDTransfer::importPacket(void) {
+    uint16_t length = rxBuffer[7] | (rxBuffer[8] << 8);
+    uint32_t crc = 0;
+    for (uint8_t i=0; i<4; i++) crc |= (uint32_t)rxBuffer[SDTRANSFER_HEADER + length + i] << (8*i);
+    uint32_t block = 0;
+    for (uint8_t i=0; i<4; i++) block |= (uint32_t)rxBuffer[3 + i] << (8*i);
+    uint8_t type = rxBuffer[2];
+    const uint8_t* payload = rxBuffer + SDTRANSFER_HEADER;
+    rxReady = false;
+    rxLength = 0;
+    lastPacket = millis();
+
+    if (crc32(rxBuffer + 2, SDTRANSFER_HEADER - 2 + length) != crc) {
+        stats.crcErrors++;
+        acknowledge(statusCrcError);
+        return running;
+    }
+    if (type == endPacket) {
+        //a file is committed complete only
+        if (fileMode && (nextBlock != endBlock)) { acknowledge(statusSequence); return running; }
+        finishing = true;
+        return running;
+    }
+    if ((block != nextBlock) || (block >= endBlock)) {
+        acknowledge(statusSequence);
+        return running;
+    }
+
+    //the last block of a file holds the rest
+    uint32_t blockLength = SD_BLOCK_SIZE;
+    if (fileMode && (fileBytes - nextBlock * SD_BLOCK_SIZE < SD_BLOCK_SIZE)) blockLength = fileBytes - nextBlock * SD_BLOCK_SIZE;
+    if ((type == dataPacket) && (length == blockLength)) {
+        if (!importBlock(payload)) { status = statusCardError; return failed; }
+        stats.dataPackets++;
+        nextBlock++;
+        stepsDone = nextBlock - firstBlock;
+        acknowledge(statusOk);
+    }
+    else if ((type == fillPacket) && (length == 3)) {
+        fillValue = payload[0];
+        fillBlocks = payload[1] | (payload[2] << 8);
+        if (fillBlocks > endBlock - nextBlock) fillBlocks = endBlock - nextBlock;
+        stats.fillPackets++;
+        stats.fillBlocks += fillBlocks;
+        if (fillBlocks == 0) acknowledge(statusOk);
+    }
+    else acknowledge(statusSequence);
+    return running;
+}
+
+//block nextBlock of the import, the blocks of a file go to the blocks allocated for it
+bool SDTransfer::importBlock(const uint8_t* data) {
+    if (!fileMode) return sdcache.writeBlock(nextBlock, data) == Z80SDCard::ok;
+    uint32_t rest = fileBytes - nextBlock * SD_BLOCK_SIZE;
+    return filesystem.writeFileData(nextBlock, data, (rest < SD_BLOCK_SIZE) ? rest : SD_BLOCK_SIZE) == CPMFileSystem::writeDone;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Packets: built in the transmit buffer, sent as far as the serial port accepts them
+---------------------------------------------------------------------------------------------------------*/
+void SDTransfer::sendPacket(packetType type, uint32_t block, const uint8_t* payload, uint16_t length) {
+    uint8_t* p = txBuffer;
+    *p++ = 'S';
+    *p++ = 'D';
+    *p++ = type;
+    for (uint8_t i=0; i<4; i++) *p++ = block >> (8*i);
+    *p++ = length;
+    *p++ = length >> 8;
+    memcpy(p, payload, length);
+    p += length;
+    uint32_t crc = crc32(txBuffer + 2, p - txBuffer - 2);
+    for (uint8_t i=0; i<4; i++) *p++ = crc >> (8*i);
+    txLength = p - txBuffer;
+    txPosition = 0;
+}
+
+void SDTransfer::sendFill(uint32_t block) {
+    uint8_t payload[3] = { fillValue, (uint8_t)fillBlocks, (uint8_t)(fillBlocks >> 8) };
+    sendPacket(fillPacket, block, payload, sizeof(payload));
+    stats.fillPackets++;
+    stats.fillBlocks += fillBlocks;
+    fillBlocks = 0;
+}
+
+void SDTransfer::acknowledge(transferStatus result) {
+    uint8_t payload = result;
+    sendPacket(ackPacket, nextBlock, &payload, 1);
+}
+
+bool SDTransfer::sendPending(void) {
+    if (txPosition < txLength) {
+        int space = Serial.availableForWrite();
+        if (space > 0) {
+            uint16_t count = txLength - txPosition;
+            if (count > space) count = space;
+            Serial.write(txBuffer + txPosition, count);
+            txPosition += count;
+        }
+    }
+    return txPosition >= txLength;
+}
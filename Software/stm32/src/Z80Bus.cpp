@@ -0,0 +1,365 @@
+#include <Z80Bus.h>
+#include <Z80BusGpio.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */  
+
+//timings
+#define RESET_PULSE_LEN_ms  100
+
+//makros for reading control lines
+#define WR_IS_HIGH       (Z80BUS_GPIOC->IDR & PORTC_PIN_WR)
+#define RD_IS_HIGH       (Z80BUS_GPIOA->IDR & PORTA_PIN_RD)
+#define WAIT_IS_HIGH     (Z80BUS_GPIOA->IDR & PORTA_PIN_WAIT)
+#define MREQ_IS_HIGH     (Z80BUS_GPIOC->IDR & PORTC_PIN_MREQ)
+#define IOREQ_IS_HIGH    (Z80BUS_GPIOA->IDR & PORTA_PIN_IOREQ)
+#define BUSREQ_IS_HIGH   (Z80BUS_GPIOA->IDR & PORTA_PIN_BUSREQ)
+#define RESET_IS_HIGH    (Z80BUS_GPIOA->IDR & PORTA_PIN_RESET)
+
+//makros for setting control lines
+#define WR_SET           Z80BUS_GPIOC->BSRR = PORTC_PIN_WR
+#define RD_SET           Z80BUS_GPIOA->BSRR = PORTA_PIN_RD
+#define WAIT_SET         Z80BUS_GPIOA->BSRR = PORTA_PIN_WAIT
+#define MREQ_SET         Z80BUS_GPIOC->BSRR = PORTC_PIN_MREQ
+#define IOREQ_SET        Z80BUS_GPIOA->BSRR = PORTA_PIN_IOREQ
+#define BUSREQ_SET       Z80BUS_GPIOA->BSRR = PORTA_PIN_BUSREQ
+#define RESET_SET        Z80BUS_GPIOA->BSRR = PORTA_PIN_RESET
+
+//makros for clearing (asserting) control lines
+#define WR_CLR           Z80BUS_GPIOC->BSRR = PORTC_PIN_WR << 16
+#define RD_CLR           Z80BUS_GPIOA->BSRR = PORTA_PIN_RD << 16
+#define WAIT_CLR         Z80BUS_GPIOA->BSRR = PORTA_PIN_WAIT << 16
+#define MREQ_CLR         Z80BUS_GPIOC->BSRR = PORTC_PIN_MREQ << 16
+#define IOREQ_CLR        Z80BUS_GPIOA->BSRR = PORTA_PIN_IOREQ << 16
+#define BUSREQ_CLR       Z80BUS_GPIOA->BSRR = PORTA_PIN_BUSREQ << 16
+#define RESET_CLR        Z80BUS_GPIOA->BSRR = PORTA_PIN_RESET << 16
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80Bus::Z80Bus(void) { 
+    //I/O ports initialization
+    //all lines required by the bus need to be open drain outputs, they have external pull ups to 5v
+    busmode = passive;
+
+    //start the cycle counter used for the bus timing
+    Z80BusTiming::begin();
+
+    //Enable GPIO clocks in case they have not by the arduino framework
+    Z80BUS_GPIO_CLK_ENABLE();
+
+    // 1 in OTYPER (1 bit per pin) sets the port pin to open drain mode
+    Z80BUS_GPIOA->OTYPER |= PORTA_BUS_LINES_IN_USE;
+    Z80BUS_GPIOB->OTYPER |= PORTB_BUS_LINES_IN_USE;
+    Z80BUS_GPIOC->OTYPER |= PORTC_BUS_LINES_IN_USE;
+
+    // 0x01 in MODER (2 bits per pin) sets the port pin to output mode
+    Z80BUS_GPIOA->MODER = (Z80BUS_GPIOA->MODER & ~Z80BusPins::field2(PORTA_BUS_LINES_IN_USE, 0x03)) | Z80BusPins::field2(PORTA_BUS_LINES_IN_USE, 0x01);
+    Z80BUS_GPIOB->MODER = (Z80BUS_GPIOB->MODER & ~Z80BusPins::field2(PORTB_BUS_LINES_IN_USE, 0x03)) | Z80BusPins::field2(PORTB_BUS_LINES_IN_USE, 0x01);
+    Z80BUS_GPIOC->MODER = (Z80BUS_GPIOC->MODER & ~Z80BusPins::field2(PORTC_BUS_LINES_IN_USE, 0x03)) | Z80BusPins::field2(PORTC_BUS_LINES_IN_USE, 0x01);
+
+    // 0x03 in OSPEEDR (2 bits per pin) sets the port pin to highspeed mode
+    Z80BUS_GPIOA->OSPEEDR |= Z80BusPins::field2(PORTA_BUS_LINES_IN_USE, 0x03);
+    Z80BUS_GPIOB->OSPEEDR |= Z80BusPins::field2(PORTB_BUS_LINES_IN_USE, 0x03);
+    Z80BUS_GPIOC->OSPEEDR |= Z80BusPins::field2(PORTC_BUS_LINES_IN_USE, 0x03);
+
+    // 0x00 in PUPDR (2 bits per pin) disables the port pin pull-up/downs
+    Z80BUS_GPIOA->PUPDR &= ~Z80BusPins::field2(PORTA_BUS_LINES_IN_USE, 0x03);
+    Z80BUS_GPIOB->PUPDR &= ~Z80BusPins::field2(PORTB_BUS_LINES_IN_USE, 0x03);
+    Z80BUS_GPIOC->PUPDR &= ~Z80BusPins::field2(PORTC_BUS_LINES_IN_USE, 0x03);
+
+    //release all lines
+    RESET_SET;
+    busSessions = 0;
+    resetHolds = 0;
+    burstPort = 0;
+    ownerCallback = nullptr;
+    burstData = 0xFF;
+    giveBus();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+This function enable or disables push-pull on the control pins (excluding reset). 
+This is required for consistent memory programming
+OTYPER has 1 bit per pin, the pins can be changed with a mask directly
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::controlPinsActiveDrive(bool enable) {
+    if (enable) {
+        // 0 in OTYPER sets the port pin to push-pull
+        Z80BUS_GPIOA->OTYPER &= ~PORTA_CONTROL_LINES_EX_RES;
+        Z80BUS_GPIOC->OTYPER &= ~PORTC_CONTROL_LINES_IN_USE;
+    }
+    else {
+        // 1 in OTYPER sets the port pin to open-drain
+        Z80BUS_GPIOA->OTYPER |= PORTA_CONTROL_LINES_EX_RES;
+        Z80BUS_GPIOC->OTYPER |= PORTC_CONTROL_LINES_IN_USE;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+reset Z80
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::resetZ80() {
+    RESET_SET;
+    delay(RESET_PULSE_LEN_ms);
+    RESET_CLR;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+set/release a specific control bit
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::write_controlBit(Z80Bus_controlBits bit, bool state) {    
+    //reset can be controlled anytime, other lines only when bus is actively controlled
+    if ((bit == reset ) &&  state) RESET_SET;
+    if ((bit == reset ) && !state) RESET_CLR;
+    if (busmode == passive) return;
+    if ((bit == ioreq ) &&  state) IOREQ_SET;
+    if ((bit == ioreq ) && !state) IOREQ_CLR;
+    if ((bit == mreq  ) &&  state) MREQ_SET;
+    if ((bit == mreq  ) && !state) MREQ_CLR;
+    if ((bit == rd    ) &&  state) RD_SET;
+    if ((bit == rd    ) && !state) RD_CLR;
+    if ((bit == wr    ) &&  state) WR_SET;
+    if ((bit == wr    ) && !state) WR_CLR;
+    if ((bit == wait  ) &&  state) WAIT_SET;
+    if ((bit == wait  ) && !state) WAIT_CLR;
+
+    //wait only as long as the operation requires
+    if      ((bit == rd) && !state) Z80BusTiming::wait(Z80BusTiming::readStrobe);
+    else if ((bit == wr) && !state) Z80BusTiming::wait(Z80BusTiming::writeStrobe);
+    else Z80BusTiming::wait(Z80BusTiming::controlSettle);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Bus write functions
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::write_dataBus(uint8_t data) {
+    if (busmode == passive) return;
+    Z80BUS_GPIOC->BSRR = dataBusTable.bsrr[data];
+    Z80BusTiming::wait(Z80BusTiming::dataSetup);        //open drain lines need time to rise
+}
+
+void Z80Bus::write_addressBus(uint16_t address) {
+    if (busmode == passive) return;
+    Z80BUS_GPIOB->ODR = address;
+    Z80BusTiming::wait(Z80BusTiming::addressSetup);     //open drain lines need time to rise
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Bus read functions
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80Bus::read_dataBus() {
+    return portCToData(Z80BUS_GPIOC->IDR);
+}
+
+uint16_t Z80Bus::read_addressBus() {
+    return Z80BUS_GPIOB->IDR;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Complete bus cycles
+ The control lines sharing a port with the data bus are driven in the same store as the data:
+    - WR and MREQ are on port C together with the data lines
+    - RD and IOREQ are both on port A
+ Flash and IO latches take over the data on the rising edge of the write strobe, so data and the
+ write strobe can be asserted together, as long as the address has been set up before
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80Bus::memRead(uint16_t address) {
+    if (busmode == passive) return 0xFF;
+    Z80BUS_GPIOB->ODR = address;
+    uint32_t start = Z80BusTiming::now();
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE | (PORTC_PIN_MREQ << 16);                    //release data, assert mreq
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_RD << 16;                                                //assert rd
+    Z80BusTiming::waitSince(start, Z80BusTiming::addressSetup);
+    Z80BusTiming::wait(Z80BusTiming::readStrobe);
+    uint8_t data = read_dataBus();
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_RD;
+    Z80BUS_GPIOC->BSRR = PORTC_PIN_MREQ;
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+    return data;
+}
+
+void Z80Bus::memWrite(uint16_t address, uint8_t data) {
+    if (busmode == passive) return;
+    Z80BUS_GPIOB->ODR = address;
+    Z80BusTiming::wait(Z80BusTiming::addressSetup);
+    uint32_t start = Z80BusTiming::now();
+    Z80BUS_GPIOC->BSRR = dataBusTable.bsrr[data] | (PORTC_WR_MREQ << 16);                  //data, assert wr and mreq
+    Z80BusTiming::waitSince(start, Z80BusTiming::dataSetup);
+    Z80BusTiming::waitSince(start, Z80BusTiming::writeStrobe);
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE | PORTC_WR_MREQ;                          //release wr, mreq and data
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+}
+
+uint8_t Z80Bus::ioRead(uint8_t ioport) {
+    if (busmode == passive) return 0xFF;
+    Z80BUS_GPIOB->ODR = ioport;
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE;                                          //release data
+    Z80BusTiming::wait(Z80BusTiming::addressSetup);
+    Z80BUS_GPIOA->BSRR = PORTA_RD_IOREQ << 16;                                             //assert rd and ioreq
+    Z80BusTiming::wait(Z80BusTiming::readStrobe);
+    uint8_t data = read_dataBus();
+    Z80BUS_GPIOA->BSRR = PORTA_RD_IOREQ;
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+    return data;
+}
+
+void Z80Bus::ioWrite(uint8_t ioport, uint8_t data) {
+    if (busmode == passive) return;
+    Z80BUS_GPIOB->ODR = ioport;
+    Z80BusTiming::wait(Z80BusTiming::addressSetup);
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_IOREQ << 16;                                                 //assert ioreq
+    uint32_t start = Z80BusTiming::now();
+    Z80BUS_GPIOC->BSRR = dataBusTable.bsrr[data] | (PORTC_PIN_WR << 16);                    //data, assert wr
+    Z80BusTiming::waitSince(start, Z80BusTiming::dataSetup);
+    Z80BusTiming::waitSince(start, Z80BusTiming::writeStrobe);
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE | PORTC_PIN_WR;                            //release wr and data
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_IOREQ;                                                       //release ioreq
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ IO bursts, IOREQ stays asserted from begin to end
+ The first port is set up before IOREQ is asserted. Within the burst, the address and data setup times
+ are only waited for if a line rises, write data stays on the bus until it changes or a read follows
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::ioBurstBegin(uint8_t ioport) {
+    if (busmode == passive) return;
+    Z80BUS_GPIOB->ODR = ioport;
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE;                                          //release data
+    Z80BusTiming::wait(Z80BusTiming::addressSetup);
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_IOREQ << 16;                                            //assert ioreq
+    burstPort = ioport;
+    burstData = 0xFF;
+}
+
+void Z80Bus::ioBurstWrite(uint8_t ioport, uint8_t data) {
+    if (busmode == passive) return;
+    setBurstPort(ioport);
+    uint32_t start = Z80BusTiming::now();
+    Z80BUS_GPIOC->BSRR = dataBusTable.bsrr[data] | (PORTC_PIN_WR << 16);                    //data, assert wr
+    if (data & ~burstData) Z80BusTiming::waitSince(start, Z80BusTiming::dataSetup);
+    Z80BusTiming::waitSince(start, Z80BusTiming::writeStrobe);
+    Z80BUS_GPIOC->BSRR = PORTC_PIN_WR;                                                      //release wr
+    burstData = data;
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+}
+
+uint8_t Z80Bus::ioBurstRead(uint8_t ioport) {
+    if (busmode == passive) return 0xFF;
+    setBurstPort(ioport);
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE;                                          //release data
+    burstData = 0xFF;
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_RD << 16;                                               //assert rd
+    Z80BusTiming::wait(Z80BusTiming::readStrobe);
+    uint8_t data = read_dataBus();
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_RD;
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+    return data;
+}
+
+void Z80Bus::ioBurstEnd(void) {
+    if (busmode == passive) return;
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_IOREQ;                                                  //release ioreq
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE;                                          //release data
+    Z80BusTiming::wait(Z80BusTiming::controlSettle);
+}
+
+void Z80Bus::setBurstPort(uint8_t ioport) {
+    if (ioport == burstPort) return;
+    Z80BUS_GPIOB->ODR = ioport;
+    if (ioport & ~burstPort) Z80BusTiming::wait(Z80BusTiming::addressSetup);
+    else Z80BusTiming::wait(Z80BusTiming::controlSettle);
+    burstPort = ioport;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ request access to bus. Requests are counted, only the first request takes the bus
+ returns false if bus was already active (nested request)
+ does not wait for Z80 to assert the busack line. It may be possible there is no CPU. Also, the CPU will
+ always release the bus according the datasheet with high priority
+---------------------------------------------------------------------------------------------------------*/
+bool Z80Bus::request_bus(){
+    if (busSessions++ > 0) return false;
+    takeBus();
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ release the bus, only the last release of nested requests gives the bus back to the Z80
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::release_bus() {
+    if (busSessions == 0) return;
+    if (--busSessions > 0) return;
+    giveBus();
+}
+
+bool Z80Bus::bus_active() {
+    return busmode == active;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ keep the Z80 in reset, counted like the bus requests
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::hold_reset() {
+    if (resetHolds++ == 0) RESET_SET;
+}
+
+void Z80Bus::release_reset() {
+    if (resetHolds == 0) return;
+    if (--resetHolds == 0) RESET_CLR;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ take the bus: busreq, then drive the control lines actively
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::takeBus() {
+    BUSREQ_CLR;
+    delayMicroseconds(10);
+    //the last cycle of the Z80 has ended, the next io cycles are the ones of the stm32
+    if (ownerCallback) ownerCallback(true);
+    controlPinsActiveDrive(true);
+    busmode = active;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ give the bus back - set output pins high (release pins)
+---------------------------------------------------------------------------------------------------------*/
+void Z80Bus::giveBus() {
+    controlPinsActiveDrive(false);
+    release_dataBus();
+    release_addressBus();
+    release_controlBus();
+    if (ownerCallback) ownerCallback(false);
+    BUSREQ_SET;
+    busmode = passive;
+}
+
+void Z80Bus::onOwnerChange(Z80BusOwnerCallback callback) {
+    ownerCallback = callback;
+}
+
+void Z80Bus::release_dataBus() {
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE;
+}
+
+void Z80Bus::release_addressBus() {
+    Z80BUS_GPIOB->BSRR = PORTB_ADDRESS_LINES_IN_USE;
+}
+
+void Z80Bus::release_controlBus() {
+    Z80BUS_GPIOA->BSRR = PORTA_CONTROL_LINES_EX_RES;
+    Z80BUS_GPIOC->BSRR = PORTC_CONTROL_LINES_IN_USE;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Bus session, holds the bus (and the Z80 reset) as long as it exists
+---------------------------------------------------------------------------------------------------------*/
+Z80BusSession::Z80BusSession(Z80Bus& bus, bool holdReset) : bus(bus), holdReset(holdReset) {
+    if (holdReset) bus.hold_reset();
+    bus.request_bus();
+}
+
+Z80BusSession::~Z80BusSession() {
+    bus.release_bus();
+    if (holdReset) bus.release_reset();
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#include <Z80BusDefs.h>
+
+//pin maps, referenced by the generated tables
+constexpr z80BusPinMap_t teachZ80Board::pins;
+
+//data bus lookup tables, generated at compile time
+constexpr dataBusTable_t dataBusTable;
+constexpr dataGatherTable_t dataGatherTable;
@@ -0,0 +1,128 @@
+#include <Z80BusSequence.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor, converts the bus timing budgets into slots
+---------------------------------------------------------------------------------------------------------*/
+Z80BusSequence::Z80BusSequence(uint32_t slotLength_ns) : slotLength_ns(slotLength_ns) {
+    uint32_t writeSetup = Z80BUS_DATA_SETUP_ns;
+    if (Z80BUS_WRITE_STROBE_ns > writeSetup) writeSetup = Z80BUS_WRITE_STROBE_ns;
+    budgetSlots[addressSetup]  = nsToSlots(Z80BUS_ADDRESS_SETUP_ns);
+    budgetSlots[dataSetup]     = nsToSlots(writeSetup);
+    budgetSlots[readStrobe]    = nsToSlots(Z80BUS_READ_STROBE_ns + slotLength_ns / 4);     //rd is asserted 1/4 into the slot
+    budgetSlots[controlSettle] = nsToSlots(Z80BUS_CONTROL_SETTLE_ns);
+    clear();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ removes all slots from the sequence
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusSequence::clear(void) {
+    slots = 0;
+    numReads = 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Bus cycles, return false if the sequence is full
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSequence::memWrite(uint16_t address, uint8_t data) {
+    return writeCycle(address, data, 0, PORTC_WR_MREQ);
+}
+
+bool Z80BusSequence::ioWrite(uint8_t ioport, uint8_t data) {
+    return writeCycle(ioport, data, PORTA_PIN_IOREQ, PORTC_PIN_WR);
+}
+
+bool Z80BusSequence::memRead(uint16_t address) {
+    return readCycle(address, PORTA_PIN_RD, PORTC_PIN_MREQ);
+}
+
+bool Z80BusSequence::ioRead(uint8_t ioport) {
+    return readCycle(ioport, PORTA_RD_IOREQ, 0);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ adds slots without any bus activity, eg to wait for a flash program operation
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSequence::idle(uint32_t ns) {
+    return reserve(nsToSlots(ns));
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ returns the data of a read cycle, after the sequence has been played
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80BusSequence::readData(uint16_t readIndex) {
+    if (readIndex >= numReads) return 0xFF;
+    return portCToData(capture[readSlots[readIndex]]);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ write cycle
+    - address is set in the first slot
+    - after address setup, data and the write strobes are asserted together
+    - after data setup, data and strobes on port C are released
+    - strobes on port A (ioreq) are released one slot later, followed by control settle time
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSequence::writeCycle(uint16_t address, uint8_t data, uint32_t portAStrobe, uint32_t portCStrobe) {
+    uint16_t start = slots;
+    uint16_t strobe = start + budgetSlots[addressSetup];
+    uint16_t release = strobe + budgetSlots[dataSetup];
+    uint16_t numSlots = release - start + budgetSlots[controlSettle];
+    if (portAStrobe) numSlots++;
+    if (!reserve(numSlots)) return false;
+
+    portB[start]   = addressWord(address);
+    portA[strobe]  = portAStrobe << 16;
+    portC[strobe]  = dataBusTable.bsrr[data] | (portCStrobe << 16);
+    portC[release] = PORTC_DATA_LINES_IN_USE | portCStrobe;
+    if (portAStrobe) portA[release + 1] = portAStrobe;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ read cycle
+    - address is set in the first slot, data bus is released
+    - memory cycles assert the strobes in the first slot (address access time is part of the budget)
+    - io cycles assert the strobes after address setup
+    - data is sampled at the end of the last slot of the read strobe budget
+    - strobes are released, followed by control settle time
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSequence::readCycle(uint16_t address, uint32_t portAStrobe, uint32_t portCStrobe) {
+    if (numReads >= Z80BUS_SEQUENCE_MAX_READS) return false;
+    uint16_t start = slots;
+    uint16_t strobe = start;
+    if (!portCStrobe) strobe += budgetSlots[addressSetup];
+    uint16_t release = start + budgetSlots[addressSetup] + budgetSlots[readStrobe];
+    if (!reserve(release - start + budgetSlots[controlSettle])) return false;
+
+    portB[start]   = addressWord(address);
+    portC[start]   = PORTC_DATA_LINES_IN_USE;
+    portA[strobe]  = portAStrobe << 16;
+    portC[strobe] |= portCStrobe << 16;
+    portA[release] = portAStrobe;
+    portC[release] = portCStrobe;
+    readSlots[numReads++] = release - 1;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ appends empty slots to the sequence
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSequence::reserve(uint16_t numSlots) {
+    if (slots + numSlots > Z80BUS_SEQUENCE_MAX_SLOTS) return false;
+    for (int i=slots; i<slots + numSlots; i++) {
+        portA[i] = 0;
+        portB[i] = 0;
+        portC[i] = 0;
+    }
+    slots += numSlots;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ converts a time into slots, rounded up, at least one slot
+---------------------------------------------------------------------------------------------------------*/
+uint16_t Z80BusSequence::nsToSlots(uint32_t ns) {
+    uint32_t numSlots = (ns + slotLength_ns - 1) / slotLength_ns;
+    if (numSlots == 0) numSlots = 1;
+    return numSlots;
+}
@@ -0,0 +1,218 @@
+#include <Z80BusSniffer.h>
+#include <Z80BusGpio.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define SNIFFER_PIN_MREQ        PC11
+#define SNIFFER_PIN_IOREQ       PA3
+#define SNIFFER_RING_MASK       (Z80SNIFFER_RING_SIZE - 1)
+#define SNIFFER_MAX_SPINS       256         //upper limit to follow one cycle, some microseconds
+#define SNIFFER_OVERFLOW        0xFF        //ring entry: records lost before the next one, count in time
+
+static_assert((Z80SNIFFER_RING_SIZE & SNIFFER_RING_MASK) == 0, "sniffer ring size must be a power of 2");
+
+const uint8_t sniffer_magicSentence[] = "helloTeachZ80BusSniffer";
+
+Z80BusSniffer* Z80BusSniffer::instance = nullptr;
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80BusSniffer::Z80BusSniffer(Z80Bus& bus, Z80IOTrap& iotrap, Z80CaptureArena& arena) : bus(bus), iotrap(iotrap), arena(arena) {
+    sniffermode = inactive;
+    ring = nullptr;
+    head = tail = 0;
+    dropped = 0;
+    lostTotal = 0;
+    magicSentenceCounter = 0;
+    observing = false;
+    instance = this;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ starts the capture, sends the trace header. Not possible while the STM32 holds the bus or the profiler
+ holds the capture arena
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSniffer::start(captureFilter filter) {
+    if (sniffermode == active) return true;
+    if (bus.bus_active()) {
+        refuse(encoder.busInUse);
+        return false;
+    }
+    ring = (z80TraceRecord_t*)arena.claim(Z80CaptureArena::sniffer);
+    if (ring == nullptr) {
+        refuse(encoder.memoryInUse);
+        return false;
+    }
+
+    head = tail = 0;
+    dropped = 0;
+    lostTotal = 0;
+    uint8_t buffer[Z80TRACE_HEADER_LEN];
+    Serial.write(buffer, encoder.header(buffer, SystemCoreClock, Z80BusTiming::now()));
+
+    //attachInterrupt configures the pins as inputs, but the bus library expects its open drain outputs.
+    //The EXTI input works in output mode as well, so the pin configuration is restored afterwards
+    uint32_t moderA = Z80BUS_GPIOA->MODER, otyperA = Z80BUS_GPIOA->OTYPER, pupdrA = Z80BUS_GPIOA->PUPDR;
+    uint32_t moderC = Z80BUS_GPIOC->MODER, otyperC = Z80BUS_GPIOC->OTYPER, pupdrC = Z80BUS_GPIOC->PUPDR;
+    observing = (filter != memoryOnly) && iotrap.active();
+    if (filter != ioOnly) attachInterrupt(digitalPinToInterrupt(SNIFFER_PIN_MREQ), mreqHandler, FALLING);
+    if (observing) iotrap.observe(ioObserved);
+    else if (filter != memoryOnly) attachInterrupt(digitalPinToInterrupt(SNIFFER_PIN_IOREQ), ioreqHandler, FALLING);
+    Z80BUS_GPIOA->MODER = moderA; Z80BUS_GPIOA->OTYPER = otyperA; Z80BUS_GPIOA->PUPDR = pupdrA;
+    Z80BUS_GPIOC->MODER = moderC; Z80BUS_GPIOC->OTYPER = otyperC; Z80BUS_GPIOC->PUPDR = pupdrC;
+
+    sniffermode = active;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ stops the capture, sends the remaining records and the end marker
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusSniffer::stop(void) {
+    if (sniffermode != active) return;
+    detachInterrupt(digitalPinToInterrupt(SNIFFER_PIN_MREQ));
+    if (observing) iotrap.observe(nullptr);
+    else detachInterrupt(digitalPinToInterrupt(SNIFFER_PIN_IOREQ));
+    observing = false;
+    sniffermode = inactive;
+
+    uint8_t buffer[Z80TRACE_MAX_RECORD_LEN];
+    while (tail != head) Serial.write(buffer, encodeNext(buffer));
+    if (dropped) {
+        Serial.write(buffer, encoder.marker(encoder.overflow, dropped, buffer));
+        lostTotal += dropped;
+    }
+    Serial.write(buffer, encoder.marker(encoder.end, lostTotal, buffer));
+    arena.release(Z80CaptureArena::sniffer);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ the capture did not start: the host parses the stream as binary, the reason goes in a trace marker
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusSniffer::refuse(Z80TraceEncoder::refusalReason reason) {
+    uint8_t buffer[Z80TRACE_HEADER_LEN];
+    Serial.write(buffer, encoder.header(buffer, SystemCoreClock, Z80BusTiming::now()));
+    Serial.write(buffer, encoder.marker(encoder.refused, reason, buffer));
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ process, run in main loop. Streams the captured records, never blocks on the serial port
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusSniffer::process(void) {
+    if (sniffermode != active) return;
+
+    uint8_t buffer[Z80TRACE_MAX_RECORD_LEN];
+    while ((tail != head) && (Serial.availableForWrite() >= (int)sizeof(buffer))) {
+        Serial.write(buffer, encodeNext(buffer));
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ reception of new serial characters, returns true if the character was used by the sniffer
+---------------------------------------------------------------------------------------------------------*/
+bool Z80BusSniffer::serialUpdate(uint8_t c) {
+
+    //process the magic sentence, the character is still processed by others
+    if (sniffermode == inactive) {
+        if (c == sniffer_magicSentence[magicSentenceCounter]) {
+            magicSentenceCounter++;
+            if (magicSentenceCounter == sizeof(sniffer_magicSentence) - 1) { sniffermode = armed; magicSentenceCounter = 0; }
+        }
+        else magicSentenceCounter = 0;
+        return false;
+    }
+
+    //character after the magic sentence selects the capture
+    if (sniffermode == armed) {
+        sniffermode = inactive;
+        if (c == 'A') start(all);
+        else if (c == 'M') start(memoryOnly);
+        else if (c == 'I') start(ioOnly);
+        else return false;
+        return true;
+    }
+
+    //any character stops the capture
+    stop();
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ encodes the oldest record of the ring, returns the number of bytes in the buffer
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80BusSniffer::encodeNext(uint8_t* buffer) {
+    const z80TraceRecord_t& record = ring[tail];
+    uint8_t length;
+    if (record.type == SNIFFER_OVERFLOW) {
+        length = encoder.marker(encoder.overflow, record.time, buffer);
+        lostTotal += record.time;
+    }
+    else length = encoder.encode(record, buffer);
+    tail = (tail + 1) & SNIFFER_RING_MASK;
+    return length;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ interrupt: follows one bus cycle and puts it into the ring
+ The address is valid at the falling edge of the request line. The data is taken from the last sample
+ with RD or WR active: the Z80 takes read data at the end of the strobe, write data is stable while WR is low
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusSniffer::capture(bool io) {
+    uint32_t time = Z80BusTiming::now();
+    uint16_t address = Z80BUS_GPIOB->IDR;
+    if (bus.bus_active()) return;
+
+    uint32_t portA, portC, sample = 0;
+    uint8_t type = SNIFFER_OVERFLOW;
+    uint32_t spins = SNIFFER_MAX_SPINS;
+    do {
+        portA = Z80BUS_GPIOA->IDR;
+        portC = Z80BUS_GPIOC->IDR;
+        if (!(portA & PORTA_PIN_RD)) { type = io ? Z80TraceEncoder::ioRead : Z80TraceEncoder::memoryRead; sample = portC; }
+        else if (!(portC & PORTC_PIN_WR)) { type = io ? Z80TraceEncoder::ioWrite : Z80TraceEncoder::memoryWrite; sample = portC; }
+    } while (!(io ? (portA & PORTA_PIN_IOREQ) : (portC & PORTC_PIN_MREQ)) && --spins);
+
+    //refresh or interrupt acknowledge
+    if (type == SNIFFER_OVERFLOW) return;
+    put({ time, address, portCToData(sample), type });
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ interrupt: puts a record into the ring
+ The io cycles observed through the IO trap come at a higher priority than the MREQ interrupt, the ring
+ is only changed with the interrupts disabled
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusSniffer::put(const z80TraceRecord_t& record) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    //a pending loss is reported in front of the next record, this needs two free entries
+    uint32_t free = (tail - head - 1) & SNIFFER_RING_MASK;
+    if (free < (dropped ? 2u : 1u)) {
+        dropped++;
+        __set_PRIMASK(primask);
+        return;
+    }
+    if (dropped) {
+        ring[head] = { dropped, 0, 0, SNIFFER_OVERFLOW };
+        head = (head + 1) & SNIFFER_RING_MASK;
+        dropped = 0;
+    }
+    ring[head] = record;
+    head = (head + 1) & SNIFFER_RING_MASK;
+    __set_PRIMASK(primask);
+}
+
+void Z80BusSniffer::mreqHandler(void) {
+    instance->capture(false);
+}
+
+void Z80BusSniffer::ioreqHandler(void) {
+    instance->capture(true);
+}
+
+//io cycles seen by the IO trap: other ports are followed here, the trapped ones come served
+void Z80BusSniffer::ioObserved(const z80TraceRecord_t* served) {
+    if (served == nullptr) instance->capture(true);
+    else instance->put(*served);
+}
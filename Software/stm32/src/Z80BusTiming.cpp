@@ -0,0 +1,38 @@
+#include <Z80BusTiming.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+//key to unlock the DWT registers on the cortex-m7
+#define DWT_LAR_UNLOCK_KEY      0xC5ACCE55
+
+//budgets in the order of the busOperation enum
+const uint16_t busTimingBudgets_ns[Z80BusTiming::numOperations] = {
+    Z80BUS_ADDRESS_SETUP_ns,
+    Z80BUS_DATA_SETUP_ns,
+    Z80BUS_READ_STROBE_ns,
+    Z80BUS_WRITE_STROBE_ns,
+    Z80BUS_CONTROL_SETTLE_ns
+};
+
+uint32_t Z80BusTiming::cycles[Z80BusTiming::numOperations];
+
+/*--------------------------------------------------------------------------------------------------------
+ Enables the DWT cycle counter and converts the timing budgets into core clock cycles
+ Can be called multiple times, the counter is only started once
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusTiming::begin(void) {
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->LAR = DWT_LAR_UNLOCK_KEY;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+    for (int i=0; i<numOperations; i++) cycles[i] = nsToCycles(busTimingBudgets_ns[i]);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ converts nanoseconds into core clock cycles, rounded up
+---------------------------------------------------------------------------------------------------------*/
+uint32_t Z80BusTiming::nsToCycles(uint32_t ns) {
+    uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+    return (ns * cyclesPerUs + 999) / 1000;
+}
@@ -0,0 +1,192 @@
+#include <Z80BusWaveform.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+//vcd signal identifiers
+#define VCD_ID_ADDRESS  '!'
+#define VCD_ID_DATA     '"'
+#define VCD_ID_RD       '#'
+#define VCD_ID_WR       '$'
+#define VCD_ID_MREQ     '%'
+#define VCD_ID_IOREQ    '&'
+
+const char* cycleNames[] = { "MEM-RD", "MEM-WR", "IO-RD ", "IO-WR " };
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80BusWaveform::Z80BusWaveform(readHandler_t handler) : readHandler(handler) {
+    cycles = 0;
+    violations = 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Plays a sequence, decodes the bus cycles and fills the sequence capture array
+ Returns the number of timing violations
+---------------------------------------------------------------------------------------------------------*/
+uint32_t Z80BusWaveform::play(Z80BusSequence* sequence, FILE* vcd) {
+    //all lines are released (high) when the sequence starts
+    portA = portB = portC = 0xFFFF;
+    dataBus = 0xFF;
+    addressChange_ns = dataChange_ns = strobeStart_ns = 0;
+    slotLength_ns = sequence->slotLength();
+    cycles = 0;
+    violations = 0;
+    lastSample_ns = 0;
+    lastSample = 0xFF;
+
+    if (vcd) vcdHeader(vcd);
+
+    for (uint32_t slot=0; slot<sequence->length(); slot++) {
+        uint32_t start_ns = slot * slotLength_ns;
+        uint32_t lastA = portA, lastB = portB, lastC = portC;
+
+        //port writes in the same order as the dma streams
+        writePort(&portB, sequence->portB[slot]);
+        update(start_ns, lastA, lastB, lastC, vcd);
+        lastB = portB;
+        writePort(&portA, sequence->portA[slot]);
+        update(start_ns + slotLength_ns / 4, lastA, lastB, lastC, vcd);
+        lastA = portA;
+        writePort(&portC, sequence->portC[slot]);
+        update(start_ns + slotLength_ns / 2, lastA, lastB, lastC, vcd);
+
+        //sample the data bus at the end of the slot
+        bool mreq  = !(portC & PORTC_PIN_MREQ);
+        bool ioreq = !(portA & PORTA_PIN_IOREQ);
+        bool rd    = !(portA & PORTA_PIN_RD);
+        uint32_t portCInput = portC;
+        if (rd && (mreq || ioreq)) {
+            //device drives the data bus
+            check((portC & PORTC_DATA_LINES_IN_USE) == PORTC_DATA_LINES_IN_USE, "bus contention, data bus not released during read", start_ns);
+            uint8_t data = 0xFF;
+            if (readHandler) data = readHandler(mreq ? memoryRead : ioRead, mreq ? portB : (portB & 0xFF));
+            portCInput = (portC & ~PORTC_DATA_LINES_IN_USE) | dataToPortC(data);
+            dataBus = data;
+            lastSample = data;
+            lastSample_ns = start_ns + slotLength_ns;
+        }
+        sequence->capture[slot] = portCInput;
+        if (vcd) vcdDump(vcd, start_ns + slotLength_ns - 1);
+    }
+
+    if (vcd) fprintf(vcd, "#%u\n", sequence->length() * slotLength_ns);
+    return violations;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ applies a bsrr word to a port (set bits have priority over reset bits, like on the stm32)
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusWaveform::writePort(uint32_t* port, uint32_t bsrr) {
+    *port &= ~(bsrr >> 16);
+    *port |= bsrr & 0xFFFF;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ tracks line changes after a port write, decodes completed cycles and checks the timing
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusWaveform::update(uint32_t time_ns, uint32_t lastA, uint32_t lastB, uint32_t lastC, FILE* vcd) {
+    //data written in the same store as the wr release has not been latched anymore
+    uint32_t dataStable_ns = dataChange_ns;
+    if (portB != lastB) addressChange_ns = time_ns;
+    if ((portC ^ lastC) & PORTC_DATA_LINES_IN_USE) {
+        dataChange_ns = time_ns;
+        dataBus = portCToData(portC);
+    }
+
+    bool lastMreq  = !(lastC & PORTC_PIN_MREQ);
+    bool lastIoreq = !(lastA & PORTA_PIN_IOREQ);
+    bool wrFalling = (lastC & PORTC_PIN_WR) && !(portC & PORTC_PIN_WR);
+    bool wrRising  = !(lastC & PORTC_PIN_WR) && (portC & PORTC_PIN_WR);
+    bool rdFalling = (lastA & PORTA_PIN_RD) && !(portA & PORTA_PIN_RD);
+    bool rdRising  = !(lastA & PORTA_PIN_RD) && (portA & PORTA_PIN_RD);
+
+    //strobes
+    if (wrFalling) {
+        strobeStart_ns = time_ns;
+        check(time_ns - addressChange_ns >= Z80BUS_ADDRESS_SETUP_ns, "address setup before WR", time_ns);
+    }
+    if (rdFalling) strobeStart_ns = time_ns;
+
+    //write cycle completes with the rising edge of wr, flash and latches take over the data
+    if (wrRising) {
+        check(time_ns - strobeStart_ns >= Z80BUS_WRITE_STROBE_ns, "WR pulse width", time_ns);
+        check(time_ns - dataStable_ns >= Z80BUS_DATA_SETUP_ns, "data setup before WR release", time_ns);
+        check(lastMreq || lastIoreq, "WR without MREQ or IOREQ", time_ns);
+        if (lastMreq) addCycle(memoryWrite, portCToData(lastC), time_ns);
+        else if (lastIoreq) addCycle(ioWrite, portCToData(lastC), time_ns);
+    }
+
+    //read cycle completes with the rising edge of rd, the data was taken at the last sample point
+    if (rdRising) {
+        uint32_t validFrom = strobeStart_ns;
+        if (addressChange_ns + Z80BUS_ADDRESS_SETUP_ns > validFrom) validFrom = addressChange_ns + Z80BUS_ADDRESS_SETUP_ns;
+        check(lastSample_ns >= strobeStart_ns, "RD without data sample", time_ns);
+        check(lastSample_ns >= validFrom + Z80BUS_READ_STROBE_ns, "read strobe / address access time", time_ns);
+        bool mreq = !(portC & PORTC_PIN_MREQ);
+        check(mreq || lastIoreq, "RD without MREQ or IOREQ", time_ns);
+        if (mreq) addCycle(memoryRead, lastSample, time_ns);
+        else if (lastIoreq) addCycle(ioRead, lastSample, time_ns);
+    }
+
+    if (vcd) vcdDump(vcd, time_ns);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ adds a decoded cycle to the list
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusWaveform::addCycle(cycleType type, uint8_t data, uint32_t time_ns) {
+    if (cycles >= Z80BUS_WAVEFORM_MAX_CYCLES) return;
+    cycle[cycles].type = type;
+    cycle[cycles].address = portB;
+    if ((type == ioRead) || (type == ioWrite)) cycle[cycles].address &= 0xFF;
+    cycle[cycles].data = data;
+    cycle[cycles].time_ns = time_ns;
+    cycles++;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ counts and reports timing violations
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusWaveform::check(bool condition, const char* text, uint32_t time_ns) {
+    if (condition) return;
+    violations++;
+    printf("Timing violation at %u ns: %s\n", time_ns, text);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ prints a decoded cycle, eg for the host tools
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusWaveform::printCycle(uint32_t index) {
+    if (index >= cycles) return;
+    printf("%8u ns  %s  %04X  %02X\n", cycle[index].time_ns, cycleNames[cycle[index].type], cycle[index].address, cycle[index].data);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ VCD output
+---------------------------------------------------------------------------------------------------------*/
+void Z80BusWaveform::vcdHeader(FILE* vcd) {
+    fprintf(vcd, "$timescale 1ns $end\n");
+    fprintf(vcd, "$scope module z80bus $end\n");
+    fprintf(vcd, "$var wire 16 %c address $end\n", VCD_ID_ADDRESS);
+    fprintf(vcd, "$var wire 8 %c data $end\n", VCD_ID_DATA);
+    fprintf(vcd, "$var wire 1 %c rd $end\n", VCD_ID_RD);
+    fprintf(vcd, "$var wire 1 %c wr $end\n", VCD_ID_WR);
+    fprintf(vcd, "$var wire 1 %c mreq $end\n", VCD_ID_MREQ);
+    fprintf(vcd, "$var wire 1 %c ioreq $end\n", VCD_ID_IOREQ);
+    fprintf(vcd, "$upscope $end\n");
+    fprintf(vcd, "$enddefinitions $end\n");
+}
+
+void Z80BusWaveform::vcdDump(FILE* vcd, uint32_t time_ns) {
+    fprintf(vcd, "#%u\n", time_ns);
+    fprintf(vcd, "b");
+    for (int i=15; i>=0; i--) fputc((portB >> i) & 0x01 ? '1' : '0', vcd);
+    fprintf(vcd, " %c\n", VCD_ID_ADDRESS);
+    fprintf(vcd, "b");
+    for (int i=7; i>=0; i--) fputc((dataBus >> i) & 0x01 ? '1' : '0', vcd);
+    fprintf(vcd, " %c\n", VCD_ID_DATA);
+    fprintf(vcd, "%c%c\n", (portA & PORTA_PIN_RD) ? '1' : '0', VCD_ID_RD);
+    fprintf(vcd, "%c%c\n", (portC & PORTC_PIN_WR) ? '1' : '0', VCD_ID_WR);
+    fprintf(vcd, "%c%c\n", (portC & PORTC_PIN_MREQ) ? '1' : '0', VCD_ID_MREQ);
+    fprintf(vcd, "%c%c\n", (portA & PORTA_PIN_IOREQ) ? '1' : '0', VCD_ID_IOREQ);
+}
@@ -0,0 +1,34 @@
+#include <Z80CaptureArena.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80CaptureArena::Z80CaptureArena(void) {
+    owner = nobody;
+    claimed = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ claims the arena for a user, returns the memory or nullptr if another user holds it.
+ Claiming again while holding the arena is allowed, the content is kept
+---------------------------------------------------------------------------------------------------------*/
+void* Z80CaptureArena::claim(arenaUser user) {
+    if (claimed && (owner != user)) return nullptr;
+    owner = user;
+    claimed = true;
+    return memory;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ releases the arena, the content stays valid for the user until another user claims it
+---------------------------------------------------------------------------------------------------------*/
+void Z80CaptureArena::release(arenaUser user) {
+    if (owner == user) claimed = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ true if the content of the arena belongs to the user
+---------------------------------------------------------------------------------------------------------*/
+bool Z80CaptureArena::holds(arenaUser user) {
+    return owner == user;
+}
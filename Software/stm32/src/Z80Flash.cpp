@@ -1,5 +1,5 @@
 #include <Z80Flash.h>
-#include <z80Programs.h>
+#include <Z80Programs.h>
 
 /* Types and definitions -------------------------------------------------------------------------------- */  
 //flash timings
@@ -11,7 +11,7 @@
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
-Z80Flash::Z80Flash(Z80Bus bus) : z80bus(bus) {
+Z80Flash::Z80Flash(Z80Bus& bus) : z80bus(bus) {
     flashmode = inactive;
     chipVendorId = 0;
     chipDeviceId = 0;
@@ -22,24 +22,7 @@ Z80Flash::Z80Flash(Z80Bus bus) : z80bus(bus) {
 ---------------------------------------------------------------------------------------------------------*/
 uint8_t Z80Flash::readByte(uint16_t address) {
     if (flashmode != active) return 0xFF;
-    z80bus.write_addressBus(address);
-    z80bus.write_controlBit(z80bus.mreq, false);
-    z80bus.write_controlBit(z80bus.rd, false);
-    uint8_t data = z80bus.read_dataBus();
-    z80bus.write_controlBit(z80bus.rd, true);
-    z80bus.write_controlBit(z80bus.mreq, true);
-    
-    return data;
-}
-
-/*--------------------------------------------------------------------------------------------------------
- single one byte write access to flash (without setting mreq, this is handled by the overlying function)
----------------------------------------------------------------------------------------------------------*/
-void Z80Flash::singleByteWrite(uint16_t address, uint8_t data) {
-    z80bus.write_dataBus(data);
-    z80bus.write_addressBus(address);
-    z80bus.write_controlBit(z80bus.wr, false);
-    z80bus.write_controlBit(z80bus.wr, true);
+    return z80bus.memRead(address);
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -48,44 +31,38 @@ void Z80Flash::singleByteWrite(uint16_t address, uint8_t data) {
 void Z80Flash::writeByte(uint16_t address, uint8_t data) {
     if (flashmode != active) return;
 
-    //enable chip
-    z80bus.write_controlBit(z80bus.mreq, false);
-
     //load address and data, 3-byte program command for SST39SF0x0
-    singleByteWrite(0x5555, 0xAA);
-    singleByteWrite(0x2AAA, 0x55);
-    singleByteWrite(0x5555, 0xA0);
+    z80bus.memWrite(0x5555, 0xAA);
+    z80bus.memWrite(0x2AAA, 0x55);
+    z80bus.memWrite(0x5555, 0xA0);
 
     //Programming the actual data byte
-    singleByteWrite(address, data);
-    
-    //disable chip and release bus
-    z80bus.write_controlBit(z80bus.mreq, true);    
-    z80bus.release_dataBus();
+    z80bus.memWrite(address, data);
 
     delayMicroseconds(BYTE_WRITE_WAIT_TIME_us);
 }
 
+/*--------------------------------------------------------------------------------------------------------
+ write a range of bytes - works in active mode only
+---------------------------------------------------------------------------------------------------------*/
+void Z80Flash::writeBytes(uint16_t address, const uint8_t* data, uint32_t length) {
+    if (flashmode != active) return;
+    for (uint32_t i=0; i<length; i++) writeByte(address + i, data[i]);
+}
+
 /*--------------------------------------------------------------------------------------------------------
  flash erase - erases the whole chip - works in active mode only
 ---------------------------------------------------------------------------------------------------------*/
 void Z80Flash::eraseFlash() {
     if (flashmode != active) return;
 
-    //enable chip
-    z80bus.write_controlBit(z80bus.mreq, false);
-
     //erase, 6-byte erase command for SST39SF0x0
-    singleByteWrite(0x5555, 0xAA);
-    singleByteWrite(0x2AAA, 0x55);
-    singleByteWrite(0x5555, 0x80);
-    singleByteWrite(0x5555, 0xAA);
-    singleByteWrite(0x2AAA, 0x55);
-    singleByteWrite(0x5555, 0x10);   
-
-    //disable chip and release bus
-    z80bus.write_controlBit(z80bus.mreq, true);
-    z80bus.release_dataBus();
+    z80bus.memWrite(0x5555, 0xAA);
+    z80bus.memWrite(0x2AAA, 0x55);
+    z80bus.memWrite(0x5555, 0x80);
+    z80bus.memWrite(0x5555, 0xAA);
+    z80bus.memWrite(0x2AAA, 0x55);
+    z80bus.memWrite(0x5555, 0x10);   
 
     delay(FLASH_ERASE_WAIT_TIME_ms);
 }
@@ -96,24 +73,17 @@ void Z80Flash::eraseFlash() {
 void Z80Flash::eraseBank() {
     if (flashmode != active) return;
 
-    //enable chip
-    z80bus.write_controlBit(z80bus.mreq, false);
-
     for (int i=0; i<16; i++) {
         //erase, 6-byte erase command for SST39SF0x0
-        singleByteWrite(0x5555, 0xAA);
-        singleByteWrite(0x2AAA, 0x55);
-        singleByteWrite(0x5555, 0x80);
-        singleByteWrite(0x5555, 0xAA);
-        singleByteWrite(0x2AAA, 0x55);
-        singleByteWrite(i << 12, 0x30);
+        z80bus.memWrite(0x5555, 0xAA);
+        z80bus.memWrite(0x2AAA, 0x55);
+        z80bus.memWrite(0x5555, 0x80);
+        z80bus.memWrite(0x5555, 0xAA);
+        z80bus.memWrite(0x2AAA, 0x55);
+        z80bus.memWrite(i << 12, 0x30);
         delay(PAGE_ERASE_WAIT_TIME_ms);
     }   
 
-    //disable chip and release bus
-    z80bus.write_controlBit(z80bus.mreq, true);
-    z80bus.release_dataBus();
-
     delay(FLASH_ERASE_WAIT_TIME_ms);
 }
 
@@ -123,34 +93,21 @@ void Z80Flash::eraseBank() {
 void Z80Flash::readChipIndentification() {
     if (flashmode != active) return;
 
-    //enable chip
-    z80bus.write_controlBit(z80bus.mreq, false);    
-
     //enter device identification mode
-    singleByteWrite(0x5555, 0xAA);
-    singleByteWrite(0x2AAA, 0x55);
-    singleByteWrite(0x5555, 0x90);
+    z80bus.memWrite(0x5555, 0xAA);
+    z80bus.memWrite(0x2AAA, 0x55);
+    z80bus.memWrite(0x5555, 0x90);
     delayMicroseconds(FLASH_IDMODE_ACCESS_TIME_us);
 
     //read ID's
-    z80bus.release_dataBus();
-    z80bus.write_controlBit(z80bus.rd, false);
-    z80bus.write_addressBus(0x0000);    
-    delayMicroseconds(FLASH_IDMODE_ACCESS_TIME_us);
-    chipVendorId = z80bus.read_dataBus();
-    z80bus.write_addressBus(0x0001);
-    delayMicroseconds(FLASH_IDMODE_ACCESS_TIME_us);
-    chipDeviceId = z80bus.read_dataBus();
-    z80bus.write_controlBit(z80bus.rd, true);
+    chipVendorId = z80bus.memRead(0x0000);
+    chipDeviceId = z80bus.memRead(0x0001);
 
     //exit device id mode
-    singleByteWrite(0x5555, 0xAA);
-    singleByteWrite(0x2AAA, 0x55);
-    singleByteWrite(0x5555, 0xF0);
+    z80bus.memWrite(0x5555, 0xAA);
+    z80bus.memWrite(0x2AAA, 0x55);
+    z80bus.memWrite(0x5555, 0xF0);
     delayMicroseconds(FLASH_IDMODE_ACCESS_TIME_us);
-
-    z80bus.write_controlBit(z80bus.mreq, true);
-    z80bus.release_dataBus();
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -173,7 +130,7 @@ bool Z80Flash::writeProgram(uint8_t programNumber) {
 
     //erase current bank, write, verify
     eraseBank();    
-    for (uint32_t i=0; i<z80FlashPrograms[programNumber].length; i++) writeByte(i, z80FlashPrograms[programNumber].data[i]);
+    writeBytes(0, z80FlashPrograms[programNumber].data, z80FlashPrograms[programNumber].length);
     bool programOK = true;
     for (uint32_t i=0; i<z80FlashPrograms[programNumber].length; i++) if (readByte(i) != z80FlashPrograms[programNumber].data[i]) programOK = false;
 
@@ -183,16 +140,18 @@ bool Z80Flash::writeProgram(uint8_t programNumber) {
 
 /*--------------------------------------------------------------------------------------------------------
  to start and stop flash mode
+ the bus and the reset are requested once per mode change, nested in an already running bus session
 ---------------------------------------------------------------------------------------------------------*/
 void Z80Flash::setMode(bool modeactive) {
+    if (modeactive == (flashmode == active)) return;
     if (modeactive) {    
+        z80bus.hold_reset();
         z80bus.request_bus();     
-        z80bus.write_controlBit(z80bus.reset, true);   
         flashmode = active;      
     }
     else {
         z80bus.release_bus();
-        z80bus.write_controlBit(z80bus.reset, false); 
+        z80bus.release_reset();
         flashmode = inactive;
     }
 }
\ No newline at end of file
@@ -5,34 +5,46 @@
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
-Z80IO::Z80IO(Z80Bus bus) : z80bus(bus) {
-
+Z80IO::Z80IO(Z80Bus& bus) : z80bus(bus) {
+    memset(&stats, 0, sizeof(stats));
 }
 
 /*--------------------------------------------------------------------------------------------------------
  IO Write Access to the bus
 ---------------------------------------------------------------------------------------------------------*/
 void Z80IO::write(uint8_t ioport, uint8_t data) {
-    z80bus.write_addressBus(ioport);
-    z80bus.write_dataBus(data);
-    z80bus.write_controlBit(z80bus.ioreq, false);
-    z80bus.write_controlBit(z80bus.wr, false);
-    z80bus.write_controlBit(z80bus.wr, true);
-    z80bus.write_controlBit(z80bus.ioreq, true);
-    z80bus.release_dataBus();
+    stats.writes++;
+    z80bus.ioWrite(ioport, data);
 }
 
 /*--------------------------------------------------------------------------------------------------------
  IO Read Access to the bus
 ---------------------------------------------------------------------------------------------------------*/
 uint8_t Z80IO::read(uint8_t ioport) {
-    z80bus.write_addressBus(ioport);
-    z80bus.write_controlBit(z80bus.ioreq, false);
-    z80bus.write_controlBit(z80bus.rd, false);
-    uint8_t data = z80bus.read_dataBus();
-    z80bus.write_controlBit(z80bus.rd, true);
-    z80bus.write_controlBit(z80bus.ioreq, true);
-    return data;
+    stats.reads++;
+    return z80bus.ioRead(ioport);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ IO bursts, IOREQ is held between begin and end (see Z80Bus.h)
+---------------------------------------------------------------------------------------------------------*/
+void Z80IO::burstBegin(uint8_t ioport) {
+    stats.bursts++;
+    z80bus.ioBurstBegin(ioport);
+}
+
+void Z80IO::burstWrite(uint8_t ioport, uint8_t data) {
+    stats.writes++;
+    z80bus.ioBurstWrite(ioport, data);
+}
+
+uint8_t Z80IO::burstRead(uint8_t ioport) {
+    stats.reads++;
+    return z80bus.ioBurstRead(ioport);
+}
+
+void Z80IO::burstEnd(void) {
+    z80bus.ioBurstEnd();
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -0,0 +1,213 @@
+#include <Z80IODevices.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define FIFO_MASK               (Z80IOFIFO_SIZE - 1)
+#define STATUS_READY            0x01
+#define STATUS_PENDING          0x01
+#define STATUS_BUSY             0x01
+#define STATUS_FAILED           0x02
+#define STATUS_MISSED           0x04
+#define DISK_PORT_LATCH         4
+#define DISK_PORT_COMMAND       5
+#define DISK_PORT_DATA          6
+
+/*--------------------------------------------------------------------------------------------------------
+ Multiplier, the product is calculated on read, there is no state but the operands
+---------------------------------------------------------------------------------------------------------*/
+Z80IOMultiplier::Z80IOMultiplier(void) {
+    memset(operands, 0, sizeof(operands));
+}
+
+uint8_t Z80IOMultiplier::ioRead(uint8_t port) {
+    uint32_t a = operands[0] | (operands[1] << 8);
+    uint32_t b = operands[2] | (operands[3] << 8);
+    return (a * b) >> (8 * (port & 0x03));
+}
+
+void Z80IOMultiplier::ioWrite(uint8_t port, uint8_t data) {
+    operands[port & 0x03] = data;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Console fifo, filled by the Z80 in interrupt context, sent to the serial port in the main loop
+---------------------------------------------------------------------------------------------------------*/
+Z80IOConsoleFifo::Z80IOConsoleFifo(void) {
+    head = tail = 0;
+}
+
+uint8_t Z80IOConsoleFifo::ioRead(uint8_t port) {
+    if (port == 1) return (((head + 1) & FIFO_MASK) != tail) ? STATUS_READY : 0;
+    return 0xFF;
+}
+
+void Z80IOConsoleFifo::ioWrite(uint8_t port, uint8_t data) {
+    if (port != 0) return;
+    uint32_t next = (head + 1) & FIFO_MASK;
+    if (next == tail) return;
+    fifo[head] = data;
+    head = next;
+}
+
+void Z80IOConsoleFifo::process(void) {
+    while (tail != head) {
+        Serial.write(fifo[tail]);
+        tail = (tail + 1) & FIFO_MASK;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Block copy, the parameters are collected in interrupt context, the copy needs the bus and is done
+ in the main loop. The Z80 is stopped by the bus request meanwhile, the reset is not touched
+---------------------------------------------------------------------------------------------------------*/
+Z80IOBlockCopy::Z80IOBlockCopy(Z80Bus& bus) : bus(bus) {
+    memset(parameters, 0, sizeof(parameters));
+    parameterIndex = 0;
+    pending = false;
+}
+
+uint8_t Z80IOBlockCopy::ioRead(uint8_t port) {
+    if (port == 1) return pending ? STATUS_PENDING : 0;
+    parameterIndex = 0;
+    return 0;
+}
+
+void Z80IOBlockCopy::ioWrite(uint8_t port, uint8_t data) {
+    if (port == 1) {
+        pending = true;
+        parameterIndex = 0;
+        return;
+    }
+    parameters[parameterIndex] = data;
+    parameterIndex = (parameterIndex + 1) % sizeof(parameters);
+}
+
+void Z80IOBlockCopy::process(void) {
+    if (!pending) return;
+    uint16_t source = parameters[0] | (parameters[1] << 8);
+    uint16_t destination = parameters[2] | (parameters[3] << 8);
+    uint16_t length = parameters[4] | (parameters[5] << 8);
+    {
+        Z80BusSession session(bus, false);
+        for (uint16_t i=0; i<length; i++) bus.memWrite(destination + i, bus.memRead(source + i));
+    }
+    pending = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Disk, the ports are served in interrupt context, the blocks are read and written through the sd cache in
+ the main loop. The Z80 polls the status until the command is done
+---------------------------------------------------------------------------------------------------------*/
+Z80IODisk::Z80IODisk(Z80SDCache& cache, Z80SPI& spi, JobEngine& jobengine, const uint32_t& missedCycles) :
+    cache(cache), spi(spi), jobengine(jobengine), missedCycles(missedCycles) {
+    memset(&stats, 0, sizeof(stats));
+    memset(lba, 0, sizeof(lba));
+    outputLatch = 0;
+    lastCommand = 0;
+    commandJobs = 0;
+    missedAtStart = missedCycles;
+    dataIndex = 0;
+    command = resetIndex;
+    busy = false;
+    failed = false;
+}
+
+uint8_t Z80IODisk::ioRead(uint8_t port) {
+    if (port < sizeof(lba)) return lba[port];
+    switch (port) {
+        case DISK_PORT_COMMAND:
+            return (busy ? STATUS_BUSY : 0) | (failed ? STATUS_FAILED : 0) | ((missedCycles != missedAtStart) ? STATUS_MISSED : 0);
+        case DISK_PORT_DATA:
+            if (busy) return 0xFF;
+            return buffer[dataIndex++ & (SD_BLOCK_SIZE - 1)];
+        default:
+            return 0xFF;
+    }
+}
+
+void Z80IODisk::ioWrite(uint8_t port, uint8_t data) {
+    if (port < sizeof(lba)) {
+        if (port == 0) missedAtStart = missedCycles;
+        lba[port] = data;
+        return;
+    }
+    switch (port) {
+        case DISK_PORT_LATCH:
+            outputLatch = data;
+            break;
+        case DISK_PORT_COMMAND:
+            if (busy) break;
+            //a byte of the buffer has been missed, the block would be written shifted
+            if ((data == writeBlock) && (dataIndex != SD_BLOCK_SIZE)) {
+                stats.rejected++;
+                failed = true;
+                dataIndex = 0;
+                break;
+            }
+            dataIndex = 0;
+            if ((data == readBlock) || (data == writeBlock)) {
+                command = data;
+                commandJobs = jobengine.jobs;
+                failed = false;
+                busy = true;
+            }
+            break;
+        case DISK_PORT_DATA:
+            if (!busy) buffer[dataIndex++ & (SD_BLOCK_SIZE - 1)] = data;
+            break;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ The written blocks stay in the cache, they are written to the card once the Z80 has not used the disk
+ for Z80IODISK_FLUSH_ms. An open stream owns the card, the command waits (busy) for the next pass.
+ A job has reset the Z80 and may have changed the card, a command of before the job fails
+---------------------------------------------------------------------------------------------------------*/
+void Z80IODisk::process(void) {
+    if (busy && (commandJobs != jobengine.jobs)) {
+        stats.errors++;
+        failed = true;
+        dataIndex = 0;
+        busy = false;
+    }
+    if (jobengine.busy() || cache.streaming()) return;
+    if (!busy) {
+        if (cache.dirty() && (millis() - lastCommand >= Z80IODISK_FLUSH_ms)) flush();
+        return;
+    }
+    uint32_t block = lba[0] | (lba[1] << 8) | (lba[2] << 16) | ((uint32_t)lba[3] << 24);
+
+    //the output latch of the Z80 is restored by the last write to the SPI port, if the card is accessed
+    spi.setOutputLatch(outputLatch);
+    Z80SDCard::sdResult result;
+    if (command == readBlock) {
+        stats.reads++;
+        if (cache.contains(block)) stats.hits++;
+        result = cache.readBlock(block, buffer);
+    }
+    else {
+        stats.writes++;
+        result = cache.writeBlock(block, buffer);
+    }
+    cache.release();
+    spi.setOutputLatch(0);
+
+    if (result != Z80SDCard::ok) {
+        stats.errors++;
+        failed = true;
+    }
+    lastCommand = millis();
+    dataIndex = 0;
+    busy = false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Writes the cached blocks to the card, with the output latch of the Z80
+---------------------------------------------------------------------------------------------------------*/
+bool Z80IODisk::flush(void) {
+    spi.setOutputLatch(outputLatch);
+    Z80SDCard::sdResult result = cache.flush();
+    cache.release();
+    spi.setOutputLatch(0);
+    if (result != Z80SDCard::ok) stats.errors++;
+    return result == Z80SDCard::ok;
+}
@@ -0,0 +1,231 @@
+#include <Z80IOTrap.h>
+#include <Z80BusGpio.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define IOTRAP_EXTI_LINE        PORTA_PIN_IOREQ     //PA3, EXTI line 3
+#define IOTRAP_VECTOR           (16 + EXTI3_IRQn)   //16 core exceptions in front of the interrupts
+#define IOTRAP_NUM_VECTORS      128                 //16 core exceptions and all stm32f722 interrupts
+
+typedef void (*vector_t)(void);
+
+//copy of the vector table, in the 512 bytes the linker script reserves in front of the RAM region
+//(aligned to the table size, as VTOR requires)
+extern "C" uint32_t _ram_vector_table[IOTRAP_NUM_VECTORS];
+static uint32_t* const ramVectors = _ram_vector_table;
+static vector_t previousHandler = nullptr;
+
+Z80IOTrap* Z80IOTrap::instance = nullptr;
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80IOTrap::Z80IOTrap(Z80Bus& bus) : bus(bus) {
+    for (uint8_t i=0; i<Z80IOTRAP_PORTS; i++) {
+        devices[i] = nullptr;
+        firstPorts[i] = 0;
+    }
+    memset(&stats, 0, sizeof(stats));
+    trapActive = false;
+    timeoutCycles = 0;
+    waitBudgetCycles = 0;
+    observer = nullptr;
+    instance = this;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ attaches a device to a port range, which has to be within the trapped ports and must not be used yet
+---------------------------------------------------------------------------------------------------------*/
+bool Z80IOTrap::attach(Z80IODevice& device, uint8_t firstPort, uint8_t numPorts) {
+    if ((numPorts == 0) || (firstPort < Z80IOTRAP_PORT_BASE)) return false;
+    if (firstPort + numPorts > Z80IOTRAP_PORT_BASE + Z80IOTRAP_PORTS) return false;
+    for (uint8_t i=0; i<numPorts; i++) if (devices[firstPort - Z80IOTRAP_PORT_BASE + i]) return false;
+
+    for (uint8_t i=0; i<numPorts; i++) {
+        devices[firstPort - Z80IOTRAP_PORT_BASE + i] = &device;
+        firstPorts[firstPort - Z80IOTRAP_PORT_BASE + i] = firstPort;
+    }
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ starts serving the trapped ports
+ The vector table is moved to ram once, the EXTI3 vector is replaced by the trap handler
+---------------------------------------------------------------------------------------------------------*/
+bool Z80IOTrap::start(uint32_t z80Clock) {
+    if (trapActive) return true;
+    if (!setClock(z80Clock)) return false;
+    timeoutCycles = Z80BusTiming::nsToCycles(Z80IOTRAP_TIMEOUT_ns);
+
+    __disable_irq();
+    if (SCB->VTOR != (uint32_t)ramVectors) {
+        memcpy(ramVectors, (const void*)SCB->VTOR, IOTRAP_NUM_VECTORS * sizeof(uint32_t));
+        SCB->VTOR = (uint32_t)ramVectors;
+        __DSB();
+    }
+    previousHandler = (vector_t)ramVectors[IOTRAP_VECTOR];
+    ramVectors[IOTRAP_VECTOR] = (uint32_t)irqHandler;
+    __DSB();
+    __enable_irq();
+
+    enableInterrupt();
+    bus.onOwnerChange(ownerChanged);
+    if (bus.bus_active()) ownerChanged(true);
+    trapActive = true;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ budget for the assertion of WAIT, at the current Z80 clock. Has to be called when the clock changes
+ The Z80 samples WAIT 1.5 clocks after IOREQ, the interrupt entry is taken off this budget
+---------------------------------------------------------------------------------------------------------*/
+bool Z80IOTrap::setClock(uint32_t z80Clock) {
+    if (z80Clock == 0) return false;
+    uint32_t sampleCycles = Z80BusTiming::nsToCycles(1500000000UL / z80Clock);
+    waitBudgetCycles = (sampleCycles > Z80IOTRAP_ENTRY_CYCLES) ? sampleCycles - Z80IOTRAP_ENTRY_CYCLES : 0;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ stops serving, the Arduino dispatch gets the interrupt back
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::stop(void) {
+    if (!trapActive) return;
+    bus.onOwnerChange(nullptr);
+    if (bus.bus_active()) ownerChanged(false);
+    __disable_irq();
+    ramVectors[IOTRAP_VECTOR] = (uint32_t)previousHandler;
+    __DSB();
+    __enable_irq();
+    trapActive = false;
+}
+
+bool Z80IOTrap::active(void) {
+    return trapActive;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ process, run in main loop. Deferred work of the devices, and keeps the interrupt enabled (masked while
+ the stm32 holds the bus)
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::process(void) {
+    if (!trapActive) return;
+    bool lineChanged = !(EXTI->IMR & IOTRAP_EXTI_LINE) || !NVIC_GetEnableIRQ(EXTI3_IRQn) || (NVIC_GetPriority(EXTI3_IRQn) != 0);
+    if (!bus.bus_active() && lineChanged) enableInterrupt();
+    for (uint8_t i=0; i<Z80IOTRAP_PORTS; i++) {
+        if (devices[i] && ((i == 0) || (devices[i] != devices[i-1]))) devices[i]->process();
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ registers the observer of the io cycles, nullptr removes it
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::observe(ioObserver newObserver) {
+    observer = newObserver;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ falling edge of IOREQ on PA3, highest priority. The pin stays an open drain output of the bus library,
+ the EXTI input works in output mode as well
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::enableInterrupt(void) {
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    SYSCFG->EXTICR[0] = (SYSCFG->EXTICR[0] & ~SYSCFG_EXTICR1_EXTI3) | SYSCFG_EXTICR1_EXTI3_PA;
+    EXTI->FTSR |= IOTRAP_EXTI_LINE;
+    EXTI->PR = IOTRAP_EXTI_LINE;
+    EXTI->IMR |= IOTRAP_EXTI_LINE;
+    NVIC_SetPriority(EXTI3_IRQn, 0);
+    NVIC_EnableIRQ(EXTI3_IRQn);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ the stm32 takes the bus: its own io cycles must not enter the handler. The edges of these cycles are
+ dropped before the Z80 runs again
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::ownerChanged(bool stm32Active) {
+    if (stm32Active) {
+        EXTI->IMR &= ~IOTRAP_EXTI_LINE;
+        return;
+    }
+    EXTI->PR = IOTRAP_EXTI_LINE;
+    NVIC_ClearPendingIRQ(EXTI3_IRQn);
+    EXTI->IMR |= IOTRAP_EXTI_LINE;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ interrupt: ports outside the trapped range go to the observer, or to the Arduino dispatch, which clears
+ the pending bit
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::irqHandler(void) {
+    if ((Z80BUS_GPIOB->IDR & 0xF0) != Z80IOTRAP_PORT_BASE) {
+        ioObserver observer = instance->observer;
+        if (observer == nullptr) {
+            previousHandler();
+            return;
+        }
+        EXTI->PR = IOTRAP_EXTI_LINE;
+        observer(nullptr);
+        return;
+    }
+    EXTI->PR = IOTRAP_EXTI_LINE;
+    instance->serve();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ serves one io cycle
+ RD or WR are asserted together with IOREQ. Interrupt acknowledge cycles (IOREQ without a strobe) are
+ left alone, WAIT is only asserted once a strobe has been seen, and only within the budget
+---------------------------------------------------------------------------------------------------------*/
+void Z80IOTrap::serve(void) {
+    uint32_t start = Z80BusTiming::now();
+    uint16_t address = Z80BUS_GPIOB->IDR;
+    uint8_t port = address;
+    if (bus.bus_active()) return;
+
+    uint32_t portA, portC;
+    do {
+        portA = Z80BUS_GPIOA->IDR;
+        portC = Z80BUS_GPIOC->IDR;
+        if (portA & PORTA_PIN_IOREQ) {
+            stats.missed++;
+            return;
+        }
+    } while ((portA & PORTA_PIN_RD) && (portC & PORTC_PIN_WR) && (Z80BusTiming::now() - start < timeoutCycles));
+    if ((portA & PORTA_PIN_RD) && (portC & PORTC_PIN_WR)) return;
+
+    //the Z80 has sampled WAIT already, the cycle ends without wait states
+    if (Z80BusTiming::now() - start > waitBudgetCycles) {
+        stats.missed++;
+        return;
+    }
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_WAIT << 16;
+
+    uint8_t index = port - Z80IOTRAP_PORT_BASE;
+    Z80IODevice* device = devices[index];
+    if (!device) stats.unclaimed++;
+    uint8_t data;
+    if (!(portA & PORTA_PIN_RD)) {
+        data = device ? device->ioRead(port - firstPorts[index]) : 0xFF;
+        Z80BUS_GPIOC->BSRR = dataBusTable.bsrr[data];
+        Z80BusTiming::wait(Z80BusTiming::dataSetup);        //open drain lines need time to rise
+        stats.reads++;
+    }
+    else {
+        data = portCToData(portC);
+        if (device) device->ioWrite(port - firstPorts[index], data);
+        stats.writes++;
+    }
+
+    //release WAIT, then the data bus after the end of the cycle. The timeout starts with the release
+    Z80BUS_GPIOA->BSRR = PORTA_PIN_WAIT;
+    uint32_t released = Z80BusTiming::now();
+    uint32_t serviceCycles = released - start;
+    if (serviceCycles > stats.maxServiceCycles) stats.maxServiceCycles = serviceCycles;
+    while (!(Z80BUS_GPIOA->IDR & PORTA_PIN_IOREQ) && (Z80BusTiming::now() - released < timeoutCycles));
+    Z80BUS_GPIOC->BSRR = PORTC_DATA_LINES_IN_USE;
+
+    ioObserver notify = observer;
+    if (notify) {
+        z80TraceRecord_t record = { start, address, data, (uint8_t)(!(portA & PORTA_PIN_RD) ? Z80TraceEncoder::ioRead : Z80TraceEncoder::ioWrite) };
+        notify(&record);
+    }
+}
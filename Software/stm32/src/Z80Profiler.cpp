@@ -0,0 +1,199 @@
+#include <Z80Profiler.h>
+#include <Z80BusGpio.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define PROFILER_TIMER          TIM14
+#define PROFILER_VERSION        1
+#define PROFILER_SCAN_PER_LOOP  256         //buckets checked per main loop iteration while dumping
+#define PROFILER_LFSR_TAPS      0xA3000000  //32 bit galois lfsr, maximum length
+
+const uint8_t profiler_magicSentence[] = "helloTeachZ80Profiler";
+
+Z80Profiler* Z80Profiler::instance = nullptr;
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80Profiler::Z80Profiler(Z80Bus& bus, Z80CaptureArena& arena) : bus(bus), arena(arena) {
+    profilermode = inactive;
+    timer = nullptr;
+    histogram = nullptr;
+    rate = 0;
+    paused = false;
+    dumping = false;
+    dither = 1;
+    magicSentenceCounter = 0;
+    instance = this;
+    clear();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ starts sampling, the counters are kept. The timer is created on first use.
+ Not possible while the bus sniffer holds the capture arena, if it took the counters they are cleared
+---------------------------------------------------------------------------------------------------------*/
+bool Z80Profiler::start(uint32_t rateHz) {
+    bool kept = valid();
+    uint16_t* memory = (uint16_t*)arena.claim(Z80CaptureArena::profiler);
+    if (memory == nullptr) return false;
+    histogram = memory;
+    if (!kept) clear();
+
+    if (timer == nullptr) {
+        timer = new HardwareTimer(PROFILER_TIMER);
+        timer->attachInterrupt(timerHandler);
+    }
+    timer->pause();
+    timer->setOverflow(rateHz, HERTZ_FORMAT);
+    period = timer->getOverflow(TICK_FORMAT);
+    rate = rateHz;
+    paused = false;
+    timer->resume();
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ stops sampling
+---------------------------------------------------------------------------------------------------------*/
+void Z80Profiler::stop(void) {
+    if (timer) timer->pause();
+    rate = 0;
+    if (!dumping) arena.release(Z80CaptureArena::profiler);
+}
+
+bool Z80Profiler::running(void) {
+    return rate != 0;
+}
+
+//false if the counters were never used or a capture of the bus sniffer took them
+bool Z80Profiler::valid(void) {
+    return (histogram != nullptr) && arena.holds(Z80CaptureArena::profiler);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ clears all counters
+---------------------------------------------------------------------------------------------------------*/
+void Z80Profiler::clear(void) {
+    paused = true;
+    if (valid()) memset(histogram, 0, Z80PROFILER_BUCKETS * sizeof(uint16_t));
+    samples = skipped = 0;
+    halvings = 0;
+    paused = dumping;
+}
+
+uint16_t Z80Profiler::hits(uint16_t address) {
+    return valid() ? histogram[address] : 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ finds the addresses with the most hits, sorted descending. Returns the number of addresses found
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80Profiler::topAddresses(uint16_t* addresses, uint8_t count) {
+    uint8_t found = 0;
+    if ((count == 0) || !valid()) return 0;
+    for (uint32_t address=0; address<Z80PROFILER_BUCKETS; address++) {
+        uint16_t value = histogram[address];
+        if ((value == 0) || ((found == count) && (value <= histogram[addresses[found-1]]))) continue;
+        uint8_t i = (found < count) ? found++ : found - 1;
+        while ((i > 0) && (histogram[addresses[i-1]] < value)) { addresses[i] = addresses[i-1]; i--; }
+        addresses[i] = address;
+    }
+    return found;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ process, run in main loop. Streams the dump, never blocks on the serial port
+---------------------------------------------------------------------------------------------------------*/
+void Z80Profiler::process(void) {
+    if (!dumping) return;
+
+    uint32_t scanned = 0;
+    while ((dumpAddress < Z80PROFILER_BUCKETS) && (scanned < PROFILER_SCAN_PER_LOOP) && (Serial.availableForWrite() >= 4)) {
+        uint16_t value = histogram[dumpAddress];
+        if (value) {
+            uint8_t entry[4] = { (uint8_t)dumpAddress, (uint8_t)(dumpAddress >> 8), (uint8_t)value, (uint8_t)(value >> 8) };
+            Serial.write(entry, sizeof(entry));
+        }
+        dumpAddress++;
+        scanned++;
+    }
+
+    if ((dumpAddress == Z80PROFILER_BUCKETS) && (Serial.availableForWrite() >= 4)) {
+        uint8_t entry[4] = { 0, 0, 0, 0 };
+        Serial.write(entry, sizeof(entry));
+        dumping = false;
+        paused = false;
+        if (!running()) arena.release(Z80CaptureArena::profiler);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ reception of new serial characters, returns true if the character was used by the profiler
+---------------------------------------------------------------------------------------------------------*/
+bool Z80Profiler::serialUpdate(uint8_t c) {
+
+    //process the magic sentence, the character is still processed by others
+    if (profilermode == inactive) {
+        if (c == profiler_magicSentence[magicSentenceCounter]) {
+            magicSentenceCounter++;
+            if (magicSentenceCounter == sizeof(profiler_magicSentence) - 1) { profilermode = armed; magicSentenceCounter = 0; }
+        }
+        else magicSentenceCounter = 0;
+        return false;
+    }
+
+    //command character after the magic sentence
+    profilermode = inactive;
+    if (c == 'S') { clear(); start(); }
+    else if (c == 'X') stop();
+    else if ((c == 'D') && !dumping) {
+        //the arena is held until the dump is sent, the counters of a capture are not dumped
+        bool counters = valid() && arena.claim(Z80CaptureArena::profiler);
+        paused = true;
+        uint32_t values[3] = { rate, counters ? samples : 0, counters ? skipped : 0 };
+        uint8_t header[18] = { 'Z', '8', '0', 'P', PROFILER_VERSION };
+        for (uint8_t i=0; i<12; i++) header[5+i] = values[i/4] >> (8*(i%4));
+        header[17] = counters ? halvings : 0;
+        Serial.write(header, sizeof(header));
+        dumpAddress = counters ? 0 : Z80PROFILER_BUCKETS;
+        dumping = true;
+    }
+    else return false;
+    return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ interrupt: one sample of the address bus
+ The refresh address is on the bus with MREQ active but without RD or WR, io cycles carry the port.
+ The next period is dithered by +-12.5%
+---------------------------------------------------------------------------------------------------------*/
+void Z80Profiler::sample(void) {
+    dither = (dither >> 1) ^ (-(dither & 1u) & PROFILER_LFSR_TAPS);
+    PROFILER_TIMER->ARR = period - 1 - (period >> 3) + (dither % ((period >> 2) | 1));
+    if (paused) return;
+
+    uint32_t portC = Z80BUS_GPIOC->IDR;
+    uint16_t address = Z80BUS_GPIOB->IDR;
+    uint32_t portA = Z80BUS_GPIOA->IDR;
+
+    bool refresh = !(portC & PORTC_PIN_MREQ) && (portA & PORTA_PIN_RD) && (portC & PORTC_PIN_WR);
+    if (bus.bus_active() || (portA & PORTA_PIN_RESET) || !(portA & PORTA_PIN_IOREQ) || refresh) {
+        skipped++;
+        return;
+    }
+
+    samples++;
+    if (++histogram[address] == 0xFFFF) halve();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ halves all counters, two counters per word
+---------------------------------------------------------------------------------------------------------*/
+void Z80Profiler::halve(void) {
+    uint32_t* words = (uint32_t*)histogram;
+    for (uint32_t i=0; i<Z80PROFILER_BUCKETS/2; i++) words[i] = (words[i] >> 1) & 0x7FFF7FFF;
+    halvings++;
+}
+
+void Z80Profiler::timerHandler(void) {
+    instance->sample();
+}
@@ -0,0 +1,416 @@
+#include <Z80SDCache.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define PREFETCH_MAX_BLOCKS     (Z80SDCACHE_FRAMES / 2)     //a prefetch does not replace the whole cache
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor, all frames are free and in the lru list, the order does not matter yet
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCache::Z80SDCache(Z80SDCard& sdcard) : sdcard(sdcard) {
+    memset(&stats, 0, sizeof(stats));
+    for (uint16_t i=0; i<Z80SDCACHE_BUCKETS; i++) buckets[i] = Z80SDCACHE_NONE;
+    for (uint16_t i=0; i<Z80SDCACHE_FRAMES; i++) {
+        frames[i].valid = false;
+        frames[i].dirty = false;
+        frames[i].readAhead = false;
+        frames[i].hashNext = Z80SDCACHE_NONE;
+        frames[i].lruPrev = (i == 0) ? Z80SDCACHE_NONE : i - 1;
+        frames[i].lruNext = (i == Z80SDCACHE_FRAMES - 1) ? Z80SDCACHE_NONE : i + 1;
+    }
+    lruHead = 0;
+    lruTail = Z80SDCACHE_FRAMES - 1;
+    dirtyFrames = 0;
+    sdWriteCount = sdcard.writeCount;
+    sdInitCount = sdcard.initCount;
+    cardOpened = false;
+    resetStreams();
+    readAheadEnabled = true;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Reads a block, from the cache or the card. getBlock returns the frame itself, it is valid until the next
+ call of the cache. nullptr if the block could not be read
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCache::readBlock(uint32_t blockNumber, uint8_t* dst) {
+    Z80SDCard::sdResult result;
+    const uint8_t* data = getBlock(blockNumber, result);
+    if (data != nullptr) memcpy(dst, data, SD_BLOCK_SIZE);
+    return result;
+}
+
+const uint8_t* Z80SDCache::getBlock(uint32_t blockNumber, Z80SDCard::sdResult& result) {
+    synchronize();
+    stats.reads++;
+    readAhead(blockNumber);
+    uint16_t index = load(blockNumber, result);
+    return (index == Z80SDCACHE_NONE) ? nullptr : frames[index].data;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Writes a block to the cache. The card is only accessed if a dirty frame has to be replaced
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCache::writeBlock(uint32_t blockNumber, const uint8_t* src) {
+    synchronize();
+    stats.writes++;
+    Z80SDCard::sdResult result = Z80SDCard::ok;
+    uint16_t index = find(blockNumber);
+    if (index != Z80SDCACHE_NONE) {
+        stats.hits++;
+        touch(index);
+    }
+    else {
+        index = replace(result);
+        if (index == Z80SDCACHE_NONE) return result;
+        insert(index, blockNumber);
+    }
+    frames[index].readAhead = false;
+    memcpy(frames[index].data, src, SD_BLOCK_SIZE);
+    setDirty(index, true);
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Loads the blocks of a range which are not cached, the consecutive ones with one multi block read
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCache::prefetch(uint32_t blockNumber, uint32_t count) {
+    synchronize();
+    return fetch(blockNumber, count, false);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Loads the blocks of a range which are not cached, marked as read ahead if requested
+ The stream is interrupted for cached blocks and to write back a dirty frame
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCache::fetch(uint32_t blockNumber, uint32_t count, bool ahead) {
+    if (count > PREFETCH_MAX_BLOCKS) count = PREFETCH_MAX_BLOCKS;
+    Z80SDCard::sdResult result = Z80SDCard::ok;
+    bool streaming = false;
+
+    for (uint32_t block = blockNumber; (block < blockNumber + count) && (result == Z80SDCard::ok); block++) {
+        bool cached = find(block) != Z80SDCACHE_NONE;
+        if (streaming && (cached || frames[lruTail].dirty)) {
+            result = sdcard.readBlocksEnd();
+            streaming = false;
+        }
+        if (cached || (result != Z80SDCard::ok)) continue;
+
+        uint16_t index = replace(result);
+        if (index == Z80SDCACHE_NONE) break;
+        if (!streaming) {
+            result = openCard();
+            if (result == Z80SDCard::ok) result = sdcard.readBlocksBegin(block, blockNumber + count - block);
+            streaming = result == Z80SDCard::ok;
+        }
+        if (result == Z80SDCard::ok) result = sdcard.readBlocksNext(frames[index].data);
+        if (result == Z80SDCard::ok) {
+            insert(index, block);
+            frames[index].readAhead = ahead;
+            stats.misses++;
+            if (ahead) stats.readAheads++;
+        }
+    }
+    if (streaming) {
+        Z80SDCard::sdResult endResult = sdcard.readBlocksEnd();
+        if (result == Z80SDCard::ok) result = endResult;
+    }
+    if (result != Z80SDCard::ok) stats.errors++;
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Read ahead for sequential readers, called before a block is read
+ A read which does not continue a stream starts a new one, replacing the stream used longest ago
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCache::resetStreams(void) {
+    for (uint8_t i=0; i<Z80SDCACHE_STREAMS; i++) {
+        streams[i].nextBlock = Z80SDCACHE_NO_BLOCK;
+        streams[i].aheadBlock = Z80SDCACHE_NO_BLOCK;
+        streams[i].lastUse = 0;
+        streams[i].window = Z80SDCACHE_READAHEAD_MIN;
+        streams[i].used = 0;
+    }
+    streamClock = 0;
+}
+
+void Z80SDCache::readAhead(uint32_t blockNumber) {
+    if (!readAheadEnabled) return;
+    stream_t* stream = nullptr;
+    stream_t* oldest = &streams[0];
+    for (uint8_t i=0; i<Z80SDCACHE_STREAMS; i++) {
+        //the last block of a stream read again
+        if (streams[i].nextBlock == blockNumber + 1) return;
+        if (streams[i].nextBlock == blockNumber) stream = &streams[i];
+        if (streams[i].lastUse < oldest->lastUse) oldest = &streams[i];
+    }
+    streamClock++;
+    if (stream == nullptr) {
+        oldest->nextBlock = blockNumber + 1;
+        oldest->aheadBlock = blockNumber + 1;
+        oldest->lastUse = streamClock;
+        oldest->window = Z80SDCACHE_READAHEAD_MIN;
+        oldest->used = 0;
+        return;
+    }
+    stream->nextBlock = blockNumber + 1;
+    stream->lastUse = streamClock;
+
+    //block read ahead and used, or read ahead and already replaced: the window is too large for the cache
+    //blocks cached otherwise (prefetch, written) do not need the card, the stream only follows
+    uint16_t index = find(blockNumber);
+    if ((index != Z80SDCACHE_NONE) && frames[index].readAhead) {
+        frames[index].readAhead = false;
+        stream->used++;
+        stats.readAheadHits++;
+    }
+    else if (index != Z80SDCACHE_NONE) {
+        if (stream->aheadBlock <= blockNumber) stream->aheadBlock = blockNumber + 1;
+        return;
+    }
+    else if (blockNumber < stream->aheadBlock) {
+        if (stream->window > Z80SDCACHE_READAHEAD_MIN) stream->window /= 2;
+        stream->aheadBlock = blockNumber;
+    }
+    if (stream->aheadBlock < blockNumber) stream->aheadBlock = blockNumber;
+
+    //next window, when the reader comes within half a window of the end
+    if (blockNumber + stream->window / 2 < stream->aheadBlock) return;
+    if ((stream->used >= stream->window / 2) && (stream->window < Z80SDCACHE_READAHEAD_MAX)) stream->window *= 2;
+    fetch(stream->aheadBlock, stream->window, true);
+    stream->aheadBlock += stream->window;
+    stream->used = 0;
+
+    //the block itself is read now, it is not read ahead
+    index = find(blockNumber);
+    if ((index != Z80SDCACHE_NONE) && frames[index].readAhead) {
+        frames[index].readAhead = false;
+        stats.readAheads--;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Master boot record, from block 0
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::mbrResult Z80SDCache::readMBR(void) {
+    Z80SDCard::mbrResult mbr;
+    const uint8_t* data = getBlock(0, mbr.readresult);
+    if (data != nullptr) sdcard.parseMBR(&mbr, data);
+    return mbr;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Writes the dirty frames to the card, in the order of the blocks. Consecutive dirty blocks are written
+ with one multi block write. maxBlocks limits the blocks written by one call (jobs running in slices)
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCache::flush(uint32_t maxBlocks) {
+    synchronize();
+    Z80SDCard::sdResult result = Z80SDCard::ok;
+
+    while ((dirtyFrames > 0) && (maxBlocks > 0) && (result == Z80SDCard::ok)) {
+        //lowest dirty block, and the dirty blocks following it
+        uint16_t first = Z80SDCACHE_NONE;
+        for (uint16_t i=0; i<Z80SDCACHE_FRAMES; i++) {
+            if (frames[i].dirty && ((first == Z80SDCACHE_NONE) || (frames[i].block < frames[first].block))) first = i;
+        }
+        uint32_t block = frames[first].block;
+        uint32_t count = 1;
+        while (count < maxBlocks) {
+            uint16_t next = find(block + count);
+            if ((next == Z80SDCACHE_NONE) || !frames[next].dirty) break;
+            count++;
+        }
+
+        result = openCard();
+        if (result != Z80SDCard::ok) break;
+        uint32_t written = 0;
+        if (count == 1) {
+            result = sdcard.writeBlock(block, frames[first].data);
+            if (result == Z80SDCard::ok) written = 1;
+        }
+        else {
+            result = sdcard.writeBlocksBegin(block, count);
+            while ((written < count) && (result == Z80SDCard::ok)) {
+                result = sdcard.writeBlocksNext(frames[find(block + written)].data);
+                if (result == Z80SDCard::ok) written++;
+            }
+            //the card may not have programmed the blocks, they stay dirty
+            if (sdcard.writeBlocksEnd() != Z80SDCard::ok) {
+                if (result == Z80SDCard::ok) result = Z80SDCard::write_timeout_2;
+                written = 0;
+            }
+        }
+        for (uint32_t i=0; i<written; i++) setDirty(find(block + i), false);
+        stats.writeBacks += written;
+        maxBlocks -= count;
+        sdWriteCount = sdcard.writeCount;
+    }
+    if (result != Z80SDCard::ok) stats.errors++;
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Drops all frames, dirty ones as well
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCache::invalidate(void) {
+    for (uint16_t i=0; i<Z80SDCACHE_FRAMES; i++) if (frames[i].valid) remove(i);
+    resetStreams();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Read ahead is on by default, off the blocks are read when they are needed
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCache::setReadAhead(bool enable) {
+    readAheadEnabled = enable;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Ends the card access of the cache, if the cache had to access the card
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCache::release(void) {
+    if (cardOpened) sdcard.accessCard(false);
+    cardOpened = false;
+}
+
+uint16_t Z80SDCache::dirtyBlocks(void) {
+    return dirtyFrames;
+}
+
+bool Z80SDCache::contains(uint32_t blockNumber) {
+    synchronize();
+    return find(blockNumber) != Z80SDCACHE_NONE;
+}
+
+bool Z80SDCache::dirty(void) {
+    return dirtyFrames > 0;
+}
+
+//a stream of another user is open on the card, the cache cannot read or write until it has ended
+bool Z80SDCache::streaming(void) {
+    return sdcard.streaming();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Clean frames are dropped, if the card has been written by someone else or it has been initialized again
+ (may be another card)
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCache::synchronize(void) {
+    if ((sdcard.writeCount == sdWriteCount) && (sdcard.initCount == sdInitCount)) return;
+    for (uint16_t i=0; i<Z80SDCACHE_FRAMES; i++) if (frames[i].valid && !frames[i].dirty) remove(i);
+    sdWriteCount = sdcard.writeCount;
+    sdInitCount = sdcard.initCount;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Accesses the card, if the user of the cache has not done it
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCache::openCard(void) {
+    if (sdcard.accessed()) return Z80SDCard::ok;
+    Z80SDCard::sdResult result = sdcard.accessCard(true);
+    cardOpened = result == Z80SDCard::ok;
+    if (!cardOpened) sdcard.accessCard(false);
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Frame of a block, Z80SDCACHE_NONE if it is not cached
+---------------------------------------------------------------------------------------------------------*/
+uint16_t Z80SDCache::find(uint32_t blockNumber) {
+    uint16_t index = buckets[bucket(blockNumber)];
+    while ((index != Z80SDCACHE_NONE) && (frames[index].block != blockNumber)) index = frames[index].hashNext;
+    return index;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Frame of a block, read from the card if it is not cached
+---------------------------------------------------------------------------------------------------------*/
+uint16_t Z80SDCache::load(uint32_t blockNumber, Z80SDCard::sdResult& result) {
+    result = Z80SDCard::ok;
+    uint16_t index = find(blockNumber);
+    if (index != Z80SDCACHE_NONE) {
+        stats.hits++;
+        touch(index);
+        return index;
+    }
+    index = replace(result);
+    if (index == Z80SDCACHE_NONE) return index;
+    result = openCard();
+    if (result == Z80SDCard::ok) result = sdcard.readBlock(blockNumber, frames[index].data);
+    if (result != Z80SDCard::ok) {
+        stats.errors++;
+        return Z80SDCACHE_NONE;
+    }
+    insert(index, blockNumber);
+    stats.misses++;
+    return index;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Frees the least recently used frame, a dirty one is written to the card first
+---------------------------------------------------------------------------------------------------------*/
+uint16_t Z80SDCache::replace(Z80SDCard::sdResult& result) {
+    uint16_t index = lruTail;
+    if (frames[index].dirty) {
+        result = openCard();
+        if (result == Z80SDCard::ok) result = sdcard.writeBlock(frames[index].block, frames[index].data);
+        sdWriteCount = sdcard.writeCount;
+        if (result != Z80SDCard::ok) {
+            stats.errors++;
+            return Z80SDCACHE_NONE;
+        }
+        stats.writeBacks++;
+    }
+    if (frames[index].valid) remove(index);
+    return index;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Hash chains and lru list. A new or used frame goes to the head of the lru list, a removed frame to the
+ tail, it is the next one to be replaced
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCache::insert(uint16_t index, uint32_t blockNumber) {
+    uint16_t b = bucket(blockNumber);
+    frames[index].block = blockNumber;
+    frames[index].valid = true;
+    frames[index].readAhead = false;
+    frames[index].hashNext = buckets[b];
+    buckets[b] = index;
+    touch(index);
+}
+
+void Z80SDCache::remove(uint16_t index) {
+    uint16_t* link = &buckets[bucket(frames[index].block)];
+    while (*link != index) link = &frames[*link].hashNext;
+    *link = frames[index].hashNext;
+    frames[index].valid = false;
+    setDirty(index, false);
+
+    if (index == lruTail) return;
+    if (frames[index].lruPrev != Z80SDCACHE_NONE) frames[frames[index].lruPrev].lruNext = frames[index].lruNext;
+    else lruHead = frames[index].lruNext;
+    frames[frames[index].lruNext].lruPrev = frames[index].lruPrev;
+    frames[index].lruPrev = lruTail;
+    frames[index].lruNext = Z80SDCACHE_NONE;
+    frames[lruTail].lruNext = index;
+    lruTail = index;
+}
+
+void Z80SDCache::touch(uint16_t index) {
+    if (index == lruHead) return;
+    frames[frames[index].lruPrev].lruNext = frames[index].lruNext;
+    if (frames[index].lruNext != Z80SDCACHE_NONE) frames[frames[index].lruNext].lruPrev = frames[index].lruPrev;
+    else lruTail = frames[index].lruPrev;
+    frames[index].lruPrev = Z80SDCACHE_NONE;
+    frames[index].lruNext = lruHead;
+    frames[lruHead].lruPrev = index;
+    lruHead = index;
+}
+
+void Z80SDCache::setDirty(uint16_t index, bool state) {
+    if (frames[index].dirty == state) return;
+    frames[index].dirty = state;
+    if (state) dirtyFrames++;
+    else dirtyFrames--;
+}
+
+uint16_t Z80SDCache::bucket(uint32_t blockNumber) {
+    return (blockNumber ^ (blockNumber >> 12)) & (Z80SDCACHE_BUCKETS - 1);
+}
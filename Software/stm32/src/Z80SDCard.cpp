@@ -1,5 +1,6 @@
 #include <Z80SDCard.h>
 #include <Z80Programs.h>
+#include <SDCrc.h>
 
 /* Types and definitions -------------------------------------------------------------------------------- */  
 #define SPI_OUT_IOPORT      0x10
@@ -8,24 +9,80 @@
 #define SPI_OUT_CLK         0x02
 #define SPI_OUT_SSEL        0x04
 #define SPI_IN_MISO         0x80
+#define DATA_TOKEN          0xFE            //single block read and write, multi block read
+#define DATA_TOKEN_MULTI    0xFC            //multi block write
+#define STOP_TOKEN          0xFD            //ends a multi block write
+#define DATA_ACCEPTED       0x05
+#define DATA_RESPONSE_MASK  0x1F
+#define DATA_CRC_ERROR      0x0B
+#define R1_CRC_ERROR        0x08
+#define SD_CRC_TRIES        3               //single block transfers with a crc error are repeated
 
 const uint8_t cmd0[]   =  {  0 | 0x40, 0x00, 0x00, 0x00, 0x00, 0x94 | 0x01 };
 const uint8_t cmd8[]   =  {  8 | 0x40, 0x00, 0x00, 0x01, 0xAA, 0x86 | 0x01 };
-const uint8_t cmd55[]  =  { 55 | 0x40, 0x00, 0x00, 0x01, 0xAA, 0x86 | 0x01 };
-const uint8_t acmd41[] =  { 41 | 0x40, 0x40, 0x00, 0x00, 0x00, 0x00 | 0x01 };
-const uint8_t cmd58[]  =  { 58 | 0x40, 0x40, 0x00, 0x00, 0x00, 0x00 | 0x01 };
+const uint8_t cmd55[]  =  { 55 | 0x40, 0x00, 0x00, 0x01, 0xAA, 0x20 | 0x01 };
+const uint8_t acmd41[] =  { 41 | 0x40, 0x40, 0x00, 0x00, 0x00, 0x76 | 0x01 };
+const uint8_t cmd58[]  =  { 58 | 0x40, 0x40, 0x00, 0x00, 0x00, 0x6E | 0x01 };
 
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
-Z80SDCard::Z80SDCard(Z80SPI spi) : z80spi(spi) {
+Z80SDCard::Z80SDCard(Z80SPI& spi) : z80spi(spi) {
     sdReady = false;
+    busRequested = false;
+    cardInitialized = false;
+    writeCount = 0;
+    initCount = 0;
+    crcErrors = 0;
+    crcMode = false;
+    stream = noStream;
+    streamBlock = 0;
+    streamRemaining = 0;
+    program = 0;
+    programIndex = 0;
+    programRemaining = 0;
+    streamStart = 0;
+    streamBytes = 0;
+    pollCommand = 0;
+    clearStats();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Telemetry: clears the statistics of all commands. record adds one command, cycles since start
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCard::clearStats(void) {
+    memset(commandStats, 0, sizeof(commandStats));
+    for (uint8_t i=0; i<SD_COMMANDS; i++) commandStats[i].minCycles = UINT32_MAX;
+}
+
+void Z80SDCard::record(uint8_t index, uint32_t start, uint32_t bytes) {
+    commandStats_t& command = commandStats[index % SD_COMMANDS];
+    uint32_t cycles = Z80BusTiming::now() - start;
+    command.count++;
+    command.totalCycles += cycles;
+    command.bytes += bytes;
+    if (cycles < command.minCycles) command.minCycles = cycles;
+    if (cycles > command.maxCycles) command.maxCycles = cycles;
 }
 
 /*--------------------------------------------------------------------------------------------------------
  Writes a program to the beginning of the selected partition
+ Begin checks the partition and opens the write stream, Next writes one block of the program, End closes
+ the stream. programBlocks returns the number of blocks to write
  ---------------------------------------------------------------------------------------------------------*/
 Z80SDCard::sdResult Z80SDCard::writeProgram(uint8_t partition, uint8_t programNumber) {
+    sdResult result = writeProgramBegin(partition, programNumber);
+    for (uint32_t i=0; (i<programBlocks(programNumber)) && (result == ok); i++) result = writeProgramNext();
+    sdResult endResult = writeProgramEnd();
+    return (result == ok) ? endResult : result;
+}
+
+uint32_t Z80SDCard::programBlocks(uint8_t programNumber) {
+    return (z80SDPrograms[programNumber].length + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+}
+
+Z80SDCard::sdResult Z80SDCard::writeProgramBegin(uint8_t partition, uint8_t programNumber) {
+    programRemaining = 0;
     if (partition > 3) return invalid_partition;
     
     //read mbr and check if the requested partition is valid (size > 0)
@@ -35,23 +92,29 @@ Z80SDCard::sdResult Z80SDCard::writeProgram(uint8_t partition, uint8_t programNu
     parseMBR(&mbr, sdDataBuffer);
     if (mbr.partitiontable[partition].size == 0) return invalid_partition;
 
-    //prepare the variables for writing the porgam
-    uint32_t bytesToWrite = z80SDPrograms[programNumber].length;
-    uint32_t blockNumber = mbr.partitiontable[partition].block;
-    uint32_t byteIndex = 0;
-
-    //write data
-    while ((bytesToWrite > 0) && (result == ok)) {
-        //prepare the data block to write
-        //if blocked is not filled by the program, fill the rest with zeros
-        uint16_t nextBlockSize = 512;
-        if (nextBlockSize > bytesToWrite) nextBlockSize = bytesToWrite;
-        bytesToWrite -= nextBlockSize;
-        for (int i=0; i<nextBlockSize; i++) sdDataBuffer[i] = z80SDPrograms[programNumber].data[byteIndex++];
-        for (int i=nextBlockSize; i<512; i++) sdDataBuffer[i] = 0;
-        result = writeBlock(blockNumber++, sdDataBuffer);
-    }
-    return result;
+    //prepare the variables for writing the porgam, all blocks in one stream
+    program = programNumber;
+    programIndex = 0;
+    programRemaining = z80SDPrograms[programNumber].length;
+    return writeBlocksBegin(mbr.partitiontable[partition].block, programBlocks(programNumber));
+}
+
+Z80SDCard::sdResult Z80SDCard::writeProgramNext(void) {
+    if (programRemaining == 0) return write_error;
+
+    //prepare the data block to write
+    //if blocked is not filled by the program, fill the rest with zeros
+    uint16_t nextBlockSize = 512;
+    if (nextBlockSize > programRemaining) nextBlockSize = programRemaining;
+    programRemaining -= nextBlockSize;
+    for (int i=0; i<nextBlockSize; i++) sdDataBuffer[i] = z80SDPrograms[program].data[programIndex++];
+    for (int i=nextBlockSize; i<512; i++) sdDataBuffer[i] = 0;
+    return writeBlocksNext(sdDataBuffer);
+}
+
+Z80SDCard::sdResult Z80SDCard::writeProgramEnd(void) {
+    programRemaining = 0;
+    return writeBlocksEnd();
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -95,7 +158,7 @@ Z80SDCard::sdResult Z80SDCard::formatCard(uint8_t numPartitions, uint32_t partit
 /*--------------------------------------------------------------------------------------------------------
  parse the partition information of a given 512 byte block of data into an MBR structure
  ---------------------------------------------------------------------------------------------------------*/
-void Z80SDCard::parseMBR(mbrResult* mbr, uint8_t* src) {
+void Z80SDCard::parseMBR(mbrResult* mbr, const uint8_t* src) {
 
     //prepare result structure
     mbr->partitions = 0;
@@ -145,6 +208,8 @@ Z80SDCard::mbrResult Z80SDCard::readMBR() {
  Accesses and initalizes the card 
     - request access to the Z80 bus
     - check if a card is present in the slot
+    - a card initialized by an earlier access is kept if it answers CMD13 (SEND_STATUS) with R2 == 0
+      otherwise (removed, reset, not yet initialized) the card is initialized:
     - wakeup the card by sending 80 clocks with ssel high
     - send CMD0 (GO_IDLE_STATE), check R1 response (must be 0x01)
     - send CMD8 (SEND_IF_CONDITION), check R7 rsponse (must be 0x01, 0x00, 0x00, 0x01, 0xAA)
@@ -157,10 +222,20 @@ Z80SDCard::mbrResult Z80SDCard::readMBR() {
 ---------------------------------------------------------------------------------------------------------*/
 Z80SDCard::sdResult Z80SDCard::accessCard(bool state) {
     if (state) {
-        //request bus
-        z80spi.requestBus(true);
-        //check if card is present
-        if(z80spi.checkSDDetect()) return nocard;
+        //request bus, once per access, a failed access has to be closed as well
+        if (!busRequested) z80spi.requestBus(true);
+        busRequested = true;
+        //check if card is present, a removed card has to be initialized again
+        if(z80spi.checkSDDetect()) {
+            cardInitialized = false;
+            return nocard;
+        }
+        //the card of the last access, still ready
+        if (cardInitialized && probeCard()) {
+            sdReady = true;
+            return ok;
+        }
+        cardInitialized = false;
         //wake up card
         z80spi.slaveSelect(true);
         for (int i=0; i<10; i++) z80spi.writeByte(0xFF);
@@ -189,65 +264,72 @@ Z80SDCard::sdResult Z80SDCard::accessCard(bool state) {
         sdCommand((uint8_t*)cmd58, 6, 5);  
         if (sdCmdRxBuffer[0] != 0x00) return invalid_capacity;
         if (!(sdCmdRxBuffer[1] & 0x40)) return invalid_capacity;
+        //CMD59, the card is in spi mode with crc checking off after CMD0
+        if (crcMode && (sendCrcOnOff() != ok)) return invalid_status;
         //done, we know we have a spec 2 card, hc or xd, with 512 byte blocks, and it's ready to read and write data
+        cardInitialized = true;
+        initCount++;
         sdReady = true;
     }
     else {
         sdReady = false;
-        z80spi.requestBus(false);        
+        if (busRequested) z80spi.requestBus(false);
+        busRequested = false;
     }
     return ok;
 }
 
+/*--------------------------------------------------------------------------------------------------------
+ Status of an initialized card, R1 and the second byte of R2 are 0 if it is ready and has no errors
+---------------------------------------------------------------------------------------------------------*/
+bool Z80SDCard::probeCard(void) {
+    uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
+    buildCommand(sdcmd, 13, 0);
+    sdCommand(sdcmd, 6, 2);
+    return (sdCmdRxBuffer[0] == 0x00) && (sdCmdRxBuffer[1] == 0x00);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ True while the card is accessed and initialized
+---------------------------------------------------------------------------------------------------------*/
+bool Z80SDCard::accessed(void) {
+    return sdReady;
+}
+
 /*--------------------------------------------------------------------------------------------------------
  Read one block of data from the SD. Assumes card was accessed before successfully
     - generates CMD17 with the block number (big endian)
     - send the command to the card, and check if the command is accepted
     - read the card, until it has its data ready
     - read the block
-    - read 2 bytes of crc (no CRC checking implemented tough)
+    - read 2 bytes of crc, checked in crc mode. A block with a crc error is read again
 ---------------------------------------------------------------------------------------------------------*/
 Z80SDCard::sdResult Z80SDCard::readBlock(uint32_t blockNumber, uint8_t* dst) {
 
-    if (!sdReady) return not_initialized;
+    if (!sdReady || (stream != noStream)) return not_initialized;
 
     //build the read command
     uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
-    sdcmd[0] = 17 | 0x40;
-    sdcmd[1] = blockNumber >> 24;
-    sdcmd[2] = blockNumber >> 16;
-    sdcmd[3] = blockNumber >>  8;
-    sdcmd[4] = blockNumber;
-    sdcmd[5] = 0 | 0x01;
-
-    //control the ssel manually, not via sdCommand
-    selectCard(false);
-    //send the command to the card
-    sdCommand(sdcmd, 6, 1, 15, false);
-    //ceck if the card accepted the command (is ready)
-    if (sdCmdRxBuffer[0] != 0x00) { selectCard(true); return not_ready; }
-
-    //wait for the card having the data ready
-    bool cardReady = false;
-    for (int i=0; i<1000; i++) {
-        uint8_t rx = z80spi.readByte();
-        if (rx != 0xFF) {
-            cardReady = true;
-            break;
-        }
-    }
-    if (!cardReady) { selectCard(true); return read_timeout; }
-
-    //read data
-    for (int i=0; i<SD_BLOCK_SIZE; i++) dst[i] = z80spi.readByte();
-
-    //read crc
-    z80spi.readByte();
-    z80spi.readByte();
-
-    //done
-    selectCard(true);
-    return ok;
+    buildCommand(sdcmd, 17, blockNumber);
+
+    uint32_t start = Z80BusTiming::now();
+    sdResult result;
+    uint8_t tries = 0;
+    do {
+        //control the ssel manually, not via sdCommand
+        selectCard(false);
+        //send the command to the card
+        sdCommand(sdcmd, 6, 1, 15, false);
+        //ceck if the card accepted the command (is ready)
+        if (sdCmdRxBuffer[0] == 0x00) result = readDataBlock(dst);
+        else if (sdCmdRxBuffer[0] == R1_CRC_ERROR) { crcErrors++; result = crc_error; }
+        else result = not_ready;
+        selectCard(true);
+    } while ((result == crc_error) && (++tries < SD_CRC_TRIES));
+
+    commandStats[17].retries += tries;
+    record(17, start, (result == ok) ? SD_BLOCK_SIZE : 0);
+    return result;
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -261,75 +343,339 @@ Z80SDCard::sdResult Z80SDCard::readBlock(uint32_t blockNumber, uint8_t* dst) {
     - check completion status
     - wait for complete message from card
 ---------------------------------------------------------------------------------------------------------*/
-Z80SDCard::sdResult Z80SDCard::writeBlock(uint32_t blockNumber, uint8_t* src) {
+Z80SDCard::sdResult Z80SDCard::writeBlock(uint32_t blockNumber, const uint8_t* src) {
 
-    if (!sdReady) return not_initialized;
+    if (!sdReady || (stream != noStream)) return not_initialized;
 
     //build the write command
     uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
-    sdcmd[0] = 24 | 0x40;
-    sdcmd[1] = blockNumber >> 24;
-    sdcmd[2] = blockNumber >> 16;
-    sdcmd[3] = blockNumber >>  8;
-    sdcmd[4] = blockNumber;
-    sdcmd[5] = 0 | 0x01;
-
-    //control the ssel manually, not via sdCommand
+    buildCommand(sdcmd, 24, blockNumber);
+
+    uint32_t start = Z80BusTiming::now();
+    sdResult result;
+    uint8_t tries = 0;
+    do {
+        //control the ssel manually, not via sdCommand
+        selectCard(false);
+        //send the command to the card
+        sdCommand(sdcmd, 6, 1, 15, false);
+        //ceck if the card accepted the command (is ready)
+        //dummy write, start token, data and the data response of the card
+        if (sdCmdRxBuffer[0] == 0x00) result = writeDataBlock(DATA_TOKEN, src);
+        else if (sdCmdRxBuffer[0] == R1_CRC_ERROR) { crcErrors++; result = crc_error; }
+        else result = not_ready;
+        selectCard(true);
+    } while ((result == crc_error) && (++tries < SD_CRC_TRIES));
+    commandStats[24].retries += tries;
+    if (result != ok) { record(24, start, 0); return result; }
+
+    //wait completion status
+    selectCard(false);
+    bool cardComplete = waitNotBusy();
+    selectCard(true);
+    record(24, start, cardComplete ? SD_BLOCK_SIZE : 0);
+    if (!cardComplete) return write_timeout_2;
+    writeCount++;
+    return ok;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Multi block transfers on a buffer of count blocks
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::readBlocks(uint32_t blockNumber, uint32_t count, uint8_t* dst) {
+    sdResult result = readBlocksBegin(blockNumber, count);
+    for (uint32_t i=0; (i<count) && (result == ok); i++) result = readBlocksNext(dst + i * SD_BLOCK_SIZE);
+    sdResult endResult = readBlocksEnd();
+    return (result == ok) ? endResult : result;
+}
+
+Z80SDCard::sdResult Z80SDCard::writeBlocks(uint32_t blockNumber, uint32_t count, const uint8_t* src) {
+    sdResult result = writeBlocksBegin(blockNumber, count);
+    for (uint32_t i=0; (i<count) && (result == ok); i++) result = writeBlocksNext(src + i * SD_BLOCK_SIZE);
+    sdResult endResult = writeBlocksEnd();
+    return (result == ok) ? endResult : result;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Multi block read stream
+    - CMD18 (READ_MULTIPLE_BLOCK) with the first block number, the card stays selected
+    - every block: data token, data, crc, like a single block read
+    - CMD12 (STOP_TRANSMISSION), the byte following the command is a stuff byte, then R1 and busy
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::readBlocksBegin(uint32_t blockNumber, uint32_t count) {
+    if (!sdReady || (stream != noStream)) return not_initialized;
+    uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
+    buildCommand(sdcmd, 18, blockNumber);
+    streamStart = Z80BusTiming::now();
+    streamBytes = 0;
     selectCard(false);
-    //send the command to the card
     sdCommand(sdcmd, 6, 1, 15, false);
+    if (sdCmdRxBuffer[0] != 0x00) { selectCard(true); record(18, streamStart, 0); return not_ready; }
+    stream = readStream;
+    streamBlock = blockNumber;
+    streamRemaining = count;
+    return ok;
+}
 
-    //ceck if the card accepted the command (is ready)
-    if (sdCmdRxBuffer[0] != 0x00) { selectCard(true); return not_ready; }
+//a block with a crc error is read again on its own, the stream is restarted behind it if blocks remain.
+//After the last announced block it stays closed, a restart would read past the range
+Z80SDCard::sdResult Z80SDCard::readBlocksNext(uint8_t* dst) {
+    if (stream != readStream) return not_initialized;
+    uint32_t block = streamBlock++;
+    uint32_t remaining = (streamRemaining > 0) ? streamRemaining - 1 : 0;
+    bool last = streamRemaining == 1;
+    streamRemaining = remaining;
+    sdResult result = readDataBlock(dst);
+    if (result == ok) streamBytes += SD_BLOCK_SIZE;
+    if (result != crc_error) return result;
+    commandStats[18].retries++;
+    readBlocksEnd();
+    result = readBlock(block, dst);
+    if ((result == ok) && !last) result = readBlocksBegin(block + 1, remaining);
+    return result;
+}
 
-    //dummy write to generate clocks, then send start token
-    z80spi.writeByte(0xFF);
-    z80spi.writeByte(0xFE);
+Z80SDCard::sdResult Z80SDCard::readBlocksEnd(void) {
+    if (stream != readStream) return ok;
+    uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
+    buildCommand(sdcmd, 12, 0);
+    uint32_t start = Z80BusTiming::now();
+    pollCommand = 12;
+    z80spi.writeBytes(sdcmd, sizeof(sdcmd));
+    z80spi.readByte();
+    sdCommand(sdcmd, 0, 1, 15, false);
+    bool ready = waitNotBusy();
+    selectCard(true);
+    stream = noStream;
+    record(12, start, 0);
+    record(18, streamStart, streamBytes);
+    if (sdCmdRxBuffer[0] != 0x00) return not_ready;
+    return ready ? ok : read_timeout;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Multi block write stream
+    - CMD55 + ACMD23 (SET_WR_BLK_ERASE_COUNT), the card can erase all blocks up front
+    - CMD25 (WRITE_MULTIPLE_BLOCK) with the first block number, the card stays selected
+    - every block: multi block token, data, data response, wait while the card is busy
+    - stop token, wait while the card is busy
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::writeBlocksBegin(uint32_t blockNumber, uint32_t count) {
+    if (!sdReady || (stream != noStream)) return not_initialized;
+    uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
 
-    //send data
-    for (int i=0; i<SD_BLOCK_SIZE; i++) z80spi.writeByte(src[i]);
+    //pre-erase is a hint to the card, a card not supporting it is written anyway
+    sdCommand((uint8_t*)cmd55, 6, 1);
+    buildCommand(sdcmd, 23, count & 0x7FFFFF);
+    sdCommand(sdcmd, 6, 1);
 
-    //wait for completion status, can take 250ms
-    bool cardComplete = false;
-    uint8_t lastRx;
-    for (int i=0; i<10000; i++) {
-        lastRx = z80spi.readByte();
-        if (lastRx != 0xFF) {
-            cardComplete = true;
-            break;
-        }
-    }
-    if (!cardComplete) { selectCard(true); return write_timeout_1; }
+    buildCommand(sdcmd, 25, blockNumber);
+    streamStart = Z80BusTiming::now();
+    streamBytes = 0;
+    selectCard(false);
+    sdCommand(sdcmd, 6, 1, 15, false);
+    if (sdCmdRxBuffer[0] != 0x00) { selectCard(true); record(25, streamStart, 0); return not_ready; }
+    stream = writeStream;
+    streamBlock = blockNumber;
+    streamRemaining = count;
+    return ok;
+}
+
+//the card rejects a block with a crc error. The stream is stopped and restarted at the block, for the block
+//and the remaining ones
+Z80SDCard::sdResult Z80SDCard::writeBlocksNext(const uint8_t* src) {
+    return writeStreamBlock(src, 0);
+}
 
-    //check if everything was ok
-    if ((lastRx & 0x1F) != 0x05) { selectCard(true); return write_error; }
+Z80SDCard::sdResult Z80SDCard::writeBlocksFill(uint8_t value) {
+    return writeStreamBlock(nullptr, value);
+}
+
+Z80SDCard::sdResult Z80SDCard::writeStreamBlock(const uint8_t* src, uint8_t fill) {
+    if (stream != writeStream) return not_initialized;
+    sdResult result;
+    uint8_t tries = 0;
+    do {
+        result = writeDataBlock(DATA_TOKEN_MULTI, src, fill);
+        if (result == crc_error) {
+            commandStats[25].retries++;
+            writeBlocksEnd();
+            sdResult restart = writeBlocksBegin(streamBlock, streamRemaining);
+            if (restart != ok) return restart;
+        }
+    } while ((result == crc_error) && (++tries < SD_CRC_TRIES));
+    if (result != ok) return result;
+    streamBlock++;
+    if (streamRemaining > 0) streamRemaining--;
+    if (!waitNotBusy()) return write_timeout_2;
+    streamBytes += SD_BLOCK_SIZE;
+    writeCount++;
+    return ok;
+}
 
-    //set ssel line
+Z80SDCard::sdResult Z80SDCard::writeBlocksEnd(void) {
+    if (stream != writeStream) return ok;
+    const uint8_t stopToken[] = { STOP_TOKEN, 0xFF };       //stop token, then one byte before the card is busy
+    z80spi.writeBytes(stopToken, sizeof(stopToken));
+    bool ready = waitNotBusy();
     selectCard(true);
+    stream = noStream;
+    record(25, streamStart, streamBytes);
+    return ready ? ok : write_timeout_2;
+}
 
-    //wait completion status
+/*--------------------------------------------------------------------------------------------------------
+ Erases a range of blocks, first and last included
+    - CMD32 (ERASE_WR_BLK_START_ADDR) and CMD33 (ERASE_WR_BLK_END_ADDR) with the block numbers
+    - CMD38 (ERASE), the card is busy until the range is erased, up to seconds for large ranges
+ The card erases while it is deselected, busy() polls it. Caches drop their blocks (writeCount)
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::eraseBlocks(uint32_t firstBlock, uint32_t lastBlock) {
+    if (!sdReady || (stream != noStream)) return not_initialized;
+    uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
+    buildCommand(sdcmd, 32, firstBlock);
+    sdCommand(sdcmd, 6, 1);
+    if (sdCmdRxBuffer[0] != 0x00) return erase_error;
+    buildCommand(sdcmd, 33, lastBlock);
+    sdCommand(sdcmd, 6, 1);
+    if (sdCmdRxBuffer[0] != 0x00) return erase_error;
+    buildCommand(sdcmd, 38, 0);
+    sdCommand(sdcmd, 6, 1);
+    if (sdCmdRxBuffer[0] != 0x00) return erase_error;
+    writeCount++;
+    return ok;
+}
+
+bool Z80SDCard::busy(void) {
     selectCard(false);
-    cardComplete = false;
+    bool cardBusy = z80spi.readByte() != 0xFF;
+    selectCard(true);
+    commandStats[pollCommand].busyPolls++;
+    return cardBusy;
+}
+
+//a multi block read or write is open, single block commands are refused until it has ended
+bool Z80SDCard::streaming(void) {
+    return stream != noStream;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Data block of a read: wait for the data token, then the data and the crc in one burst
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::readDataBlock(uint8_t* dst) {
+    uint8_t token = 0xFF;
+    for (int i=0; i<1000; i++) {
+        token = z80spi.readByte();
+        if (token != 0xFF) break;
+        commandStats[pollCommand].busyPolls++;
+    }
+    if (token == 0xFF) return read_timeout;
+    if (token != DATA_TOKEN) return read_error;
+
+    uint8_t crc[2];
+    z80spi.readBytes(dst, SD_BLOCK_SIZE);
+    z80spi.readBytes(crc, sizeof(crc));
+    if (crcMode && (sdCrc16(dst, SD_BLOCK_SIZE) != ((crc[0] << 8) | crc[1]))) {
+        crcErrors++;
+        return crc_error;
+    }
+    return ok;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Data block of a write: a dummy byte to generate clocks, the token, the data. Without crc mode, the crc
+ bytes are clocked while waiting for the data response (MOSI high)
+ Without src, all bytes of the block are fill. Its crc is chained over a short pattern
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::writeDataBlock(uint8_t token, const uint8_t* src, uint8_t fill) {
+    const uint8_t startToken[] = { 0xFF, token };
+    z80spi.writeBytes(startToken, sizeof(startToken));
+    if (src != nullptr) z80spi.writeBytes(src, SD_BLOCK_SIZE);
+    else z80spi.fillBytes(fill, SD_BLOCK_SIZE);
+    if (crcMode) {
+        uint16_t crc = 0;
+        if (src != nullptr) crc = sdCrc16(src, SD_BLOCK_SIZE);
+        else {
+            uint8_t pattern[16];
+            memset(pattern, fill, sizeof(pattern));
+            for (uint16_t i=0; i<SD_BLOCK_SIZE / sizeof(pattern); i++) crc = sdCrc16(pattern, sizeof(pattern), crc);
+        }
+        const uint8_t crcBytes[] = { (uint8_t)(crc >> 8), (uint8_t)crc };
+        z80spi.writeBytes(crcBytes, sizeof(crcBytes));
+    }
+
+    //wait for data response, can take 250ms
+    uint8_t lastRx = 0xFF;
     for (int i=0; i<10000; i++) {
         lastRx = z80spi.readByte();
-        if (lastRx == 0xFF) {
-            cardComplete = true;
-            break;
-        }
+        if (lastRx != 0xFF) break;
+        commandStats[pollCommand].busyPolls++;
     }
-    selectCard(true);
-    if (!cardComplete) return write_timeout_2; 
+    if (lastRx == 0xFF) return write_timeout_1;
+    if ((lastRx & DATA_RESPONSE_MASK) == DATA_CRC_ERROR) {
+        crcErrors++;
+        return crc_error;
+    }
+    if ((lastRx & DATA_RESPONSE_MASK) != DATA_ACCEPTED) return write_error;
     return ok;
 }
 
+/*--------------------------------------------------------------------------------------------------------
+ The card holds MISO low while it is busy
+---------------------------------------------------------------------------------------------------------*/
+bool Z80SDCard::waitNotBusy(void) {
+    for (int i=0; i<10000; i++) {
+        if (z80spi.readByte() == 0xFF) return true;
+        commandStats[pollCommand].busyPolls++;
+    }
+    return false;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Command with a 32 bit argument (big endian) and its crc7. The card checks it for CMD0 and CMD8, and for
+ all commands in crc mode
+---------------------------------------------------------------------------------------------------------*/
+void Z80SDCard::buildCommand(uint8_t* cmd, uint8_t index, uint32_t argument) {
+    cmd[0] = index | 0x40;
+    cmd[1] = argument >> 24;
+    cmd[2] = argument >> 16;
+    cmd[3] = argument >>  8;
+    cmd[4] = argument;
+    cmd[5] = sdCrc7(cmd, 5);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ CRC mode: the card checks the crc of commands and data blocks (CMD59), the library checks the crc of the
+ data blocks read. Transfers with a crc error are repeated, see crcErrors. Kept for the following accesses
+---------------------------------------------------------------------------------------------------------*/
+Z80SDCard::sdResult Z80SDCard::setCrcMode(bool enable) {
+    crcMode = enable;
+    if (!sdReady) return ok;
+    if (stream != noStream) return not_initialized;
+    return sendCrcOnOff();
+}
+
+bool Z80SDCard::getCrcMode(void) {
+    return crcMode;
+}
+
+Z80SDCard::sdResult Z80SDCard::sendCrcOnOff(void) {
+    uint8_t sdcmd[SD_COMMAND_BUFFER_LENGTH];
+    buildCommand(sdcmd, 59, crcMode ? 1 : 0);
+    sdCommand(sdcmd, 6, 1);
+    return (sdCmdRxBuffer[0] == 0x00) ? ok : not_ready;
+}
+
 /*--------------------------------------------------------------------------------------------------------
  Send command and wait for expected amount of bytes reponse (first accepted byte is byte with MSB = 0)
 ---------------------------------------------------------------------------------------------------------*/
 void Z80SDCard::sdCommand(uint8_t* cmd, uint8_t txlen, uint8_t rxlen, uint8_t maxtries, bool controlssel) {
+    uint32_t start = Z80BusTiming::now();
+    if (txlen > 0) pollCommand = cmd[0] & 0x3F;
     //select the card
     if(controlssel) selectCard(false);
     //send the required amount of bytes
-    for (int i=0; i<txlen; i++) z80spi.writeByte(cmd[i]);
+    z80spi.writeBytes(cmd, txlen);
     //check response. read until the byte has highest bit cleared. then read remaining bytes
     //put the data in the response buffer
     for (int i=0; i<maxtries; i++) {
@@ -339,6 +685,8 @@ void Z80SDCard::sdCommand(uint8_t* cmd, uint8_t txlen, uint8_t rxlen, uint8_t ma
     for (int i=1; i<rxlen; i++) sdCmdRxBuffer[i] = z80spi.readByte();
     //deselect card
     if(controlssel) selectCard(true);
+    //commands with manual ssel are part of a transfer, recorded there
+    if(controlssel) record(cmd[0] & 0x3F, start, 0);
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -8,48 +8,100 @@
 #define SPI_OUT_SSEL        0x04
 #define SPI_IN_MISO         0x80
 #define SPI_IN_SDDET        0x40
+#define SPI_OUT_LINES       (SPI_OUT_MOSI | SPI_OUT_CLK | SPI_OUT_SSEL)
 
 /*--------------------------------------------------------------------------------------------------------
  Constructor
 ---------------------------------------------------------------------------------------------------------*/
-Z80SPI::Z80SPI(Z80IO io) : z80io(io) {
+Z80SPI::Z80SPI(Z80IO& io) : z80io(io) {
     outputBuffer = SPI_OUT_MOSI | SPI_OUT_SSEL;
+    memset(&stats, 0, sizeof(stats));
 }
 
 /*--------------------------------------------------------------------------------------------------------
- Write a single byte
+ Single bytes, one burst each
 ---------------------------------------------------------------------------------------------------------*/
 void Z80SPI::writeByte(uint8_t data) {
-    uint8_t mask = 0x80;
-    for (int i=0; i<8; i++) {
-        outputBuffer = outputBuffer & ~SPI_OUT_CLK;
-        if (data & mask) outputBuffer = outputBuffer | SPI_OUT_MOSI;
-        else outputBuffer = outputBuffer & ~SPI_OUT_MOSI;
-        mask = mask >> 1;
-        z80io.write(SPI_OUT_IOPORT, outputBuffer);
-        outputBuffer = outputBuffer | SPI_OUT_CLK;
-        z80io.write(SPI_OUT_IOPORT, outputBuffer);
+    transfer(&data, nullptr, 1);
+}
+
+uint8_t Z80SPI::readByte(void) {
+    uint8_t result;
+    transfer(nullptr, &result, 1);
+    return result;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Bulk transfers, MOSI is held high while reading
+---------------------------------------------------------------------------------------------------------*/
+void Z80SPI::writeBytes(const uint8_t* data, uint32_t length) {
+    transfer(data, nullptr, length);
+}
+
+void Z80SPI::readBytes(uint8_t* data, uint32_t length) {
+    transfer(nullptr, data, length);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Sends the same byte length times in one burst, for pattern blocks without a source buffer. The latch
+ values of the 8 bits are computed once
+---------------------------------------------------------------------------------------------------------*/
+void Z80SPI::fillBytes(uint8_t data, uint32_t length) {
+    const uint8_t clockLow[2] = { (uint8_t)(outputBuffer & ~(SPI_OUT_CLK | SPI_OUT_MOSI)), (uint8_t)((outputBuffer & ~SPI_OUT_CLK) | SPI_OUT_MOSI) };
+    uint8_t edges[16];
+    for (uint8_t i=0; i<8; i++) {
+        uint8_t bit = (data >> (7 - i)) & 0x01;
+        edges[2*i] = clockLow[bit];
+        edges[2*i + 1] = clockLow[bit] | SPI_OUT_CLK;
     }
-    outputBuffer = outputBuffer & ~SPI_OUT_CLK;
-    outputBuffer = outputBuffer | SPI_OUT_MOSI;
-    z80io.write(SPI_OUT_IOPORT, outputBuffer);
+
+    stats.bytes += length;
+    stats.transfers++;
+    z80io.burstBegin(SPI_OUT_IOPORT);
+    for (uint32_t i=0; i<length; i++) {
+        for (uint8_t edge=0; edge<sizeof(edges); edge++) z80io.burstWrite(SPI_OUT_IOPORT, edges[edge]);
+    }
+    outputBuffer = clockLow[1];
+    z80io.burstWrite(SPI_OUT_IOPORT, outputBuffer);
+    z80io.burstEnd();
 }
 
 /*--------------------------------------------------------------------------------------------------------
- Read a single byte
+ Full duplex transfer, tx or rx can be nullptr. One burst for all bytes, per bit:
+    - clock low with the MOSI level (the card shifts its next bit out on the falling edge)
+    - clock high (the card samples MOSI on the rising edge)
+    - MISO read, only if there is something to receive
+ Only the writes with a rising line (clock high, MOSI high) wait for the data setup time
 ---------------------------------------------------------------------------------------------------------*/
-uint8_t Z80SPI::readByte(void) {
-    uint8_t result = 0;
-    for (int i=0; i<8; i++) {
-        result = result << 1;        
-        outputBuffer = outputBuffer | SPI_OUT_CLK;
-        z80io.write(SPI_OUT_IOPORT, outputBuffer);
-        uint8_t data = z80io.read(SPI_IN_IOPORT);
-        if (data & SPI_IN_MISO) result = result | 0x01;
-        outputBuffer = outputBuffer & ~SPI_OUT_CLK;
-        z80io.write(SPI_OUT_IOPORT, outputBuffer);
+void Z80SPI::transfer(const uint8_t* tx, uint8_t* rx, uint32_t length) {
+    const uint8_t clockLow[2] = { (uint8_t)(outputBuffer & ~(SPI_OUT_CLK | SPI_OUT_MOSI)), (uint8_t)((outputBuffer & ~SPI_OUT_CLK) | SPI_OUT_MOSI) };
+    const uint8_t clockHigh[2] = { (uint8_t)(clockLow[0] | SPI_OUT_CLK), (uint8_t)(clockLow[1] | SPI_OUT_CLK) };
+
+    stats.bytes += length;
+    stats.transfers++;
+    z80io.burstBegin(SPI_OUT_IOPORT);
+    for (uint32_t i=0; i<length; i++) {
+        uint8_t data = tx ? tx[i] : 0xFF;
+        uint8_t result = 0;
+        for (uint8_t mask=0x80; mask; mask >>= 1) {
+            uint8_t bit = (data & mask) ? 1 : 0;
+            z80io.burstWrite(SPI_OUT_IOPORT, clockLow[bit]);
+            z80io.burstWrite(SPI_OUT_IOPORT, clockHigh[bit]);
+            if (rx && (z80io.burstRead(SPI_IN_IOPORT) & SPI_IN_MISO)) result |= mask;
+        }
+        if (rx) rx[i] = result;
     }
-    return result;
+    outputBuffer = clockLow[1];
+    z80io.burstWrite(SPI_OUT_IOPORT, outputBuffer);
+    z80io.burstEnd();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ the other bits of the output port (sram bank) are written with every clock edge. While the Z80 is
+ running, they have to be the ones the Z80 has set, otherwise its memory is switched away
+---------------------------------------------------------------------------------------------------------*/
+void Z80SPI::setOutputLatch(uint8_t latch) {
+    outputBuffer = (outputBuffer & SPI_OUT_LINES) | (latch & ~SPI_OUT_LINES);
 }
 
 /*--------------------------------------------------------------------------------------------------------
@@ -75,7 +127,7 @@ bool Z80SPI::checkSDDetect(void) {
 void Z80SPI::requestBus(bool request) {
     z80io.requestBus(request);
     if (request) {
-        outputBuffer = SPI_OUT_MOSI | SPI_OUT_SSEL;
+        outputBuffer = (outputBuffer & ~SPI_OUT_LINES) | SPI_OUT_MOSI | SPI_OUT_SSEL;
         z80io.write(SPI_OUT_IOPORT, outputBuffer);
     }
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include <Z80Trace.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define TRACE_MODE_NEXT         0x00
+#define TRACE_MODE_SHORT        0x10
+#define TRACE_MODE_ABSOLUTE     0x20
+#define TRACE_MODE_MARKER       0x30
+#define TRACE_DELTA_VARINT      0x0F
+
+const uint8_t trace_magic[] = "Z80T";
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+Z80TraceEncoder::Z80TraceEncoder(void) {
+    lastTime = 0;
+    lastMemory = lastIo = 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ starts a new stream, writes the header and resets the delta state. Returns the number of bytes written
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80TraceEncoder::header(uint8_t* buffer, uint32_t clockHz, uint32_t startTime) {
+    lastTime = startTime;
+    lastMemory = lastIo = 0;
+
+    for (uint8_t i=0; i<4; i++) buffer[i] = trace_magic[i];
+    buffer[4] = Z80TRACE_VERSION;
+    for (uint8_t i=0; i<4; i++) buffer[5+i] = clockHz >> (8*i);
+    buffer[9] = Z80TRACE_TIME_SHIFT;
+    return Z80TRACE_HEADER_LEN;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ encodes one bus cycle, returns the number of bytes written (max Z80TRACE_MAX_RECORD_LEN)
+ The time is only advanced by whole time units, so the rounding error does not accumulate
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80TraceEncoder::encode(const z80TraceRecord_t& record, uint8_t* buffer) {
+    uint32_t delta = (record.time - lastTime) >> Z80TRACE_TIME_SHIFT;
+    lastTime += delta << Z80TRACE_TIME_SHIFT;
+
+    uint8_t length = 1;
+    buffer[0] = (record.type & 0x03) << 6;
+    if (delta < TRACE_DELTA_VARINT) buffer[0] |= delta;
+    else {
+        buffer[0] |= TRACE_DELTA_VARINT;
+        length += varint(delta - TRACE_DELTA_VARINT, &buffer[length]);
+    }
+
+    bool io = (record.type == ioRead) || (record.type == ioWrite);
+    uint16_t& last = io ? lastIo : lastMemory;
+    int32_t offset = (int32_t)record.address - (int32_t)last;
+    if ((io && (offset == 0)) || (!io && (offset == 1))) buffer[0] |= TRACE_MODE_NEXT;
+    else if ((io && ((record.address & 0xFF00) == (last & 0xFF00))) || (!io && (offset >= -128) && (offset <= 127))) {
+        buffer[0] |= TRACE_MODE_SHORT;
+        buffer[length++] = io ? (record.address & 0xFF) : (uint8_t)(int8_t)offset;
+    }
+    else {
+        buffer[0] |= TRACE_MODE_ABSOLUTE;
+        buffer[length++] = record.address & 0xFF;
+        buffer[length++] = record.address >> 8;
+    }
+    last = record.address;
+
+    buffer[length++] = record.data;
+    return length;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ encodes a marker, returns the number of bytes written
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80TraceEncoder::marker(markerType marker, uint32_t value, uint8_t* buffer) {
+    buffer[0] = (marker << 6) | TRACE_MODE_MARKER;
+    return 1 + varint(value, &buffer[1]);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ unsigned LEB128, max 5 bytes for 32 bits
+---------------------------------------------------------------------------------------------------------*/
+uint8_t Z80TraceEncoder::varint(uint32_t value, uint8_t* buffer) {
+    uint8_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[length++] = value;
+    return length;
+}
@@ -14,8 +14,17 @@
 #include <Z80IO.h>
 #include <Z80SPI.h>
 #include <Z80SDCard.h>
+#include <Z80SDCache.h>
 #include <CPMFileSystem.h>
+#include <JobEngine.h>
+#include <SDJobs.h>
+#include <SDTransfer.h>
 #include <FlashLoader.h>
+#include <Z80CaptureArena.h>
+#include <Z80BusSniffer.h>
+#include <Z80Profiler.h>
+#include <Z80IOTrap.h>
+#include <Z80IODevices.h>
 #include <Bootloader.h>
 
 /* Types and definitions -------------------------------------------------------------------------------- */
@@ -43,9 +52,23 @@ Z80Bus z80bus;
 Z80IO z80io(z80bus);
 Z80SPI z80spi(z80io);
 Z80SDCard z80sdcard(z80spi);
+Z80SDCache z80sdcache(z80sdcard);
 Z80Flash z80flash(z80bus);
 FlashLoader flashloader(z80flash);
-CPMFileSystem filesystem(CPMFileSystem::geometry_8k_8m_32_512, z80sdcard, z80bus);
+Z80IOTrap iotrap(z80bus);
+Z80CaptureArena capturearena;
+Z80BusSniffer sniffer(z80bus, iotrap, capturearena);
+Z80Profiler profiler(z80bus, capturearena);
+Z80IOMultiplier iomultiplier;
+Z80IOConsoleFifo ioconsolefifo;
+Z80IOBlockCopy ioblockcopy(z80bus);
+JobEngine jobengine(z80bus);
+Z80IODisk iodisk(z80sdcache, z80spi, jobengine, iotrap.stats.missed);
+CPMFileSystem filesystem(CPMFileSystem::geometry_8k_8m_32_512, z80sdcard, z80sdcache, z80bus);
+SDFormatJob formatjob(z80sdcard, z80sdcache);
+SDProgramJob programjob(z80sdcard, z80sdcache);
+CPMListJob listjob(filesystem);
+SDTransfer sdtransfer(z80sdcache, filesystem, jobengine);
 
 /*#########################################################################################################
  Main Program5
@@ -68,6 +91,11 @@ void setup() {
 	}
 
 	console.begin();
+	iotrap.attach(iomultiplier, 0x60, 4);
+	iotrap.attach(ioconsolefifo, 0x64, 2);
+	iotrap.attach(ioblockcopy, 0x66, 2);
+	iotrap.attach(iodisk, 0x68, 7);
+	iotrap.start(config.configdata.clock.z80Clock);
 	z80bus.resetZ80();
 	delay(STARTUP_DELAY_ms);
 	
@@ -82,13 +110,20 @@ void loop() {
    
 	//Process modules
 	flashloader.process();
+	sniffer.process();
+	profiler.process();
+	iotrap.process();
+	jobengine.process();
+	console.process();
    	statusLed.process();
    	button.process();
 
-	//Process Serial Data
-	int rx = Serial.read();	
-	if (rx != -1){
-		if (!flashloader.serialUpdate((uint8_t) rx)) {			
+	//Process Serial Data, all bytes received since the last loop (a job slice takes a few milliseconds)
+	//a running sd transfer gets all bytes, its packets are binary
+	int rx;
+	while ((rx = Serial.read()) != -1) {
+		if (sdtransfer.serialUpdate((uint8_t) rx)) continue;
+		if (!flashloader.serialUpdate((uint8_t) rx) && !sniffer.serialUpdate((uint8_t) rx) && !profiler.serialUpdate((uint8_t) rx)) {			
 			bootloader_magicSentence((uint8_t) rx);
 			console.serialUpdate((uint8_t) rx);
 		}
@@ -0,0 +1,110 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* Variables and instances ------------------------------------------------------------------------------ */
+uint32_t SystemCoreClock = SIM_CORE_CLOCK_Hz;
+SimDWT_TypeDef simDWT;
+SimCoreDebug_TypeDef simCoreDebug;
+SimSerial Serial;
+
+static uint64_t virtualCycles = 0;
+
+/*--------------------------------------------------------------------------------------------------------
+ Virtual clock
+---------------------------------------------------------------------------------------------------------*/
+void simAdvance(uint32_t cycles) {
+    virtualCycles += cycles;
+}
+
+uint64_t simCycles(void) {
+    return virtualCycles;
+}
+
+SimCycleCounter::operator uint32_t() const {
+    virtualCycles += SIM_CYCCNT_READ_CYCLES;
+    return (uint32_t)virtualCycles;
+}
+
+SimCycleCounter& SimCycleCounter::operator=(uint32_t value) {
+    //the virtual clock keeps running, only the visible counter could be reset on the target
+    (void)value;
+    return *this;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Arduino time functions, based on the virtual clock
+---------------------------------------------------------------------------------------------------------*/
+uint32_t millis(void) {
+    return virtualCycles / (SIM_CORE_CLOCK_Hz / 1000);
+}
+
+uint32_t micros(void) {
+    return virtualCycles / (SIM_CORE_CLOCK_Hz / 1000000);
+}
+
+void delay(uint32_t ms) {
+    virtualCycles += (uint64_t)ms * (SIM_CORE_CLOCK_Hz / 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    virtualCycles += (uint64_t)us * (SIM_CORE_CLOCK_Hz / 1000000);
+}
+
+void yield(void) {
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Serial port on stdin/stdout
+---------------------------------------------------------------------------------------------------------*/
+int SimSerial::available(void) {
+    struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+    return (poll(&input, 1, 0) > 0) && (input.revents & POLLIN) ? 1 : 0;
+}
+
+int SimSerial::read(void) {
+    if (!available()) return -1;
+    uint8_t data;
+    if (::read(STDIN_FILENO, &data, 1) != 1) return -1;
+    return data;
+}
+
+size_t SimSerial::write(uint8_t data) {
+    fputc(data, output ? output : stdout);
+    return 1;
+}
+
+size_t SimSerial::write(const uint8_t* buffer, size_t length) {
+    fwrite(buffer, 1, length, output ? output : stdout);
+    return length;
+}
+
+size_t SimSerial::print(const char* text) {
+    return write((const uint8_t*)text, strlen(text));
+}
+
+size_t SimSerial::print(long value, int base) {
+    char text[24];
+    snprintf(text, sizeof(text), base == HEX ? "%lX" : "%ld", value);
+    return print(text);
+}
+
+size_t SimSerial::println(const char* text) {
+    return print(text) + print("\r\n");
+}
+
+size_t SimSerial::println(long value, int base) {
+    return print(value, base) + print("\r\n");
+}
+
+size_t SimSerial::printf(const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) return 0;
+    if (length >= (int)sizeof(text)) length = sizeof(text) - 1;
+    return write((const uint8_t*)text, length);
+}
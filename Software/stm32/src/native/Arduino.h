@@ -0,0 +1,99 @@
+/* -------------------------------------------------------------------------------------------------------
+ Arduino and CMSIS replacement for the native (host) build
+
+ Only used by the PlatformIO native environment, it provides the small part of the Arduino and CMSIS
+ API the teachZ80 driver stack uses, so the drivers compile unchanged on the development host:
+    - time functions (millis, micros, delay, delayMicroseconds), based on a virtual clock
+    - the DWT cycle counter used by Z80BusTiming, also based on the virtual clock
+    - a Serial object writing to stdout and reading from stdin
+
+ Virtual clock:
+ The host is not cycle accurate, and real waiting would make the simulation slow. Instead, time is a
+ virtual core clock counter at the target frequency. Each simulated register access advances it by a
+ few cycles (see SimBoard.h), a delay advances it immediately. Timing loops in the drivers therefore
+ terminate the same way as on the target, and benchmarks report the estimated time on the target.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <ctype.h>
+
+    #define SIM_CORE_CLOCK_Hz           216000000
+    #define SIM_CYCCNT_READ_CYCLES      2           //one iteration of a wait loop
+
+    #define HEX                         16
+    #define DEC                         10
+
+    extern uint32_t SystemCoreClock;
+
+    //virtual clock
+    void simAdvance(uint32_t cycles);
+    uint64_t simCycles(void);
+
+    //arduino time functions
+    uint32_t millis(void);
+    uint32_t micros(void);
+    void delay(uint32_t ms);
+    void delayMicroseconds(uint32_t us);
+    void yield(void);
+
+    //dwt cycle counter, reads advance the virtual clock
+    struct SimCycleCounter {
+        operator uint32_t() const;
+        SimCycleCounter& operator=(uint32_t value);
+    };
+
+    struct SimDWT_TypeDef {
+        uint32_t CTRL;
+        uint32_t LAR;
+        SimCycleCounter CYCCNT;
+    };
+
+    struct SimCoreDebug_TypeDef {
+        uint32_t DEMCR;
+    };
+
+    extern SimDWT_TypeDef simDWT;
+    extern SimCoreDebug_TypeDef simCoreDebug;
+
+    #define DWT                             (&simDWT)
+    #define CoreDebug                       (&simCoreDebug)
+    #define DWT_CTRL_CYCCNTENA_Msk          0x00000001UL
+    #define CoreDebug_DEMCR_TRCENA_Msk      0x01000000UL
+
+    //serial port on stdin/stdout
+    #define SIM_SERIAL_TX_BUFFER            1024
+
+    class SimSerial {
+
+        public:
+            void begin(uint32_t baud) { (void)baud; }
+            int available(void);
+            int read(void);
+            size_t write(uint8_t data);
+            size_t write(const uint8_t* buffer, size_t length);
+            size_t print(const char* text);
+            size_t print(long value, int base = DEC);
+            size_t println(const char* text = "");
+            size_t println(long value, int base = DEC);
+            size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+            void flush(void) { fflush(stdout); }
+            int availableForWrite(void) { return SIM_SERIAL_TX_BUFFER; }
+            void redirect(FILE* file) { output = file; }     //nullptr: stdout
+
+        private:
+            FILE* output = nullptr;
+
+    };
+
+    extern SimSerial Serial;
+
+#endif
@@ -0,0 +1,153 @@
+#include <SimBoard.h>
+
+/* Variables and instances ------------------------------------------------------------------------------ */
+SimBoard simBoard;
+
+/*--------------------------------------------------------------------------------------------------------
+ Simulated GPIO port
+---------------------------------------------------------------------------------------------------------*/
+SimGpio::SimGpio(SimBoard* board, uint8_t index) : ODR(this, false), BSRR(this, true), IDR(this), board(board), index(index) {
+    MODER = OTYPER = OSPEEDR = PUPDR = 0;
+    output = 0xFFFF;
+}
+
+//bsrr: set bits have priority over reset bits, like on the stm32
+void SimGpio::write(uint32_t value, bool bsrr) {
+    simAdvance(SIM_GPIO_WRITE_CYCLES);
+    if (bsrr) output = (output & ~(value >> 16) & 0xFFFF) | (value & 0xFFFF);
+    else output = value & 0xFFFF;
+    board->update();
+}
+
+uint32_t SimGpio::read(void) {
+    simAdvance(SIM_GPIO_READ_CYCLES);
+    return output & board->portInput(index);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+SimBoard::SimBoard(void) : portA(this, 0), portB(this, 1), portC(this, 2) {
+    flashBank = false;
+    monitor = nullptr;
+    powerOn();
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ brings the board into the power on state, the flash memory and the sd card image are kept
+---------------------------------------------------------------------------------------------------------*/
+void SimBoard::powerOn(void) {
+    portA.output = portB.output = portC.output = 0xFFFF;
+    lastA = lastB = lastC = 0xFFFF;
+    output0 = output1 = 0;
+    readData = 0xFF;
+    flashEnabled = true;
+    memset(sram, 0, sizeof(sram));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ called after every output change, decodes the completed bus cycles
+    - write cycles complete with the rising edge of WR, the data is taken before the edge
+    - read cycles complete with the rising edge of RD, the data was provided through portInput
+---------------------------------------------------------------------------------------------------------*/
+void SimBoard::update(void) {
+    uint32_t portAOut = portA.output, portBOut = portB.output, portCOut = portC.output;
+
+    if (portAOut & PORTA_PIN_RESET) flashEnabled = true;
+    if ((lastA & PORTA_PIN_BUSREQ) && !(portAOut & PORTA_PIN_BUSREQ)) stats.busRequests++;
+
+    bool lastMreq  = !(lastC & PORTC_PIN_MREQ);
+    bool lastIoreq = !(lastA & PORTA_PIN_IOREQ);
+    bool wrRising  = !(lastC & PORTC_PIN_WR) && (portCOut & PORTC_PIN_WR);
+    bool rdRising  = !(lastA & PORTA_PIN_RD) && (portAOut & PORTA_PIN_RD);
+
+    if (wrRising) {
+        if (lastMreq) {
+            memoryWrite(lastB, portCToData(lastC));
+            if (monitor) monitor(1, lastB, portCToData(lastC));
+        }
+        else if (lastIoreq) {
+            ioWrite(lastB & 0xFF, portCToData(lastC));
+            if (monitor) monitor(3, lastB, portCToData(lastC));
+        }
+    }
+    if (rdRising) {
+        if (lastMreq) {
+            stats.memReads++;
+            if (flashEnabled) flash.endOfRead();
+            if (monitor) monitor(0, lastB, readData);
+        }
+        else if (lastIoreq) {
+            stats.ioReads++;
+            if ((lastB & 0xF0) == SIM_IOPORT_FLASH_DISABLE) flashEnabled = false;
+            if (monitor) monitor(2, lastB, readData);
+        }
+    }
+
+    lastA = portAOut;
+    lastB = portBOut;
+    lastC = portCOut;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ levels devices drive onto a port, the data bus during read cycles, all other lines are released
+---------------------------------------------------------------------------------------------------------*/
+uint32_t SimBoard::portInput(uint8_t index) {
+    if (index != 2) return 0xFFFF;
+    bool rd    = !(portA.output & PORTA_PIN_RD);
+    bool mreq  = !(portC.output & PORTC_PIN_MREQ);
+    bool ioreq = !(portA.output & PORTA_PIN_IOREQ);
+    if (!rd) return 0xFFFF;
+    if (mreq) readData = memoryRead(portB.output);
+    else if (ioreq) readData = ioRead(portB.output & 0xFF);
+    else return 0xFFFF;
+    return dataToPortC(readData) | (0xFFFF & ~PORTC_DATA_LINES_IN_USE);
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ memory
+---------------------------------------------------------------------------------------------------------*/
+uint32_t SimBoard::sramAddress(uint16_t address) {
+    if (address & 0x8000) return SIM_SRAM_HIGH_BANK * SIM_SRAM_BANK_SIZE + (address & 0x7FFF);
+    return (output0 >> 4) * SIM_SRAM_BANK_SIZE + address;
+}
+
+uint8_t SimBoard::sramRead(uint16_t address) {
+    return sram[sramAddress(address)];
+}
+
+uint8_t SimBoard::memoryRead(uint16_t address) {
+    if (flashEnabled) return flash.read((flashBank ? 0x10000 : 0) | address);
+    return sram[sramAddress(address)];
+}
+
+void SimBoard::memoryWrite(uint16_t address, uint8_t data) {
+    stats.memWrites++;
+    if (flashEnabled) flash.write((flashBank ? 0x10000 : 0) | address, data);
+    sram[sramAddress(address)] = data;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ io ports, decoded by the upper 4 address bits
+---------------------------------------------------------------------------------------------------------*/
+uint8_t SimBoard::ioRead(uint8_t ioport) {
+    if ((ioport & 0xF0) != SIM_IOPORT_IN_0) return 0xFF;
+    uint8_t input = 0xFF & ~SIM_IN_0_MISO;
+    if (sdcard.miso()) input |= SIM_IN_0_MISO;
+    if (sdcard.inserted()) input &= ~SIM_IN_0_SDDET;
+    return input;
+}
+
+void SimBoard::ioWrite(uint8_t ioport, uint8_t data) {
+    stats.ioWrites++;
+    switch (ioport & 0xF0) {
+        case SIM_IOPORT_OUT_0:
+            output0 = data;
+            sdcard.spi(data & SIM_OUT_0_SSEL, data & SIM_OUT_0_CLK, data & SIM_OUT_0_MOSI);
+            break;
+        case SIM_IOPORT_OUT_1:
+            output1 = data;
+            break;
+    }
+}
@@ -0,0 +1,134 @@
+/* -------------------------------------------------------------------------------------------------------
+ Simulated teachZ80 board for the native (host) build
+
+ Replaces the GPIO ports A, B and C of the STM32 with simulated ports (selected by Z80BusGpio.h), and
+ decodes the bus cycles the drivers generate on them. Connected to the bus are:
+    - SST39SF010 flash (SimFlash), A16 set by the flash bank jumper
+    - 512k banked SRAM: the low 32k use the bank selected by bits 4-7 of the output latch (A15-A18),
+      the high 32k always use bank 15
+    - output latch 0 on io port 0x10 (SD card SPI lines, SRAM bank) and output latch 1 on io port 0x20
+    - input port 0 on io port 0x00 (bit 7 MISO, bit 6 SD detect, low active)
+    - SD card in SPI mode, backed by an image file (SimSDCard)
+
+ Memory map: as long as the Z80 is held in reset, and after reset until the dummy read of io port 0x70,
+ the flash is enabled: reads come from the flash, writes go to both the flash (command state machine)
+ and the SRAM. With the flash disabled, all accesses go to the SRAM.
+ Pin levels follow the open drain bus: a line reads low if the STM32 or a device pulls it low. A high
+ level on the reset pin holds the Z80 in reset.
+
+ Every register access advances the virtual clock (see Arduino.h) by the typical AHB access time.
+ An optional monitor function is called for every completed bus cycle, like a passive bus sniffer would
+ see it (type 0 memory read, 1 memory write, 2 io read, 3 io write).
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef SIM_BOARD_H
+#define SIM_BOARD_H
+
+    #include <Arduino.h>
+    #include <Z80BusDefs.h>
+    #include <SimFlash.h>
+    #include <SimSDCard.h>
+
+    #define SIM_GPIO_WRITE_CYCLES       2
+    #define SIM_GPIO_READ_CYCLES        4
+
+    #define SIM_SRAM_SIZE               0x80000
+    #define SIM_SRAM_BANK_SIZE          0x8000
+    #define SIM_SRAM_HIGH_BANK          15
+
+    #define SIM_IOPORT_IN_0             0x00
+    #define SIM_IOPORT_OUT_0            0x10
+    #define SIM_IOPORT_OUT_1            0x20
+    #define SIM_IOPORT_FLASH_DISABLE    0x70
+    #define SIM_OUT_0_MOSI              0x01
+    #define SIM_OUT_0_CLK               0x02
+    #define SIM_OUT_0_SSEL              0x04
+    #define SIM_IN_0_SDDET              0x40
+    #define SIM_IN_0_MISO               0x80
+
+    class SimBoard;
+
+    class SimGpio {
+
+        public:
+            //ODR and BSRR: writes update the port outputs and let the board decode the bus
+            class outputRegister {
+                public:
+                    outputRegister(SimGpio* port, bool bsrr) : port(port), bsrr(bsrr) {}
+                    outputRegister& operator=(uint32_t value) { port->write(value, bsrr); return *this; }
+                    operator uint32_t() const { return port->output; }
+                private:
+                    SimGpio* port;
+                    bool bsrr;
+            };
+
+            //IDR: pin levels, outputs and devices combined
+            class inputRegister {
+                public:
+                    inputRegister(SimGpio* port) : port(port) {}
+                    operator uint32_t() const { return port->read(); }
+                private:
+                    SimGpio* port;
+            };
+
+            SimGpio(SimBoard* board, uint8_t index);
+            void write(uint32_t value, bool bsrr);
+            uint32_t read(void);
+
+            uint32_t MODER, OTYPER, OSPEEDR, PUPDR;
+            outputRegister ODR, BSRR;
+            inputRegister IDR;
+            uint32_t output;
+
+        private:
+            SimBoard* board;
+            uint8_t index;
+
+    };
+
+    class SimBoard {
+
+        public:
+            struct statistics_t {
+                uint32_t memReads;
+                uint32_t memWrites;
+                uint32_t ioReads;
+                uint32_t ioWrites;
+                uint32_t busRequests;
+            };
+
+            typedef void (*monitorFunction)(uint8_t type, uint16_t address, uint8_t data);
+
+            SimBoard(void);
+            void powerOn(void);
+            void update(void);
+            uint32_t portInput(uint8_t index);
+            uint8_t sramRead(uint16_t address);
+
+            SimGpio portA, portB, portC;
+            SimFlash flash;
+            SimSDCard sdcard;
+            uint8_t sram[SIM_SRAM_SIZE];
+            uint8_t output0, output1;
+            bool flashEnabled;
+            bool flashBank;
+            statistics_t stats;
+            monitorFunction monitor;
+
+        private:
+            uint32_t lastA, lastB, lastC;
+            uint8_t readData;
+
+            uint8_t memoryRead(uint16_t address);
+            void memoryWrite(uint16_t address, uint8_t data);
+            uint8_t ioRead(uint8_t ioport);
+            void ioWrite(uint8_t ioport, uint8_t data);
+            uint32_t sramAddress(uint16_t address);
+
+    };
+
+    extern SimBoard simBoard;
+
+#endif
@@ -0,0 +1,111 @@
+#include <SimFlash.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define COMMAND_ADDRESS_MASK    0x7FFF
+#define COMMAND_ADDRESS_1       0x5555
+#define COMMAND_ADDRESS_2       0x2AAA
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor, the flash is delivered erased
+---------------------------------------------------------------------------------------------------------*/
+SimFlash::SimFlash(void) {
+    clear();
+}
+
+void SimFlash::clear(void) {
+    memset(memory, 0xFF, sizeof(memory));
+    state = idle;
+    idMode = false;
+    toggle = false;
+    busyData = 0xFF;
+    busyUntil = 0;
+    programs = 0;
+    erases = 0;
+    violations = 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ returns true as long as a program or erase operation is in progress
+---------------------------------------------------------------------------------------------------------*/
+bool SimFlash::busy(void) {
+    return simCycles() < busyUntil;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ read access, returns the status during program/erase, the ids in id mode, the memory otherwise
+---------------------------------------------------------------------------------------------------------*/
+uint8_t SimFlash::read(uint32_t address) {
+    address %= SIM_FLASH_SIZE;
+    if (busy()) return (~busyData & 0x80) | (toggle ? 0x40 : 0x00);
+    if (idMode) return (address & 0x01) ? SIM_FLASH_DEVICE_ID : SIM_FLASH_VENDOR_ID;
+    return memory[address];
+}
+
+//the toggle bit changes with every completed read cycle
+void SimFlash::endOfRead(void) {
+    toggle = !toggle;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ write access, runs the command state machine
+---------------------------------------------------------------------------------------------------------*/
+void SimFlash::write(uint32_t address, uint8_t data) {
+    address %= SIM_FLASH_SIZE;
+    if (busy()) {
+        violations++;
+        return;
+    }
+
+    uint16_t commandAddress = address & COMMAND_ADDRESS_MASK;
+    flashState next = idle;
+
+    switch (state) {
+        case idle:
+            if ((commandAddress == COMMAND_ADDRESS_1) && (data == 0xAA)) next = unlocked1;
+            else if (data == 0xF0) idMode = false;
+            break;
+        case unlocked1:
+            if ((commandAddress == COMMAND_ADDRESS_2) && (data == 0x55)) next = unlocked2;
+            break;
+        case unlocked2:
+            if (commandAddress != COMMAND_ADDRESS_1) break;
+            if (data == 0xA0) next = programByte;
+            else if (data == 0x80) next = eraseSetup;
+            else if (data == 0x90) idMode = true;
+            else if (data == 0xF0) idMode = false;
+            break;
+        case programByte:
+            //programming can only clear bits
+            memory[address] &= data;
+            programs++;
+            startOperation(SIM_FLASH_PROGRAM_TIME_us, memory[address]);
+            break;
+        case eraseSetup:
+            if ((commandAddress == COMMAND_ADDRESS_1) && (data == 0xAA)) next = eraseUnlocked1;
+            break;
+        case eraseUnlocked1:
+            if ((commandAddress == COMMAND_ADDRESS_2) && (data == 0x55)) next = eraseUnlocked2;
+            break;
+        case eraseUnlocked2:
+            if ((commandAddress == COMMAND_ADDRESS_1) && (data == 0x10)) {
+                memset(memory, 0xFF, sizeof(memory));
+                erases++;
+                startOperation(SIM_FLASH_CHIP_ERASE_ms * 1000, 0xFF);
+            }
+            else if (data == 0x30) {
+                memset(&memory[address & ~(SIM_FLASH_SECTOR_SIZE - 1)], 0xFF, SIM_FLASH_SECTOR_SIZE);
+                erases++;
+                startOperation(SIM_FLASH_SECTOR_ERASE_ms * 1000, 0xFF);
+            }
+            break;
+    }
+    state = next;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ starts a program or erase operation, the data is used for the data# polling
+---------------------------------------------------------------------------------------------------------*/
+void SimFlash::startOperation(uint32_t time_us, uint8_t data) {
+    busyData = data;
+    busyUntil = simCycles() + (uint64_t)time_us * (SIM_CORE_CLOCK_Hz / 1000000);
+}
@@ -0,0 +1,59 @@
+/* -------------------------------------------------------------------------------------------------------
+ Simulated SST39SF010 flash for the native (host) build
+
+ Model of the 128k x 8 flash on the teachZ80 board, with the JEDEC command state machine of the
+ SST39SF0x0 family:
+    - byte program:     5555/AA, 2AAA/55, 5555/A0, address/data
+    - sector erase:     5555/AA, 2AAA/55, 5555/80, 5555/AA, 2AAA/55, sector/30    (4k sectors)
+    - chip erase:       5555/AA, 2AAA/55, 5555/80, 5555/AA, 2AAA/55, 5555/10
+    - id entry / exit:  5555/AA, 2AAA/55, 5555/90   and   5555/AA, 2AAA/55, 5555/F0 or xxxx/F0
+ Only A0-A14 are decoded for the command addresses, as on the real chip.
+
+ Program and erase operations take the typical time of the datasheet, based on the virtual clock. While
+ an operation is in progress, reads return the data# polling / toggle bit status, and writes are ignored
+ and counted as violations (the driver did not wait long enough).
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef SIM_FLASH_H
+#define SIM_FLASH_H
+
+    #include <Arduino.h>
+
+    #define SIM_FLASH_SIZE              0x20000
+    #define SIM_FLASH_SECTOR_SIZE       0x1000
+    #define SIM_FLASH_VENDOR_ID         0xBF
+    #define SIM_FLASH_DEVICE_ID         0xB5
+    #define SIM_FLASH_PROGRAM_TIME_us   20
+    #define SIM_FLASH_SECTOR_ERASE_ms   18
+    #define SIM_FLASH_CHIP_ERASE_ms     70
+
+    class SimFlash {
+
+        public:
+            SimFlash(void);
+            void clear(void);
+            uint8_t read(uint32_t address);
+            void write(uint32_t address, uint8_t data);
+            void endOfRead(void);
+            bool busy(void);
+
+            uint8_t memory[SIM_FLASH_SIZE];
+            uint32_t programs;
+            uint32_t erases;
+            uint32_t violations;
+
+        private:
+            enum flashState : uint8_t { idle, unlocked1, unlocked2, programByte, eraseSetup, eraseUnlocked1, eraseUnlocked2 };
+            flashState state;
+            bool idMode;
+            bool toggle;
+            uint8_t busyData;
+            uint64_t busyUntil;
+
+            void startOperation(uint32_t time_us, uint8_t data);
+
+    };
+
+#endif
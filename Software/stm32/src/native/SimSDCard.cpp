@@ -0,0 +1,383 @@
+#include <SimSDCard.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define R1_IDLE             0x01
+#define R1_ILLEGAL_COMMAND  0x04
+#define R1_CRC_ERROR        0x08
+#define R1_ADDRESS_ERROR    0x20
+#define DATA_TOKEN          0xFE
+#define DATA_TOKEN_MULTI    0xFC
+#define STOP_TOKEN          0xFD
+#define DATA_ACCEPTED       0xE5
+#define DATA_WRITE_ERROR    0xED
+#define DATA_CRC_ERROR      0xEB
+#define ERROR_OUT_OF_RANGE  0x08
+#define OCR_CCS             0x40
+
+/*--------------------------------------------------------------------------------------------------------
+ Constructor
+---------------------------------------------------------------------------------------------------------*/
+SimSDCard::SimSDCard(void) {
+    image = nullptr;
+    blocks = 0;
+    memset(&stats, 0, sizeof(stats));
+    injectCrcErrors = 0;
+    reset();
+}
+
+void SimSDCard::reset(void) {
+    state = command;
+    selected = false;
+    lastClk = false;
+    idle = true;
+    appCommand = false;
+    initTries = 0;
+    rxByte = rxBits = 0;
+    txByte = 0xFF;
+    txBits = 0;
+    cmdLength = 0;
+    responseHead = responseLength = 0;
+    busyUntil = 0;
+    reading = false;
+    singleRead = false;
+    readyAt = 0;
+    multiWrite = false;
+    crcOn = false;
+    eraseStart = eraseEnd = 0xFFFFFFFF;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ inserts a card, backed by an image file. If the file does not exist and createBlocks is given, an empty
+ image of that size is created. Returns false if there is no usable image
+---------------------------------------------------------------------------------------------------------*/
+bool SimSDCard::open(const char* imageFile, uint32_t createBlocks) {
+    close();
+    image = fopen(imageFile, "r+b");
+    if ((image == nullptr) && (createBlocks > 0)) {
+        image = fopen(imageFile, "w+b");
+        if (image != nullptr) {
+            fseek(image, (long)createBlocks * SIM_SD_BLOCK_SIZE - 1, SEEK_SET);
+            fputc(0, image);
+        }
+    }
+    if (image == nullptr) return false;
+    fseek(image, 0, SEEK_END);
+    blocks = ftell(image) / SIM_SD_BLOCK_SIZE;
+    reset();
+    return blocks > 0;
+}
+
+void SimSDCard::close(void) {
+    if (image != nullptr) fclose(image);
+    image = nullptr;
+    blocks = 0;
+}
+
+bool SimSDCard::inserted(void) {
+    return image != nullptr;
+}
+
+uint32_t SimSDCard::capacity(void) {
+    return blocks;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ called with the new state of the spi lines, whenever the output latch is written
+---------------------------------------------------------------------------------------------------------*/
+void SimSDCard::spi(bool ssel, bool clk, bool mosi) {
+    if (!inserted()) return;
+
+    //deselected card ignores the clock, bits are aligned again with the next select
+    if (ssel) {
+        selected = false;
+        lastClk = clk;
+        return;
+    }
+    if (!selected) {
+        selected = true;
+        rxBits = 0;
+        txBits = 0;
+        txByte = next();
+    }
+
+    //sample on the rising edge, shift out on the falling edge
+    if (clk && !lastClk) {
+        rxByte = (rxByte << 1) | (mosi ? 0x01 : 0x00);
+        if (++rxBits == 8) {
+            rxBits = 0;
+            receive(rxByte);
+        }
+    }
+    if (!clk && lastClk) {
+        if (++txBits == 8) {
+            txBits = 0;
+            txByte = next();
+        }
+    }
+    lastClk = clk;
+}
+
+bool SimSDCard::miso(void) {
+    if (!inserted() || !selected) return true;
+    return (txByte << txBits) & 0x80;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ a complete byte has been received from the host
+---------------------------------------------------------------------------------------------------------*/
+void SimSDCard::receive(uint8_t data) {
+    switch (state) {
+        case command:
+            //a command starts with 01 in the upper bits, everything else between commands is ignored
+            if ((cmdLength == 0) && ((data & 0xC0) != 0x40)) return;
+            cmd[cmdLength++] = data;
+            if (cmdLength == sizeof(cmd)) {
+                cmdLength = 0;
+                execute();
+            }
+            break;
+
+        case writeToken:
+            if (data == (multiWrite ? DATA_TOKEN_MULTI : DATA_TOKEN)) {
+                state = writeData;
+                dataCount = 0;
+            }
+            else if (multiWrite && (data == STOP_TOKEN)) {
+                busyUntil = simCycles() + (uint64_t)SIM_SD_WRITE_BUSY_us * (SIM_CORE_CLOCK_Hz / 1000000);
+                multiWrite = false;
+                state = command;
+            }
+            break;
+
+        case writeData:
+            //data block followed by 2 bytes of crc
+            block[dataCount++] = data;
+            if (dataCount < sizeof(block)) return;
+            if ((crcOn && (crc16(block, SIM_SD_BLOCK_SIZE) != ((block[SIM_SD_BLOCK_SIZE] << 8) | block[SIM_SD_BLOCK_SIZE + 1])))
+                || (injectCrcErrors > 0)) {
+                //the block is rejected, the card is not busy
+                if (injectCrcErrors > 0) injectCrcErrors--;
+                stats.crcErrors++;
+                queue(DATA_CRC_ERROR);
+                state = multiWrite ? writeToken : command;
+                return;
+            }
+            if (writeBlockNumber < blocks) {
+                fseek(image, (long)writeBlockNumber * SIM_SD_BLOCK_SIZE, SEEK_SET);
+                fwrite(block, 1, SIM_SD_BLOCK_SIZE, image);
+                stats.blocksWritten++;
+                queue(DATA_ACCEPTED);
+            }
+            else queue(DATA_WRITE_ERROR);
+            busyUntil = simCycles() + (uint64_t)SIM_SD_WRITE_BUSY_us * (SIM_CORE_CLOCK_Hz / 1000000);
+            //a multi block write continues with the next block, until the stop token
+            writeBlockNumber++;
+            state = multiWrite ? writeToken : command;
+            break;
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ executes a received command and queues the response
+---------------------------------------------------------------------------------------------------------*/
+void SimSDCard::execute(void) {
+    uint8_t index = cmd[0] & 0x3F;
+    uint32_t argument = (cmd[1] << 24) | (cmd[2] << 16) | (cmd[3] << 8) | cmd[4];
+    bool application = appCommand;
+    appCommand = false;
+    uint8_t r1 = idle ? R1_IDLE : 0x00;
+    stats.commands++;
+
+    //a new command discards what has not been read from the last response, one byte Ncr
+    //any command ends a multi block read, CMD12 is the one to use
+    responseHead = responseLength = 0;
+    reading = false;
+    queue(0xFF);
+
+    if ((crcOn || (index == 8)) && (crc7(cmd, 5) != cmd[5])) {
+        stats.crcErrors++;
+        queue(r1 | R1_CRC_ERROR);
+        return;
+    }
+
+    if (index == 0) {
+        idle = true;
+        crcOn = false;
+        initTries = 0;
+        queue(R1_IDLE);
+    }
+    else if (index == 8) {
+        queue(r1);
+        queue(0x00);
+        queue(0x00);
+        queue(cmd[3] & 0x0F);
+        queue(cmd[4]);
+    }
+    else if (index == 55) {
+        appCommand = true;
+        queue(r1);
+    }
+    else if ((index == 41) && application) {
+        if (++initTries >= SIM_SD_INIT_TRIES) idle = false;
+        queue(idle ? R1_IDLE : 0x00);
+    }
+    else if (index == 58) {
+        queue(r1);
+        queue(0x80 | (idle ? 0x00 : OCR_CCS));
+        queue(0xFF);
+        queue(0x80);
+        queue(0x00);
+    }
+    else if (index == 13) {
+        queue(r1);
+        queue(0x00);
+    }
+    else if (index == 59) {
+        crcOn = argument & 0x01;
+        queue(r1);
+    }
+    else if (((index == 17) || (index == 18)) && !idle) {
+        if (argument >= blocks) {
+            queue(R1_ADDRESS_ERROR);
+            return;
+        }
+        queue(0x00);
+        readBlockNumber = argument;
+        readyAt = simCycles() + (uint64_t)SIM_SD_READ_ACCESS_us * (SIM_CORE_CLOCK_Hz / 1000000);
+        singleRead = index == 17;
+        reading = true;
+    }
+    else if (index == 12) {
+        queue(0x00);
+    }
+    else if ((index == 23) && application) {
+        stats.preEraseBlocks += argument & 0x7FFFFF;
+        queue(r1);
+    }
+    else if ((index == 24) && !idle) {
+        if (argument >= blocks) {
+            queue(R1_ADDRESS_ERROR);
+            return;
+        }
+        queue(0x00);
+        writeBlockNumber = argument;
+        multiWrite = false;
+        state = writeToken;
+    }
+    else if ((index == 25) && !idle) {
+        if (argument >= blocks) {
+            queue(R1_ADDRESS_ERROR);
+            return;
+        }
+        queue(0x00);
+        writeBlockNumber = argument;
+        multiWrite = true;
+        state = writeToken;
+    }
+    else if (((index == 32) || (index == 33)) && !idle) {
+        if (argument >= blocks) {
+            queue(R1_ADDRESS_ERROR);
+            return;
+        }
+        if (index == 32) eraseStart = argument;
+        else eraseEnd = argument;
+        queue(0x00);
+    }
+    else if ((index == 38) && !idle) {
+        //erase sequence error without a valid range
+        if ((eraseStart >= blocks) || (eraseEnd >= blocks) || (eraseStart > eraseEnd)) {
+            queue(R1_ADDRESS_ERROR);
+            return;
+        }
+        queue(0x00);
+        erase();
+        busyUntil = simCycles() + (uint64_t)SIM_SD_ERASE_BUSY_us * (SIM_CORE_CLOCK_Hz / 1000000);
+    }
+    else {
+        stats.illegalCommands++;
+        queue(r1 | R1_ILLEGAL_COMMAND);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ response queue, the card sends busy (0x00) after a write, 0xFF when there is nothing to send
+---------------------------------------------------------------------------------------------------------*/
+void SimSDCard::queue(uint8_t data) {
+    if (responseLength < SIM_SD_RESPONSE_LENGTH) response[responseLength++] = data;
+}
+
+uint8_t SimSDCard::next(void) {
+    //read, the block is queued after the access time, a multi block read continues with the next block
+    if ((responseHead == responseLength) && reading) {
+        if (simCycles() < readyAt) return 0xFF;
+        responseHead = responseLength = 0;
+        queueBlock(readBlockNumber++);
+        if (singleRead) reading = false;
+    }
+    if (responseHead < responseLength) return response[responseHead++];
+    if (simCycles() < busyUntil) return 0x00;
+    return 0xFF;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ one byte access time, the data token, the block and the crc. Behind the end of the card, the error token
+---------------------------------------------------------------------------------------------------------*/
+void SimSDCard::queueBlock(uint32_t blockNumber) {
+    queue(0xFF);
+    if (blockNumber >= blocks) {
+        queue(ERROR_OUT_OF_RANGE);
+        reading = false;
+        return;
+    }
+    queue(DATA_TOKEN);
+    fseek(image, (long)blockNumber * SIM_SD_BLOCK_SIZE, SEEK_SET);
+    if (fread(block, 1, SIM_SD_BLOCK_SIZE, image) != SIM_SD_BLOCK_SIZE) memset(block, 0, SIM_SD_BLOCK_SIZE);
+    for (int i=0; i<SIM_SD_BLOCK_SIZE; i++) queue(block[i]);
+    uint16_t crc = crc16(block, SIM_SD_BLOCK_SIZE);
+    if (injectCrcErrors > 0) {
+        injectCrcErrors--;
+        crc ^= 0x0001;
+    }
+    queue(crc >> 8);
+    queue(crc);
+    stats.blocksRead++;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ erases the range of CMD32 and CMD33, the range has to be set again for the next erase
+---------------------------------------------------------------------------------------------------------*/
+void SimSDCard::erase(void) {
+    uint8_t zeros[SIM_SD_BLOCK_SIZE * 64] = {};
+    fseek(image, (long)eraseStart * SIM_SD_BLOCK_SIZE, SEEK_SET);
+    for (uint32_t block = eraseStart; block <= eraseEnd; block += 64) {
+        uint32_t count = eraseEnd - block + 1;
+        if (count > 64) count = 64;
+        fwrite(zeros, SIM_SD_BLOCK_SIZE, count, image);
+    }
+    stats.erasedBlocks += eraseEnd - eraseStart + 1;
+    eraseStart = eraseEnd = 0xFFFFFFFF;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ crc16 (ccitt) of a data block, as sent by the card
+---------------------------------------------------------------------------------------------------------*/
+uint16_t SimSDCard::crc16(const uint8_t* data, uint16_t length) {
+    uint16_t crc = 0;
+    for (int i=0; i<length; i++) {
+        crc ^= data[i] << 8;
+        for (int j=0; j<8; j++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ crc7 of a command, left aligned with the end bit, as the last byte of the command
+---------------------------------------------------------------------------------------------------------*/
+uint8_t SimSDCard::crc7(const uint8_t* data, uint8_t length) {
+    uint8_t crc = 0;
+    for (int i=0; i<length; i++) {
+        crc ^= data[i];
+        for (int j=0; j<8; j++) crc = (crc & 0x80) ? (crc << 1) ^ 0x12 : crc << 1;
+    }
+    return crc | 0x01;
+}
@@ -0,0 +1,106 @@
+/* -------------------------------------------------------------------------------------------------------
+ Simulated SD card for the native (host) build
+
+ Model of an SDHC card in SPI mode, backed by a local image file (raw dump of the card, 512 byte blocks).
+ The card is connected to the simulated board the same way as on the teachZ80: the SPI lines are bits of
+ the output latch on io port 0x10, MISO is an input bit on io port 0x00.
+
+ SPI mode 0: the card samples MOSI on the rising clock edge and shifts out the next MISO bit on the
+ falling edge. Bits are aligned to bytes by the slave select line.
+
+ Supported commands:
+    - CMD0, CMD8, CMD55/ACMD41 and CMD58 for the initialization, ACMD41 reports ready after a few tries
+    - CMD17 single block read and CMD24 single block write
+    - CMD18 multi block read, blocks are sent one after the other until CMD12 stops the transmission
+    - CMD25 multi block write with the multi block token, ended by the stop token. ACMD23 is accepted
+    - CMD32/CMD33 erase range and CMD38 erase, the blocks are set to 0x00, the card is busy for the
+      typical erase time
+    - CMD13 status and CMD59 crc on/off. With crc on, the crc7 of the commands and the crc16 of the blocks
+      written are checked. CMD8 is always checked
+    - injectCrcErrors corrupts the crc of the next blocks read or written, to test the retries
+ Other commands are answered with illegal command. After a block write, the card signals busy for the
+ typical write time, based on the virtual clock. A read command sends the data token after the typical
+ access time, the following blocks of a multi block read are sent without delay.
+
+ Author: Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+
+#ifndef SIM_SD_CARD_H
+#define SIM_SD_CARD_H
+
+    #include <Arduino.h>
+
+    #define SIM_SD_BLOCK_SIZE           512
+    #define SIM_SD_RESPONSE_LENGTH      1024
+    #define SIM_SD_INIT_TRIES           3
+    #define SIM_SD_WRITE_BUSY_us        250
+    #define SIM_SD_READ_ACCESS_us       500         //first block of a read command
+    #define SIM_SD_ERASE_BUSY_us        20000       //erase command, independent of the range
+
+    class SimSDCard {
+
+        public:
+            struct statistics_t {
+                uint32_t commands;
+                uint32_t blocksRead;
+                uint32_t blocksWritten;
+                uint32_t illegalCommands;
+                uint32_t preEraseBlocks;        //announced with ACMD23
+                uint32_t erasedBlocks;          //CMD38
+                uint32_t crcErrors;             //commands and blocks written with a wrong crc
+            };
+
+            SimSDCard(void);
+            bool open(const char* imageFile, uint32_t createBlocks = 0);
+            void close(void);
+            bool inserted(void);
+            uint32_t capacity(void);
+            void spi(bool ssel, bool clk, bool mosi);
+            bool miso(void);
+
+            statistics_t stats;
+            uint32_t injectCrcErrors;
+
+        private:
+            enum cardState : uint8_t { command, writeToken, writeData };
+
+            FILE* image;
+            uint32_t blocks;
+            cardState state;
+            bool selected;
+            bool lastClk;
+            bool idle;
+            bool appCommand;
+            uint8_t initTries;
+            uint8_t rxByte, rxBits;
+            uint8_t txByte, txBits;
+            uint8_t cmd[6];
+            uint8_t cmdLength;
+            uint8_t response[SIM_SD_RESPONSE_LENGTH];
+            uint16_t responseHead, responseLength;
+            uint32_t writeBlockNumber;
+            uint32_t readBlockNumber;
+            uint32_t eraseStart;
+            uint32_t eraseEnd;
+            uint64_t readyAt;
+            bool reading;
+            bool singleRead;
+            bool multiWrite;
+            bool crcOn;
+            uint16_t dataCount;
+            uint8_t block[SIM_SD_BLOCK_SIZE + 2];
+            uint64_t busyUntil;
+
+            void reset(void);
+            void receive(uint8_t data);
+            void execute(void);
+            void queue(uint8_t data);
+            uint8_t next(void);
+            void queueBlock(uint32_t blockNumber);
+            void erase(void);
+            uint16_t crc16(const uint8_t* data, uint16_t length);
+            uint8_t crc7(const uint8_t* data, uint8_t length);
+
+    };
+
+#endif
@@ -0,0 +1,1232 @@
+/* -------------------------------------------------------------------------------------------------------
+ teachZ80 host tools
+
+ Built by the PlatformIO native environment, runs on the development host, not on the board.
+ Usage:
+    program waveform [file.vcd]     builds typical bus sequences, plays them on the waveform simulator and
+                                    verifies the decoded bus cycles and the timing. Optionally writes a VCD file
+    program check [image]           runs the driver stack (bus, flash, io, spi, sd card, cpm filesystem) against
+                                    the simulated board and verifies the results
+    program bench [image]           throughput benchmarks of the driver stack on the simulated board
+    program trace [file.trc]        records the bus cycles of the driver stack like the bus sniffer does, and
+                                    writes them in the trace format (default trace.trc), see tools/z80Trace.py
+
+ The SD card of the simulated board is backed by an image file (default sdcard.img), an empty image is
+ created if the file does not exist. check and bench overwrite parts of the image.
+ Benchmarks report the estimated time on the target (virtual clock) and the time on the host.
+
+ Author   : Christian Luethi
+--------------------------------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <Z80BusSequence.h>
+#include <Z80BusWaveform.h>
+#include <Z80Bus.h>
+#include <Z80IO.h>
+#include <Z80SPI.h>
+#include <Z80SDCard.h>
+#include <Z80SDCache.h>
+#include <Z80Flash.h>
+#include <Z80Programs.h>
+#include <CPMFileSystem.h>
+#include <CPMBitmap.h>
+#include <JobEngine.h>
+#include <SDJobs.h>
+#include <SDTransfer.h>
+#include <Z80Trace.h>
+#include <Z80IODevices.h>
+#include <Z80CaptureArena.h>
+#include <SimBoard.h>
+
+/* Types and definitions -------------------------------------------------------------------------------- */
+#define SPI_OUT_IOPORT      0x10
+#define SPI_IN_IOPORT       0x00
+#define SPI_OUT_MOSI        0x01
+#define SPI_OUT_CLK         0x02
+#define SPI_OUT_SSEL        0x04
+#define SPI_IN_MISO         0x80
+
+#define SD_IMAGE_FILE       "sdcard.img"
+#define SD_IMAGE_BLOCKS     0x20000         //64MB
+#define SD_PARTITION_START  0x800
+#define SD_MULTI_BLOCKS     4
+#define SD_TEST_BLOCK       0x100
+#define CPM_BOOT_TRACKS     32
+#define CPM_DIR_TRACKS      32
+#define BENCH_BYTES         0x8000
+#define BENCH_BLOCKS        64
+#define BENCH_STREAM_BLOCKS 256             //sequential reads through the cache, 4 times the frames
+#define BENCH_FORMAT_DISKS  4
+#define BENCH_DIRECTORY_READS 100
+#define CPM_DISK_TRACKS     16384
+#define TRACE_FILE          "trace.trc"
+
+/* Variables and instances ------------------------------------------------------------------------------ */
+Z80BusSequence sequence;
+uint8_t memory[0x10000];
+uint8_t spiInput = SPI_IN_MISO;
+
+/*--------------------------------------------------------------------------------------------------------
+ device model for the waveform simulator: 64k memory and the SPI input port
+---------------------------------------------------------------------------------------------------------*/
+uint8_t readHandler(Z80BusWaveform::cycleType type, uint16_t address) {
+    if (type == Z80BusWaveform::memoryRead) return memory[address];
+    if (address == SPI_IN_IOPORT) return spiInput;
+    return 0xFF;
+}
+
+Z80BusWaveform waveform(readHandler);
+
+/*--------------------------------------------------------------------------------------------------------
+ expected bus cycles, filled while the sequence is built
+---------------------------------------------------------------------------------------------------------*/
+Z80BusWaveform::busCycle_t expected[Z80BUS_WAVEFORM_MAX_CYCLES];
+uint32_t numExpected = 0;
+
+void expect(Z80BusWaveform::cycleType type, uint16_t address, uint8_t data) {
+    expected[numExpected].type = type;
+    expected[numExpected].address = address;
+    expected[numExpected].data = data;
+    numExpected++;
+}
+
+void flashProgram(uint16_t address, uint8_t data) {
+    const uint16_t addresses[] = { 0x5555, 0x2AAA, 0x5555, address };
+    const uint8_t values[] = { 0xAA, 0x55, 0xA0, data };
+    for (int i=0; i<4; i++) {
+        sequence.memWrite(addresses[i], values[i]);
+        expect(Z80BusWaveform::memoryWrite, addresses[i], values[i]);
+    }
+}
+
+void spiWriteByte(uint8_t data) {
+    uint8_t outputBuffer = SPI_OUT_MOSI;
+    for (int i=7; i>=0; i--) {
+        outputBuffer &= ~SPI_OUT_CLK;
+        if (data & (1 << i)) outputBuffer |= SPI_OUT_MOSI;
+        else outputBuffer &= ~SPI_OUT_MOSI;
+        sequence.ioWrite(SPI_OUT_IOPORT, outputBuffer);
+        expect(Z80BusWaveform::ioWrite, SPI_OUT_IOPORT, outputBuffer);
+        outputBuffer |= SPI_OUT_CLK;
+        sequence.ioWrite(SPI_OUT_IOPORT, outputBuffer);
+        expect(Z80BusWaveform::ioWrite, SPI_OUT_IOPORT, outputBuffer);
+    }
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ waveform verification
+---------------------------------------------------------------------------------------------------------*/
+int waveformCheck(const char* vcdFile) {
+    for (uint32_t i=0; i<sizeof(memory); i++) memory[i] = i ^ (i >> 8);
+
+    //flash program command for one byte, read back, spi byte and spi input read
+    sequence.clear();
+    flashProgram(0x1234, 0x5A);
+    sequence.memRead(0x1234);
+    expect(Z80BusWaveform::memoryRead, 0x1234, memory[0x1234]);
+    spiWriteByte(0xA5);
+    sequence.ioRead(SPI_IN_IOPORT);
+    expect(Z80BusWaveform::ioRead, SPI_IN_IOPORT, spiInput);
+
+    FILE* vcd = nullptr;
+    if (vcdFile) vcd = fopen(vcdFile, "w");
+    uint32_t violations = waveform.play(&sequence, vcd);
+    if (vcd) fclose(vcd);
+
+    uint32_t errors = 0;
+    for (uint32_t i=0; i<waveform.cycles; i++) waveform.printCycle(i);
+    if (waveform.cycles != numExpected) {
+        printf("ERROR: %u bus cycles decoded, %u expected\n", waveform.cycles, numExpected);
+        errors++;
+    }
+    for (uint32_t i=0; (i<waveform.cycles) && (i<numExpected); i++) {
+        if ((waveform.cycle[i].type != expected[i].type) || (waveform.cycle[i].address != expected[i].address) || (waveform.cycle[i].data != expected[i].data)) {
+            printf("ERROR: cycle %u does not match the expected cycle\n", i);
+            errors++;
+        }
+    }
+    if ((sequence.readData(0) != memory[0x1234]) || (sequence.readData(1) != spiInput)) {
+        printf("ERROR: captured read data does not match\n");
+        errors++;
+    }
+
+    printf("\n%u slots of %u ns (%u ns), %u bus cycles, %u timing violations, %u errors\n", sequence.length(), sequence.slotLength(), sequence.length() * sequence.slotLength(), waveform.cycles, violations, errors);
+    return ((violations == 0) && (errors == 0)) ? 0 : 1;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ driver stack on the simulated board, built the same way as in the firmware
+---------------------------------------------------------------------------------------------------------*/
+struct driverStack_t {
+    Z80Bus z80bus;
+    Z80IO z80io;
+    Z80SPI z80spi;
+    Z80SDCard z80sdcard;
+    Z80SDCache z80sdcache;
+    Z80Flash z80flash;
+    CPMFileSystem filesystem;
+
+    driverStack_t() : z80io(z80bus), z80spi(z80io), z80sdcard(z80spi), z80sdcache(z80sdcard), z80flash(z80bus),
+                      filesystem(CPMFileSystem::geometry_8k_8m_32_512, z80sdcard, z80sdcache, z80bus) {}
+};
+
+bool insertCard(const char* imageFile) {
+    if (simBoard.sdcard.open(imageFile, SD_IMAGE_BLOCKS)) return true;
+    printf("ERROR: cannot open or create the SD card image %s\n", imageFile);
+    return false;
+}
+
+uint32_t checkErrors = 0;
+
+void verify(bool condition, const char* text) {
+    printf("%-50s %s\n", text, condition ? "ok" : "FAILED");
+    if (!condition) checkErrors++;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ sd transfer packets, built and decoded as tools/z80Disk.py does
+---------------------------------------------------------------------------------------------------------*/
+void transferCommand(SDTransfer& transfer, char direction, uint32_t block, uint32_t count) {
+    const char magic[] = "helloTeachZ80SDTransfer";
+    for (uint32_t i=0; i<sizeof(magic) - 1; i++) transfer.serialUpdate(magic[i]);
+    transfer.serialUpdate(direction);
+    for (uint8_t i=0; i<8; i++) transfer.serialUpdate(((i < 4) ? block : count) >> (8*(i%4)));
+}
+
+//'R' reads a file, 'W' writes one of bytes, 'D' deletes it
+void transferFileCommand(SDTransfer& transfer, uint8_t disk, uint8_t user, const char* filename, char direction = 'R', uint32_t bytes = 0) {
+    const char magic[] = "helloTeachZ80SDTransfer";
+    for (uint32_t i=0; i<sizeof(magic) - 1; i++) transfer.serialUpdate(magic[i]);
+    transfer.serialUpdate(direction);
+    transfer.serialUpdate(disk);
+    transfer.serialUpdate(user);
+    char name[SDTRANSFER_FILE_COMMAND - 2] = { 0 };
+    memcpy(name, filename, strlen(filename) < sizeof(name) ? strlen(filename) : sizeof(name));
+    for (uint8_t i=0; i<sizeof(name); i++) transfer.serialUpdate(name[i]);
+    if (direction == 'W') for (uint8_t i=0; i<4; i++) transfer.serialUpdate(bytes >> (8*i));
+}
+
+void transferSend(SDTransfer& transfer, uint8_t type, uint32_t block, const uint8_t* payload, uint16_t length, bool corrupt = false) {
+    static uint8_t packet[SDTRANSFER_PACKET_MAX];
+    uint8_t header[SDTRANSFER_HEADER] = { 'S', 'D', type, (uint8_t)block, (uint8_t)(block >> 8), (uint8_t)(block >> 16), (uint8_t)(block >> 24), (uint8_t)length, (uint8_t)(length >> 8) };
+    memcpy(packet, header, sizeof(header));
+    memcpy(&packet[SDTRANSFER_HEADER], payload, length);
+    uint32_t crc = SDTransfer::crc32(&packet[2], SDTRANSFER_HEADER - 2 + length);
+    for (uint8_t i=0; i<4; i++) packet[SDTRANSFER_HEADER + length + i] = crc >> (8*i);
+    if (corrupt) packet[SDTRANSFER_HEADER]++;
+    for (uint32_t i=0; i<SDTRANSFER_HEADER + length + 4u; i++) transfer.serialUpdate(packet[i]);
+}
+
+bool transferReceive(FILE* file, uint8_t& type, uint32_t& block, uint8_t* payload, uint16_t& length) {
+    uint8_t header[SDTRANSFER_HEADER];
+    uint8_t crc[4];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) return false;
+    if ((header[0] != 'S') || (header[1] != 'D')) return false;
+    type = header[2];
+    block = header[3] | (header[4] << 8) | (header[5] << 16) | ((uint32_t)header[6] << 24);
+    length = header[7] | (header[8] << 8);
+    if ((length > SD_BLOCK_SIZE) || (fread(payload, 1, length, file) != length) || (fread(crc, 1, 4, file) != 4)) return false;
+    uint8_t packet[SDTRANSFER_PACKET_MAX];
+    memcpy(packet, header, sizeof(header));
+    memcpy(&packet[SDTRANSFER_HEADER], payload, length);
+    return SDTransfer::crc32(&packet[2], SDTRANSFER_HEADER - 2 + length) == (uint32_t)(crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((uint32_t)crc[3] << 24));
+}
+
+//file import as the host does it: one data packet per block, the ack is awaited. Returns the status of the last ack
+uint8_t transferWriteFile(SDTransfer& transfer, JobEngine& jobs, uint8_t disk, uint8_t user, const char* filename, const uint8_t* data, uint32_t bytes, uint32_t cancelAt = 0xFFFFFFFF) {
+    FILE* output = tmpfile();
+    Serial.redirect(output);
+    transferFileCommand(transfer, disk, user, filename, 'W', bytes);
+    for (uint8_t i=0; i<4; i++) jobs.process();
+    for (uint32_t block=0; (block * SD_BLOCK_SIZE < bytes) && jobs.busy(); block++) {
+        if (block == cancelAt) { jobs.cancel(); break; }
+        uint32_t rest = bytes - block * SD_BLOCK_SIZE;
+        transferSend(transfer, SDTransfer::dataPacket, block, &data[block * SD_BLOCK_SIZE], (rest < SD_BLOCK_SIZE) ? rest : SD_BLOCK_SIZE);
+        for (uint8_t i=0; i<4; i++) jobs.process();
+    }
+    if (jobs.busy()) transferSend(transfer, SDTransfer::endPacket, (bytes + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE, data, 0);
+    while (jobs.busy()) jobs.process();
+    Serial.redirect(nullptr);
+    rewind(output);
+    uint8_t type;
+    uint32_t packetBlock;
+    uint8_t payload[SD_BLOCK_SIZE];
+    uint16_t length;
+    uint8_t status = SDTransfer::statusCancelled;
+    while (transferReceive(output, type, packetBlock, payload, length)) if (type == SDTransfer::ackPacket) status = payload[0];
+    fclose(output);
+    return status;
+}
+
+//file delete as the host does it, returns the status of the ack
+uint8_t transferDeleteFile(SDTransfer& transfer, JobEngine& jobs, uint8_t disk, uint8_t user, const char* filename) {
+    FILE* output = tmpfile();
+    Serial.redirect(output);
+    transferFileCommand(transfer, disk, user, filename, 'D');
+    while (jobs.busy()) jobs.process();
+    Serial.redirect(nullptr);
+    rewind(output);
+    uint8_t type;
+    uint32_t packetBlock;
+    uint8_t payload[SD_BLOCK_SIZE];
+    uint16_t length;
+    uint8_t status = SDTransfer::statusCancelled;
+    if (transferReceive(output, type, packetBlock, payload, length) && (type == SDTransfer::ackPacket)) status = payload[0];
+    fclose(output);
+    return status;
+}
+
+//bus owner changes, [0] back to the Z80, [1] to the stm32
+uint32_t ownerChanges[2];
+
+void countOwnerChange(bool stm32Active) {
+    ownerChanges[stm32Active ? 1 : 0]++;
+}
+
+//job which keeps a multi block read open until it is cancelled, as a long transfer does
+class StreamJob : public Job {
+    public:
+        StreamJob(Z80SDCard& sdcard, uint32_t block) : sdcard(sdcard), block(block) {}
+        jobState begin(void) override {
+            sdcard.accessCard(true);
+            return (sdcard.readBlocksBegin(block, 0) == Z80SDCard::ok) ? running : failed;
+        }
+        jobState step(void) override { return waiting; }
+        void end(jobState state) override {
+            (void)state;
+            sdcard.readBlocksEnd();
+            sdcard.accessCard(false);
+        }
+    private:
+        Z80SDCard& sdcard;
+        uint32_t block;
+};
+
+/*--------------------------------------------------------------------------------------------------------
+ driver stack verification
+---------------------------------------------------------------------------------------------------------*/
+//full cpm directory: pairs of files with the same name in user 0 and 1, two extents each, the second extent
+//in front of the first. The first extent has 512 records (EX 3 with EXM 3), the second one 10 (EX 4)
+void fillDirectory(driverStack_t& stack, uint32_t disk) {
+    uint8_t block[SD_BLOCK_SIZE];
+    for (uint32_t track=0; track<CPM_DIR_TRACKS; track++) {
+        memset(block, 0, sizeof(block));
+        for (uint32_t i=0; i<16; i++) {
+            uint32_t entry = track * 16 + i;
+            uint8_t* extent = &block[i * 32];
+            extent[0] = (entry / 2) & 1;
+            snprintf((char*)&extent[1], 12, "FILE%04uDAT", entry / 4);
+            extent[12] = (entry & 1) ? 3 : 4;
+            extent[15] = (entry & 1) ? 128 : 10;
+        }
+        stack.z80sdcard.writeBlock(SD_PARTITION_START + disk * CPM_DISK_TRACKS + CPM_BOOT_TRACKS + track, block);
+    }
+}
+
+int stackCheck(const char* imageFile) {
+    if (!insertCard(imageFile)) return 1;
+    static driverStack_t stack;
+
+    //flash identification, programming and verification, through the shadow flash logic
+    stack.z80flash.setMode(true);
+    stack.z80flash.readChipIndentification();
+    verify((stack.z80flash.chipVendorId == SIM_FLASH_VENDOR_ID) && (stack.z80flash.chipDeviceId == SIM_FLASH_DEVICE_ID), "flash chip identification");
+    stack.z80flash.setMode(false);
+    verify(stack.z80flash.writeProgram(0), "flash program and verify");
+    verify(memcmp(simBoard.flash.memory, z80FlashPrograms[0].data, z80FlashPrograms[0].length) == 0, "flash content");
+    stack.z80flash.setMode(true);
+    verify(stack.z80flash.bytesProgrammed() == z80FlashPrograms[0].length, "flash bytes programmed");
+    stack.z80flash.setMode(false);
+    verify(simBoard.flash.violations == 0, "flash accessed during program/erase");
+
+    //sram, after the flash has been disabled
+    stack.z80bus.request_bus();
+    stack.z80bus.ioRead(SIM_IOPORT_FLASH_DISABLE);
+    for (uint32_t i=0; i<0x100; i++) stack.z80bus.memWrite(0x8000 + i, i ^ 0x5A);
+    bool sramOK = true;
+    for (uint32_t i=0; i<0x100; i++) {
+        if (stack.z80bus.memRead(0x8000 + i) != (i ^ 0x5A)) sramOK = false;
+        if (simBoard.sramRead(0x8000 + i) != (i ^ 0x5A)) sramOK = false;
+    }
+    stack.z80bus.release_bus();
+    verify(sramOK, "sram write and read back");
+
+    //sd card
+    verify(stack.z80sdcard.accessCard(true) == Z80SDCard::ok, "sd card initialization");
+    //the card stays initialized, the next access only asks for the status. A removed card is initialized again
+    stack.z80sdcard.accessCard(false);
+    uint32_t commands = simBoard.sdcard.stats.commands;
+    uint32_t inits = stack.z80sdcard.initCount;
+    bool sessionOK = stack.z80sdcard.accessCard(true) == Z80SDCard::ok;
+    sessionOK &= (simBoard.sdcard.stats.commands - commands == 1) && (stack.z80sdcard.initCount == inits);
+    stack.z80sdcard.accessCard(false);
+    simBoard.sdcard.close();
+    sessionOK &= stack.z80sdcard.accessCard(true) == Z80SDCard::nocard;
+    stack.z80sdcard.accessCard(false);
+    insertCard(imageFile);
+    sessionOK &= (stack.z80sdcard.accessCard(true) == Z80SDCard::ok) && (stack.z80sdcard.initCount == inits + 1);
+    verify(sessionOK, "sd card session kept, removed card initialized again");
+    verify(stack.z80sdcard.formatCard(1, SD_PARTITION_START, SD_IMAGE_BLOCKS - SD_PARTITION_START) == Z80SDCard::ok, "sd card mbr");
+    Z80SDCard::mbrResult mbr = stack.z80sdcard.readMBR();
+    verify((mbr.readresult == Z80SDCard::ok) && (mbr.partitions == 1) && (mbr.partitiontable[0].block == SD_PARTITION_START), "sd card partition table");
+    uint8_t block[SD_BLOCK_SIZE];
+    for (int i=0; i<SD_BLOCK_SIZE; i++) block[i] = i * 7;
+    bool blockOK = stack.z80sdcard.writeBlock(SD_TEST_BLOCK, block) == Z80SDCard::ok;
+    memset(block, 0, sizeof(block));
+    blockOK &= stack.z80sdcard.readBlock(SD_TEST_BLOCK, block) == Z80SDCard::ok;
+    for (int i=0; i<SD_BLOCK_SIZE; i++) if (block[i] != (uint8_t)(i * 7)) blockOK = false;
+    verify(blockOK, "sd card block write and read back");
+    static uint8_t blocks[SD_MULTI_BLOCKS * SD_BLOCK_SIZE];
+    for (int i=0; i<(int)sizeof(blocks); i++) blocks[i] = (i * 13) ^ (i >> 9);
+    blockOK = stack.z80sdcard.writeBlocks(SD_TEST_BLOCK, SD_MULTI_BLOCKS, blocks) == Z80SDCard::ok;
+    blockOK &= stack.z80sdcard.readBlock(SD_TEST_BLOCK + SD_MULTI_BLOCKS - 1, block) == Z80SDCard::ok;
+    blockOK &= memcmp(block, &blocks[(SD_MULTI_BLOCKS - 1) * SD_BLOCK_SIZE], SD_BLOCK_SIZE) == 0;
+    memset(blocks, 0, sizeof(blocks));
+    blockOK &= stack.z80sdcard.readBlocks(SD_TEST_BLOCK, SD_MULTI_BLOCKS, blocks) == Z80SDCard::ok;
+    for (int i=0; i<(int)sizeof(blocks); i++) if (blocks[i] != (uint8_t)((i * 13) ^ (i >> 9))) blockOK = false;
+    verify(blockOK, "sd card multi block write and read back");
+    verify(stack.z80sdcard.readBlocks(SD_IMAGE_BLOCKS - 1, 2, blocks) == Z80SDCard::read_error, "sd card multi block read behind the end");
+
+    //telemetry: one entry per transfer, streams with their bytes, the bus counters follow the transfers
+    stack.z80sdcard.clearStats();
+    uint32_t spiBytes = stack.z80spi.stats.bytes;
+    uint32_t ioReads = stack.z80io.stats.reads;
+    stack.z80sdcard.readBlock(SD_TEST_BLOCK, block);
+    stack.z80sdcard.readBlocks(SD_TEST_BLOCK, SD_MULTI_BLOCKS, blocks);
+    const Z80SDCard::commandStats_t* commandStats = stack.z80sdcard.commandStats;
+    bool telemetryOK = (commandStats[17].count == 1) && (commandStats[17].bytes == SD_BLOCK_SIZE) && (commandStats[17].minCycles == commandStats[17].maxCycles);
+    telemetryOK &= (commandStats[18].count == 1) && (commandStats[18].bytes == SD_MULTI_BLOCKS * SD_BLOCK_SIZE) && (commandStats[12].count == 1);
+    telemetryOK &= (commandStats[18].totalCycles > commandStats[17].totalCycles) && (commandStats[24].count == 0) && (commandStats[17].busyPolls > 0);
+    telemetryOK &= (stack.z80spi.stats.bytes - spiBytes > (SD_MULTI_BLOCKS + 1) * SD_BLOCK_SIZE) && (stack.z80io.stats.reads - ioReads > stack.z80spi.stats.bytes - spiBytes);
+    verify(telemetryOK, "sd card telemetry per command");
+
+    //crc mode, the transfers with an injected crc error are repeated
+    uint32_t crcErrors = stack.z80sdcard.crcErrors;
+    bool crcOK = stack.z80sdcard.setCrcMode(true) == Z80SDCard::ok;
+    simBoard.sdcard.injectCrcErrors = 1;
+    crcOK &= stack.z80sdcard.writeBlock(SD_TEST_BLOCK, &blocks[SD_BLOCK_SIZE]) == Z80SDCard::ok;
+    simBoard.sdcard.injectCrcErrors = 1;
+    crcOK &= stack.z80sdcard.readBlock(SD_TEST_BLOCK, block) == Z80SDCard::ok;
+    crcOK &= memcmp(block, &blocks[SD_BLOCK_SIZE], SD_BLOCK_SIZE) == 0;
+    for (int i=0; i<(int)sizeof(blocks); i++) blocks[i] = i * 3;
+    simBoard.sdcard.injectCrcErrors = 1;
+    crcOK &= stack.z80sdcard.writeBlocks(SD_TEST_BLOCK, SD_MULTI_BLOCKS, blocks) == Z80SDCard::ok;
+    memset(blocks, 0, sizeof(blocks));
+    simBoard.sdcard.injectCrcErrors = 1;
+    crcOK &= stack.z80sdcard.readBlocks(SD_TEST_BLOCK, SD_MULTI_BLOCKS, blocks) == Z80SDCard::ok;
+    for (int i=0; i<(int)sizeof(blocks); i++) if (blocks[i] != (uint8_t)(i * 3)) crcOK = false;
+    //a crc error on the last block of a stream: read again with CMD17, the stream is not restarted past the range
+    uint32_t streams = stack.z80sdcard.commandStats[18].count;
+    uint32_t singleReads = stack.z80sdcard.commandStats[17].count;
+    simBoard.sdcard.injectCrcErrors = 1;
+    crcOK &= stack.z80sdcard.readBlocks(SD_TEST_BLOCK, 1, blocks) == Z80SDCard::ok;
+    crcOK &= (stack.z80sdcard.commandStats[18].count == streams + 1) && (stack.z80sdcard.commandStats[17].count == singleReads + 1);
+    for (int i=0; i<SD_BLOCK_SIZE; i++) if (blocks[i] != (uint8_t)(i * 3)) crcOK = false;
+    crcOK &= (stack.z80sdcard.crcErrors - crcErrors == 5) && (simBoard.sdcard.injectCrcErrors == 0);
+    crcOK &= stack.z80sdcard.setCrcMode(false) == Z80SDCard::ok;
+    verify(crcOK, "sd card crc mode, repeated transfers");
+    verify(stack.z80sdcard.writeProgram(0, 0) == Z80SDCard::ok, "sd card boot program");
+
+    //sd block cache: dirty frames are written back when replaced or flushed, writes bypassing the cache
+    //drop the clean frames
+    Z80SDCache& cache = stack.z80sdcache;
+    uint32_t writeBacks = cache.stats.writeBacks;
+    bool cacheOK = true;
+    for (uint32_t i=0; i<Z80SDCACHE_FRAMES + 8; i++) {
+        memset(block, i, sizeof(block));
+        cacheOK &= cache.writeBlock(SD_TEST_BLOCK + i, block) == Z80SDCard::ok;
+    }
+    cacheOK &= (cache.stats.writeBacks - writeBacks == 8) && !cache.contains(SD_TEST_BLOCK + 7) && cache.contains(SD_TEST_BLOCK + 8);
+    cacheOK &= (cache.flush() == Z80SDCard::ok) && !cache.dirty() && (cache.stats.writeBacks - writeBacks == Z80SDCACHE_FRAMES + 8);
+    for (uint32_t i=0; i<Z80SDCACHE_FRAMES + 8; i++) {
+        cacheOK &= stack.z80sdcard.readBlock(SD_TEST_BLOCK + i, block) == Z80SDCard::ok;
+        if ((block[0] != (uint8_t)i) || (block[SD_BLOCK_SIZE - 1] != (uint8_t)i)) cacheOK = false;
+    }
+    uint32_t hits = cache.stats.hits;
+    cacheOK &= (cache.readBlock(SD_TEST_BLOCK + 9, block) == Z80SDCard::ok) && (block[0] == 9) && (cache.stats.hits - hits == 1);
+    stack.z80sdcard.writeBlock(SD_TEST_BLOCK + 9, blocks);
+    cacheOK &= !cache.contains(SD_TEST_BLOCK + 9);
+    verify(cacheOK, "sd block cache write back, lru and foreign writes");
+
+    //sequential reads are read ahead with multi block reads, other blocks read in between do not stop it
+    cache.invalidate();
+    uint32_t readAheadHits = cache.stats.readAheadHits;
+    commands = simBoard.sdcard.stats.commands;
+    bool readAheadOK = true;
+    for (uint32_t i=16; i<Z80SDCACHE_FRAMES; i++) {
+        readAheadOK &= cache.readBlock(SD_TEST_BLOCK + i, block) == Z80SDCard::ok;
+        readAheadOK &= block[0] == (uint8_t)i;
+        if (i == 32) readAheadOK &= cache.readBlock(0, block) == Z80SDCard::ok;
+    }
+    readAheadOK &= (cache.stats.readAheadHits - readAheadHits >= 40) && (simBoard.sdcard.stats.commands - commands < 24);
+    verify(readAheadOK, "sd block cache read ahead");
+
+    //empty cpm directory on disk A with one file
+    memset(block, 0xE5, sizeof(block));
+    for (uint32_t i=0; i<CPM_DIR_TRACKS; i++) stack.z80sdcard.writeBlock(SD_PARTITION_START + CPM_BOOT_TRACKS + i, block);
+    memset(block, 0, 32);
+    memcpy(&block[1], "TEST    TXT", 11);
+    block[15] = 0x10;
+    block[16] = 0x02;
+    stack.z80sdcard.writeBlock(SD_PARTITION_START + CPM_BOOT_TRACKS, block);
+    stack.z80sdcard.accessCard(false);
+    verify(stack.filesystem.listFiles(0, true), "cpm directory");
+    uint32_t sdCommands = simBoard.sdcard.stats.commands;
+    stack.filesystem.readDisk(0, true);
+    verify(simBoard.sdcard.stats.commands == sdCommands, "cpm directory again, from the sd block cache");
+    //the file records are reused by every refresh, and taken over by the disk read last
+    bool recordsOK = true;
+    for (uint32_t i=0; i<100; i++) recordsOK &= stack.filesystem.readDisk(0, true) && (stack.filesystem.fileCount(0) == 1);
+    recordsOK &= stack.filesystem.readDisk(1) && (stack.filesystem.fileCount(0) == 0) && (stack.filesystem.fileCount(1) == 0);
+    recordsOK &= stack.filesystem.readDisk(0) && (stack.filesystem.fileCount(0) == 1);
+    verify(recordsOK, "cpm file records reused on refresh");
+
+    //allocation bitmap: ranges across words, counts, free runs found first fit and next fit
+    static CPMBitmap bitmap;
+    bitmap.begin(1022);
+    bitmap.setBlocks(0, 2);
+    bitmap.setBlocks(30, 40);
+    bitmap.setBlocks(100);
+    bool bitmapOK = (bitmap.usedBlocks() == 43) && (bitmap.freeBlocks() == 1022 - 43) && (bitmap.highestUsed() == 100);
+    bitmapOK &= bitmap.allUsed(30, 40) && !bitmap.allUsed(29, 2) && bitmap.anyUsed(70, 31) && !bitmap.anyUsed(70, 30);
+    bitmapOK &= (bitmap.firstFit(1) == 2) && (bitmap.firstFit(28) == 2) && (bitmap.firstFit(29) == 70) && (bitmap.firstFit(31) == 101);
+    bitmap.clearBlocks(31, 38);
+    bitmapOK &= (bitmap.usedBlocks() == 5) && bitmap.testBlock(30) && !bitmap.testBlock(31) && bitmap.testBlock(69) && (bitmap.firstFit(38) == 31);
+    bitmap.setBlocks(1000, 30);
+    bitmapOK &= (bitmap.nextFit(10) == 2) && (bitmap.nextFit(10) == 12) && (bitmap.nextFit(10) == 31) && (bitmap.nextFit(30) == 70);
+    bitmap.setBlocks(101, 899);
+    bitmapOK &= (bitmap.nextFit(20) == 2) && (bitmap.nextFit(2000) == CPMBITMAP_NONE) && (bitmap.highestUsed() == 1021);
+    bitmapOK &= (bitmap.usedBlocks() == 926) && !bitmap.anyUsed(1022, 10) && !bitmap.allUsed(1000, 30);
+    verify(bitmapOK, "cpm allocation bitmap");
+
+    //extents found in any order through the file index, user areas kept apart
+    stack.z80sdcard.accessCard(true);
+    fillDirectory(stack, 1);
+    stack.z80sdcard.accessCard(false);
+    bool indexOK = stack.filesystem.readDisk(1, true) && (stack.filesystem.fileCount(1) == CPM_DIR_TRACKS * 8);
+    const CPMFileSystem::file_t* file = stack.filesystem.getFile(1, 1, "file0005.dat");
+    indexOK &= (file != nullptr) && (file->user == 1) && (file->extends == 2) && (file->records == 522) && (file->blocks == 9);
+    indexOK &= (stack.filesystem.getFile(1, 0, "FILE0127.DAT") != nullptr) && (stack.filesystem.getFile(1, 2, "FILE0005.DAT") == nullptr);
+    indexOK &= (stack.filesystem.getFile(1, 0, "FILE0128.DAT") == nullptr) && (stack.filesystem.getFile(0, 0, "TEST.TXT") == nullptr);
+    verify(indexOK, "cpm file index, extents in any order");
+
+    //a committed write replaces the record in place: every file of user 1 in turn, the last record (FILE0127)
+    //and records in the probe chain of others are deleted. All files are found without a new read, and the
+    //records match the ones of a new read
+    bool updateOK = true;
+    char filename[13];
+    for (uint32_t i=0; i<CPM_DIR_TRACKS * 4; i++) {
+        snprintf(filename, sizeof(filename), "FILE%04u.DAT", i);
+        updateOK &= stack.filesystem.writeFileBegin(1, 1, filename, 0) == CPMFileSystem::writeDone;
+        updateOK &= stack.filesystem.writeFileEnd(true) == CPMFileSystem::writeDone;
+        updateOK &= stack.filesystem.fileCount(1) == CPM_DIR_TRACKS * 8;
+        for (uint32_t j=0; j<CPM_DIR_TRACKS * 4; j++) {
+            snprintf(filename, sizeof(filename), "FILE%04u.DAT", j);
+            file = stack.filesystem.getFile(1, 0, filename);
+            updateOK &= (file != nullptr) && (file->extends == 2);
+            file = stack.filesystem.getFile(1, 1, filename);
+            updateOK &= (file != nullptr) && (file->extends == ((j <= i) ? 1 : 2)) && (file->records == ((j <= i) ? 0 : 522u));
+        }
+    }
+    CPMFileSystem::file_t updated[CPM_DIR_TRACKS * 8];
+    for (uint32_t j=0; j<CPM_DIR_TRACKS * 8; j++) {
+        snprintf(filename, sizeof(filename), "FILE%04u.DAT", j / 2);
+        file = stack.filesystem.getFile(1, j & 1, filename);
+        if (file != nullptr) updated[j] = *file;
+    }
+    updateOK &= stack.filesystem.readDisk(1, true) && (stack.filesystem.fileCount(1) == CPM_DIR_TRACKS * 8);
+    for (uint32_t j=0; j<CPM_DIR_TRACKS * 8; j++) {
+        snprintf(filename, sizeof(filename), "FILE%04u.DAT", j / 2);
+        file = stack.filesystem.getFile(1, j & 1, filename);
+        updateOK &= (file != nullptr) && (memcmp(file, &updated[j], sizeof(CPMFileSystem::file_t)) == 0);
+    }
+    verify(updateOK, "cpm file records replaced in place after a write");
+
+    //erase deletes the record without a new one: the last record (FILE0127 of user 1) first, then every file
+    //of user 0. Their slots stay in the probe chain of others, all files left are found without a new read
+    bool eraseOK = stack.filesystem.eraseFile(1, 1, "FILE0127.DAT") == CPMFileSystem::writeDone;
+    eraseOK &= (stack.filesystem.fileCount(1) == CPM_DIR_TRACKS * 8 - 1) && (stack.filesystem.getFile(1, 1, "FILE0127.DAT") == nullptr);
+    eraseOK &= stack.filesystem.eraseFile(1, 1, "FILE0127.DAT") == CPMFileSystem::writeInvalid;
+    for (uint32_t i=0; i<CPM_DIR_TRACKS * 4; i++) {
+        snprintf(filename, sizeof(filename), "FILE%04u.DAT", i);
+        eraseOK &= stack.filesystem.eraseFile(1, 0, filename) == CPMFileSystem::writeDone;
+        eraseOK &= stack.filesystem.fileCount(1) == CPM_DIR_TRACKS * 8 - 2 - i;
+        for (uint32_t j=0; j<CPM_DIR_TRACKS * 4; j++) {
+            snprintf(filename, sizeof(filename), "FILE%04u.DAT", j);
+            eraseOK &= (stack.filesystem.getFile(1, 0, filename) == nullptr) == (j <= i);
+            file = stack.filesystem.getFile(1, 1, filename);
+            eraseOK &= (j == CPM_DIR_TRACKS * 4 - 1) ? (file == nullptr) : ((file != nullptr) && (file->extends == 1));
+        }
+    }
+    eraseOK &= stack.filesystem.readDisk(1, true) && (stack.filesystem.fileCount(1) == CPM_DIR_TRACKS * 4 - 1);
+    eraseOK &= (stack.filesystem.getFile(1, 0, "FILE0000.DAT") == nullptr) && (stack.filesystem.getFile(1, 1, "FILE0126.DAT") != nullptr);
+    verify(eraseOK, "cpm file erase, records deleted in place");
+    verify(stack.filesystem.readDisk(0) && (stack.filesystem.getFile(0, 0, "test.txt") != nullptr), "cpm file lookup by name");
+    verify(simBoard.sdcard.stats.illegalCommands == 0, "sd card illegal commands");
+
+    //nested bus sessions take the bus only once, and give it back at the end. The owner callback (io trap
+    //mask) is called once each way
+    uint32_t busRequests = simBoard.stats.busRequests;
+    ownerChanges[0] = ownerChanges[1] = 0;
+    stack.z80bus.onOwnerChange(countOwnerChange);
+    {
+        Z80BusSession session(stack.z80bus);
+        stack.filesystem.listFiles(0, true);
+        stack.z80flash.setMode(true);
+        stack.z80flash.readChipIndentification();
+        stack.z80flash.setMode(false);
+        verify(stack.z80bus.bus_active(), "bus held by the outer session");
+    }
+    stack.z80bus.onOwnerChange(nullptr);
+    verify(simBoard.stats.busRequests - busRequests == 1, "nested bus sessions request the bus once");
+    verify((ownerChanges[0] == 1) && (ownerChanges[1] == 1), "bus owner change reported once each way");
+    verify(!stack.z80bus.bus_active() && !(simBoard.portA.output & PORTA_PIN_RESET), "bus and reset released after the session");
+
+    //jobs run in slices, hold the bus and the reset until they end, and can be cancelled
+    JobEngine jobs(stack.z80bus);
+    CPMListJob listJob(stack.filesystem);
+    listJob.setup(0, true);
+    stack.z80sdcache.invalidate();
+    bool jobOK = jobs.start(listJob) && !jobs.start(listJob);
+    while (jobs.busy()) {
+        jobOK &= stack.z80bus.bus_active() && (simBoard.portA.output & PORTA_PIN_RESET);
+        jobs.process();
+    }
+    jobOK &= (jobs.state == Job::done) && (jobs.progress() == 100) && (jobs.slices > CPM_DIR_TRACKS) && (jobs.maxSlice_us < 10000);
+    jobOK &= !stack.z80bus.bus_active() && !(simBoard.portA.output & PORTA_PIN_RESET);
+    verify(jobOK, "cpm directory job in slices");
+    SDProgramJob programJob(stack.z80sdcard, stack.z80sdcache);
+    programJob.setup(0, 0);
+    jobs.start(programJob);
+    for (uint8_t i=0; i<3; i++) jobs.process();     //begin, mbr and the first block of the program
+    jobs.cancel();
+    bool cancelOK = (jobs.state == Job::cancelled) && !stack.z80bus.bus_active() && !stack.z80sdcard.accessed();
+    cancelOK &= (stack.z80sdcard.accessCard(true) == Z80SDCard::ok) && (stack.z80sdcard.readBlock(SD_PARTITION_START, block) == Z80SDCard::ok);
+    stack.z80sdcard.accessCard(false);
+    jobs.start(programJob);
+    while (jobs.busy()) jobs.process();
+    cancelOK &= (jobs.state == Job::done) && (programJob.result == Z80SDCard::ok) && (jobs.maxSlice_us < 10000);
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.readBlock(SD_PARTITION_START + z80SDPrograms[0].length / SD_BLOCK_SIZE, block);
+    stack.z80sdcard.accessCard(false);
+    cancelOK &= memcmp(block, &z80SDPrograms[0].data[z80SDPrograms[0].length & ~(SD_BLOCK_SIZE - 1)], z80SDPrograms[0].length % SD_BLOCK_SIZE) == 0;
+    verify(cancelOK, "sd program job cancelled, then complete");
+
+    //sd transfer: export in data and fill packets, import with a corrupted packet and a fill run
+    SDTransfer transfer(stack.z80sdcache, stack.filesystem, jobs);
+    const uint32_t transferBlock = SD_TEST_BLOCK + 0x100;
+    static uint8_t image[8 * SD_BLOCK_SIZE];
+    static uint8_t card[8 * SD_BLOCK_SIZE];
+    const uint8_t content[8] = { 'D', 0xE5, 0xE5, 0xE5, 0x00, 'D', 'D', 0xE5 };
+    for (uint32_t i=0; i<8; i++) {
+        for (int j=0; j<SD_BLOCK_SIZE; j++) image[i * SD_BLOCK_SIZE + j] = (content[i] == 'D') ? i + j : content[i];
+    }
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.writeBlocks(transferBlock, 8, image);
+    stack.z80sdcard.accessCard(false);
+    memset(image, 0x55, sizeof(image));
+    FILE* output = tmpfile();
+    Serial.redirect(output);
+    transferCommand(transfer, 'E', transferBlock, 8);
+    while (jobs.busy()) jobs.process();
+    Serial.redirect(nullptr);
+    rewind(output);
+    bool exportOK = (jobs.state == Job::done) && (transfer.transfermode == SDTransfer::inactive);
+    uint8_t type;
+    uint32_t packetBlock;
+    uint16_t length;
+    uint32_t packets = 0;
+    while (transferReceive(output, type, packetBlock, block, length)) {
+        packets++;
+        uint8_t* at = &image[(packetBlock - transferBlock) * SD_BLOCK_SIZE];
+        if (type == SDTransfer::dataPacket) memcpy(at, block, SD_BLOCK_SIZE);
+        if (type == SDTransfer::fillPacket) memset(at, block[0], (block[1] | (block[2] << 8)) * SD_BLOCK_SIZE);
+        if (type == SDTransfer::endPacket) exportOK &= (block[0] == SDTransfer::statusOk) && (packetBlock == transferBlock + 8);
+    }
+    fclose(output);
+    stack.z80sdcard.accessCard(true);
+    exportOK &= stack.z80sdcard.readBlocks(transferBlock, 8, card) == Z80SDCard::ok;
+    stack.z80sdcard.accessCard(false);
+    exportOK &= (packets == 8) && (transfer.stats.dataPackets == 3) && (transfer.stats.fillBlocks == 5) && (memcmp(image, card, sizeof(image)) == 0);
+    verify(exportOK, "sd transfer export, empty blocks as fill runs");
+
+    output = tmpfile();
+    Serial.redirect(output);
+    transferCommand(transfer, 'I', transferBlock + 8, 8);
+    jobs.process();
+    const uint8_t fill[3] = { 0xE5, 6, 0 };
+    transferSend(transfer, SDTransfer::dataPacket, transferBlock + 8, image, SD_BLOCK_SIZE);
+    for (uint8_t i=0; i<4; i++) jobs.process();
+    transferSend(transfer, SDTransfer::dataPacket, transferBlock + 9, &image[5 * SD_BLOCK_SIZE], SD_BLOCK_SIZE, true);
+    for (uint8_t i=0; i<4; i++) jobs.process();
+    transferSend(transfer, SDTransfer::dataPacket, transferBlock + 9, &image[5 * SD_BLOCK_SIZE], SD_BLOCK_SIZE);
+    for (uint8_t i=0; i<4; i++) jobs.process();
+    transferSend(transfer, SDTransfer::fillPacket, transferBlock + 10, fill, sizeof(fill));
+    for (uint8_t i=0; i<4; i++) jobs.process();
+    transferSend(transfer, SDTransfer::endPacket, transferBlock + 16, fill, 0);
+    while (jobs.busy()) jobs.process();
+    Serial.redirect(nullptr);
+    rewind(output);
+    const uint8_t acks[6] = { SDTransfer::statusOk, SDTransfer::statusOk, SDTransfer::statusCrcError, SDTransfer::statusOk, SDTransfer::statusOk, SDTransfer::statusOk };
+    bool importOK = jobs.state == Job::done;
+    packets = 0;
+    while (transferReceive(output, type, packetBlock, block, length)) {
+        importOK &= (packets < 6) && (type == SDTransfer::ackPacket) && (block[0] == acks[packets]);
+        packets++;
+    }
+    fclose(output);
+    importOK &= (packets == 6) && (packetBlock == transferBlock + 16) && (transfer.stats.crcErrors == 1) && !stack.z80sdcache.dirty();
+    stack.z80sdcard.accessCard(true);
+    importOK &= stack.z80sdcard.readBlocks(transferBlock + 8, 8, card) == Z80SDCard::ok;
+    stack.z80sdcard.accessCard(false);
+    importOK &= (memcmp(card, image, SD_BLOCK_SIZE) == 0) && (memcmp(&card[SD_BLOCK_SIZE], &image[5 * SD_BLOCK_SIZE], SD_BLOCK_SIZE) == 0);
+    for (uint32_t i=2 * SD_BLOCK_SIZE; i<sizeof(card); i++) if (card[i] != 0xE5) importOK = false;
+    verify(importOK, "sd transfer import, crc error answered");
+
+    //file export: two directory entries, the second one in front, 8 allocation blocks in a row and one apart.
+    //The file is read in multi block runs, the last packet holds the rest of the last record. Each command
+    //reads the directory again (one more run)
+    const uint32_t fileBytes = 512 * 128 + 21 * 128;
+    static uint8_t fileData[fileBytes + SD_BLOCK_SIZE];
+    static uint8_t fileReceived[fileBytes + SD_BLOCK_SIZE];
+    for (uint32_t i=0; i<fileBytes; i++) fileData[i] = i * 7 + (i >> 9);
+    memset(block, 0xE5, sizeof(block));
+    memset(block, 0, 64);
+    memcpy(&block[1], "BIG     DAT", 11);
+    block[12] = 4;
+    block[15] = 21;
+    block[16] = 30;
+    memcpy(&block[33], "BIG     DAT", 11);
+    block[44] = 3;
+    block[47] = 128;
+    for (uint8_t i=0; i<8; i++) block[48 + 2*i] = 10 + i;
+    //the directory is written behind the file system (like the Z80 does), after it has read the disk
+    const uint32_t dataStart = SD_PARTITION_START + CPM_BOOT_TRACKS;
+    stack.filesystem.readDisk(0, true);
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.writeBlock(dataStart + 1, block);
+    stack.z80sdcard.writeBlocks(dataStart + 10 * 16, 128, fileData);
+    stack.z80sdcard.writeBlocks(dataStart + 30 * 16, 6, fileData + 128 * SD_BLOCK_SIZE);
+    stack.z80sdcard.accessCard(false);
+    stack.z80sdcard.clearStats();
+    output = tmpfile();
+    Serial.redirect(output);
+    transferFileCommand(transfer, 0, 0, "big.dat");
+    while (jobs.busy()) jobs.process();
+    transferFileCommand(transfer, 0, 1, "big.dat");
+    while (jobs.busy()) jobs.process();
+    Serial.redirect(nullptr);
+    rewind(output);
+    memset(fileReceived, 0x55, sizeof(fileReceived));
+    bool fileOK = true;
+    uint32_t fileSize = 0;
+    uint32_t endBlock = 0;
+    packets = 0;
+    uint8_t refused = SDTransfer::statusOk;
+    while (transferReceive(output, type, packetBlock, block, length)) {
+        packets++;
+        if ((type == SDTransfer::ackPacket) && (packets == 1)) fileSize = packetBlock;
+        if (type == SDTransfer::ackPacket) refused = block[0];
+        if ((type == SDTransfer::dataPacket) && (packetBlock * SD_BLOCK_SIZE + length <= fileBytes)) memcpy(&fileReceived[packetBlock * SD_BLOCK_SIZE], block, length);
+        if ((type == SDTransfer::endPacket) && (endBlock == 0)) endBlock = packetBlock;
+    }
+    fclose(output);
+    fileOK &= (fileSize == fileBytes) && (endBlock == 134) && (memcmp(fileReceived, fileData, fileBytes) == 0);
+    fileOK &= (stack.z80sdcard.commandStats[18].count <= 6 + 2) && (refused == SDTransfer::statusNoFile);
+    verify(fileOK, "sd transfer file export in multi block runs");
+
+    //file import: a new file of three entries (512, 512, 148 records) in one run of free blocks, read back
+    //by the file export. The last record is filled with end of file
+    const uint32_t newBytes = 1172 * 128 - 16;
+    static uint8_t newData[newBytes + SD_BLOCK_SIZE];
+    for (uint32_t i=0; i<newBytes; i++) newData[i] = i * 13 + (i >> 11);
+    uint8_t written = transferWriteFile(transfer, jobs, 0, 0, "new.bin", newData, newBytes);
+    stack.filesystem.readDisk(0, true);
+    const CPMFileSystem::file_t* newFile = stack.filesystem.getFile(0, 0, "NEW.BIN");
+    uint32_t filesBefore = stack.filesystem.fileCount(0);
+    bool writeOK = (written == SDTransfer::statusOk) && (newFile != nullptr) && (transfer.transfermode == SDTransfer::inactive);
+    writeOK &= (newFile != nullptr) && (newFile->records == 1172) && (newFile->extends == 3) && (newFile->blocks == 19);
+    output = tmpfile();
+    Serial.redirect(output);
+    transferFileCommand(transfer, 0, 0, "new.bin");
+    while (jobs.busy()) jobs.process();
+    Serial.redirect(nullptr);
+    rewind(output);
+    static uint8_t newReceived[newBytes + 16 + SD_BLOCK_SIZE];
+    fileSize = 0;
+    packets = 0;
+    while (transferReceive(output, type, packetBlock, block, length)) {
+        if ((type == SDTransfer::ackPacket) && (packets++ == 0)) fileSize = packetBlock;
+        if ((type == SDTransfer::dataPacket) && (packetBlock * SD_BLOCK_SIZE + length <= newBytes + 16)) memcpy(&newReceived[packetBlock * SD_BLOCK_SIZE], block, length);
+    }
+    fclose(output);
+    writeOK &= (fileSize == newBytes + 16) && (memcmp(newReceived, newData, newBytes) == 0);
+    for (uint32_t i=newBytes; i<newBytes + 16; i++) if (newReceived[i] != CPMFILE_EOF) writeOK = false;
+    verify(writeOK, "cpm file write, three entries read back");
+
+    //replace: BIG.DAT (2 entries, 9 blocks) by one entry of 8 records. The new entry takes the slot of the
+    //old one, the directory changes in one block write. The blocks of the old file are free again
+    Z80SDCard::sdResult sdResult;
+    const uint8_t* directory = stack.z80sdcache.getBlock(dataStart + 1, sdResult);
+    uint8_t directoryBefore[SD_BLOCK_SIZE];
+    memcpy(directoryBefore, directory, SD_BLOCK_SIZE);
+    stack.z80sdcache.release();
+    uint32_t freeBefore = 0;
+    for (uint32_t i=0; i<CPM_DIR_TRACKS; i++) {
+        stack.z80sdcard.accessCard(true);
+        stack.z80sdcard.readBlock(dataStart + i, block);
+        stack.z80sdcard.accessCard(false);
+        for (uint8_t j=0; j<16; j++) if (block[j * 32] == 0xE5) freeBefore++;
+    }
+    stack.z80sdcard.clearStats();
+    written = transferWriteFile(transfer, jobs, 0, 0, "big.dat", newData, 1000);
+    bool replaceOK = written == SDTransfer::statusOk;
+    //data blocks 0 and 1 of the file, then the directory block
+    replaceOK &= (stack.z80sdcard.commandStats[24].count + stack.z80sdcard.commandStats[25].count <= 3);
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.readBlock(dataStart + 1, block);
+    stack.z80sdcard.accessCard(false);
+    replaceOK &= (block[0] == 0) && (memcmp(&block[1], "BIG     DAT", 11) == 0) && (block[12] == 0) && (block[14] == 0) && (block[15] == 8);
+    replaceOK &= (block[16] != 0) && (block[18] == 0) && (block[32] == 0xE5) && (memcmp(&block[64], &directoryBefore[64], SD_BLOCK_SIZE - 64) == 0);
+    uint32_t freeAfter = 0;
+    for (uint32_t i=0; i<CPM_DIR_TRACKS; i++) {
+        stack.z80sdcard.accessCard(true);
+        stack.z80sdcard.readBlock(dataStart + i, card);
+        stack.z80sdcard.accessCard(false);
+        for (uint8_t j=0; j<16; j++) if (card[j * 32] == 0xE5) freeAfter++;
+    }
+    stack.filesystem.readDisk(0, true);
+    const CPMFileSystem::file_t* bigFile = stack.filesystem.getFile(0, 0, "BIG.DAT");
+    replaceOK &= (freeAfter == freeBefore + 1) && (bigFile != nullptr) && (bigFile->records == 8) && (bigFile->extends == 1);
+    replaceOK &= stack.filesystem.fileCount(0) == filesBefore;
+    //the blocks of the old BIG.DAT (10..17) are free again: 16 blocks fit in 4..19, behind TEST.TXT and the new BIG.DAT
+    written = transferWriteFile(transfer, jobs, 0, 1, "run.dat", newData, 16 * 8192);
+    uint16_t runStart = 0;
+    stack.z80sdcard.accessCard(true);
+    for (uint32_t i=0; i<CPM_DIR_TRACKS; i++) {
+        stack.z80sdcard.readBlock(dataStart + i, card);
+        for (uint8_t j=0; j<16; j++) if ((card[j * 32] == 1) && (memcmp(&card[j * 32 + 1], "RUN     DAT", 11) == 0) && (card[j * 32 + 12] == 3)) runStart = card[j * 32 + 16] | (card[j * 32 + 17] << 8);
+    }
+    stack.z80sdcard.accessCard(false);
+    replaceOK &= (written == SDTransfer::statusOk) && (block[16] == 3) && (runStart == 4);
+    verify(replaceOK, "cpm file write, replace in one directory block");
+
+    //cancelled after two blocks, no space, read only, and a name which is not valid: the disk stays as it is
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.readBlock(dataStart + 1, directoryBefore);
+    stack.z80sdcard.accessCard(false);
+    written = transferWriteFile(transfer, jobs, 0, 0, "big.dat", newData, 4000, 2);
+    bool refuseOK = written == SDTransfer::statusCancelled;
+    refuseOK &= transferWriteFile(transfer, jobs, 0, 0, "huge.dat", newData, 9 * 1024 * 1024) == SDTransfer::statusNoSpace;
+    refuseOK &= transferWriteFile(transfer, jobs, 0, 0, "no*.dat", newData, 10) == SDTransfer::statusNoFile;
+    refuseOK &= transferWriteFile(transfer, jobs, 0, 16, "big.dat", newData, 10) == SDTransfer::statusNoFile;
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.readBlock(dataStart + 1, block);
+    block[9] |= 0x80;
+    stack.z80sdcard.writeBlock(dataStart + 1, block);
+    stack.z80sdcard.accessCard(false);
+    refuseOK &= transferWriteFile(transfer, jobs, 0, 0, "big.dat", newData, 10) == SDTransfer::statusReadOnly;
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.readBlock(dataStart + 1, block);
+    block[9] &= 0x7F;
+    stack.z80sdcard.writeBlock(dataStart + 1, block);
+    stack.z80sdcard.accessCard(false);
+    refuseOK &= memcmp(block, directoryBefore, SD_BLOCK_SIZE) == 0;
+    stack.filesystem.readDisk(0, true);
+    bigFile = stack.filesystem.getFile(0, 0, "BIG.DAT");
+    refuseOK &= (bigFile != nullptr) && (bigFile->records == 8);
+    verify(refuseOK, "cpm file write refused or cancelled, no change");
+
+    //replace on a full disk: FILL.DAT leaves two blocks free. Its replace fits in the free blocks, or only in
+    //place of the old file (distinct state, the old file is kept until the commit), or not at all
+    uint32_t freeBlocks = 0;
+    for (uint32_t step=512; step>0; step>>=1) {
+        if (stack.filesystem.writeFileBegin(0, 0, "fill.dat", (freeBlocks + step) * 8192) == CPMFileSystem::writeDone) freeBlocks += step;
+        stack.filesystem.writeFileEnd(false);
+    }
+    bool fullOK = (freeBlocks > 8) && (stack.filesystem.writeFileBegin(0, 0, "fill.dat", (freeBlocks - 2) * 8192) == CPMFileSystem::writeDone);
+    fullOK &= stack.filesystem.writeFileEnd(true) == CPMFileSystem::writeDone;
+    fullOK &= stack.filesystem.writeFileBegin(0, 0, "fill.dat", 2 * 8192) == CPMFileSystem::writeDone;
+    stack.filesystem.writeFileEnd(false);
+    fullOK &= stack.filesystem.writeFileBegin(0, 0, "fill.dat", freeBlocks * 8192) == CPMFileSystem::writeNoSpaceReplace;
+    fullOK &= stack.filesystem.writeFileBegin(0, 0, "fill.dat", (freeBlocks + 1) * 8192) == CPMFileSystem::writeNoSpace;
+    fullOK &= stack.filesystem.writeFileBegin(0, 0, "other.dat", 3 * 8192) == CPMFileSystem::writeNoSpace;
+    fullOK &= transferWriteFile(transfer, jobs, 0, 0, "fill.dat", newData, 3 * 8192) == SDTransfer::statusNoSpaceReplace;
+    stack.filesystem.readDisk(0, true);
+    const CPMFileSystem::file_t* fillFile = stack.filesystem.getFile(0, 0, "FILL.DAT");
+    fullOK &= (fillFile != nullptr) && (fillFile->blocks == freeBlocks - 2);
+    //deleted by the host, FILL.DAT fits in its whole size again
+    fullOK &= transferDeleteFile(transfer, jobs, 0, 0, "fill.dat") == SDTransfer::statusOk;
+    fullOK &= (stack.filesystem.getFile(0, 0, "FILL.DAT") == nullptr) && (transfer.transfermode == SDTransfer::inactive);
+    fullOK &= transferDeleteFile(transfer, jobs, 0, 0, "fill.dat") == SDTransfer::statusNoFile;
+    fullOK &= stack.filesystem.writeFileBegin(0, 0, "fill.dat", freeBlocks * 8192) == CPMFileSystem::writeDone;
+    stack.filesystem.writeFileEnd(false);
+    verify(fullOK, "cpm file replace on a full disk, distinct state");
+
+    //format with disks: one erase, the directories as fill blocks (crc mode checks the generated crc), and
+    //the boot program
+    memset(block, 0x3C, sizeof(block));
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.writeBlock(SD_PARTITION_START + CPM_DISK_TRACKS + CPM_BOOT_TRACKS + 5, block);
+    stack.z80sdcard.writeBlock(SD_PARTITION_START + CPM_DISK_TRACKS + CPM_BOOT_TRACKS + CPM_DIR_TRACKS, block);
+    stack.z80sdcard.setCrcMode(true);
+    stack.z80sdcard.accessCard(false);
+    SDFormatJob formatJob(stack.z80sdcard, stack.z80sdcache);
+    formatJob.setup(1, SD_PARTITION_START, SD_IMAGE_BLOCKS - SD_PARTITION_START);
+    formatJob.setupDisks(16, CPM_DISK_TRACKS, CPM_BOOT_TRACKS, CPM_DIR_TRACKS, 0);
+    uint32_t erased = simBoard.sdcard.stats.erasedBlocks;
+    uint32_t illegal = simBoard.sdcard.stats.illegalCommands;
+    uint32_t crcFailures = simBoard.sdcard.stats.crcErrors;
+    jobs.start(formatJob);
+    while (jobs.busy()) jobs.process();
+    bool formatOK = (jobs.state == Job::done) && (formatJob.result == Z80SDCard::ok) && (formatJob.eraseResult == Z80SDCard::ok);
+    formatOK &= (formatJob.disks == (SD_IMAGE_BLOCKS - SD_PARTITION_START) / CPM_DISK_TRACKS) && (jobs.progress() == 100) && (jobs.maxSlice_us < 10000);
+    formatOK &= (simBoard.sdcard.stats.erasedBlocks - erased == formatJob.disks * CPM_DISK_TRACKS);
+    formatOK &= (simBoard.sdcard.stats.illegalCommands == illegal) && (simBoard.sdcard.stats.crcErrors == crcFailures);
+    stack.z80sdcard.accessCard(true);
+    for (uint8_t disk=0; disk<formatJob.disks; disk++) {
+        formatOK &= stack.z80sdcard.readBlocks(SD_PARTITION_START + disk * CPM_DISK_TRACKS + CPM_BOOT_TRACKS, SD_MULTI_BLOCKS, blocks) == Z80SDCard::ok;
+        for (int i=0; i<(int)sizeof(blocks); i++) if (blocks[i] != 0xE5) formatOK = false;
+    }
+    formatOK &= stack.z80sdcard.readBlock(SD_PARTITION_START + CPM_DISK_TRACKS + CPM_BOOT_TRACKS + CPM_DIR_TRACKS - 1, block) == Z80SDCard::ok;
+    for (int i=0; i<SD_BLOCK_SIZE; i++) if (block[i] != 0xE5) formatOK = false;
+    formatOK &= stack.z80sdcard.readBlock(SD_PARTITION_START + CPM_DISK_TRACKS + CPM_BOOT_TRACKS + CPM_DIR_TRACKS, block) == Z80SDCard::ok;
+    for (int i=0; i<SD_BLOCK_SIZE; i++) if (block[i] != 0x00) formatOK = false;
+    formatOK &= stack.z80sdcard.readBlock(SD_PARTITION_START, block) == Z80SDCard::ok;
+    formatOK &= memcmp(block, z80SDPrograms[0].data, SD_BLOCK_SIZE) == 0;
+    stack.z80sdcard.setCrcMode(false);
+    stack.z80sdcard.accessCard(false);
+    verify(formatOK, "sd format job, erased disks and empty directories");
+    verify(stack.filesystem.listFiles(1, true), "cpm directory of a formatted disk");
+
+    //virtual io devices, called like the io trap does
+    Z80IOMultiplier multiplier;
+    const uint8_t operands[] = { 0xD2, 0x04, 0x2E, 0x16 };
+    for (uint8_t i=0; i<4; i++) multiplier.ioWrite(i, operands[i]);
+    uint32_t product = 0;
+    for (uint8_t i=0; i<4; i++) product |= (uint32_t)multiplier.ioRead(i) << (8*i);
+    verify(product == 1234u * 5678u, "io multiplier");
+    Z80IOBlockCopy blockCopy(stack.z80bus);
+    stack.z80bus.request_bus();
+    stack.z80bus.ioRead(SIM_IOPORT_FLASH_DISABLE);
+    for (uint32_t i=0; i<0x100; i++) stack.z80bus.memWrite(0x8000 + i, i ^ 0x5A);
+    stack.z80bus.release_bus();
+    const uint8_t copyParameters[] = { 0x00, 0x80, 0x00, 0x90, 0x00, 0x01 };
+    blockCopy.ioRead(0);
+    for (uint8_t i=0; i<6; i++) blockCopy.ioWrite(0, copyParameters[i]);
+    blockCopy.ioWrite(1, 0);
+    bool copyPending = blockCopy.ioRead(1) != 0;
+    blockCopy.process();
+    bool copyOK = copyPending && (blockCopy.ioRead(1) == 0) && !stack.z80bus.bus_active();
+    for (uint32_t i=0; i<0x100; i++) if (simBoard.sramRead(0x9000 + i) != (i ^ 0x5A)) copyOK = false;
+    verify(copyOK, "io block copy");
+    uint32_t missedCycles = 0;
+    Z80IODisk disk(stack.z80sdcache, stack.z80spi, jobs, missedCycles);
+    const uint32_t diskBlock = SD_TEST_BLOCK + 1;
+    for (uint8_t i=0; i<4; i++) disk.ioWrite(i, diskBlock >> (8*i));
+    disk.ioWrite(4, 0x30 | SPI_OUT_MOSI | SPI_OUT_SSEL);
+    disk.ioWrite(5, Z80IODisk::resetIndex);
+    for (uint32_t i=0; i<SD_BLOCK_SIZE; i++) disk.ioWrite(6, i * 7);
+    disk.ioWrite(5, Z80IODisk::writeBlock);
+    bool diskOK = disk.ioRead(5) == 0x01;
+    uint32_t blocksWritten = simBoard.sdcard.stats.blocksWritten;
+    disk.process();
+    diskOK &= (disk.ioRead(5) == 0) && stack.z80sdcache.dirty() && (simBoard.sdcard.stats.blocksWritten == blocksWritten);
+    diskOK &= disk.flush() && !stack.z80sdcache.dirty() && ((simBoard.output0 & 0xF0) == 0x30);
+    static Z80SDCache otherCache(stack.z80sdcard);
+    Z80IODisk otherDisk(otherCache, stack.z80spi, jobs, missedCycles);
+    for (uint8_t pass=0; pass<2; pass++) {
+        for (uint8_t i=0; i<4; i++) otherDisk.ioWrite(i, diskBlock >> (8*i));
+        otherDisk.ioWrite(5, Z80IODisk::readBlock);
+        otherDisk.process();
+        diskOK &= otherDisk.ioRead(5) == 0;
+        for (uint32_t i=0; i<SD_BLOCK_SIZE; i++) if (otherDisk.ioRead(6) != (uint8_t)(i * 7)) diskOK = false;
+    }
+    diskOK &= (otherDisk.stats.reads == 2) && (otherDisk.stats.hits == 1) && !stack.z80bus.bus_active();
+    verify(diskOK, "io disk write, read and cache");
+
+    //missed io cycles: a buffer short of a byte is not written, the block number reads back, a cycle missed
+    //by the trap is reported until the next transfer starts
+    blocksWritten = simBoard.sdcard.stats.blocksWritten;
+    for (uint8_t i=0; i<4; i++) disk.ioWrite(i, (diskBlock + 1) >> (8*i));
+    disk.ioWrite(5, Z80IODisk::resetIndex);
+    for (uint32_t i=0; i<SD_BLOCK_SIZE - 1; i++) disk.ioWrite(6, i);
+    disk.ioWrite(5, Z80IODisk::writeBlock);
+    disk.process();
+    bool missedOK = (disk.ioRead(5) == 0x02) && (disk.stats.rejected == 1) && !stack.z80sdcache.dirty();
+    for (uint8_t i=0; i<4; i++) missedOK &= disk.ioRead(i) == (uint8_t)((diskBlock + 1) >> (8*i));
+    missedCycles++;
+    disk.ioWrite(5, Z80IODisk::readBlock);
+    disk.process();
+    missedOK &= disk.ioRead(5) == 0x04;
+    for (uint8_t i=0; i<4; i++) disk.ioWrite(i, diskBlock >> (8*i));
+    disk.ioWrite(5, Z80IODisk::readBlock);
+    disk.process();
+    missedOK &= (disk.ioRead(5) == 0) && (disk.ioRead(6) == 0) && (simBoard.sdcard.stats.blocksWritten == blocksWritten);
+    verify(missedOK, "io disk missed cycles reported");
+
+    //a request latched before a job fails, it is not served after the job
+    StreamJob streamJob(stack.z80sdcard, SD_TEST_BLOCK);
+    stack.z80sdcache.invalidate();
+    disk.ioWrite(5, Z80IODisk::resetIndex);
+    for (uint32_t i=0; i<SD_BLOCK_SIZE; i++) disk.ioWrite(6, i);
+    disk.ioWrite(5, Z80IODisk::writeBlock);
+    uint32_t diskWrites = disk.stats.writes;
+    uint32_t blocksWrittenBefore = simBoard.sdcard.stats.blocksWritten;
+    bool waitOK = jobs.start(streamJob);
+    jobs.process();
+    disk.process();
+    waitOK &= jobs.busy() && (disk.ioRead(5) == 0x02) && (disk.stats.errors == 1);
+    jobs.cancel();
+    disk.process();
+    waitOK &= (disk.ioRead(5) == 0x02) && (disk.stats.writes == diskWrites) && !stack.z80sdcache.dirty();
+    waitOK &= simBoard.sdcard.stats.blocksWritten == blocksWrittenBefore;
+    //a request while a job streams from the card stays busy, it is served after the job
+    stack.z80sdcache.invalidate();
+    waitOK &= jobs.start(streamJob);
+    jobs.process();
+    disk.ioWrite(5, Z80IODisk::readBlock);
+    uint32_t diskReads = disk.stats.reads;
+    for (uint8_t i=0; i<3; i++) {
+        jobs.process();
+        disk.process();
+    }
+    waitOK &= jobs.busy() && (disk.ioRead(5) == 0x01) && (disk.stats.reads == diskReads) && (disk.stats.errors == 1);
+    jobs.cancel();
+    disk.process();
+    waitOK &= (disk.ioRead(5) == 0) && (disk.stats.reads == diskReads + 1);
+    for (uint32_t i=0; i<SD_BLOCK_SIZE; i++) if (disk.ioRead(6) != (uint8_t)(i * 7)) waitOK = false;
+    //a stream opened without a job holds the request as well
+    stack.z80sdcard.accessCard(true);
+    stack.z80sdcard.readBlocksBegin(SD_TEST_BLOCK, 0);
+    disk.ioWrite(5, Z80IODisk::readBlock);
+    disk.process();
+    waitOK &= disk.ioRead(5) == 0x01;
+    stack.z80sdcard.readBlocksEnd();
+    stack.z80sdcard.accessCard(false);
+    disk.process();
+    waitOK &= (disk.ioRead(5) == 0) && (disk.stats.errors == 1) && !stack.z80bus.bus_active();
+    verify(waitOK, "io disk request failed by job, waits for stream");
+
+    //capture arena: one user at a time, the content stays with the last user until another claims it
+    static Z80CaptureArena arena;
+    uint16_t* counters = (uint16_t*)arena.claim(Z80CaptureArena::profiler);
+    bool arenaOK = (counters != nullptr) && (arena.claim(Z80CaptureArena::sniffer) == nullptr);
+    arena.release(Z80CaptureArena::profiler);
+    arenaOK &= arena.holds(Z80CaptureArena::profiler) && (arena.claim(Z80CaptureArena::profiler) == counters);
+    arena.release(Z80CaptureArena::profiler);
+    arenaOK &= (arena.claim(Z80CaptureArena::sniffer) == (void*)counters) && !arena.holds(Z80CaptureArena::profiler);
+    arenaOK &= arena.claim(Z80CaptureArena::profiler) == nullptr;
+    arena.release(Z80CaptureArena::sniffer);
+    verify(arenaOK, "capture arena shared by profiler and sniffer");
+
+    printf("\n%u errors\n", checkErrors);
+    return checkErrors == 0 ? 0 : 1;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ benchmarks, time on the target from the virtual clock, time on the host from the monotonic clock
+---------------------------------------------------------------------------------------------------------*/
+uint64_t benchCycles;
+double benchHost;
+
+double hostSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void benchStart(void) {
+    benchCycles = simCycles();
+    benchHost = hostSeconds();
+}
+
+void benchReport(const char* name, uint32_t bytes) {
+    double target = (double)(simCycles() - benchCycles) / SIM_CORE_CLOCK_Hz;
+    double host = hostSeconds() - benchHost;
+    printf("%-26s %8u bytes  target %9.2f ms %9.1f kB/s   host %8.2f ms\n", name, bytes, target * 1000, bytes / target / 1024, host * 1000);
+}
+
+int stackBench(const char* imageFile) {
+    if (!insertCard(imageFile)) return 1;
+    static driverStack_t stack;
+    static uint8_t block[SD_BLOCK_SIZE];
+
+    //bus cycles to the sram
+    stack.z80bus.request_bus();
+    stack.z80bus.ioRead(SIM_IOPORT_FLASH_DISABLE);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_BYTES; i++) stack.z80bus.memWrite(0x8000 + i, i);
+    benchReport("memory write", BENCH_BYTES);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_BYTES; i++) stack.z80bus.memRead(0x8000 + i);
+    benchReport("memory read", BENCH_BYTES);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_BYTES; i++) stack.z80bus.ioWrite(SIM_IOPORT_OUT_1, i);
+    benchReport("io write", BENCH_BYTES);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_BYTES; i++) stack.z80bus.ioRead(SIM_IOPORT_IN_0);
+    benchReport("io read", BENCH_BYTES);
+    stack.z80bus.release_bus();
+
+    //flash programming, one 4k sector
+    stack.z80flash.setMode(true);
+    benchStart();
+    for (uint32_t i=0; i<SIM_FLASH_SECTOR_SIZE; i++) stack.z80flash.writeByte(i, i);
+    benchReport("flash program", SIM_FLASH_SECTOR_SIZE);
+    stack.z80flash.setMode(false);
+
+    //sd card blocks
+    benchStart();
+    if (stack.z80sdcard.accessCard(true) != Z80SDCard::ok) {
+        printf("ERROR: sd card initialization failed\n");
+        return 1;
+    }
+    benchReport("sd card access, init", 0);
+    stack.z80sdcard.accessCard(false);
+    benchStart();
+    stack.z80sdcard.accessCard(true);
+    benchReport("sd card access, session", 0);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_BLOCKS; i++) stack.z80sdcard.writeBlock(SD_TEST_BLOCK + i, block);
+    benchReport("sd card block write", BENCH_BLOCKS * SD_BLOCK_SIZE);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_BLOCKS; i++) stack.z80sdcard.readBlock(SD_TEST_BLOCK + i, block);
+    benchReport("sd card block read", BENCH_BLOCKS * SD_BLOCK_SIZE);
+    static uint8_t blocks[BENCH_BLOCKS * SD_BLOCK_SIZE];
+    benchStart();
+    stack.z80sdcard.writeBlocks(SD_TEST_BLOCK, BENCH_BLOCKS, blocks);
+    benchReport("sd card multi block write", BENCH_BLOCKS * SD_BLOCK_SIZE);
+    benchStart();
+    stack.z80sdcard.readBlocks(SD_TEST_BLOCK, BENCH_BLOCKS, blocks);
+    benchReport("sd card multi block read", BENCH_BLOCKS * SD_BLOCK_SIZE);
+    stack.z80sdcard.setCrcMode(true);
+    benchStart();
+    stack.z80sdcard.writeBlocks(SD_TEST_BLOCK, BENCH_BLOCKS, blocks);
+    benchReport("sd card multi write, crc", BENCH_BLOCKS * SD_BLOCK_SIZE);
+    benchStart();
+    stack.z80sdcard.readBlocks(SD_TEST_BLOCK, BENCH_BLOCKS, blocks);
+    benchReport("sd card multi read, crc", BENCH_BLOCKS * SD_BLOCK_SIZE);
+    stack.z80sdcard.setCrcMode(false);
+    stack.z80sdcard.accessCard(false);
+
+    //sequential reads through the sd block cache
+    Z80SDCache& cache = stack.z80sdcache;
+    cache.setReadAhead(false);
+    cache.invalidate();
+    benchStart();
+    for (uint32_t i=0; i<BENCH_STREAM_BLOCKS; i++) cache.readBlock(SD_TEST_BLOCK + i, block);
+    benchReport("sd cache sequential read", BENCH_STREAM_BLOCKS * SD_BLOCK_SIZE);
+    cache.setReadAhead(true);
+    cache.invalidate();
+    benchStart();
+    for (uint32_t i=0; i<BENCH_STREAM_BLOCKS; i++) cache.readBlock(SD_TEST_BLOCK + i, block);
+    benchReport("sd cache read ahead", BENCH_STREAM_BLOCKS * SD_BLOCK_SIZE);
+    cache.release();
+    cache.invalidate();
+
+    //cpm directory of disk A, read from the card and from the sd block cache
+    benchStart();
+    stack.filesystem.readDisk(0, true);
+    benchReport("cpm directory, card", CPM_DIR_TRACKS * SD_BLOCK_SIZE);
+    benchStart();
+    stack.filesystem.readDisk(0, true);
+    benchReport("cpm directory, cache", CPM_DIR_TRACKS * SD_BLOCK_SIZE);
+
+    //full directory of 512 entries, the extents are resolved through the file index
+    stack.z80sdcard.accessCard(true);
+    fillDirectory(stack, 1);
+    stack.z80sdcard.accessCard(false);
+    stack.filesystem.readDisk(1, true);
+    benchStart();
+    for (uint32_t i=0; i<BENCH_DIRECTORY_READS; i++) stack.filesystem.readDisk(1, true);
+    benchReport("cpm full directory, cache", BENCH_DIRECTORY_READS * CPM_DIR_TRACKS * SD_BLOCK_SIZE);
+
+    //cpm disks prepared with single block writes of the directories, and with the format job
+    memset(block, 0xE5, sizeof(block));
+    benchStart();
+    stack.z80sdcard.accessCard(true);
+    for (uint32_t disk=0; disk<BENCH_FORMAT_DISKS; disk++) {
+        for (uint32_t i=0; i<CPM_DIR_TRACKS; i++) stack.z80sdcard.writeBlock(SD_PARTITION_START + disk * CPM_DISK_TRACKS + CPM_BOOT_TRACKS + i, block);
+    }
+    stack.z80sdcard.accessCard(false);
+    benchReport("cpm directories, blocks", BENCH_FORMAT_DISKS * CPM_DIR_TRACKS * SD_BLOCK_SIZE);
+    JobEngine jobs(stack.z80bus);
+    SDFormatJob formatJob(stack.z80sdcard, stack.z80sdcache);
+    formatJob.setup(1, SD_PARTITION_START, SD_IMAGE_BLOCKS - SD_PARTITION_START);
+    formatJob.setupDisks(BENCH_FORMAT_DISKS, CPM_DISK_TRACKS, CPM_BOOT_TRACKS, CPM_DIR_TRACKS);
+    benchStart();
+    jobs.start(formatJob);
+    while (jobs.busy()) jobs.process();
+    benchReport("cpm format job, erase", BENCH_FORMAT_DISKS * CPM_DIR_TRACKS * SD_BLOCK_SIZE);
+
+    //telemetry of the data transfers of all benchmarks, as on the console page
+    printf("\n");
+    const uint8_t transfers[] = { 17, 18, 24, 25 };
+    for (uint8_t i=0; i<sizeof(transfers); i++) {
+        const Z80SDCard::commandStats_t& command = stack.z80sdcard.commandStats[transfers[i]];
+        if (command.count == 0) continue;
+        printf("sd cmd%-3u %7u transfers  mean %9u cycles %9.1f kB/s  %u polls\n", transfers[i], command.count, (uint32_t)(command.totalCycles / command.count),
+               (double)command.bytes * SIM_CORE_CLOCK_Hz / command.totalCycles / 1024, command.busyPolls);
+    }
+
+    printf("\nbus cycles: %u memory reads, %u memory writes, %u io reads, %u io writes\n", simBoard.stats.memReads, simBoard.stats.memWrites, simBoard.stats.ioReads, simBoard.stats.ioWrites);
+    return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ bus trace, the board monitor feeds the encoder like the sniffer interrupt on the target
+---------------------------------------------------------------------------------------------------------*/
+Z80TraceEncoder traceEncoder;
+FILE* traceFile;
+uint32_t traceRecords = 0;
+uint32_t traceBytes = 0;
+
+void traceMonitor(uint8_t type, uint16_t address, uint8_t data) {
+    z80TraceRecord_t record = { (uint32_t)simCycles(), address, data, type };
+    uint8_t buffer[Z80TRACE_MAX_RECORD_LEN];
+    uint8_t length = traceEncoder.encode(record, buffer);
+    fwrite(buffer, 1, length, traceFile);
+    traceRecords++;
+    traceBytes += length;
+}
+
+int traceCapture(const char* file) {
+    if (!insertCard(SD_IMAGE_FILE)) return 1;
+    traceFile = fopen(file, "wb");
+    if (!traceFile) {
+        printf("ERROR: cannot create the trace file %s\n", file);
+        return 1;
+    }
+    static driverStack_t stack;
+    uint8_t buffer[Z80TRACE_HEADER_LEN];
+    traceBytes = fwrite(buffer, 1, traceEncoder.header(buffer, SIM_CORE_CLOCK_Hz, (uint32_t)simCycles()), traceFile);
+    simBoard.monitor = traceMonitor;
+
+    //flash identification, sd card initialization and the cpm directory of disk A
+    stack.z80flash.setMode(true);
+    stack.z80flash.readChipIndentification();
+    stack.z80flash.setMode(false);
+    stack.filesystem.listFiles(0, true);
+
+    simBoard.monitor = nullptr;
+    traceBytes += fwrite(buffer, 1, traceEncoder.marker(traceEncoder.end, 0, buffer), traceFile);
+    fclose(traceFile);
+    printf("%u bus cycles, %u bytes, %.2f bytes per cycle written to %s\n", traceRecords, traceBytes, (double)traceBytes / traceRecords, file);
+    return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------
+ main
+---------------------------------------------------------------------------------------------------------*/
+int main(int argc, char** argv) {
+    const char* argument = argc >= 3 ? argv[2] : nullptr;
+    if ((argc >= 2) && (strcmp(argv[1], "waveform") == 0)) return waveformCheck(argument);
+    if ((argc >= 2) && (strcmp(argv[1], "check") == 0)) return stackCheck(argument ? argument : SD_IMAGE_FILE);
+    if ((argc >= 2) && (strcmp(argv[1], "bench") == 0)) return stackBench(argument ? argument : SD_IMAGE_FILE);
+    if ((argc >= 2) && (strcmp(argv[1], "trace") == 0)) return traceCapture(argument ? argument : TRACE_FILE);
+
+    printf("Usage: %s waveform [file.vcd] | check [image] | bench [image] | trace [file.trc]\n", argv[0]);
+    return 1;
+}
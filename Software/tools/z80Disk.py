@@ -0,0 +1,361 @@
+# --------------------------------------------------------------------------------------
+# Teach Z80 Disk Transfer
+#
+# Exports and imports CP/M disks (or any range of SD card blocks) over the serial port,
+# without removing the SD card. Single CP/M files are read from a disk with getfile and written
+# to it with putfile, and deleted with delfile. The images are raw, 8MB per CP/M disk, and can be used
+# with cpmtools: cpmls -f z80-retro-8k-8m disk.img (diskdefs in Software/Z80/cpm)
+# The packet format is described in Software/stm32/include/SDTransfer.h
+#
+# Expected arguments:
+#   export <output.img> [disk | block count] [--resume]   card to image, disk A-P
+#   import <input.img> [disk | block]                     image to card, disk A-P
+#   getfile <disk> <NAME.TYP> [output] [--user n]         CP/M file to the host
+#   putfile <disk> <file> [file ...] [--user n]           host files to the disk, replaces them
+#   delfile <disk> <NAME.TYP> [--user n]                  deletes a CP/M file (ERA)
+# putfile writes the directory last. A replace is atomic when the old and the new directory
+# entries share one directory track (files up to 1MB), larger files switch track by track
+# A disk letter selects the CP/M disk in the first partition. --resume continues an
+# export after the blocks already in the image file
+# Example usage: python3 z80Disk.py export backupA.img A
+#                python3 z80Disk.py putfile A ../Z80/cpm/filesystem/adventure/*
+#
+# Author: Christian Luethi
+# Version: 1.2 - October 17 2026
+# --------------------------------------------------------------------------------------
+
+# --------------------------------------------------------------------------------------
+# Imports and variables
+# --------------------------------------------------------------------------------------
+import sys, os.path, serial, serial.tools.list_ports, time, struct, zlib
+
+# --------------------------------------------------------------------------------------
+# Configuration
+# --------------------------------------------------------------------------------------
+versionString = "1.2"
+magicSentence = "..helloTeachZ80SDTransfer"
+blockSize = 512
+diskBlocks = 16384
+fillMax = 128
+ackTimeout = 2.0
+commandTimeout = 0.5
+fileCommandTimeout = 5.0        #file commands read the directory (and may initialize the card) before the ack
+retries = 5
+statusText = ["ok", "crc error", "sequence error", "card error", "timeout", "busy", "cancelled", "file not fount", "disk full", "file is read only", "disk full, the old file is kept until the new one is written: delete it first with delfile"]
+
+# **************************************************************************************
+# Functions
+# **************************************************************************************
+# --------------------------------------------------------------------------------------
+# Builds a packet: sync, type, block, payload length, payload, crc32 over type to payload
+# --------------------------------------------------------------------------------------
+def packet(type, block, payload):
+    body = struct.pack("<cIH", type, block, len(payload)) + payload
+    return b"SD" + body + struct.pack("<I", zlib.crc32(body) & 0xFFFFFFFF)
+
+# --------------------------------------------------------------------------------------
+# Reads the next packet, returns (type, block, payload) or None on a timeout.
+# Bytes before the sync are skipped, packets with a wrong crc are dropped
+# --------------------------------------------------------------------------------------
+def receivePacket(com, buffer, timeout):
+    end = time.time() + timeout
+    while (time.time() < end):
+        index = buffer.find(b"SD")
+        if (index > 0): del buffer[:index]
+        if (index < 0) and (len(buffer) > 1): del buffer[:-1]
+        if ((index >= 0) and (len(buffer) >= 9)):
+            type, block, length = struct.unpack("<cIH", bytes(buffer[2:9]))
+            if (length > blockSize):
+                del buffer[:2]
+                continue
+            if (len(buffer) >= 9 + length + 4):
+                body = bytes(buffer[2:9+length])
+                crc = struct.unpack("<I", bytes(buffer[9+length:13+length]))[0]
+                del buffer[:13+length]
+                if (zlib.crc32(body) & 0xFFFFFFFF == crc): return type, block, body[7:]
+                continue
+        buffer += com.read(max(1, com.in_waiting))
+    return None
+
+# --------------------------------------------------------------------------------------
+# Check on each comport if a TeachZ80 is reachable, send the transfer command on it.
+# Returns the open port, the receive buffer and the block of the first ack
+# --------------------------------------------------------------------------------------
+def sendCommand(command, arguments, timeout = commandTimeout):
+    for device in [port.device for port in serial.tools.list_ports.comports()]:
+        try:
+            #Open the next port. Will raise an exception if not accessible
+            com = serial.Serial(device, baudrate=115200, bytesize=serial.EIGHTBITS, parity=serial.PARITY_NONE, stopbits=serial.STOPBITS_ONE, timeout=0.1)
+            com.reset_input_buffer()
+            com.write(magicSentence.encode() + command.encode() + arguments)
+            buffer = bytearray()
+            received = receivePacket(com, buffer, timeout)
+            if (received != None) and (received[0] == b"A"):
+                if (received[2][0] != 0): printAndExit(f"TeachZ80 fount on {com.port}, transfer refused: {statusText[received[2][0]]}")
+                return com, buffer, received[1]
+            com.close()
+
+        #exception happened, just move to the next port
+        except Exception as e:
+            pass
+
+    #no port fount
+    return None, None, None
+
+# --------------------------------------------------------------------------------------
+# First block of a CP/M disk, from the partition table of the card (first partition)
+# --------------------------------------------------------------------------------------
+def diskStart(letter):
+    com, buffer, block = sendCommand("E", struct.pack("<II", 0, 1))
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    mbr = None
+    while True:
+        received = receivePacket(com, buffer, ackTimeout)
+        if (received == None): printAndExit("No answer from the board")
+        type, block, payload = received
+        if (type == b"D"): mbr = payload
+        elif (type == b"F"): mbr = bytes([payload[0]]) * blockSize
+        elif (type == b"E"): break
+    com.close()
+    if (payload[0] != 0): printAndExit(f"Cannot read the partition table: {statusText[payload[0]]}")
+    if ((mbr == None) or (mbr[510:512] != b"\x55\xAA")): printAndExit("No partition table on the card")
+    partitionStart = struct.unpack("<I", mbr[0x1BE+8:0x1BE+12])[0]
+    return partitionStart + (ord(letter.upper()) - ord("A")) * diskBlocks
+
+# --------------------------------------------------------------------------------------
+# Range from the arguments: a disk letter, or a first block and (export) a number of blocks
+# --------------------------------------------------------------------------------------
+def blockRange(arguments, count):
+    if (len(arguments) == 0): arguments = ["A"]
+    if (len(arguments[0]) == 1) and (arguments[0].upper() >= "A") and (arguments[0].upper() <= "P"): return diskStart(arguments[0]), diskBlocks
+    if (len(arguments) > 1): count = int(arguments[1], 0)
+    if (count == None): printAndExit("Number of blocks missing")
+    return int(arguments[0], 0), count
+
+def printProgress(done, total, start):
+    seconds = max(0.001, time.time() - start)
+    print(f"\r{done} of {total} blocks - {done*100//max(1,total): >3}% - {done*blockSize/1024/seconds:.1f} kB/s   ", end="", flush=True)
+
+# --------------------------------------------------------------------------------------
+# Export: the board streams data and fill packets, the image is written as they arrive
+# --------------------------------------------------------------------------------------
+def exportImage(filename, arguments, resume):
+    first, count = blockRange(arguments, None)
+    skip = 0
+    if resume and os.path.isfile(filename): skip = min(count, os.path.getsize(filename) // blockSize)
+    out = open(filename, mode="r+b" if (skip > 0) else "wb")
+    out.truncate(skip * blockSize)
+    out.seek(skip * blockSize)
+    if (skip == count): printAndExit(f"'{filename}' is complete")
+
+    com, buffer, block = sendCommand("E", struct.pack("<II", first + skip, count - skip))
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    print(f"TeachZ80 fount on {com.port}, exporting blocks {first + skip} to {first + count - 1}")
+    start = time.time()
+    next = first + skip
+    while True:
+        received = receivePacket(com, buffer, ackTimeout)
+        if (received == None):
+            com.write(b"X")
+            printAndExit(f"\nTransfer stopped, no data from the board. Continue with --resume")
+        type, block, payload = received
+        if (block != next) and (type != b"E"):
+            com.write(b"X")
+            printAndExit(f"\nTransfer stopped, block {block} received, {next} expected. Continue with --resume")
+        if (type == b"D"):
+            out.write(payload)
+            next += 1
+        elif (type == b"F"):
+            blocks = payload[1] | (payload[2] << 8)
+            out.write(bytes([payload[0]]) * (blocks * blockSize))
+            next += blocks
+        elif (type == b"E"): break
+        out.flush()
+        printProgress(next - first, count, start)
+    out.close()
+    com.close()
+    print("")
+    if (payload[0] != 0): printAndExit(f"Transfer stopped: {statusText[payload[0]]}. Continue with --resume")
+    print(f"{count} blocks written to '{filename}'")
+
+# --------------------------------------------------------------------------------------
+# Import: one packet, then the ack. The ack holds the next block the board expects
+# --------------------------------------------------------------------------------------
+def importImage(filename, arguments):
+    data = open(filename, mode="rb").read()
+    count = (len(data) + blockSize - 1) // blockSize
+    data += bytes(count * blockSize - len(data))
+    first, count = blockRange(arguments, count)
+    count = min(count, len(data) // blockSize)
+
+    com, buffer, block = sendCommand("I", struct.pack("<II", first, count))
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    print(f"TeachZ80 fount on {com.port}, importing blocks {first} to {first + count - 1}")
+    start = time.time()
+    next = first
+    errors = 0
+    while True:
+        index = next - first
+        if (index == count): request = packet(b"E", next, b"")
+        else:
+            block = data[index*blockSize:(index+1)*blockSize]
+            blocks = 0
+            if (block == bytes([block[0]]) * blockSize) and (block[0] in (0x00, 0xE5)):
+                while (index + blocks < count) and (blocks < fillMax) and (data[(index+blocks)*blockSize:(index+blocks+1)*blockSize] == block): blocks += 1
+            if (blocks > 1): request = packet(b"F", next, struct.pack("<BH", block[0], blocks))
+            else: request = packet(b"D", next, block)
+        com.write(request)
+        received = receivePacket(com, buffer, ackTimeout + 0.5)
+        if (received == None) or (received[0] != b"A"):
+            errors += 1
+            if (errors > retries): printAndExit(f"\nTransfer stopped, no answer from the board. Continue with 'import {filename} {next}' and a cut image")
+            continue
+        type, block, payload = received
+        status = payload[0]
+        if (status in (3, 4, 5, 6)): printAndExit(f"\nTransfer stopped at block {block}: {statusText[status]}")
+        if (status != 0):
+            errors += 1
+            if (errors > retries): printAndExit(f"\nTransfer stopped at block {block}: {statusText[status]}")
+        else: errors = 0
+        if (status == 0) and (index == count): break
+        next = block
+        printProgress(next - first, count, start)
+    com.close()
+    print("")
+    print(f"{count} blocks written to the card")
+
+# --------------------------------------------------------------------------------------
+# Get file: the ack holds the size of the file, the blocks are numbered from the start
+# of the file. Holes come as fill packets, the file is cut to its size at the end
+# --------------------------------------------------------------------------------------
+def getFile(arguments, user):
+    if (len(arguments) < 2) or (len(arguments[0]) != 1) or (arguments[0].upper() < "A") or (arguments[0].upper() > "P"): printAndExit(usage)
+    disk = ord(arguments[0].upper()) - ord("A")
+    name = arguments[1].upper()
+    filename = arguments[2] if (len(arguments) > 2) else name.lower()
+    if (len(name) > 12): printAndExit(f"Invalid CP/M file name '{name}'")
+
+    com, buffer, size = sendCommand("R", struct.pack("<BB12s", disk, user, name.encode()), fileCommandTimeout)
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    print(f"TeachZ80 fount on {com.port}, reading {arguments[0].upper()}:{name} ({size} bytes)")
+    out = open(filename, mode="wb")
+    count = (size + blockSize - 1) // blockSize
+    start = time.time()
+    received = 0
+    while True:
+        answer = receivePacket(com, buffer, ackTimeout)
+        if (answer == None):
+            com.write(b"X")
+            printAndExit(f"\nTransfer stopped, no data from the board")
+        type, block, payload = answer
+        if (type == b"D"):
+            out.seek(block * blockSize)
+            out.write(payload)
+            received = block + 1
+        elif (type == b"F"):
+            out.seek(block * blockSize)
+            out.write(bytes([payload[0]]) * ((payload[1] | (payload[2] << 8)) * blockSize))
+            received = block + (payload[1] | (payload[2] << 8))
+        elif (type == b"E"): break
+        printProgress(min(received, count), count, start)
+    out.truncate(size)
+    out.close()
+    com.close()
+    print("")
+    if (payload[0] != 0): printAndExit(f"Transfer stopped: {statusText[payload[0]]}")
+    print(f"{size} bytes written to '{filename}'")
+
+# --------------------------------------------------------------------------------------
+# Put file: the board allocates the blocks, the file is sent as an import with the blocks
+# numbered from the start of the file. The last ack confirms the directory is written, an
+# existing file stays as it was until then
+# --------------------------------------------------------------------------------------
+def putFile(arguments, user):
+    if (len(arguments) < 2) or (len(arguments[0]) != 1) or (arguments[0].upper() < "A") or (arguments[0].upper() > "P"): printAndExit(usage)
+    disk = ord(arguments[0].upper()) - ord("A")
+    for filename in arguments[1:]:
+        if (os.path.isfile(filename) == False): printAndExit(f"Invalid input file '{filename}'")
+        name = os.path.basename(filename).upper()
+        parts = name.split(".")
+        if (len(parts) > 2) or (len(parts[0]) == 0) or (len(parts[0]) > 8) or ((len(parts) == 2) and (len(parts[1]) > 3)): printAndExit(f"Invalid CP/M file name '{name}'")
+        data = open(filename, mode="rb").read()
+        count = (len(data) + blockSize - 1) // blockSize
+
+        com, buffer, block = sendCommand("W", struct.pack("<BB12sI", disk, user, name.encode(), len(data)), fileCommandTimeout)
+        if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+        print(f"TeachZ80 fount on {com.port}, writing {arguments[0].upper()}:{name} ({len(data)} bytes)")
+        start = time.time()
+        next = 0
+        errors = 0
+        while True:
+            if (next == count): request = packet(b"E", next, b"")
+            else: request = packet(b"D", next, data[next*blockSize:(next+1)*blockSize])
+            com.write(request)
+            received = receivePacket(com, buffer, ackTimeout + 0.5)
+            if (received == None) or (received[0] != b"A"):
+                errors += 1
+                if (errors > retries): printAndExit(f"\nTransfer stopped, no answer from the board. {name} is unchanged")
+                continue
+            type, block, payload = received
+            status = payload[0]
+            if (status >= 3): printAndExit(f"\nTransfer stopped at block {block}: {statusText[status]}")
+            if (status != 0):
+                errors += 1
+                if (errors > retries): printAndExit(f"\nTransfer stopped at block {block}: {statusText[status]}")
+            else: errors = 0
+            if (status == 0) and (next == count): break
+            next = block
+            printProgress(next, count, start)
+        com.close()
+        print("")
+        print(f"{len(data)} bytes written to {arguments[0].upper()}:{name}")
+
+# --------------------------------------------------------------------------------------
+# Delete file: the board erases the file, the ack tells the result
+# --------------------------------------------------------------------------------------
+def deleteFile(arguments, user):
+    if (len(arguments) < 2) or (len(arguments[0]) != 1) or (arguments[0].upper() < "A") or (arguments[0].upper() > "P"): printAndExit(usage)
+    disk = ord(arguments[0].upper()) - ord("A")
+    name = arguments[1].upper()
+    if (len(name) > 12): printAndExit(f"Invalid CP/M file name '{name}'")
+
+    com, buffer, block = sendCommand("D", struct.pack("<BB12s", disk, user, name.encode()), fileCommandTimeout)
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    com.close()
+    print(f"TeachZ80 fount on {com.port}, {arguments[0].upper()}:{name} deleted")
+
+# --------------------------------------------------------------------------------------
+# Prints exit code to screen and exits
+# --------------------------------------------------------------------------------------
+def printAndExit(exitmessage):
+    print(exitmessage)
+    print("")
+    exit()
+
+# **************************************************************************************
+# Main Program
+# **************************************************************************************
+# Welcome message
+print("")
+print(f"Disk Transfer Script Version {versionString}")
+print("")
+
+usage = "Invalid usage. Try 'python3 z80Disk.py export <output.img> [disk | block count] [--resume]', 'python3 z80Disk.py import <input.img> [disk | block]', 'python3 z80Disk.py getfile <disk> <NAME.TYP> [output] [--user n]', 'python3 z80Disk.py putfile <disk> <file> [file ...] [--user n]' or 'python3 z80Disk.py delfile <disk> <NAME.TYP> [--user n]'"
+if (len(sys.argv) < 3): printAndExit(usage)
+user = 0
+if ("--user" in sys.argv):
+    index = sys.argv.index("--user")
+    if (index + 1 >= len(sys.argv)) or (not sys.argv[index + 1].isdigit()): printAndExit(usage)
+    user = int(sys.argv[index + 1])
+    del sys.argv[index:index + 2]
+arguments = [argument for argument in sys.argv[3:] if (argument != "--resume")]
+
+if (sys.argv[1] == "export"): exportImage(sys.argv[2], arguments, "--resume" in sys.argv)
+elif (sys.argv[1] == "import"):
+    if (os.path.isfile(sys.argv[2]) == False): printAndExit(f"Invalid input file '{sys.argv[2]}'")
+    importImage(sys.argv[2], arguments)
+elif (sys.argv[1] == "getfile"): getFile(sys.argv[2:], user)
+elif (sys.argv[1] == "putfile"): putFile(sys.argv[2:], user)
+elif (sys.argv[1] == "delfile"): deleteFile(sys.argv[2:], user)
+else:
+    printAndExit(usage)
@@ -0,0 +1,208 @@
+# --------------------------------------------------------------------------------------
+# Teach Z80 Profiler
+#
+# Reads the address histogram of the statistical profiler of the stm32 support
+# processor, and maps the hits onto the symbols of the z80asm label files (--label)
+# or listings (--list), for example Software/Z80/cpm/cpm.sym or cpm.lst
+# The dump format is described in Software/stm32/include/Z80Profiler.h
+#
+# Expected arguments:
+#   capture <output.prof> [seconds]         clear, sample for some seconds (default 10), dump
+#   dump <output.prof>                      dump the current histogram, sampling continues
+#   report <input.prof> [symbolfiles ...]   hits per symbol and hottest addresses
+# Example usage: python3 z80Profile.py report cpm.prof ../Z80/cpm/cpm.sym
+#
+# Author: Christian Luethi
+# Version: 1.0 - October 17 2026
+# --------------------------------------------------------------------------------------
+
+# --------------------------------------------------------------------------------------
+# Imports and variables
+# --------------------------------------------------------------------------------------
+import sys, os.path, serial, serial.tools.list_ports, time, struct, re, bisect
+
+# --------------------------------------------------------------------------------------
+# Configuration
+# --------------------------------------------------------------------------------------
+versionString = "1.0"
+magicSentence = "..helloTeachZ80Profiler"
+headerLength = 18
+topSymbols = 20
+topAddresses = 20
+
+# **************************************************************************************
+# Functions
+# **************************************************************************************
+# --------------------------------------------------------------------------------------
+# Check on each comport if a TeachZ80 is reachable, send the profiler command on it.
+# With a dump command, waits for the dump header. Returns the open port and the data received
+# --------------------------------------------------------------------------------------
+def sendCommand(command, com=None):
+    ports = [com.port] if com else [port.device for port in serial.tools.list_ports.comports()]
+    for device in ports:
+        try:
+            #Open the next port. Will raise an exception if not accessible
+            if (com == None): com = serial.Serial(device, baudrate=115200, bytesize=serial.EIGHTBITS, parity=serial.PARITY_NONE, stopbits=serial.STOPBITS_ONE, timeout=0.1)
+            com.reset_input_buffer()
+            com.write((magicSentence + command).encode())
+            if (command != "D"): return com, b""
+
+            #receive data for a maximum 500 milliseconds
+            received = b""
+            loopCount = 0
+            while (loopCount < 50):
+                loopCount += 1
+                time.sleep(0.01)
+                received += com.read(com.in_waiting)
+                index = received.find(b"Z80P")
+                if ((index >= 0) and (len(received) >= index + headerLength)): return com, received[index:]
+            com.close()
+            com = None
+
+        #exception happened, just move to the next port
+        except Exception as e:
+            com = None
+
+    #no port fount
+    return None, b""
+
+# --------------------------------------------------------------------------------------
+# Receives the dump until the terminating entry, and stores it
+# --------------------------------------------------------------------------------------
+def dump(filename, com=None):
+    com, data = sendCommand("D", com)
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    print(f"TeachZ80 fount on {com.port}, reading histogram")
+
+    idle = 0
+    while (idle < 50):
+        chunk = com.read(max(1, com.in_waiting))
+        if (len(chunk) == 0): idle += 1
+        else: idle = 0
+        data += chunk
+        entries = (len(data) - headerLength) // 4
+        if ((entries > 0) and (data[headerLength + 4*(entries-1):headerLength + 4*entries] == b"\0\0\0\0")): break
+    com.close()
+
+    out = open(filename, mode="wb")
+    out.write(data)
+    out.close()
+    print(f"{len(data)} bytes written to '{filename}'")
+
+# --------------------------------------------------------------------------------------
+# Clears the histogram, samples for the given time, then dumps it
+# --------------------------------------------------------------------------------------
+def capture(filename, seconds):
+    com, data = sendCommand("S")
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    print(f"Sampling for {seconds} seconds")
+    time.sleep(seconds)
+    dump(filename, com)
+
+# --------------------------------------------------------------------------------------
+# Reads a dump, returns the header values and a dictionary address: hits
+# --------------------------------------------------------------------------------------
+def readDump(filename):
+    file = open(filename, mode="rb")
+    data = file.read()
+    file.close()
+    if ((len(data) < headerLength) or (data[0:4] != b"Z80P")): printAndExit(f"No profiler dump in '{filename}'")
+    if (data[4] != 1): printAndExit(f"Unsupported dump version {data[4]}")
+    rate, samples, skipped = struct.unpack("<III", data[5:17])
+    halvings = data[17]
+    histogram = {}
+    complete = False
+    for position in range(headerLength, len(data) - 3, 4):
+        address, hits = struct.unpack("<HH", data[position:position+4])
+        if (hits == 0):
+            complete = True
+            break
+        histogram[address] = hits
+    if (not complete): print("WARNING: dump incomplete, no terminating entry")
+    return rate, samples, skipped, halvings, histogram
+
+# --------------------------------------------------------------------------------------
+# Reads the symbols of z80asm label files (name: equ $1234) and listings (address, code bytes, name:)
+# Returns a sorted list of (address, name)
+# --------------------------------------------------------------------------------------
+def readSymbols(filenames):
+    labelPattern = re.compile(r"^\s*([A-Za-z_.$?@][\w.$?@]*):?\s+equ\s+(?:\$|0x|#)?([0-9A-Fa-f]+)h?\s*$", re.IGNORECASE)
+    listPattern = re.compile(r"^([0-9A-Fa-f]{4})(?:\s+[0-9A-Fa-f]{2}\b)*\s+([A-Za-z_.][\w.]*):")
+    symbols = {}
+    for filename in filenames:
+        if (os.path.isfile(filename) == False): printAndExit(f"Invalid symbol file '{filename}'")
+        for line in open(filename, errors="replace"):
+            match = labelPattern.match(line)
+            if match:
+                symbols[match.group(1)] = int(match.group(2), 16) & 0xFFFF
+                continue
+            match = listPattern.match(line)
+            if match: symbols.setdefault(match.group(2), int(match.group(1), 16))
+    return sorted((address, name) for name, address in symbols.items())
+
+# --------------------------------------------------------------------------------------
+# Name of the symbol an address belongs to, the nearest symbol at or below the address
+# --------------------------------------------------------------------------------------
+def symbolName(symbols, addresses, address):
+    index = bisect.bisect_right(addresses, address) - 1
+    if (index < 0): return "?"
+    offset = address - symbols[index][0]
+    return symbols[index][1] + (f"+{offset:X}h" if offset else "")
+
+# --------------------------------------------------------------------------------------
+# Prints the hits per symbol and the hottest addresses
+# --------------------------------------------------------------------------------------
+def report(filename, symbolfiles):
+    rate, samples, skipped, halvings, histogram = readDump(filename)
+    symbols = readSymbols(symbolfiles)
+    addresses = [address for address, name in symbols]
+    total = max(1, sum(histogram.values()))
+
+    print(f"{samples} samples at {rate} Hz, {skipped} skipped, counters halved {halvings} times")
+    print(f"{len(histogram)} addresses hit, {len(symbols)} symbols loaded")
+    print("")
+
+    if symbols:
+        perSymbol = {}
+        for address, hits in histogram.items():
+            index = bisect.bisect_right(addresses, address) - 1
+            name = symbols[index][1] if (index >= 0) else "?"
+            perSymbol[name] = perSymbol.get(name, 0) + hits
+        print("Hits per symbol")
+        print("-------------------------------------------------------------")
+        for name, hits in sorted(perSymbol.items(), key=lambda item: -item[1])[:topSymbols]:
+            print(f"{hits*100/total:6.2f}%  {hits: >8}  {name}")
+        print("")
+
+    print("Hottest addresses")
+    print("-------------------------------------------------------------")
+    for address, hits in sorted(histogram.items(), key=lambda item: -item[1])[:topAddresses]:
+        name = symbolName(symbols, addresses, address) if symbols else ""
+        print(f"{hits*100/total:6.2f}%  {hits: >8}  {address:0>4X}  {name}")
+
+# --------------------------------------------------------------------------------------
+# Prints exit code to screen and exits
+# --------------------------------------------------------------------------------------
+def printAndExit(exitmessage):
+    print(exitmessage)
+    print("")
+    exit()
+
+# **************************************************************************************
+# Main Program
+# **************************************************************************************
+# Welcome message
+print("")
+print(f"Profiler Script Version {versionString}")
+print("")
+
+usage = "Invalid usage. Try 'python3 z80Profile.py capture|dump <output.prof> [seconds]' or 'python3 z80Profile.py report <input.prof> [symbolfiles ...]'"
+if (len(sys.argv) < 3): printAndExit(usage)
+
+if (sys.argv[1] == "capture"): capture(sys.argv[2], float(sys.argv[3]) if (len(sys.argv) > 3) else 10)
+elif (sys.argv[1] == "dump"): dump(sys.argv[2])
+elif (sys.argv[1] == "report"):
+    if (os.path.isfile(sys.argv[2]) == False): printAndExit(f"Invalid input file '{sys.argv[2]}'")
+    report(sys.argv[2], sys.argv[3:])
+else:
+    printAndExit(usage)
@@ -0,0 +1,250 @@
+# --------------------------------------------------------------------------------------
+# Teach Z80 Bus Trace
+#
+# Captures the bus cycles of a running Z80 with the passive bus sniffer of the
+# stm32 support processor, and decodes trace files to text.
+# The trace format is described in Software/stm32/include/Z80Trace.h
+#
+# Expected arguments:
+#   capture <output.trc> [all|mem|io] [seconds]  capture until Ctrl-C or timeout
+#   decode <input.trc> [output.txt]               decode to text, default to screen
+# Example usage: python3 z80Trace.py capture cpm.trc io
+#
+# Author: Christian Luethi
+# Version: 1.0 - October 17 2026
+# --------------------------------------------------------------------------------------
+
+# --------------------------------------------------------------------------------------
+# Imports and variables
+# --------------------------------------------------------------------------------------
+import sys, os.path, serial, serial.tools.list_ports, time, struct
+
+# --------------------------------------------------------------------------------------
+# Configuration
+# --------------------------------------------------------------------------------------
+versionString = "1.0"
+magicSentence = "..helloTeachZ80BusSniffer"
+filters = { "all": "A", "mem": "M", "io": "I" }
+cycleNames = [ "MR", "MW", "IR", "IW" ]
+headerLength = 10
+refusedMarker = 0xB0
+refusalReasons = { 1: "the bus is in use by the stm32", 2: "the capture memory is in use by the profiler" }
+
+# **************************************************************************************
+# Classes
+# **************************************************************************************
+# --------------------------------------------------------------------------------------
+# Decoder for the trace stream. Yields (time in seconds, type, address, data) for every
+# bus cycle, ("OVERFLOW"|"END", lost cycles) and ("REFUSED", reason) for markers
+# --------------------------------------------------------------------------------------
+class TraceDecoder:
+    def __init__(self, data):
+        if ((len(data) < headerLength) or (data[0:4] != b"Z80T")): raise ValueError("no trace header found")
+        if (data[4] != 1): raise ValueError(f"unsupported trace version {data[4]}")
+        self.clock = struct.unpack("<I", data[5:9])[0]
+        self.unit = (1 << data[9]) / self.clock
+        self.data = data
+        self.position = headerLength
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            byte = self.data[self.position]
+            self.position += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if ((byte & 0x80) == 0): return value
+
+    def records(self):
+        time = 0
+        lastMemory = 0
+        lastIo = 0
+        while (self.position < len(self.data)):
+            start = self.position
+            try:
+                first = self.data[self.position]
+                self.position += 1
+                type = first >> 6
+                mode = (first >> 4) & 0x03
+                if (mode == 3):
+                    lost = self.varint()
+                    if (type == 1):
+                        yield ("END", lost)
+                        return
+                    if (type == 2):
+                        yield ("REFUSED", lost)
+                        return
+                    yield ("OVERFLOW", lost)
+                    continue
+
+                delta = first & 0x0F
+                if (delta == 15): delta += self.varint()
+                time += delta
+
+                io = type >= 2
+                last = lastIo if io else lastMemory
+                if (mode == 0):
+                    address = last if io else (last + 1) & 0xFFFF
+                elif (mode == 1):
+                    value = self.data[self.position]
+                    self.position += 1
+                    if io: address = (last & 0xFF00) | value
+                    else: address = (last + (value - 256 if value > 127 else value)) & 0xFFFF
+                else:
+                    address = self.data[self.position] | (self.data[self.position+1] << 8)
+                    self.position += 2
+                if io: lastIo = address
+                else: lastMemory = address
+
+                value = self.data[self.position]
+                self.position += 1
+                yield (time * self.unit, type, address, value)
+
+            #the stream ends within a record, capture was interrupted
+            except IndexError:
+                self.position = start
+                return
+
+# **************************************************************************************
+# Functions
+# **************************************************************************************
+# --------------------------------------------------------------------------------------
+# Check on each comport if a TeachZ80 is reachable, and start the capture on it.
+# Returns the open port and the data received so far, starting with the trace header
+# --------------------------------------------------------------------------------------
+def startCapture(filter):
+    for port in serial.tools.list_ports.comports():
+        try:
+            #Open the next port. Will raise an exception if not accessible
+            com = serial.Serial(port.device, baudrate=115200, bytesize=serial.EIGHTBITS, parity=serial.PARITY_NONE, stopbits=serial.STOPBITS_ONE, timeout=0.1)
+            com.reset_input_buffer()
+
+            # Send the magic sentence and the capture filter, the trace header follows
+            com.write((magicSentence + filter).encode())
+
+            #receive data for a maximum 500 milliseconds
+            received = b""
+            loopCount = 0
+            while (loopCount < 50):
+                loopCount += 1
+                time.sleep(0.01)
+                received += com.read(com.in_waiting)
+                index = received.find(b"Z80T")
+                if ((index >= 0) and (len(received) >= index + headerLength)): return com, received[index:]
+            com.close()
+
+        #exception happened, just move to the next port
+        except Exception as e:
+            pass
+
+    #no port fount
+    return None, b""
+
+# --------------------------------------------------------------------------------------
+# Capture until Ctrl-C or timeout, then stop the sniffer and wait for the end marker
+# --------------------------------------------------------------------------------------
+def capture(filename, filter, seconds):
+    com, data = startCapture(filter)
+    if (com == None): printAndExit("Cannot find TeachZ80 Board on any available port.")
+    print(f"TeachZ80 fount on {com.port}, capturing to '{filename}', stop with Ctrl-C")
+
+    started = time.time()
+    try:
+        while ((seconds == 0) or (time.time() - started < seconds)):
+            data += com.read(max(1, com.in_waiting))
+            #the sniffer sends the refused marker right after the header if the capture did not start
+            if ((len(data) > headerLength + 1) and (data[headerLength] == refusedMarker)):
+                com.close()
+                printAndExit(f"\nCapture not started, {refusalReasons.get(data[headerLength+1], 'unknown reason')}.")
+            print(f"\r{len(data): >10} bytes received", end="")
+    except KeyboardInterrupt:
+        pass
+
+    #stop the capture, the remaining records and the end marker follow
+    com.write(b"x")
+    idle = 0
+    while (idle < 10):
+        chunk = com.read(max(1, com.in_waiting))
+        if (len(chunk) == 0): idle += 1
+        data += chunk
+    com.close()
+    print(f"\r{len(data): >10} bytes received")
+
+    out = open(filename, mode="wb")
+    out.write(data)
+    out.close()
+    summary(data)
+
+# --------------------------------------------------------------------------------------
+# Decodes a trace to text, one line per bus cycle
+# --------------------------------------------------------------------------------------
+def decode(filename, output):
+    trace = open(filename, mode="rb")
+    data = trace.read()
+    trace.close()
+
+    out = open(output, mode="w") if output else sys.stdout
+    for record in TraceDecoder(data).records():
+        if (record[0] == "REFUSED"): out.write(f"{record[0]}: {refusalReasons.get(record[1], 'unknown reason')}\n")
+        elif (len(record) == 2): out.write(f"{record[0]}: {record[1]} bus cycles lost\n")
+        else: out.write(f"{record[0]*1e6:14.3f} us  {cycleNames[record[1]]}  {record[2]:0>4X}  {record[3]:0>2X}\n")
+    if output: out.close()
+    summary(data)
+
+# --------------------------------------------------------------------------------------
+# Prints a short summary of a trace
+# --------------------------------------------------------------------------------------
+def summary(data):
+    try:
+        decoder = TraceDecoder(data)
+    except ValueError as e:
+        printAndExit("ERROR: " + str(e))
+    counts = [0, 0, 0, 0]
+    lost = 0
+    end = False
+    duration = 0
+    for record in decoder.records():
+        if (record[0] == "REFUSED"):
+            print("", file=sys.stderr)
+            print(f"Capture not started, {refusalReasons.get(record[1], 'unknown reason')}", file=sys.stderr)
+            return
+        if (len(record) == 2):
+            if (record[0] == "END"): end = True
+            else: lost += record[1]
+        else:
+            counts[record[1]] += 1
+            duration = record[0]
+    print("", file=sys.stderr)
+    print(f"{sum(counts)} bus cycles in {duration*1000:.3f} ms, {len(data)} bytes, {len(data)/max(1, sum(counts)):.2f} bytes per cycle", file=sys.stderr)
+    print(f"{counts[0]} memory reads, {counts[1]} memory writes, {counts[2]} io reads, {counts[3]} io writes", file=sys.stderr)
+    print(f"{lost} bus cycles lost" + ("" if end else ", trace incomplete (no end marker)"), file=sys.stderr)
+
+# --------------------------------------------------------------------------------------
+# Prints exit code to screen and exits
+# --------------------------------------------------------------------------------------
+def printAndExit(exitmessage):
+    print(exitmessage)
+    print("")
+    exit()
+
+# **************************************************************************************
+# Main Program
+# **************************************************************************************
+# Welcome message
+print("", file=sys.stderr)
+print(f"Bus Trace Script Version {versionString}", file=sys.stderr)
+print("", file=sys.stderr)
+
+usage = "Invalid usage. Try 'python3 z80Trace.py capture <output.trc> [all|mem|io] [seconds]' or 'python3 z80Trace.py decode <input.trc> [output.txt]'"
+if (len(sys.argv) < 3): printAndExit(usage)
+
+if (sys.argv[1] == "capture"):
+    filter = sys.argv[3] if (len(sys.argv) > 3) else "all"
+    if (filter not in filters): printAndExit(usage)
+    capture(sys.argv[2], filters[filter], float(sys.argv[4]) if (len(sys.argv) > 4) else 0)
+elif (sys.argv[1] == "decode"):
+    if (os.path.isfile(sys.argv[2]) == False): printAndExit(f"Invalid input file '{sys.argv[2]}'")
+    decode(sys.argv[2], sys.argv[3] if (len(sys.argv) > 3) else None)
+else:
+    printAndExit(usage)